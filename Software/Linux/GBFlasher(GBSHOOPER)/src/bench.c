@@ -0,0 +1,434 @@
+/*
+============================================================================
+Name        : bench.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Benchmarks against the software device model
+============================================================================
+*/
+
+#define _GNU_SOURCE		/* F_SETPIPE_SZ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "gbshooper.h"
+#include "communications.h"
+#include "flashcart.h"
+#include "context.h"
+#include "gbsim.h"
+
+/* output format version, bump it when columns change */
+#define BENCH_FORMAT	1
+#define BENCH_RAM_SIZE	S_128K
+#define BENCH_FLAKY_PPM	20		/* the flaky sweep, a block in ten goes bad */
+#define BENCH_NOISY_PPM	20		/* the noisy sweep, wire bytes damaged */
+#define BENCH_OLD_FW	"0.1"	/* the oldfw sweep, before any extension */
+
+/* the slow disk of the sink sweep: a pipe with room for one page, read or
+ * filled by a thread that stops for SINK_STALL_MS every SINK_STALL_EVERY
+ * bytes, like an SD card flushing its cache */
+#define SINK_PIPE		4096
+#define SINK_STALL_EVERY	S_32K
+#define SINK_STALL_MS	200
+
+/* images written to the cart */
+#define IMG_RANDOM		0
+#define IMG_PADDED		1	/* code in the first 32KB, 0xFF after */
+
+/* Types */
+/*********/
+
+/* one point of a sweep */
+typedef struct
+{
+	const char* sweep;
+	const gbsim_chip_t* chip;
+	uint32_t rom_size;
+	uint16_t block;
+	uint32_t baud;
+	uint32_t latency_us;
+	uint8_t sink;			/* real time, files go through the slow disk */
+	uint32_t flaky_ppm;		/* cart reads the model damages, per million */
+	uint32_t noisy_ppm;		/* wire bytes the model damages, per million */
+	uint8_t proto;			/* PROTO_*, the most the host asks for */
+	const char* fw;			/* firmware the model reports, NULL for its own */
+} bench_cfg_t;
+
+typedef struct
+{
+	char* name;
+	char* variant;
+	void* (*op)(void*);
+	uint8_t ram;			/* works on the save RAM */
+	uint8_t input;			/* writes an image, IMG_* + 1, 0 if none */
+	uint8_t prg_mode;
+	uint8_t compress;
+	uint8_t sequential;
+	uint8_t robust;
+} bench_op_t;
+
+/* the slow disk, reading what a dump writes to its pipe, or feeding an
+ * image to a write */
+typedef struct
+{
+	const char* file;
+	uint8_t* data;
+	uint32_t size;
+	uint32_t got;			/* bytes through the pipe */
+	uint8_t feed;			/* data goes into the pipe */
+} bench_disk_t;
+
+static const bench_op_t ops[] = {
+	{"erase_flash", "-", gbs_erase_flash, 0, 0, 0, 0, 0, 0},
+	{"write_flash", "generic", gbs_write_flash, 0, IMG_RANDOM+1, PRG_GENERIC,
+		0, 0, 0},
+	{"write_flash", "auto", gbs_write_flash, 0, IMG_RANDOM+1, PRG_AUTO, 0, 0,
+		0},
+	{"write_flash", "pad-raw", gbs_write_flash, 0, IMG_PADDED+1, PRG_AUTO, 0,
+		0, 0},
+	{"write_flash", "pad-rle", gbs_write_flash, 0, IMG_PADDED+1, PRG_AUTO, 1,
+		0, 0},
+	{"write_flash", "seq", gbs_write_flash, 0, IMG_RANDOM+1, PRG_AUTO, 0, 1,
+		0},
+	{"read_flash", "-", gbs_read_flash, 0, 0, 0, 0, 0, 0},
+	{"read_flash", "seq", gbs_read_flash, 0, 0, 0, 0, 1, 0},
+	{"read_flash", "robust", gbs_read_flash, 0, 0, 0, 0, 0, 4},
+	{"write_ram", "-", gbs_write_ram, 1, IMG_RANDOM+1, 0, 0, 0, 0},
+	{"read_ram", "-", gbs_read_ram, 1, 0, 0, 0, 0, 0},
+	{"erase_ram", "-", gbs_erase_ram, 1, 0, 0, 0, 0, 0}
+};
+
+#define COUNT(a)	(sizeof a / sizeof a[0])
+
+/* operations each sweep runs, by name and variant */
+static const char* rom_ops[] = {"read_flash/-", "write_flash/auto", NULL};
+static const char* block_ops[] = {"read_flash/-", "write_flash/auto",
+	"read_ram/-", "write_ram/-", NULL};
+static const char* link_ops[] = {"read_flash/-", "write_flash/auto",
+	"write_flash/pad-rle", NULL};
+static const char* chip_ops[] = {"erase_flash/-", "write_flash/generic",
+	"write_flash/auto", NULL};
+static const char* sink_ops[] = {"read_flash/seq", "read_flash/-",
+	"write_flash/seq", "write_flash/auto", NULL};
+static const char* flaky_ops[] = {"read_flash/robust", NULL};
+static const char* oldfw_ops[] = {"erase_flash/-", "write_flash/auto",
+	"write_flash/pad-rle", "read_flash/-", "read_flash/robust",
+	"write_ram/-", "read_ram/-", NULL};
+
+static const uint32_t rom_sizes[] = {S_32K, S_256K, S_1MB, S_4MB};
+static const uint16_t block_sizes[] = {256, 512, 1024, 4096};
+static const uint32_t bauds[] = {BAUDRATE_115_2K, BAUDRATE_230_4K,
+	BAUDRATE_1M};
+static const uint32_t latencies_us[] = {0, 125, 1000, 4000};
+
+
+/* fills an image the same way on every run */
+static void bench_fill(uint8_t* image, uint32_t size, uint8_t kind) {
+	uint32_t i, seed = kind == IMG_PADDED ? 0x4321 : 0x1234;
+
+	for (i=0; i<size; i++) {
+		seed = seed * 1103515245 + 12345;
+		if (kind == IMG_PADDED && i >= S_32K)
+			image[i] = 0xFF;
+		else if (kind == IMG_PADDED && (i / 16) % 4 == 0)
+			image[i] = 0x00;		/* blank tile rows */
+		else
+			image[i] = (seed >> 16) & 0xFF;
+	}
+}
+
+static uint16_t bench_save(const char* file, uint8_t* data, uint32_t size) {
+	FILE* f;
+
+	if ((f = fopen(file, "wb")) == NULL)
+		return STAT_ERROR;
+	fwrite(data, 1, size, f);
+	fclose(f);
+	return STAT_OK;
+}
+
+static uint8_t bench_matches(const char* file, uint8_t* data, uint32_t size) {
+	uint8_t* buf;
+	FILE* f;
+	uint8_t ok;
+
+	if ((f = fopen(file, "rb")) == NULL)
+		return 0;
+	buf = malloc(size);
+	ok = buf != NULL && fread(buf, 1, size, f) == size
+		&& memcmp(buf, data, size) == 0;
+	fclose(f);
+	free(buf);
+	return ok;
+}
+
+static void* bench_disk(void* ptr) {
+	bench_disk_t* disk = (bench_disk_t*) ptr;
+	struct timespec stall = {0, SINK_STALL_MS * 1000000L};
+	uint8_t scrap[SINK_PIPE];
+	uint32_t next = SINK_STALL_EVERY;
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(disk->file, disk->feed ? O_WRONLY : O_RDONLY)) < 0)
+		return NULL;
+#ifdef F_SETPIPE_SZ
+	fcntl(fd, F_SETPIPE_SZ, SINK_PIPE);
+#endif
+	for (;;) {
+		if (disk->feed) {
+			n = disk->size - disk->got < SINK_PIPE ? disk->size - disk->got
+				: SINK_PIPE;
+			if (n == 0 || (n = write(fd, &disk->data[disk->got], n)) <= 0)
+				break;
+		}
+		else {
+			if ((n = read(fd, scrap, sizeof scrap)) <= 0)
+				break;
+			if (disk->got + n <= disk->size)
+				memcpy(&disk->data[disk->got], scrap, n);
+		}
+		disk->got += n;
+		if (disk->got >= next) {
+			nanosleep(&stall, NULL);
+			next += SINK_STALL_EVERY;
+		}
+	}
+	close(fd);
+
+	return NULL;
+}
+
+/* runs one operation on a fresh model and prints its row */
+static uint16_t bench_run(const bench_op_t* op, const bench_cfg_t* cfg) {
+	gbsim_t sim;
+	gbs_ctx_t* ctx;
+	thread_args_t args;
+	char file[] = "/tmp/gbsbenchXXXXXX";
+	uint32_t size = op->ram ? BENCH_RAM_SIZE : cfg->rom_size;
+	uint8_t* image = NULL, * mem;
+	bench_disk_t disk;
+	pthread_t reader;
+	uint8_t ok;
+	int fd;
+	double ms;
+
+	if (size > cfg->rom_size)
+		size = cfg->rom_size;
+	if ((fd = mkstemp(file)) < 0)
+		return STAT_ERROR;
+	close(fd);
+	if (gbsim_init(&sim, cfg->chip, BENCH_RAM_SIZE) != STAT_OK)
+		return STAT_ERROR;
+	sim.baudrate = cfg->baud;
+	sim.latency_ns = cfg->latency_us * 1000;
+	sim.flaky_ppm = cfg->flaky_ppm;
+	sim.corrupt_ppm = cfg->noisy_ppm;
+	if (cfg->fw) {
+		sim.fw_mayor = cfg->fw[0];
+		sim.fw_minor = cfg->fw[2];
+	}
+	mem = op->ram ? sim.ram : sim.flash;
+
+	/* something to read back or to erase */
+	bench_fill(mem, size, IMG_RANDOM);
+	if (op->input) {
+		if ((image = malloc(size)) == NULL)
+			return STAT_ERROR;
+		bench_fill(image, size, op->input - 1);
+		if (!cfg->sink)
+			bench_save(file, image, size);
+		if (!op->ram)
+			memset(sim.flash, 0xFF, cfg->chip->size);
+	}
+	if (cfg->sink) {
+		/* a pipe in place of the file, the disk thread at its end */
+		unlink(file);
+		disk.file = file;
+		disk.size = size;
+		disk.got = 0;
+		disk.feed = image != NULL;
+		disk.data = image != NULL ? image : malloc(size);
+		if (mkfifo(file, 0600) != 0 || disk.data == NULL
+				|| pthread_create(&reader, NULL, bench_disk, &disk) != 0)
+			return STAT_ERROR;
+		gbsim_realtime(&sim);
+	}
+	if ((ctx = gbs_ctx_new()) == NULL)
+		return STAT_ERROR;
+	gbs_ctx_set_sim(ctx, &sim);
+	gbs_ctx_set_proto(ctx, cfg->proto);
+
+	memset(&args, 0, sizeof(args));
+	gbs_args_init(&args, ctx);
+	args.file = file;
+	args.size = size;
+	args.block_size = cfg->block;
+	args.prg_mode = op->prg_mode;
+	args.compress = op->compress;
+	args.sequential = op->sequential;
+	args.robust = op->robust;
+	op->op(&args);
+
+	/* check what the operation left behind */
+	ok = args.ret == STAT_OK;
+	if (cfg->sink)
+		pthread_join(reader, NULL);
+	if (cfg->sink && !disk.feed) {
+		ok = ok && disk.got == size && memcmp(disk.data, sim.flash, size) == 0;
+		free(disk.data);
+	}
+	else if (ok && op->input)
+		ok = memcmp(mem, image, size) == 0;
+	else if (ok && op->op == gbs_read_flash)
+		ok = bench_matches(file, sim.flash, size);
+	else if (ok && op->op == gbs_read_ram)
+		ok = bench_matches(file, sim.ram, size);
+	else if (ok && op->op == gbs_erase_ram)
+		ok = sim.ram[0] == 0x00 && sim.ram[size-1] == 0x00;
+	else if (ok && op->op == gbs_erase_flash)
+		ok = sim.flash[0] == 0xFF && sim.flash[cfg->chip->size-1] == 0xFF;
+
+	ms = args.stats.wall_ns / 1e6;
+	printf("%-7s %-11s %-8s %-9s %6u %5u %7u %6u %8" PRIu64 " %8" PRIu64
+			" %11.3f %9.1f %s\n", cfg->sweep, op->name, op->variant,
+			cfg->chip->name, size / 1024, cfg->block, cfg->baud,
+			cfg->latency_us, args.stats.bytes,
+			args.stats.tx_bytes + args.stats.rx_bytes, ms,
+			ms > 0 ? args.stats.bytes / 1.024 / ms : 0, ok ? "ok" : "FAIL");
+
+	gbs_ctx_free(ctx);
+	gbsim_free(&sim);
+	gbs_args_destroy(&args);
+	unlink(file);
+	free(image);
+	return ok ? STAT_OK : STAT_ERROR;
+}
+
+/* runs the listed operations at one sweep point */
+static uint16_t bench_ops(const char** list, const bench_cfg_t* cfg) {
+	uint16_t ret = STAT_OK;
+	char key[32];
+	uint32_t i, j;
+
+	for (i = 0; list[i] != NULL; i++)
+		for (j = 0; j < COUNT(ops); j++) {
+			snprintf(key, sizeof key, "%s/%s", ops[j].name, ops[j].variant);
+			if (strcmp(key, list[i]) == 0 && bench_run(&ops[j], cfg) != STAT_OK)
+				ret = STAT_ERROR;
+		}
+
+	return ret;
+}
+
+int main(int argc, char* argv[]) {
+	bench_cfg_t base = {"base", NULL, S_256K, BLOCK_MAX, BAUDRATE_230_4K,
+		GBSIM_LATENCY_NS / 1000, 0, 0, 0, PROTO_V2, NULL};
+	bench_cfg_t cfg;
+	uint16_t ret = STAT_OK;
+	uint32_t i;
+
+	base.chip = gbsim_find_chip("S29GL032");
+
+	/* one row per run, whitespace separated, keyed by the first 8 columns.
+	 * Times come from the model's clock, so runs are repeatable, but for
+	 * the sink sweep: that one runs in real time, to see what the host's
+	 * own stalls cost. */
+	printf("# gbsbench format %d\n", BENCH_FORMAT);
+	printf("# %-5s %-11s %-8s %-9s %6s %5s %7s %6s %8s %8s %11s %9s %s\n",
+			"sweep", "op", "variant", "chip", "kb", "block", "baud",
+			"lat_us", "bytes", "wire", "ms", "kb_s", "check");
+
+	for (i = 0; i < COUNT(ops); i++)
+		if (bench_run(&ops[i], &base) != STAT_OK)
+			ret = STAT_ERROR;
+
+	cfg = base;
+	cfg.sweep = "rom";
+	for (i = 0; i < COUNT(rom_sizes); i++) {
+		cfg.rom_size = rom_sizes[i];
+		if (bench_ops(rom_ops, &cfg) != STAT_OK)
+			ret = STAT_ERROR;
+	}
+
+	cfg = base;
+	cfg.sweep = "block";
+	for (i = 0; i < COUNT(block_sizes); i++) {
+		cfg.block = block_sizes[i];
+		if (bench_ops(block_ops, &cfg) != STAT_OK)
+			ret = STAT_ERROR;
+	}
+
+	cfg = base;
+	cfg.sweep = "baud";
+	for (i = 0; i < COUNT(bauds); i++) {
+		cfg.baud = bauds[i];
+		if (bench_ops(link_ops, &cfg) != STAT_OK)
+			ret = STAT_ERROR;
+	}
+
+	cfg = base;
+	cfg.sweep = "latency";
+	for (i = 0; i < COUNT(latencies_us); i++) {
+		cfg.latency_us = latencies_us[i];
+		if (bench_ops(link_ops, &cfg) != STAT_OK)
+			ret = STAT_ERROR;
+	}
+
+	cfg = base;
+	cfg.sweep = "chip";
+	for (i = 0; i < gbsim_chips_count; i++) {
+		cfg.chip = &gbsim_chips[i];
+		cfg.rom_size = base.rom_size < cfg.chip->size ? base.rom_size
+			: cfg.chip->size;
+		if (bench_ops(chip_ops, &cfg) != STAT_OK)
+			ret = STAT_ERROR;
+	}
+
+	cfg = base;
+	cfg.sweep = "sink";
+	cfg.rom_size = S_64K;
+	cfg.baud = BAUDRATE_1M;
+	cfg.sink = 1;
+	if (bench_ops(sink_ops, &cfg) != STAT_OK)
+		ret = STAT_ERROR;
+
+	/* dirty contacts, what the robust read's votes cost */
+	cfg = base;
+	cfg.sweep = "flaky";
+	cfg.flaky_ppm = BENCH_FLAKY_PPM;
+	if (bench_ops(flaky_ops, &cfg) != STAT_OK)
+		ret = STAT_ERROR;
+
+	/* the 2-byte packets the frames replaced, next to the base rows */
+	cfg = base;
+	cfg.sweep = "legacy";
+	cfg.proto = PROTO_LEGACY;
+	if (bench_ops(link_ops, &cfg) != STAT_OK)
+		ret = STAT_ERROR;
+
+	/* a bad cable, only the frames get through it */
+	cfg = base;
+	cfg.sweep = "noisy";
+	cfg.noisy_ppm = BENCH_NOISY_PPM;
+	if (bench_ops(link_ops, &cfg) != STAT_OK)
+		ret = STAT_ERROR;
+
+	/* a flasher never updated: every extension has to fall back */
+	cfg = base;
+	cfg.sweep = "oldfw";
+	cfg.fw = BENCH_OLD_FW;
+	if (bench_ops(oldfw_ops, &cfg) != STAT_OK)
+		ret = STAT_ERROR;
+
+	return ret == STAT_OK ? EXIT_WIN : EXIT_FAIL;
+}
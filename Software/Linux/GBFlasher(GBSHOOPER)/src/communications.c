@@ -12,8 +12,13 @@ Description : Ladecadence.net GameBoy FlashCart interface
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
 
 #include "communications.h"
+#include "context.h"
 #include "gbshooper.h"
 
 /**************************** COMUNICACION ************************************/
@@ -87,72 +92,493 @@ void gbs_close_ftdi(struct ftdi_context* ftdic) {
 	ftdi_deinit(ftdic);
 }
 
-void gbs_send_byte(struct ftdi_context* ftdic, uint8_t c) {
-	ftdi_write_data(ftdic, &c, 1);
-	usleep(50);
+/* raw 8N1 at the flasher's speed. Reads wait up to 100ms for a byte and
+ * return 0 if none came, like ftdi_read_data() does; receives poll first,
+ * so they don't overrun their own timeouts by that much. */
+static uint16_t gbs_open_tty(conn_t* conn, const char* path) {
+	struct termios tio;
+
+	if ((conn->fd = open(path, O_RDWR | O_NOCTTY)) < 0) {
+		fprintf(stderr, "Can't open %s\n", path);
+		return STAT_ERROR;
+	}
+	if (tcgetattr(conn->fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		cfsetspeed(&tio, B230400);
+		tio.c_cc[VMIN] = 0;
+		tio.c_cc[VTIME] = 1;
+		tcsetattr(conn->fd, TCSANOW, &tio);
+	}
+	tcflush(conn->fd, TCIOFLUSH);
+
+	return STAT_OK;
+}
+
+static void gbs_trace(conn_t* conn, uint8_t kind, uint16_t len, uint8_t a,
+		uint8_t b) {
+	if (conn->trace != NULL)
+		gbs_trace_record(conn->trace, gbs_clock_ns(conn), kind, len, a, b);
+}
+
+uint16_t gbs_open(gbs_ctx_t* ctx, conn_t* conn) {
+	conn->ctx = ctx;
+	conn->sim = ctx->sim;
+	conn->block_size = BUFFER_SIZE;
+	conn->fw_mayor = conn->fw_minor = 0;
+	conn->stats = NULL;
+	conn->baudrate = ctx->sim != NULL ? ctx->sim->baudrate : BAUDRATE_230_4K;
+	conn->sent_ns = 0;
+	conn->sent_len = 0;
+	conn->rtt_fresh = 0;
+	conn->timing = ctx->timing;
+	conn->trace = ctx->trace;
+	conn->fd = -1;
+	conn->shared = 0;
+	conn->proto = PROTO_LEGACY;
+	conn->cmd = 0;
+	if (ctx->session_open) {
+		/* the FTDI context goes back to the session on close, with
+		 * whatever the operation left in its read buffer */
+		conn->ftdic = ctx->session.ftdic;
+		conn->fd = ctx->session.fd;
+		conn->sim = ctx->session.sim;
+		conn->shared = 1;
+		gbs_trace(conn, TRACE_OPEN, 0, 0, 0);
+		gbs_purge_rx(conn);
+		return STAT_OK;
+	}
+	gbs_trace(conn, TRACE_OPEN, 0, 0, 0);
+	if (conn->sim != NULL) {
+		gbsim_purge(conn->sim);
+		return STAT_OK;
+	}
+	if (ctx->device != NULL)
+		return gbs_open_tty(conn, ctx->device);
+
+	return gbs_open_ftdi(&conn->ftdic);
+}
+
+void gbs_close(conn_t* conn) {
+	packet_t packet0, packet1;
+
+	/* the next link starts with the old protocol */
+	if (conn->proto == PROTO_V2) {
+		packet0.type = TYPE_COMMAND;
+		packet0.data = CMD_PROTO;
+		gbs_send_packet(conn, &packet0);
+		packet0.type = TYPE_DATA;
+		packet0.data = PROTO_LEGACY;
+		gbs_send_packet(conn, &packet0);
+		gbs_receive_packet(conn, &packet1, RTO_CMD);
+		conn->proto = PROTO_LEGACY;
+	}
+
+	if (conn->stats != NULL)
+		conn->stats->wall_ns = gbs_clock_ns(conn) - conn->stats->start_ns;
+	gbs_trace(conn, TRACE_CLOSE, 0, 0, 0);
+	conn->ctx->timing = conn->timing;
+
+	if (conn->shared) {
+		conn->ctx->session.ftdic = conn->ftdic;
+		return;
+	}
+	if (conn->sim != NULL)
+		return;
+	if (conn->fd >= 0) {
+		close(conn->fd);
+		return;
+	}
+
+	gbs_close_ftdi(&conn->ftdic);
+}
+
+/* frames what goes both ways from now on, once the flasher agreed to it
+ * with CMD_PROTO, or goes back to plain packets */
+void gbs_set_proto(conn_t* conn, uint8_t proto) {
+	conn->proto = proto;
+	gbs_frame_init(&conn->framer);
+	conn->rx_off = 0;
+}
+
+void gbs_purge_rx(conn_t* conn) {
+	if (conn->proto == PROTO_V2)
+		gbs_frame_resync(&conn->framer);
+	if (conn->sim != NULL)
+		gbsim_purge(conn->sim);
+	else if (conn->fd >= 0)
+		tcflush(conn->fd, TCIFLUSH);
+	else
+		ftdi_usb_purge_rx_buffer(&conn->ftdic);
 }
 
-void gbs_send_packet(struct ftdi_context* ftdic, packet_t* pkt) {
-	ftdi_write_data(ftdic, &pkt->type, 1);
-	usleep(50);
-	ftdi_write_data(ftdic, &pkt->data, 1);
+/* link time: the model's virtual clock, or the monotonic clock */
+uint64_t gbs_clock_ns(conn_t* conn) {
+	struct timespec ts;
+
+	if (conn->sim != NULL)
+		return conn->sim->clock_ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
-uint8_t gbs_receive_byte (struct ftdi_context* ftdic, uint8_t* c, 
-							uint16_t timeout) {
-	time_t tp = time (NULL);
-	uint16_t bytesReceived = 0;
+/* starts accounting the traffic of an open link in stats */
+void gbs_measure(conn_t* conn, gbs_stats_t* stats, const char* op) {
+	gbs_stats_reset(stats, op, gbs_clock_ns(conn));
+	conn->stats = stats;
+}
+
+/* raw transfers, dispatched to the device model when one is attached */
+static int gbs_write_raw(conn_t* conn, const uint8_t* buf, int len) {
+	int ret;
+
+	if (conn->sim != NULL)
+		ret = gbsim_write(conn->sim, buf, len);
+	else if (conn->fd >= 0)
+		ret = write(conn->fd, buf, len);
+	else
+		ret = ftdi_write_data(&conn->ftdic, (uint8_t*) buf, len);
+
+	if (ret > 0) {
+		conn->sent_ns = gbs_clock_ns(conn);
+		conn->sent_len = ret;
+		if (conn->stats != NULL)
+			conn->stats->tx_bytes += ret;
+	}
+	return ret;
+}
+
+static int gbs_read_raw(conn_t* conn, uint8_t* buf, int len) {
+	int ret;
+
+	if (conn->sim != NULL)
+		ret = gbsim_read(conn->sim, buf, len);
+	else if (conn->fd >= 0)
+		ret = read(conn->fd, buf, len);
+	else
+		ret = ftdi_read_data(&conn->ftdic, buf, len);
+
+	if (ret <= 0)
+		return ret;
+	if (conn->stats != NULL)
+		conn->stats->rx_bytes += ret;
+	/* first byte back since the last write */
+	if (conn->sent_ns != 0) {
+		conn->rtt_ns = gbs_clock_ns(conn) - conn->sent_ns;
+		conn->rtt_fresh = 1;
+		conn->sent_ns = 0;
+		if (conn->stats != NULL)
+			gbs_stats_rtt(conn->stats, conn->rtt_ns);
+	}
+	return ret;
+}
+
+/* sends again what the flasher NAKed, as long as we kept it */
+static void gbs_resend(conn_t* conn) {
+	const uint8_t* frame;
+	uint16_t len;
+	uint8_t seq;
+
+	for (seq = conn->framer.nak; seq != conn->framer.tx_seq; seq++) {
+		if ((len = gbs_frame_kept(&conn->framer, seq, &frame)) == 0)
+			continue;
+		gbs_write_raw(conn, frame, len);
+		if (conn->stats != NULL)
+			conn->stats->resent++;
+	}
+}
+
+/* v2 reads: frames are taken in whole, never reading past the end of
+ * one, and their payload handed out. Damaged or missing ones are NAKed,
+ * NAKs from the flasher answered. Returns 0 like a raw read if no
+ * payload came. */
+static int gbs_read_frames(conn_t* conn, uint8_t* buf, int len) {
+	gbs_framer_t* fr = &conn->framer;
+	uint8_t chunk[256], nak[FRAME_HEAD + 1 + FRAME_CRC];
+	uint16_t need;
+	int n, i;
+
+	while (conn->rx_off == fr->rx_len) {
+		need = gbs_frame_need(fr);
+		if ((n = gbs_read_raw(conn, chunk, need < sizeof chunk ? need
+						: sizeof chunk)) <= 0)
+			return n;
+		for (i = 0; i < n; i++) {
+			switch (gbs_frame_byte(fr, chunk[i])) {
+				case FRAME_GOOD:
+					conn->rx_off = 0;
+					break;
+				case FRAME_BAD:
+					if (conn->stats != NULL)
+						conn->stats->frame_errors++;
+					gbs_write_raw(conn, nak, gbs_frame_nak(fr, nak));
+					break;
+				case FRAME_RESEND:
+					gbs_resend(conn);
+					break;
+				default:
+					break;
+			}
+		}
+	}
+
+	n = fr->rx_len - conn->rx_off < len ? fr->rx_len - conn->rx_off : len;
+	memcpy(buf, &fr->rx[FRAME_HEAD + conn->rx_off], n);
+	conn->rx_off += n;
+
+	return n;
+}
+
+/* payload still waiting in the last frame */
+static uint8_t gbs_rx_pending(conn_t* conn) {
+	return conn->proto == PROTO_V2 && conn->rx_off < conn->framer.rx_len;
+}
+
+/* what goes to the flasher, in frames of FRAME_MAX at most on v2 links,
+ * tagged with the command it belongs to */
+static int gbs_write(conn_t* conn, const uint8_t* buf, int len) {
+	const uint8_t* frame;
+	uint16_t n, flen;
+	int done = 0;
+
+	if (conn->proto != PROTO_V2)
+		return gbs_write_raw(conn, buf, len);
+
+	while (done < len) {
+		n = len - done < FRAME_MAX ? len - done : FRAME_MAX;
+		flen = gbs_frame_build(&conn->framer, conn->cmd, &buf[done], n,
+				&frame);
+		if (gbs_write_raw(conn, frame, flen) != flen)
+			return done > 0 ? done : -1;
+		done += n;
+	}
+
+	return done;
+}
+
+static int gbs_read(conn_t* conn, uint8_t* buf, int len) {
+	if (conn->proto == PROTO_V2)
+		return gbs_read_frames(conn, buf, len);
+	return gbs_read_raw(conn, buf, len);
+}
+
+/* time the last write may still spend on the wire after it returned */
+static uint64_t gbs_wire_ns(conn_t* conn) {
+	if (conn->sent_ns == 0 || conn->baudrate == 0)
+		return 0;
+	return (uint64_t) conn->sent_len * 10 * 1000000000ULL / conn->baudrate;
+}
+
+/* longest a kind of reply can take: what the chip allows for programs
+ * and erases, if it is known */
+static uint64_t gbs_rto_ceiling(conn_t* conn, uint8_t kind) {
+	if (kind == RTO_PRG && conn->timing.prg_byte_ns != 0)
+		return conn->block_size * conn->timing.prg_byte_ns + RTO_SLACK_NS;
+	if (kind == RTO_ERASE)
+		return conn->timing.erase_ns != 0 ? conn->timing.erase_ns
+			: ERASETIME * 1000000000ULL;
+	return SLEEPTIME * 1000000000ULL;
+}
+
+/* how long to wait for a kind of reply: the smoothed round trip plus four
+ * deviations, never under half again the round trip, device timings
+ * drift, nor under RTO_MIN_NS, and never over the ceiling */
+uint64_t gbs_rto_ns(conn_t* conn, uint8_t kind) {
+	gbs_rto_t* rto = &conn->timing.kind[kind];
+	uint64_t max = gbs_rto_ceiling(conn, kind), t;
+
+	if (rto->srtt_ns == 0)
+		return max;
+	t = rto->srtt_ns + 4 * rto->rttvar_ns;
+	if (t < rto->srtt_ns + rto->srtt_ns / 2)
+		t = rto->srtt_ns + rto->srtt_ns / 2;
+	if (t < RTO_MIN_NS)
+		t = RTO_MIN_NS;
+
+	return t < max ? t : max;
+}
+
+/* folds a time a kind of reply took into its estimate */
+void gbs_rto_observe(conn_t* conn, uint8_t kind, uint64_t ns) {
+	gbs_rto_t* rto = &conn->timing.kind[kind];
+	uint64_t r = ns != 0 ? ns : 1, d;
+
+	if (rto->srtt_ns == 0) {
+		rto->srtt_ns = r;
+		rto->rttvar_ns = r / 2;
+		return;
+	}
+	d = rto->srtt_ns > r ? rto->srtt_ns - r : r - rto->srtt_ns;
+	rto->rttvar_ns = (3 * rto->rttvar_ns + d) / 4;
+	rto->srtt_ns = (7 * rto->srtt_ns + r) / 8;
+}
+
+/* the round trip of the reply just received. The last write's own wire
+ * time is left out, that is allowed for apart. */
+static void gbs_rto_sample(conn_t* conn, uint8_t kind, uint64_t wire_ns) {
+	if (!conn->rtt_fresh)
+		return;
+	conn->rtt_fresh = 0;
+	gbs_rto_observe(conn, kind,
+			conn->rtt_ns > wire_ns ? conn->rtt_ns - wire_ns : 0);
+}
+
+/* lets ns of link time go by: the model's clock moves on, a real link
+ * sleeps */
+void gbs_pause(conn_t* conn, uint64_t ns) {
+	struct timespec ts;
+
+	if (conn->sim != NULL) {
+		gbsim_idle(conn->sim, ns);
+		return;
+	}
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	nanosleep(&ts, NULL);
+}
+
+/* the flash chip on the cart, by manufacturer and chip ID, and its worst
+ * case timings. Program and erase times learnt on another chip are
+ * forgotten. */
+void gbs_rto_chip(conn_t* conn, uint16_t chip, uint64_t prg_byte_ns,
+		uint64_t erase_ns) {
+	if (chip != conn->timing.chip) {
+		memset(&conn->timing.kind[RTO_PRG], 0, sizeof(gbs_rto_t));
+		memset(&conn->timing.kind[RTO_ERASE], 0, sizeof(gbs_rto_t));
+		conn->timing.chip = chip;
+	}
+	conn->timing.prg_byte_ns = prg_byte_ns;
+	conn->timing.erase_ns = erase_ns;
+}
+
+/* reads what has come in by the deadline, a tty is polled first. Polls
+ * are cut at 100ms, like the tty's own reads, so cancels get seen. */
+static int gbs_read_until(conn_t* conn, uint8_t* buf, int len,
+		uint64_t deadline) {
+	struct pollfd pfd;
+	uint64_t now, ms = 0;
+
+	if (conn->fd >= 0 && !gbs_rx_pending(conn)) {
+		now = gbs_clock_ns(conn);
+		if (now < deadline)
+			ms = (deadline - now + 999999) / 1000000;
+		pfd.fd = conn->fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, ms < 100 ? (int) ms : 100) <= 0)
+			return 0;
+	}
+
+	return gbs_read(conn, buf, len);
+}
+
+void gbs_send_byte(conn_t* conn, uint8_t c) {
+	gbs_trace(conn, TRACE_TX_DATA, 1, c, 0);
+	gbs_write(conn, &c, 1);
+	if (conn->sim == NULL)
+		usleep(50);
+}
+
+void gbs_send_packet(conn_t* conn, packet_t* pkt) {
+	gbs_trace(conn, TRACE_TX_PACKET, 2, pkt->type, pkt->data);
+	if (pkt->type == TYPE_COMMAND)
+		conn->cmd = pkt->data;
+	if (conn->proto == PROTO_V2) {
+		/* both halves in one frame */
+		gbs_write(conn, (uint8_t*) pkt, 2);
+		return;
+	}
+	gbs_write(conn, &pkt->type, 1);
+	if (conn->sim == NULL)
+		usleep(50);
+	gbs_write(conn, &pkt->data, 1);
+}
+
+uint8_t gbs_receive_byte (conn_t* conn, uint8_t* c, uint8_t kind) {
+	uint64_t wire_ns = gbs_wire_ns(conn);
+	uint64_t deadline = gbs_clock_ns(conn) + gbs_rto_ns(conn, kind) + wire_ns;
+	int bytesReceived = 0;
 
 	do {
-		bytesReceived = ftdi_read_data (ftdic, c, 1);
-		if (bytesReceived != 0)
+		bytesReceived = gbs_read_until (conn, c, 1, deadline);
+		/* the model answers synchronously, nothing more will arrive */
+		if (bytesReceived != 0 || conn->sim != NULL)
 			break;
-	} while (time (NULL) - tp < timeout);
+	} while (gbs_clock_ns(conn) < deadline);
 
-	if (bytesReceived == 0)
+	if (bytesReceived == 0) {
+		if (conn->stats != NULL)
+			conn->stats->timeouts++;
+		gbs_trace(conn, TRACE_TIMEOUT, 1, 0, 0);
 		return STAT_TIMEOUT;
+	}
 
-	if (bytesReceived > 0)
+	if (bytesReceived > 0) {
+		gbs_rto_sample(conn, kind, wire_ns);
+		gbs_trace(conn, TRACE_RX_BYTE, 1, *c, 0);
 		return STAT_OK;
+	}
 
-	if (bytesReceived < 0)
-		fprintf(stderr, "ERROR LIBUSB: %s\n",  ftdi_get_error_string (ftdic));
+	if (bytesReceived < 0 && conn->sim == NULL && conn->fd < 0)
+		fprintf(stderr, "ERROR LIBUSB: %s\n",
+				ftdi_get_error_string (&conn->ftdic));
 
 	return STAT_ERROR;
 }
 
 
-uint16_t gbs_receive_packet(struct ftdi_context* ftdic, packet_t* packet, 
-							uint16_t timeout) {
+uint16_t gbs_receive_packet(conn_t* conn, packet_t* packet, 
+							uint8_t kind) {
+	return gbs_wait_packet(conn, packet, kind, NULL);
+}
+
+/* gbs_receive_packet() for long waits, gives up with STAT_CANCELLED as
+ * soon as *cancel is set */
+uint16_t gbs_wait_packet(conn_t* conn, packet_t* packet, uint8_t kind,
+		_Atomic uint8_t* cancel) {
 
-	time_t tp = time (NULL);
-	uint16_t bytes_received, bytes_left = 0;
+	uint64_t wire_ns = gbs_wire_ns(conn);
+	uint64_t deadline = gbs_clock_ns(conn) + gbs_rto_ns(conn, kind) + wire_ns;
+	int bytes_received;
 	uint16_t remaining = 2;
-	do {
-		bytes_left = 2;
+	uint8_t* p = (uint8_t*) packet;
 
-		bytes_received =
-			ftdi_read_data (ftdic, (unsigned char*)&packet[2-remaining],
-					bytes_left);
-		remaining -= bytes_received;
-		tp = time (NULL);
+	do {
+		bytes_received = gbs_read_until (conn, &p[2-remaining], remaining,
+				deadline);
+		if (bytes_received > 0)
+			remaining -= bytes_received;
+		if (conn->sim != NULL)
+			break;
+		if (cancel != NULL && remaining != 0 && atomic_load(cancel))
+			return STAT_CANCELLED;
 
-	} while (time (NULL) - tp < timeout && remaining != 0);
+	} while (gbs_clock_ns(conn) < deadline && remaining != 0);
 
 	
 	/* printf("ERROR LIBUSB: %s\n",  ftdi_get_error_string (ftdic)); */
 
 
-	if (remaining > 0)
+	if (remaining > 0) {
+		if (conn->stats != NULL)
+			conn->stats->timeouts++;
+		gbs_trace(conn, TRACE_TIMEOUT, 2, 0, 0);
 		return STAT_TIMEOUT;
-	else
-		return STAT_OK;
+	}
+
+	gbs_rto_sample(conn, kind, wire_ns);
+	gbs_trace(conn, TRACE_RX_PACKET, 2, packet->type, packet->data);
+	return STAT_OK;
 
 }
 
 
 
-void gbs_send_buffer(struct ftdi_context* ftdic, uint8_t* buffer) {
-	ftdi_write_data(ftdic, buffer, BUFFER_SIZE);
+void gbs_send_buffer(conn_t* conn, uint8_t* buffer) {
+	gbs_trace(conn, TRACE_TX_DATA, conn->block_size, buffer[0], buffer[1]);
+	gbs_write(conn, buffer, conn->block_size);
 }
 
+void gbs_send_data(conn_t* conn, uint8_t* data, uint16_t len) {
+	gbs_trace(conn, TRACE_TX_DATA, len, data[0], len > 1 ? data[1] : 0);
+	gbs_write(conn, data, len);
+}
@@ -12,26 +12,109 @@ Description : Ladecadence.net GameBoy FlashCart interface
 #define __COMMUNICATIONS_H
 
 #include <inttypes.h>
+#include <stdatomic.h>
 #include <ftdi.h>
 
+#include "frame.h"
+#include "gbsim.h"
+#include "stats.h"
+#include "trace.h"
+
+/* replies waited for, each kind with its own round trip estimate */
+#define RTO_CMD			0	/* command acknowledges and answers */
+#define RTO_READ		1	/* data read back */
+#define RTO_PRG			2	/* a flash block's check, once programmed */
+#define RTO_RAM			3	/* a RAM block's check */
+#define RTO_ERASE		4	/* a whole chip erase */
+#define RTO_KINDS		5
+
+/* shortest wait, above the FTDI latency timer and scheduling jitter */
+#define RTO_MIN_NS		50000000ULL
+/* firmware and USB time on top of programming a flash block */
+#define RTO_SLACK_NS	1000000000ULL
+
 /* Types */
 /*********/
+
+/* library context, see context.h */
+typedef struct gbs_ctx gbs_ctx_t;
+
 typedef struct
 {
 	uint8_t type;
 	uint8_t data;
 } packet_t;
 
+/* smoothed round trip of one kind of reply, RFC 6298 style */
+typedef struct
+{
+	uint64_t srtt_ns;		/* 0 until the first reply */
+	uint64_t rttvar_ns;
+} gbs_rto_t;
+
+/* what the host has learnt about the flasher's timing. Links start with
+ * the context's and give it back on close, so it carries over between
+ * operations. Until a kind has been measured its waits are the ceiling:
+ * the chip's worst case for programs and erases, SLEEPTIME and ERASETIME
+ * when the chip is unknown. */
+typedef struct
+{
+	gbs_rto_t kind[RTO_KINDS];
+	uint16_t chip;			/* manufacturer and chip ID, flash times are for */
+	uint64_t prg_byte_ns;	/* worst case program time per byte, 0 unknown */
+	uint64_t erase_ns;		/* worst case chip erase, 0 unknown */
+} gbs_timing_t;
+
+/* an open link to the flasher: the FTDI device, or the serial tty or
+ * software device model the context names */
+typedef struct
+{
+	gbs_ctx_t* ctx;
+	struct ftdi_context ftdic;
+	int fd;					/* serial tty, -1 if not used */
+	gbsim_t* sim;
+	uint16_t block_size;	/* negotiated transfer block size */
+	uint8_t fw_mayor;		/* firmware version, once asked for */
+	uint8_t fw_minor;
+	uint8_t wbuf_size;		/* for the write-buffer program algorithm */
+	gbs_stats_t* stats;		/* where to account traffic, if anywhere */
+	uint32_t baudrate;
+	uint64_t sent_ns;		/* last write still waiting for a reply */
+	uint32_t sent_len;		/* its bytes, maybe still on the wire */
+	uint64_t rtt_ns;		/* round trip of the reply being received */
+	uint8_t rtt_fresh;
+	gbs_timing_t timing;
+	gbs_trace_t* trace;		/* packet trace, if recording */
+	uint8_t shared;			/* borrowed from the session, left open */
+	uint8_t proto;			/* PROTO_*, see gbs_set_proto() */
+	uint8_t cmd;			/* last command sent, v2 frames carry it */
+	gbs_framer_t framer;	/* v2 */
+	uint16_t rx_off;		/* payload of the last frame already read */
+} conn_t;
+
 /* function prototypes */
 /***********************/
 uint16_t gbs_open_ftdi(struct ftdi_context* ftdic);
 void gbs_close_ftdi(struct ftdi_context* ftdic);
-void gbs_send_byte(struct ftdi_context* ftdic, uint8_t c);
-void gbs_send_packet(struct ftdi_context* ftdic, packet_t* pkt);
-uint8_t gbs_receive_byte (struct ftdi_context* ftdic, uint8_t* c, 
-		uint16_t timeout);
-uint16_t gbs_receive_packet(struct ftdi_context* ftdic, packet_t* packet, 
-		uint16_t timeout);
-void gbs_send_buffer(struct ftdi_context* ftdic, uint8_t* buffer);
+uint16_t gbs_open(gbs_ctx_t* ctx, conn_t* conn);
+void gbs_close(conn_t* conn);
+void gbs_set_proto(conn_t* conn, uint8_t proto);
+void gbs_purge_rx(conn_t* conn);
+uint64_t gbs_clock_ns(conn_t* conn);
+void gbs_pause(conn_t* conn, uint64_t ns);
+void gbs_measure(conn_t* conn, gbs_stats_t* stats, const char* op);
+void gbs_send_byte(conn_t* conn, uint8_t c);
+void gbs_send_packet(conn_t* conn, packet_t* pkt);
+uint8_t gbs_receive_byte (conn_t* conn, uint8_t* c, uint8_t kind);
+uint16_t gbs_receive_packet(conn_t* conn, packet_t* packet, 
+		uint8_t kind);
+uint16_t gbs_wait_packet(conn_t* conn, packet_t* packet, uint8_t kind,
+		_Atomic uint8_t* cancel);
+uint64_t gbs_rto_ns(conn_t* conn, uint8_t kind);
+void gbs_rto_observe(conn_t* conn, uint8_t kind, uint64_t ns);
+void gbs_rto_chip(conn_t* conn, uint16_t chip, uint64_t prg_byte_ns,
+		uint64_t erase_ns);
+void gbs_send_buffer(conn_t* conn, uint8_t* buffer);
+void gbs_send_data(conn_t* conn, uint8_t* data, uint16_t len);
 
 #endif
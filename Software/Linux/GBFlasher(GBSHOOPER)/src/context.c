@@ -0,0 +1,285 @@
+/*
+============================================================================
+Name        : context.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Library context and asynchronous operations
+============================================================================
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "gbshooper.h"
+#include "remote.h"
+
+gbs_ctx_t* gbs_ctx_new() {
+	gbs_ctx_t* ctx;
+
+	if ((ctx = calloc(1, sizeof(*ctx))) == NULL)
+		return NULL;
+	if (pipe(ctx->notify) != 0) {
+		free(ctx);
+		return NULL;
+	}
+	fcntl(ctx->notify[0], F_SETFL, O_NONBLOCK);
+	fcntl(ctx->notify[1], F_SETFL, O_NONBLOCK);
+	fcntl(ctx->notify[0], F_SETFD, FD_CLOEXEC);
+	fcntl(ctx->notify[1], F_SETFD, FD_CLOEXEC);
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_cond_init(&ctx->wake, NULL);
+	atomic_init(&ctx->notified, 0);
+
+	return ctx;
+}
+
+/* cancels the running operation and waits for it to stop, drops the
+ * queued ones without calling their callbacks and closes the session */
+void gbs_ctx_free(gbs_ctx_t* ctx) {
+	gbs_job_t* job;
+
+	if (ctx == NULL)
+		return;
+
+	gbs_ctx_cancel(ctx);
+	pthread_mutex_lock(&ctx->lock);
+	ctx->quit = 1;
+	pthread_cond_broadcast(&ctx->wake);
+	pthread_mutex_unlock(&ctx->lock);
+	if (ctx->worker_running)
+		pthread_join(ctx->worker, NULL);
+
+	while ((job = ctx->jobs) != NULL) {
+		ctx->jobs = job->next;
+		free(job);
+	}
+	gbs_session_end(ctx);
+
+	close(ctx->notify[0]);
+	close(ctx->notify[1]);
+	pthread_cond_destroy(&ctx->wake);
+	pthread_mutex_destroy(&ctx->lock);
+	free(ctx);
+}
+
+/* the software device model instead of the FTDI device */
+void gbs_ctx_set_sim(gbs_ctx_t* ctx, gbsim_t* sim) {
+	ctx->sim = sim;
+}
+
+/* a serial tty instead of the FTDI device */
+void gbs_ctx_set_device(gbs_ctx_t* ctx, const char* path) {
+	ctx->device = path;
+}
+
+/* packet trace links record to, NULL to stop */
+void gbs_ctx_set_trace(gbs_ctx_t* ctx, gbs_trace_t* trace) {
+	ctx->trace = trace;
+}
+
+/* file the chip erase times are logged to, and the expected time of the
+ * next erase taken from. Lines are "chip ms time": manufacturer and chip
+ * ID in hex, the erase in milliseconds and when it ended. */
+void gbs_ctx_set_erase_log(gbs_ctx_t* ctx, const char* path) {
+	ctx->erase_log = path;
+}
+
+/* newest protocol the links may move to, PROTO_LEGACY keeps them on plain
+ * packets even with firmware that frames. 0 for the newest both ends
+ * know. */
+void gbs_ctx_set_proto(gbs_ctx_t* ctx, uint8_t proto) {
+	ctx->proto = proto;
+}
+
+/* a gbshooperd socket: operations, status, ID, header and probes are all
+ * sent there, and the server, which keeps the flasher open, runs them in
+ * turn with other clients'. NULL to talk to the flasher here. */
+void gbs_ctx_set_server(gbs_ctx_t* ctx, const char* path) {
+	ctx->server = path;
+}
+
+/* opens the flasher once for a run of operations. Until the session ends,
+ * gbs_open() lends every operation of the context this link instead of
+ * finding and opening the device again. */
+uint16_t gbs_session_begin(gbs_ctx_t* ctx) {
+	if (ctx->session_open)
+		return STAT_OK;
+	/* the server holds one already */
+	if (ctx->server != NULL) {
+		ctx->session_open = 1;
+		return STAT_OK;
+	}
+	if (gbs_open(ctx, &ctx->session) != STAT_OK)
+		return STAT_ERROR;
+	ctx->session_open = 1;
+
+	return STAT_OK;
+}
+
+void gbs_session_end(gbs_ctx_t* ctx) {
+	if (!ctx->session_open)
+		return;
+	ctx->session_open = 0;
+	if (ctx->server != NULL)
+		return;
+	/* the operations' links kept the timing up to date, not this one */
+	ctx->session.timing = ctx->timing;
+	gbs_close(&ctx->session);
+}
+
+/* wakes up gbs_ctx_fd() readers, once until they dispatch */
+void gbs_ctx_notify(gbs_ctx_t* ctx) {
+	ssize_t n;
+
+	if (ctx == NULL || atomic_exchange(&ctx->notified, 1))
+		return;
+	n = write(ctx->notify[1], "", 1);
+	(void) n;
+}
+
+static void* gbs_ctx_worker(void* ptr) {
+	gbs_ctx_t* ctx = (gbs_ctx_t*) ptr;
+	gbs_job_t* job;
+
+	pthread_mutex_lock(&ctx->lock);
+	while (!ctx->quit) {
+		for (job = ctx->jobs; job != NULL; job = job->next)
+			if (job->state == JOB_QUEUED)
+				break;
+		if (job == NULL) {
+			pthread_cond_wait(&ctx->wake, &ctx->lock);
+			continue;
+		}
+
+		job->state = JOB_RUNNING;
+		pthread_mutex_unlock(&ctx->lock);
+		if (ctx->server != NULL)
+			gbs_remote_job(job->op, job->args);
+		else
+			job->op(job->args);
+		pthread_mutex_lock(&ctx->lock);
+		job->state = JOB_ENDED;
+		gbs_ctx_notify(ctx);
+	}
+	pthread_mutex_unlock(&ctx->lock);
+
+	return NULL;
+}
+
+/* queues op (gbs_read_flash(), gbs_erase_ram()...) and returns at once.
+ * args must stay valid until done has been called. */
+uint16_t gbs_start_op(gbs_ctx_t* ctx, void* (*op)(void*),
+		thread_args_t* args, gbs_progress_fn progress, gbs_done_fn done,
+		void* data) {
+	gbs_job_t* job, ** tail;
+
+	if ((job = calloc(1, sizeof(*job))) == NULL)
+		return STAT_ERROR;
+	job->op = op;
+	job->args = args;
+	job->progress = progress;
+	job->done = done;
+	job->data = data;
+	job->state = JOB_QUEUED;
+	args->ctx = ctx;
+
+	pthread_mutex_lock(&ctx->lock);
+	if (!ctx->worker_running) {
+		if (pthread_create(&ctx->worker, NULL, gbs_ctx_worker, ctx) != 0) {
+			pthread_mutex_unlock(&ctx->lock);
+			free(job);
+			return STAT_ERROR;
+		}
+		ctx->worker_running = 1;
+	}
+	for (tail = &ctx->jobs; *tail != NULL; tail = &(*tail)->next)
+		;
+	*tail = job;
+	pthread_cond_signal(&ctx->wake);
+	pthread_mutex_unlock(&ctx->lock);
+
+	return STAT_OK;
+}
+
+/* file descriptor for poll() and friends, readable when gbs_ctx_dispatch()
+ * has callbacks to run */
+int gbs_ctx_fd(gbs_ctx_t* ctx) {
+	return ctx->notify[0];
+}
+
+/* runs the callbacks that are due, on the calling thread. Call it from one
+ * thread only. Returns the operations not finished yet. */
+uint32_t gbs_ctx_dispatch(gbs_ctx_t* ctx) {
+	gbs_job_t* job, ** link;
+	char buf[16];
+	uint32_t done, left = 0;
+	uint8_t state;
+
+	atomic_store(&ctx->notified, 0);
+	while (read(ctx->notify[0], buf, sizeof buf) > 0)
+		;
+
+	/* only this function unlinks jobs, so the list can be walked without
+	 * the lock while a callback runs */
+	pthread_mutex_lock(&ctx->lock);
+	link = &ctx->jobs;
+	while ((job = *link) != NULL) {
+		state = job->state;
+		pthread_mutex_unlock(&ctx->lock);
+
+		done = atomic_load_explicit(&job->args->done_bytes,
+				memory_order_relaxed);
+		if (state != JOB_QUEUED && done != job->reported) {
+			job->reported = done;
+			if (job->progress != NULL)
+				job->progress(job->args, job->data);
+		}
+
+		pthread_mutex_lock(&ctx->lock);
+		if (state == JOB_ENDED) {
+			*link = job->next;
+			pthread_mutex_unlock(&ctx->lock);
+			if (job->done != NULL)
+				job->done(job->args, job->data);
+			free(job);
+			pthread_mutex_lock(&ctx->lock);
+			continue;
+		}
+		left++;
+		link = &job->next;
+	}
+	pthread_mutex_unlock(&ctx->lock);
+
+	return left;
+}
+
+/* cancels every operation queued or running on the context. Their done
+ * callbacks still come, with STAT_CANCELLED. */
+void gbs_ctx_cancel(gbs_ctx_t* ctx) {
+	gbs_job_t* job;
+
+	pthread_mutex_lock(&ctx->lock);
+	for (job = ctx->jobs; job != NULL; job = job->next)
+		if (job->state != JOB_ENDED)
+			gbs_cancel(job->args);
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/* waits up to timeout_ms for something to dispatch, then dispatches it */
+uint32_t gbs_ctx_wait(gbs_ctx_t* ctx, uint32_t timeout_ms) {
+	struct pollfd p;
+
+	p.fd = ctx->notify[0];
+	p.events = POLLIN;
+	p.revents = 0;
+	poll(&p, 1, timeout_ms);
+
+	return gbs_ctx_dispatch(ctx);
+}
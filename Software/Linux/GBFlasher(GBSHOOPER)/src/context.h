@@ -0,0 +1,99 @@
+/*
+============================================================================
+Name        : context.h
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Library context and asynchronous operations
+============================================================================
+*/
+
+#ifndef __CONTEXT_H
+#define __CONTEXT_H
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "communications.h"
+#include "flashcart.h"
+
+/* job states */
+#define JOB_QUEUED		0
+#define JOB_RUNNING		1
+#define JOB_ENDED		2
+
+/* Types */
+/*********/
+
+/* callbacks of an operation started with gbs_start_op(). They run on the
+ * thread that calls gbs_ctx_dispatch(), never on the library's worker. */
+typedef void (*gbs_progress_fn)(thread_args_t* args, void* data);
+typedef void (*gbs_done_fn)(thread_args_t* args, void* data);
+
+/* an operation queued on a context */
+typedef struct gbs_job
+{
+	void* (*op)(void*);
+	thread_args_t* args;
+	gbs_progress_fn progress;
+	gbs_done_fn done;
+	void* data;
+	uint32_t reported;		/* bytes last passed to progress */
+	uint8_t state;			/* JOB_*, guarded by the context lock */
+	struct gbs_job* next;
+} gbs_job_t;
+
+/* everything the library knows about one flasher. Nothing is shared
+ * between contexts, so each can be driven from its own thread. */
+struct gbs_ctx
+{
+	/* link to open, see gbs_ctx_set_*() */
+	gbsim_t* sim;
+	const char* device;
+	gbs_trace_t* trace;
+	const char* erase_log;	/* chip erase times, NULL to keep none */
+	uint8_t proto;			/* newest PROTO_* links may use, 0 for any */
+	const char* server;		/* gbshooperd socket, runs everything there */
+
+	/* link kept open between gbs_session_begin() and gbs_session_end() */
+	conn_t session;
+	uint8_t session_open;
+
+	/* flasher timing, learnt by the links */
+	gbs_timing_t timing;
+
+	/* operations run one at a time, in order, by a worker thread */
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_t worker;
+	uint8_t worker_running;
+	uint8_t quit;
+	gbs_job_t* jobs;		/* queued, running and undispatched ones */
+	int notify[2];			/* pipe, readable when callbacks are due */
+	_Atomic uint8_t notified;
+};
+
+/* function prototypes */
+/***********************/
+gbs_ctx_t* gbs_ctx_new();
+void gbs_ctx_free(gbs_ctx_t* ctx);
+void gbs_ctx_set_sim(gbs_ctx_t* ctx, gbsim_t* sim);
+void gbs_ctx_set_device(gbs_ctx_t* ctx, const char* path);
+void gbs_ctx_set_trace(gbs_ctx_t* ctx, gbs_trace_t* trace);
+void gbs_ctx_set_erase_log(gbs_ctx_t* ctx, const char* path);
+void gbs_ctx_set_proto(gbs_ctx_t* ctx, uint8_t proto);
+void gbs_ctx_set_server(gbs_ctx_t* ctx, const char* path);
+uint16_t gbs_session_begin(gbs_ctx_t* ctx);
+void gbs_session_end(gbs_ctx_t* ctx);
+uint16_t gbs_start_op(gbs_ctx_t* ctx, void* (*op)(void*),
+		thread_args_t* args, gbs_progress_fn progress, gbs_done_fn done,
+		void* data);
+int gbs_ctx_fd(gbs_ctx_t* ctx);
+uint32_t gbs_ctx_dispatch(gbs_ctx_t* ctx);
+uint32_t gbs_ctx_wait(gbs_ctx_t* ctx, uint32_t timeout_ms);
+void gbs_ctx_cancel(gbs_ctx_t* ctx);
+void gbs_ctx_notify(gbs_ctx_t* ctx);
+
+#endif
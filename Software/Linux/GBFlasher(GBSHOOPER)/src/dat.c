@@ -0,0 +1,318 @@
+/*
+============================================================================
+Name        : dat.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Indexed ROM database, compiled from No-Intro style DATs
+============================================================================
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gbshooper.h"
+#include "dat.h"
+
+#define DAT_VALUE		512		/* longest attribute value kept */
+#define DAT_PATH		1024
+
+/* what gbs_dat_compile() collects before writing the index */
+typedef struct
+{
+	dat_entry_t* entries;
+	uint32_t count;
+	char* names;
+	uint32_t names_len;
+} dat_build_t;
+
+/* the value of attribute attr in the tag between p and end, entities
+ * decoded. Returns 0 if it isn't there. */
+static uint8_t gbs_dat_attr(const char* p, const char* end, const char* attr,
+		char* dst, size_t n) {
+	static const struct { const char* entity; char c; } entities[] = {
+		{"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'},
+		{"&apos;", '\''}
+	};
+	size_t len = strlen(attr), i = 0, e;
+
+	for (p++; p + len + 2 < end; p++)
+		if ((p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\n'
+					|| p[-1] == '\r') && strncmp(p, attr, len) == 0
+				&& p[len] == '=' && p[len+1] == '"')
+			break;
+	if (p + len + 2 >= end)
+		return 0;
+
+	for (p += len + 2; p < end && *p != '"' && i + 1 < n; p++) {
+		for (e = 0; *p == '&' && e < sizeof entities / sizeof entities[0];
+				e++)
+			if (strncmp(p, entities[e].entity,
+						strlen(entities[e].entity)) == 0)
+				break;
+		if (*p == '&' && e < sizeof entities / sizeof entities[0]) {
+			dst[i++] = entities[e].c;
+			p += strlen(entities[e].entity) - 1;
+		}
+		else
+			dst[i++] = *p;
+	}
+	dst[i] = '\0';
+
+	return 1;
+}
+
+/* hex digits into bytes, 0 unless all of them are there */
+static uint8_t gbs_dat_hex(const char* s, uint8_t* dst, uint32_t len) {
+	unsigned int byte;
+	uint32_t i;
+
+	if (strlen(s) != len * 2)
+		return 0;
+	for (i = 0; i < len; i++) {
+		if (sscanf(&s[i * 2], "%2x", &byte) != 1)
+			return 0;
+		dst[i] = byte;
+	}
+
+	return 1;
+}
+
+static uint16_t gbs_dat_add(dat_build_t* b, const char* game,
+		const char* start, const char* end) {
+	char value[DAT_VALUE], file[DAT_VALUE];
+	uint8_t crc[4];
+	dat_entry_t* e;
+	size_t len;
+	void* p;
+
+	if (!gbs_dat_attr(start, end, "crc", value, sizeof value)
+			|| !gbs_dat_hex(value, crc, 4))
+		return STAT_OK;		/* nothing to index it by */
+
+	if ((p = realloc(b->entries, (b->count + 1) * sizeof(*e))) == NULL)
+		return STAT_ERROR;
+	b->entries = p;
+	e = &b->entries[b->count];
+	memset(e, 0, sizeof(*e));
+	e->crc32 = (uint32_t) crc[0] << 24 | crc[1] << 16 | crc[2] << 8 | crc[3];
+	e->have = HASH_CRC32;
+	if (gbs_dat_attr(start, end, "size", value, sizeof value))
+		e->size = strtoul(value, NULL, 10);
+	if (gbs_dat_attr(start, end, "md5", value, sizeof value)
+			&& gbs_dat_hex(value, e->md5, 16))
+		e->have |= HASH_MD5;
+	if (gbs_dat_attr(start, end, "sha1", value, sizeof value)
+			&& gbs_dat_hex(value, e->sha1, 20))
+		e->have |= HASH_SHA1;
+	if (!gbs_dat_attr(start, end, "name", file, sizeof file))
+		file[0] = '\0';
+
+	/* "game\0file\0" */
+	len = strlen(game) + strlen(file) + 2;
+	if ((p = realloc(b->names, b->names_len + len)) == NULL)
+		return STAT_ERROR;
+	b->names = p;
+	e->name = b->names_len;
+	strcpy(&b->names[b->names_len], game);
+	strcpy(&b->names[b->names_len + strlen(game) + 1], file);
+	b->names_len += len;
+	b->count++;
+
+	return STAT_OK;
+}
+
+/* the <game> (or <machine>) and <rom> tags of an XML DAT */
+static uint16_t gbs_dat_parse(dat_build_t* b, const char* xml, size_t len) {
+	const char* p = xml, * end = xml + len, * close;
+	char game[DAT_VALUE] = "";
+
+	while ((p = memchr(p, '<', end - p)) != NULL) {
+		if ((close = memchr(p, '>', end - p)) == NULL)
+			break;
+		if (strncmp(p, "<game", 5) == 0 || strncmp(p, "<machine", 8) == 0) {
+			if (!gbs_dat_attr(p, close, "name", game, sizeof game))
+				game[0] = '\0';
+		}
+		else if (strncmp(p, "<rom", 4) == 0 && (p[4] == ' ' || p[4] == '\t'
+					|| p[4] == '\n' || p[4] == '\r')) {
+			if (gbs_dat_add(b, game, p, close) != STAT_OK)
+				return STAT_ERROR;
+		}
+		p = close + 1;
+	}
+
+	return STAT_OK;
+}
+
+static uint16_t gbs_dat_write(dat_build_t* b, const char* index) {
+	dat_header_t header;
+	uint32_t* buckets;
+	uint32_t i, j, mask;
+	char tmp[DAT_PATH];
+	uint16_t ret = STAT_ERROR;
+	FILE* f;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DAT_MAGIC, sizeof(header.magic));
+	header.version = DAT_VERSION;
+	header.entries = b->count;
+	header.names = b->names_len;
+	for (header.buckets = 16; header.buckets < b->count * 2;
+			header.buckets <<= 1)
+		;
+	if ((buckets = calloc(header.buckets, sizeof(*buckets))) == NULL)
+		return STAT_ERROR;
+	mask = header.buckets - 1;
+	for (i = 0; i < b->count; i++) {
+		for (j = b->entries[i].crc32 & mask; buckets[j] != 0;
+				j = (j + 1) & mask)
+			;
+		buckets[j] = i + 1;
+	}
+
+	/* readers map the index, so a new one replaces it whole */
+	snprintf(tmp, sizeof tmp, "%s.tmp", index);
+	if ((f = fopen(tmp, "wb")) != NULL) {
+		if (fwrite(&header, sizeof(header), 1, f) == 1
+				&& fwrite(buckets, sizeof(*buckets), header.buckets, f)
+					== header.buckets
+				&& fwrite(b->entries, sizeof(dat_entry_t), b->count, f)
+					== b->count
+				&& fwrite(b->names, 1, b->names_len, f) == b->names_len)
+			ret = STAT_OK;
+		if (fclose(f) != 0 || ret != STAT_OK || rename(tmp, index) != 0) {
+			unlink(tmp);
+			ret = STAT_ERROR;
+		}
+	}
+	free(buckets);
+
+	return ret;
+}
+
+/* compiles a No-Intro style XML DAT into an index for gbs_dat_open().
+ * Returns the ROMs indexed, -1 on errors. */
+int32_t gbs_dat_compile(const char* dat, const char* index) {
+	dat_build_t b;
+	char* xml;
+	FILE* f;
+	long len;
+	int32_t ret = -1;
+
+	if ((f = fopen(dat, "rb")) == NULL)
+		return -1;
+	fseek(f, 0L, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0L, SEEK_SET);
+	if (len <= 0 || (xml = malloc(len + 1)) == NULL) {
+		fclose(f);
+		return -1;
+	}
+	if (fread(xml, 1, len, f) != (size_t) len) {
+		free(xml);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	xml[len] = '\0';
+
+	memset(&b, 0, sizeof(b));
+	if (gbs_dat_parse(&b, xml, len) == STAT_OK
+			&& gbs_dat_write(&b, index) == STAT_OK)
+		ret = b.count;
+	free(xml);
+	free(b.entries);
+	free(b.names);
+
+	return ret;
+}
+
+/* maps an index. Nothing is read until a lookup touches it. */
+uint16_t gbs_dat_open(gbs_dat_t* db, const char* index) {
+	const dat_header_t* h;
+	struct stat st;
+	uint64_t need;
+	void* map;
+	int fd;
+
+	memset(db, 0, sizeof(*db));
+	if ((fd = open(index, O_RDONLY)) < 0)
+		return STAT_ERROR;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(*h)) {
+		close(fd);
+		return STAT_ERROR;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return STAT_ERROR;
+
+	h = map;
+	need = sizeof(*h) + (uint64_t) h->buckets * sizeof(uint32_t)
+		+ (uint64_t) h->entries * sizeof(dat_entry_t) + h->names;
+	if (memcmp(h->magic, DAT_MAGIC, sizeof(h->magic)) != 0
+			|| h->version != DAT_VERSION || h->buckets == 0
+			|| (h->buckets & (h->buckets - 1)) != 0
+			|| h->buckets <= h->entries || need != (uint64_t) st.st_size) {
+		munmap(map, st.st_size);
+		return STAT_ERROR;
+	}
+
+	db->map = map;
+	db->length = st.st_size;
+	db->header = h;
+	db->buckets = (const uint32_t*) (db->map + sizeof(*h));
+	db->entries = (const dat_entry_t*) (db->buckets + h->buckets);
+	db->names = (const char*) (db->entries + h->entries);
+
+	return STAT_OK;
+}
+
+void gbs_dat_close(gbs_dat_t* db) {
+	if (db->map != NULL)
+		munmap((void*) db->map, db->length);
+	memset(db, 0, sizeof(*db));
+}
+
+/* the entry with the dump's CRC32 and size, if every other digest both
+ * sides have agrees. NULL if the DAT doesn't know it. */
+const dat_entry_t* gbs_dat_lookup(const gbs_dat_t* db,
+		const gbs_hash_t* hash) {
+	const dat_entry_t* e;
+	uint32_t i, mask = db->header->buckets - 1;
+
+	if (!(hash->want & HASH_CRC32))
+		return NULL;
+	for (i = hash->crc32 & mask; db->buckets[i] != 0; i = (i + 1) & mask) {
+		if (db->buckets[i] > db->header->entries)
+			break;
+		e = &db->entries[db->buckets[i] - 1];
+		if (e->crc32 != hash->crc32 || e->size != hash->bytes
+				|| e->name >= db->header->names)
+			continue;
+		if ((e->have & hash->want & HASH_MD5)
+				&& memcmp(e->md5, hash->md5, 16) != 0)
+			continue;
+		if ((e->have & hash->want & HASH_SHA1)
+				&& memcmp(e->sha1, hash->sha1, 20) != 0)
+			continue;
+		return e;
+	}
+
+	return NULL;
+}
+
+const char* gbs_dat_name(const gbs_dat_t* db, const dat_entry_t* entry) {
+	return db->names + entry->name;
+}
+
+const char* gbs_dat_file(const gbs_dat_t* db, const dat_entry_t* entry) {
+	return db->names + entry->name + strlen(db->names + entry->name) + 1;
+}
@@ -0,0 +1,71 @@
+/*
+============================================================================
+Name        : dat.h
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Indexed ROM database, compiled from No-Intro style DATs
+============================================================================
+*/
+
+#ifndef __DAT_H
+#define __DAT_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "hash.h"
+
+#define DAT_MAGIC		"GBSDATIX"
+#define DAT_VERSION		1
+
+/* Types */
+/*********/
+
+/* The index file, mapped as it is: a header, a table of buckets, the
+ * entries and their names. Buckets hold an entry number plus one, 0 for
+ * empty, at crc32 modulo their count and the next ones (linear probing).
+ * There are at least twice as many buckets as entries. Host byte order. */
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t entries;
+	uint32_t buckets;		/* a power of two */
+	uint32_t names;			/* bytes of names */
+} dat_header_t;
+
+typedef struct
+{
+	uint32_t crc32;
+	uint32_t size;
+	uint8_t md5[16];
+	uint8_t sha1[20];
+	uint8_t have;			/* HASH_* the DAT gave */
+	uint8_t pad[3];
+	uint32_t name;			/* offset in the names, game then file name */
+} dat_entry_t;
+
+/* an open index */
+typedef struct
+{
+	const uint8_t* map;
+	size_t length;
+	const dat_header_t* header;
+	const uint32_t* buckets;
+	const dat_entry_t* entries;
+	const char* names;
+} gbs_dat_t;
+
+/* function prototypes */
+/***********************/
+int32_t gbs_dat_compile(const char* dat, const char* index);
+uint16_t gbs_dat_open(gbs_dat_t* db, const char* index);
+void gbs_dat_close(gbs_dat_t* db);
+const dat_entry_t* gbs_dat_lookup(const gbs_dat_t* db,
+		const gbs_hash_t* hash);
+const char* gbs_dat_name(const gbs_dat_t* db, const dat_entry_t* entry);
+const char* gbs_dat_file(const gbs_dat_t* db, const dat_entry_t* entry);
+
+#endif
@@ -9,18 +9,115 @@ Description : Ladecadence.net GameBoy FlashCart interface
 */
 
 
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "flashcart.h"
 #include "communications.h"
+#include "context.h"
 #include "gbshooper.h"
+#include "remote.h"
+#include "ring.h"
+#include "rle.h"
 
+#define HEADER_END		0x150		/* the cart header ends here */
+
+#define SINK_SLOTS		16			/* blocks a read keeps ahead of the disk */
+
+/* the file end of a pipelined read */
+typedef struct
+{
+	thread_args_t* args;
+	FILE* f;
+	gbs_ring_t ring;		/* verified blocks, in order */
+	uint16_t block_size;
+	uint32_t skip;
+	pthread_t thread;
+} gbs_sink_t;
+
+/* robust reads */
+#define ROBUST_READS_MAX	16		/* extra reads of a block, at most */
+#define ROBUST_LINK		0x01		/* the block failed the link check */
+#define ROBUST_NO_CRC	0x02		/* the flasher's second read of it too */
+
+/* the versions of a block a robust read has seen, by CRC-32, and how many
+ * reads gave each */
+typedef struct
+{
+	uint32_t crc[ROBUST_READS_MAX + 2];
+	uint8_t votes[ROBUST_READS_MAX + 2];
+	int8_t copy[ROBUST_READS_MAX + 2];	/* a read that gave it, -1 if none */
+	uint8_t count;
+	uint8_t total;
+} gbs_ballot_t;
+
+/* a robust read of the blocks from base on */
+typedef struct
+{
+	thread_args_t* args;
+	uint8_t read_cmd;
+	uint8_t crc_cmd;		/* 0 if the flasher can't send CRCs */
+	uint8_t reads;			/* extra reads of a bad block, at most */
+	uint32_t base;
+	uint32_t bank_size;
+	uint32_t chunks;
+	uint8_t* image;			/* what the blocks are believed to hold */
+	uint32_t* crc;			/* of each block as first read */
+	uint32_t* dev;			/* of each block as the flasher read it again */
+	uint8_t* state;			/* ROBUST_* */
+	uint8_t* copies;		/* the reads of the block being voted on */
+} gbs_robust_t;
+
+#define PREP_SLOTS		8			/* blocks a write prepares ahead */
+#define SRC_POLL_MS		100			/* a stalled pipe checks for a cancel */
+#define ERASE_POLL_MIN_NS	5000000ULL		/* erase status polls, at the end */
+#define ERASE_POLL_MAX_NS	100000000ULL	/* and while far from it */
+#define ERASE_LOG_LAST	8			/* logged erases the expected time is from */
+typedef struct
+{
+	FILE* f;
+	uint32_t size;			/* bytes to send */
+	uint32_t pos;			/* bytes taken so far */
+	uint8_t seekable;
+	uint8_t head[HEADER_END];	/* read ahead from a pipe for its header */
+	uint32_t head_len;
+	thread_args_t* args;
+	_Atomic uint8_t closed;	/* nobody wants more, see gbs_prep_stop() */
+} gbs_src_t;
+
+/* a write block, ready to go on the wire */
+typedef struct
+{
+	uint32_t pos;			/* in the flash */
+	uint16_t len;			/* bytes of wire */
+	uint8_t check;
+	uint8_t wire[BLOCK_MAX + 1];	/* block, or RLE format byte and block */
+} gbs_frame_t;
+
+/* the file end of a write: reads, sums and frames blocks ahead of the
+ * link, on its own thread unless args->sequential */
+typedef struct
+{
+	thread_args_t* args;
+	gbs_src_t* src;
+	uint16_t block_size;
+	uint8_t prg_cmd;
+	uint8_t skip;			/* leave args->skip banks and blank blocks */
+	uint32_t pos;			/* next block to look at */
+	uint8_t short_read;		/* the source ended before its size */
+	gbs_ring_t ring;		/* of gbs_frame_t */
+	pthread_t thread;
+	gbs_frame_t one;		/* the frame when sequential */
+} gbs_prep_t;
 
 /* flash chip producers */
-desc_t producers[] = {
+static const desc_t producers[] = {
 	{0x01, "AMD"}, {0x02, "AMI"}, {0xe5, "Analog Devices"},
 	{0x1f, "Atmel"}, {0x31, "Catalyst"}, {0x34, "Cypress"},
 	{0x04, "Fujitsu"}, {0xE0, "Goldstar"}, {0x07, "Hitachi"},
@@ -33,13 +130,25 @@ desc_t producers[] = {
 	{0x19, "Xicor"}, {0xc9, "Xilinx"}
 };
 
-/* flash chip ids */
-desc_t chip_ids[] = {
-	{0xA4, "29F040B"}, {0xAD, "AM29F016"}
+/* flash chip ids, the fastest way we know to program them and how long
+ * they may take at worst */
+static const chip_desc_t chip_ids[] = {
+	{0x01, 0xA4, "29F040B", PRG_GENERIC, 0, 300, 8, 64},
+	{0x01, 0xAD, "AM29F016", PRG_UNLOCK_BYPASS, 0, 300, 25, 256},
+	{0x01, 0xD5, "AM29F080", PRG_UNLOCK_BYPASS, 0, 300, 16, 128},
+	{0x04, 0xAD, "MBM29F016", PRG_GENERIC, 0, 300, 25, 256},
+	{0x01, 0x7E, "S29GL032", PRG_WRITE_BUFFER, 32, 200, 32, 128},
+	{0xC2, 0x7E, "MX29GL032", PRG_WRITE_BUFFER, 32, 200, 25, 50}
+};
+
+/* program algorithms */
+static const desc_t prg_modes[] = {
+	{PRG_AUTO, "auto"}, {PRG_GENERIC, "generic"},
+	{PRG_UNLOCK_BYPASS, "unlock bypass"}, {PRG_WRITE_BUFFER, "write buffer"}
 };
 
 /* array of cart types - source GB CPU Manual */
-desc_t carts[] = {
+static const desc_t carts[] = {
 	{0x00, "ROM ONLY"}, {0x01, "ROM+MBC1"},
 	{0x02, "ROM+MBC1+RAM"}, {0x03, "ROM+MBC1+RAM+BATT"},
 	{0x05, "ROM+MBC2"}, {0x06, "ROM+MBC2+BATTERY"},
@@ -56,7 +165,7 @@ desc_t carts[] = {
 };
 
 /* rom sizes */
-desc_t rom_sizes[] = {
+static const desc_t rom_sizes[] = {
 	{0x00, "32KB", S_32K}, {0x01, "64KB", S_64K}, {0x02, "128KB", S_128K}, 
 	{0x03, "256KB", S_256K}, {0x04, "512KB", S_512K}, {0x05, "1MB", S_1MB}, 
 	{0x06, "2MB", S_2MB}, {0x07, "4MB", S_4MB}, {0x52, "1.1MB", S_1_1MB}, 
@@ -64,79 +173,219 @@ desc_t rom_sizes[] = {
 };
 
 /* ram sizes */
-desc_t ram_sizes[] = {
-	{0x00, "0KB", S_0K}, {0x01, "2KB", S_2K}, {0x02, "8KB", S_2K}, 
+static const desc_t ram_sizes[] = {
+	{0x00, "0KB", S_0K}, {0x01, "2KB", S_2K}, {0x02, "8KB", S_8K}, 
 	{0x03, "32KB", S_32K}, 	{0x04, "128KB", S_128K}
 };
 
 
-uint16_t gbs_status(status_t* status) {
-	struct ftdi_context ftdic;
-	uint16_t err;
-	packet_t packet0, packet1, packet2, packet3;	/* packets */
+static uint8_t gbs_fw_at_least(conn_t* conn, uint8_t mayor, uint8_t minor) {
+	return conn->fw_mayor > mayor
+		|| (conn->fw_mayor == mayor && conn->fw_minor >= minor);
+}
+
+/* moves the link to framed packets if both ends speak them and the
+ * context allows it, see gbs_ctx_set_proto(). The flasher answers in the
+ * old protocol and switches after; if it doesn't agree, nothing changes. */
+static uint16_t gbs_negotiate_proto(conn_t* conn) {
+	packet_t packet0, packet1;
+
+	if (conn->proto == PROTO_V2 || conn->ctx->proto == PROTO_LEGACY
+			|| !gbs_fw_at_least(conn, FW_PROTO_MAYOR, FW_PROTO_MINOR))
+		return STAT_OK;
 
-	if (gbs_open_ftdi(&ftdic)==STAT_ERROR) {
+	packet0.type = TYPE_COMMAND;
+	packet0.data = CMD_PROTO;
+	gbs_send_packet(conn, &packet0);
+	packet0.type = TYPE_DATA;
+	packet0.data = PROTO_V2;
+	gbs_send_packet(conn, &packet0);
+	if (gbs_receive_packet(conn, &packet1, RTO_CMD) != STAT_OK)
 		return STAT_ERROR;
-	}
+	if (packet1.data == STAT_OK)
+		gbs_set_proto(conn, PROTO_V2);
+
+	return STAT_OK;
+}
+
+/* TYPE_INFO exchange on an open link. A non-zero block code also asks the
+ * flasher for that transfer block size for the rest of the session. */
+static uint16_t gbs_info(conn_t* conn, status_t* status, uint8_t block) {
+	packet_t packet0, packet1, packet2, packet3;	/* packets */
 
 	/* pedimos la información */
-	ftdi_usb_purge_rx_buffer(&ftdic);
+	gbs_purge_rx(conn);
 	/* preparamos el paquete */
 	packet0.type = TYPE_INFO;
-	packet0.data = 0x00;
+	packet0.data = block;
 	/* lo enviamos */
-	gbs_send_packet(&ftdic, &packet0);
+	gbs_send_packet(conn, &packet0);
 	
 	/* leemos la respuesta */
-	err = gbs_receive_packet(&ftdic, &packet1, SLEEPTIME);
-	if (err != STAT_OK)
+	if (gbs_receive_packet(conn, &packet1, RTO_CMD) != STAT_OK)
 			return STAT_ERROR;
-	gbs_receive_packet(&ftdic, &packet2, SLEEPTIME);
-	if (err != STAT_OK)
+	if (gbs_receive_packet(conn, &packet2, RTO_CMD) != STAT_OK)
 			return STAT_ERROR;
-
-	gbs_receive_packet(&ftdic, &packet3, SLEEPTIME);
-	if (err != STAT_OK)
+	if (gbs_receive_packet(conn, &packet3, RTO_CMD) != STAT_OK)
 			return STAT_ERROR;
 
 	if (packet1.data != GBS_ID) {
 		printf("%d\n", packet1.data);
-		gbs_close_ftdi(&ftdic);
 		return STAT_ERROR;
 	}
 
-	status->version_mayor = packet2.data;
-	status->version_minor = packet3.data;
+	status->version_mayor = conn->fw_mayor = packet2.data;
+	status->version_minor = conn->fw_minor = packet3.data;
 
-	gbs_close_ftdi(&ftdic);
-	return STAT_OK;
+	/* older firmware doesn't answer block requests */
+	if (block == BLOCK_256 
+			|| !gbs_fw_at_least(conn, FW_BLOCK_MAYOR, FW_BLOCK_MINOR))
+		return gbs_negotiate_proto(conn);
+
+	/* granted block size */
+	if (gbs_receive_packet(conn, &packet1, RTO_CMD) != STAT_OK)
+		return STAT_ERROR;
+	switch (packet1.data) {
+		case BLOCK_256:
+		case BLOCK_512:
+		case BLOCK_1K:
+		case BLOCK_4K:
+			if (packet1.data <= block)
+				conn->block_size = BUFFER_SIZE << packet1.data;
+			break;
+		default:
+			break;
+	}
 
+	return gbs_negotiate_proto(conn);
 }
 
-uint16_t gbs_flash_id(flash_id_t* id) {
+/* negotiates the largest transfer block that fits in max bytes, keeping
+ * BUFFER_SIZE blocks when the flasher can't do better. Always sent, so the
+ * flasher drops whatever size a previous session left behind. */
+static void gbs_negotiate_block(conn_t* conn, uint32_t max) {
+	status_t status;
+	uint8_t block = BLOCK_4K;
 
-	struct ftdi_context ftdic;
-	packet_t packet0, packet1, packet2;	/* packets */
-	char str[30];
-	uint16_t i;
-	uint16_t producers_count = sizeof producers / sizeof producers[0];
-	uint16_t ids_count = sizeof chip_ids / sizeof chip_ids[0];
-	uint16_t info_prod_ok, info_chip_ok = STAT_ERROR;
+	if (max == 0 || max > BLOCK_MAX)
+		max = BLOCK_MAX;
+	while (block != BLOCK_256 && (BUFFER_SIZE << block) > max)
+		block = (block == BLOCK_4K) ? BLOCK_1K : block - 1;
+
+	gbs_info(conn, &status, block);
+}
+
+uint16_t gbs_status(gbs_ctx_t* ctx, status_t* status) {
+	conn_t conn;
+	uint16_t err;
 
-	if (gbs_open_ftdi(&ftdic)==STAT_ERROR) {
+	if (ctx->server != NULL)
+		return gbs_remote_status(ctx, status);
+	if (gbs_open(ctx, &conn)==STAT_ERROR) {
 		return STAT_ERROR;
 	}
 
+	err = gbs_info(&conn, status, BLOCK_256);
+
+	gbs_close(&conn);
+	return err;
+
+}
+
+const char* gbs_prg_mode_name(uint8_t mode) {
+	uint16_t i;
+	uint16_t modes_count = sizeof prg_modes / sizeof prg_modes[0];
+
+	for (i = 0; i < modes_count; i++)
+		if (mode == prg_modes[i].index)
+			return prg_modes[i].name;
+
+	return "unknown";
+}
+
+/* ROM size a header size code (0x148) stands for, 0 if unknown */
+uint32_t gbs_rom_bytes(uint8_t code) {
+	uint16_t i;
+	uint16_t rom_sizes_count = sizeof rom_sizes / sizeof rom_sizes[0];
+
+	for (i = 0; i < rom_sizes_count; i++)
+		if (code == rom_sizes[i].index)
+			return rom_sizes[i].size;
+
+	return 0;
+}
+
+static const chip_desc_t* gbs_find_chip(uint8_t manufacturer_id, 
+		uint8_t chip_id) {
+	uint16_t i;
+	uint16_t ids_count = sizeof chip_ids / sizeof chip_ids[0];
+
+	for (i = 0; i < ids_count; i++)
+		if (manufacturer_id == chip_ids[i].manufacturer_id
+				&& chip_id == chip_ids[i].chip_id)
+			return &chip_ids[i];
+
+	return NULL;
+}
+
+/* asks the flasher for the manufacturer and chip IDs on an open link */
+static uint16_t gbs_query_id(conn_t* conn, packet_t* manufacturer, 
+		packet_t* chip) {
+	packet_t packet0;
+
 	/* pedimos la información */
 	/* preparamos el paquete */
 	packet0.type = TYPE_COMMAND;
 	packet0.data = CMD_ID;
 	/* lo enviamos */
-	gbs_send_packet(&ftdic, &packet0);
+	gbs_send_packet(conn, &packet0);
 
 	/* leemos la respuesta */
-	gbs_receive_packet(&ftdic, &packet1, SLEEPTIME);
-	gbs_receive_packet(&ftdic, &packet2, SLEEPTIME);
+	if (gbs_receive_packet(conn, manufacturer, RTO_CMD) != STAT_OK)
+		return STAT_ERROR;
+	if (gbs_receive_packet(conn, chip, RTO_CMD) != STAT_OK)
+		return STAT_ERROR;
+
+	return STAT_OK;
+}
+
+/* gbs_query_id(), and the chip's worst case timings for the link's
+ * program and erase timeouts. NULL if we don't know the chip. */
+static const chip_desc_t* gbs_identify(conn_t* conn, packet_t* manufacturer,
+		packet_t* chip) {
+	const chip_desc_t* desc;
+
+	if (gbs_query_id(conn, manufacturer, chip) != STAT_OK)
+		return NULL;
+	desc = gbs_find_chip(manufacturer->data, chip->data);
+	if (desc == NULL)
+		gbs_rto_chip(conn, manufacturer->data << 8 | chip->data, 0, 0);
+	else
+		gbs_rto_chip(conn, manufacturer->data << 8 | chip->data,
+				desc->t_byte_max_us * 1000ULL,
+				desc->t_erase_max_s * 1000000000ULL);
+
+	return desc;
+}
+
+uint16_t gbs_flash_id(gbs_ctx_t* ctx, flash_id_t* id) {
+
+	conn_t conn;
+	packet_t packet1, packet2;	/* packets */
+	char str[30];
+	uint16_t i;
+	uint16_t producers_count = sizeof producers / sizeof producers[0];
+	uint16_t info_prod_ok, info_chip_ok = STAT_ERROR;
+	const chip_desc_t* chip;
+
+	if (ctx->server != NULL)
+		return gbs_remote_id(ctx, id);
+	if (gbs_open(ctx, &conn)==STAT_ERROR) {
+		return STAT_ERROR;
+	}
+
+	packet1.data = packet2.data = 0x00;
+	chip = gbs_identify(&conn, &packet1, &packet2);
 
 	i=0;
 
@@ -151,31 +400,83 @@ uint16_t gbs_flash_id(flash_id_t* id) {
 			snprintf(str, 30, "Unknown manufacturer: 0x%.2X", packet1.data);
 	id->manufacturer = strdup(str);
 
+	id->prg_mode = PRG_GENERIC;
+	id->wbuf_size = 0;
 	strcpy (str,"");
-	for (i = 0; i < ids_count; i++)
-		if (packet2.data == chip_ids[i].index) {
-			strcpy (str, chip_ids[i].name);
-			id->chip_id = packet2.data;
-			info_chip_ok = STAT_OK;
-		}
+	if (chip != NULL) {
+		strcpy (str, chip->name);
+		id->chip_id = packet2.data;
+		id->prg_mode = chip->prg_mode;
+		id->wbuf_size = chip->wbuf_size;
+		info_chip_ok = STAT_OK;
+	}
 	if (strncmp(str, "", 30) == 0)
 		snprintf(str, 30, "Unknown flash ID: 0x%.2X", packet2.data);
 	id->chip = strdup(str);
 
 	if ((info_prod_ok==STAT_OK) && (info_chip_ok==STAT_OK)) {
-		gbs_close_ftdi(&ftdic);
+		gbs_close(&conn);
 		return STAT_OK;
 	}
 	else {
-		gbs_close_ftdi(&ftdic);
+		gbs_close(&conn);
 		return STAT_ERROR;
 	}
 
-	gbs_close_ftdi(&ftdic);
+	gbs_close(&conn);
+}
+
+/* tells the flasher the program algorithm, with the write buffer size
+ * gbs_select_prg_mode() found. Firmware older than FW_PRG_MODE only knows
+ * the generic one, as does a flasher refusing it. Returns the algorithm
+ * the flasher will use. */
+static uint8_t gbs_send_prg_mode(conn_t* conn, uint8_t mode) {
+	packet_t packet0, packet1;
+
+	if (mode == PRG_GENERIC || mode == PRG_AUTO
+			|| !gbs_fw_at_least(conn, FW_PRG_MODE_MAYOR, FW_PRG_MODE_MINOR))
+		return PRG_GENERIC;
+
+	packet0.type = TYPE_COMMAND;
+	packet0.data = CMD_PRG_MODE;
+	gbs_send_packet(conn, &packet0);
+	packet0.type = TYPE_DATA;
+	packet0.data = mode;
+	gbs_send_packet(conn, &packet0);
+	packet0.data = conn->wbuf_size;
+	gbs_send_packet(conn, &packet0);
+
+	if (gbs_receive_packet(conn, &packet1, RTO_CMD) != STAT_OK
+			|| packet1.data != STAT_OK)
+		return PRG_GENERIC;
+
+	return mode;
+}
+
+/* picks the program algorithm for this session from the flash ID and tells
+ * the flasher about it. Anything the chip or firmware can't do falls back to
+ * the generic per-byte sequence. The firmware version must be known, ask
+ * for it (gbs_info()) first. */
+static uint8_t gbs_select_prg_mode(conn_t* conn, uint8_t mode) {
+	packet_t packet1, packet2;
+	const chip_desc_t* chip = NULL;
+
+	/* the ID also sets the program timeouts, so it is asked for always */
+	chip = gbs_identify(conn, &packet1, &packet2);
+	conn->wbuf_size = 0;
+	if (mode == PRG_GENERIC || chip == NULL)
+		return PRG_GENERIC;
+
+	if (mode == PRG_AUTO)
+		mode = chip->prg_mode;
+	if (mode == PRG_WRITE_BUFFER)
+		conn->wbuf_size = chip->wbuf_size;
+
+	return gbs_send_prg_mode(conn, mode);
 }
 
-uint16_t gbs_read_header(rom_header_t* header) {
-	struct ftdi_context ftdic;
+uint16_t gbs_read_header(gbs_ctx_t* ctx, rom_header_t* header) {
+	conn_t conn;
 	packet_t packet0, packet1, packet2, packet3, packet4;	/* packets */
 	char str[30];
 	uint16_t i;
@@ -184,10 +485,13 @@ uint16_t gbs_read_header(rom_header_t* header) {
 	uint16_t ram_sizes_count = sizeof ram_sizes / sizeof ram_sizes[0];
 	uint16_t header_cart_ok = STAT_ERROR, 
 			 header_rom_ok = STAT_ERROR, 
-			 header_ram_ok = STAT_ERROR;
+			 header_ram_ok = STAT_ERROR,
+			 header_rx_ok = STAT_OK;
 	char title[17];
 
-	if (gbs_open_ftdi(&ftdic)==STAT_ERROR) {
+	if (ctx->server != NULL)
+		return gbs_remote_header(ctx, header);
+	if (gbs_open(ctx, &conn)==STAT_ERROR) {
 		return STAT_ERROR;
 	}
 
@@ -196,20 +500,28 @@ uint16_t gbs_read_header(rom_header_t* header) {
 	packet0.type = TYPE_COMMAND;
 	packet0.data = CMD_READ_HEADER;
 	/* lo enviamos */
-	gbs_send_packet(&ftdic, &packet0);
+	gbs_send_packet(&conn, &packet0);
 
 	/* leemos la respuesta */
 	/* pkt1 = mapper, pkt2 = rom size, pkt3 = ram_size */
-	gbs_receive_packet(&ftdic, &packet1, SLEEPTIME);
-	gbs_receive_packet(&ftdic, &packet2, SLEEPTIME);
-	gbs_receive_packet(&ftdic, &packet3, SLEEPTIME);
+	/* un paquete perdido no vale como cabecera, se mira el hardware */
+	packet1.data = packet2.data = packet3.data = 0;
+	if (gbs_receive_packet(&conn, &packet1, RTO_READ) != STAT_OK
+			|| gbs_receive_packet(&conn, &packet2, RTO_READ) != STAT_OK
+			|| gbs_receive_packet(&conn, &packet3, RTO_READ) != STAT_OK)
+		header_rx_ok = STAT_ERROR;
 
 	/* receive name */
 	for (i=0; i<16; i++)
 	{
-		gbs_receive_packet(&ftdic, &packet4, SLEEPTIME);
+		if (header_rx_ok != STAT_OK
+				|| gbs_receive_packet(&conn, &packet4, RTO_READ) != STAT_OK) {
+			header_rx_ok = STAT_ERROR;
+			packet4.data = '\0';
+		}
 		title[i] = packet4.data;
 	}
+	title[16] = '\0';
 
 	header->title = strdup(title);
 
@@ -248,15 +560,15 @@ uint16_t gbs_read_header(rom_header_t* header) {
 
 	/* valores correctos ? */
 	if ((header_cart_ok==STAT_OK) && (header_rom_ok==STAT_OK) 
-			&& (header_ram_ok==STAT_OK)) {
-		gbs_close_ftdi(&ftdic);
+			&& (header_ram_ok==STAT_OK) && (header_rx_ok==STAT_OK)) {
+		gbs_close(&conn);
 		return STAT_OK;
 	}
 	else {
-		gbs_close_ftdi(&ftdic);
+		gbs_close(&conn);
 		// hardware ok?
 		status_t s;
-		if (gbs_status(&s) == STAT_OK)
+		if (gbs_status(ctx, &s) == STAT_OK)
 		{
 			//name can be garbage, add null at the end
 			title[15] = '\0';
@@ -266,347 +578,1406 @@ uint16_t gbs_read_header(rom_header_t* header) {
 			return STAT_ERROR;
 	}
 
-	gbs_close_ftdi(&ftdic);
+	gbs_close(&conn);
 }
 
+/* looks into the slot as cheaply as the flasher allows: the header, and
+ * the flash ID only when the header reads blank, so an erased flash cart
+ * is seen too. With nothing in the slot the bus reads 0xFF. STAT_ERROR
+ * only if the flasher didn't answer. */
+uint16_t gbs_probe_cart(gbs_ctx_t* ctx, gbs_probe_t* probe) {
+	conn_t conn;
+	packet_t packet0, packet1, packet2;
+	uint16_t i;
+	uint16_t carts_count = sizeof carts / sizeof carts[0];
+	uint16_t ram_sizes_count = sizeof ram_sizes / sizeof ram_sizes[0];
+	uint8_t cart_ok = 0, ram_ok = 0, title_ok = 0;
 
-void* gbs_erase_flash (void* ptr) {
-
-	struct ftdi_context ftdic;
-	packet_t packet0, packet1;	/* packets */
-	thread_args_t* args;
-
-	args = (thread_args_t*) ptr;
-	args->stat = T_RUNNING;
-
-	if (gbs_open_ftdi(&ftdic)==STAT_ERROR) {
-		args->ret = STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
-	}
+	if (ctx->server != NULL)
+		return gbs_remote_probe(ctx, probe);
+	memset(probe, 0, sizeof(*probe));
+	if (gbs_open(ctx, &conn) == STAT_ERROR)
+		return STAT_ERROR;
 
-	/* enviamos el comando */
-	/* preparamos el paquete */
 	packet0.type = TYPE_COMMAND;
-	packet0.data = CMD_ERASE_FLASH;
-	/* lo enviamos */
-	gbs_send_packet(&ftdic, &packet0);
-	/* leemos la respuesta */
-	if (gbs_receive_packet(&ftdic, &packet1, ERASETIME) == STAT_TIMEOUT) {
-		gbs_close_ftdi(&ftdic);
-		args->ret = STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
+	packet0.data = CMD_READ_HEADER;
+	gbs_send_packet(&conn, &packet0);
+	for (i = 0; i < sizeof probe->header; i++) {
+		if (gbs_receive_packet(&conn, &packet1, RTO_READ) != STAT_OK) {
+			gbs_close(&conn);
+			return STAT_ERROR;
+		}
+		probe->header[i] = packet1.data;
 	}
-	if (packet1.data == STAT_OK) {
-		gbs_close_ftdi(&ftdic);
-		args->ret = STAT_OK;
-		args->stat = T_END;
-		return NULL;
+
+	for (i = 0; i < carts_count; i++)
+		if (probe->header[0] == carts[i].index)
+			cart_ok = 1;
+	for (i = 0; i < ram_sizes_count; i++)
+		if (probe->header[2] == ram_sizes[i].index)
+			ram_ok = 1;
+	for (i = 3; i < sizeof probe->header; i++)
+		if (probe->header[i] != 0x00 && probe->header[i] != 0xFF)
+			title_ok = 1;
+	probe->present = cart_ok && ram_ok && title_ok
+		&& gbs_rom_bytes(probe->header[1]);
+
+	if (!probe->present) {
+		memset(probe->header, 0, sizeof probe->header);
+		if (gbs_query_id(&conn, &packet1, &packet2) != STAT_OK) {
+			gbs_close(&conn);
+			return STAT_ERROR;
+		}
+		probe->present = gbs_find_chip(packet1.data, packet2.data) != NULL;
+		if (probe->present) {
+			probe->manufacturer_id = packet1.data;
+			probe->chip_id = packet2.data;
+		}
 	}
-	gbs_close_ftdi(&ftdic);
-	
-	args->ret = STAT_ERROR;
-	args->stat = T_END;
-	return NULL;
+	gbs_close(&conn);
+
+	return STAT_OK;
 }
 
-void* gbs_write_flash(void* ptr) {	
-	struct ftdi_context ftdic;
-	uint8_t buffer[BUFFER_SIZE];		/* buffer de envio/recepción */
-	packet_t packet0, packet1;			/* packets */
-	uint16_t stat, i;
-	uint8_t check;
-	FILE* r00m;
-	uint64_t fsize;
-	uint32_t chunk_counter;
-	thread_args_t* args;
 
-	args = (thread_args_t*) ptr;
-	args->stat = T_RUNNING;
+void gbs_args_init(thread_args_t* args, gbs_ctx_t* ctx) {
+	pthread_condattr_t attr;
 
-	if ((r00m = fopen(args->file, "rb")) == NULL) {
-		args->ret = STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
-	}
+	args->ctx = ctx;
+	args->fd = -1;
+	args->stat = T_RUNNING;
+	atomic_init(&args->cancel, 0);
+	args->done_bytes = 0;
+	args->total_bytes = 0;
+	memset(&args->stats, 0, sizeof(args->stats));
+	args->report = NULL;
+	args->report_banks = 0;
+	pthread_mutex_init(&args->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&args->done, &attr);
+	pthread_condattr_destroy(&attr);
+}
 
-	/* get file size in bytes */
-	fseek(r00m, 0L, SEEK_END);
-	fsize = ftell(r00m);
-	/* back to start again */
-	fseek(r00m, 0L, SEEK_SET);
-	printf("ROM size: %ld bytes\n", fsize);	
+void gbs_args_destroy(thread_args_t* args) {
+	free(args->report);
+	args->report = NULL;
+	pthread_cond_destroy(&args->done);
+	pthread_mutex_destroy(&args->lock);
+}
 
-	if (gbs_open_ftdi(&ftdic)==STAT_ERROR) {
-		args->ret = STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
+/* waits up to timeout_ms for the operation to end, returns its T_ state */
+uint8_t gbs_wait(thread_args_t* args, uint32_t timeout_ms) {
+	struct timespec ts;
+	uint8_t stat;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
 	}
 
+	pthread_mutex_lock(&args->lock);
+	while (args->stat != T_END)
+		if (pthread_cond_timedwait(&args->done, &args->lock, &ts) != 0)
+			break;
+	stat = args->stat;
+	pthread_mutex_unlock(&args->lock);
 
-	/* comenzamos a grabar */
-	chunk_counter = 0;
-	packet0.type = TYPE_COMMAND;
-	packet0.data = CMD_PRG_FLASH;
-	gbs_send_packet(&ftdic, &packet0);
+	return stat;
+}
 
-	stat = gbs_receive_packet(&ftdic, &packet1, SLEEPTIME);
-	if (stat == STAT_TIMEOUT) {
-		packet0.type = TYPE_COMMAND;
-		packet0.data = CMD_END;
-		gbs_send_packet(&ftdic, &packet0);
-		fclose(r00m);
-		gbs_close_ftdi(&ftdic);
-		args->ret = STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
-	}
-	if (packet1.data == STAT_OK) {
-		while (!feof(r00m)) {
-			/* calculate percentage */
-			args->progress = (100*chunk_counter*BUFFER_SIZE)/fsize;
+/* completed fraction for progress bars, 0 while the length is unknown */
+double gbs_fraction(thread_args_t* args) {
+	uint32_t total = atomic_load(&args->total_bytes);
 
-			/* leemos un bloque de bytes */
-			stat = fread(&buffer, sizeof(uint8_t), BUFFER_SIZE, r00m);
-			check = 0;
-			/* calculamos la comprobación */
-			for (i=0; i<BUFFER_SIZE; i++) {
-				check+=buffer[i];
-			}
-			/* lo enviamos */
-			gbs_send_buffer(&ftdic, (uint8_t*)&buffer);
+	if (total == 0)
+		return 0;
+	return (double) atomic_load_explicit(&args->done_bytes,
+			memory_order_relaxed) / total;
+}
 
-			/* recibimos la comprobación */
-			gbs_receive_packet(&ftdic, &packet1, SLEEPTIME);
-			if (packet1.data != check) {	/* bad check */
-				/* paramos */
-				packet0.type = TYPE_COMMAND;
-				packet0.data = CMD_END;
-				gbs_send_packet(&ftdic, &packet0);
-				fclose(r00m);
-				gbs_close_ftdi(&ftdic);
-				args->ret = STAT_ERROR;
-				args->stat = T_END;
-				return NULL;
-			}
+/* asks the operation to stop. Transfers check between blocks, end the
+ * flasher's command and finish with STAT_CANCELLED. Safe to call from any
+ * thread or from a signal handler. */
+void gbs_cancel(thread_args_t* args) {
+	atomic_store(&args->cancel, 1);
+}
 
-			/* more bytes to transfer? */
-			stat = getc(r00m);
-			if (!feof(r00m)) {
-				fseek(r00m, -1, SEEK_CUR);
-				/* seguimos grabando (si no hemos terminado ya) */
-				packet0.type = TYPE_COMMAND;
-				packet0.data = CMD_PRG_FLASH;
-				gbs_send_packet(&ftdic, &packet0);
-				chunk_counter++;
-			}
-			else 
-				break;
-			
-		}
+uint8_t gbs_cancelled(thread_args_t* args) {
+	return atomic_load(&args->cancel);
+}
 
-	}
-	else {
-		packet0.type = TYPE_COMMAND;
-		packet0.data = CMD_END;
-		gbs_send_packet(&ftdic, &packet0);
-		fclose(r00m);
-		gbs_close_ftdi(&ftdic);
-		args->ret=STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
-	}
+void gbs_start(thread_args_t* args, uint32_t total) {
+	pthread_mutex_lock(&args->lock);
+	args->stat = T_RUNNING;
+	pthread_mutex_unlock(&args->lock);
+	args->timed = 0;
+	free(args->report);
+	args->report = NULL;
+	args->report_banks = 0;
+	atomic_store(&args->total_bytes, total);
+	atomic_store(&args->done_bytes, 0);
+}
 
-	packet0.type = TYPE_COMMAND;
-	packet0.data = CMD_END;
-	gbs_send_packet(&ftdic, &packet0);
+void gbs_progress(thread_args_t* args, uint32_t bytes) {
+	atomic_store_explicit(&args->done_bytes, bytes, memory_order_relaxed);
+	gbs_ctx_notify(args->ctx);
+}
 
-	
-	fclose(r00m);
-	gbs_close_ftdi(&ftdic);
-	args->ret = STAT_OK;
+/* publishes the result and wakes up whoever waits for it */
+void* gbs_finish(thread_args_t* args, uint16_t ret) {
+	if (args->hash != NULL)
+		gbs_hash_stop(args->hash);
+	if (ret == STAT_OK)
+		gbs_progress(args, args->total_bytes);
+	args->stats.bytes = args->timed ? 0 : atomic_load(&args->done_bytes);
+
+	pthread_mutex_lock(&args->lock);
+	args->ret = ret;
 	args->stat = T_END;
-	return NULL;
+	pthread_cond_broadcast(&args->done);
+	pthread_mutex_unlock(&args->lock);
 
+	return NULL;
 }
 
-void* gbs_read_flash(void* ptr) {	
-	struct ftdi_context ftdic;
-	uint8_t buffer[BUFFER_SIZE];		/* buffer de envio/recepción */
-	packet_t packet0, packet1, packet2;	/* packets */
-	uint32_t i, n, chunks;
-	uint8_t check;
-	FILE* r00m;
-	thread_args_t* args;
+/* stops a cancelled operation between blocks. The flasher is waiting for
+ * the next command, CMD_END takes it back to idle. */
+static void* gbs_stop(conn_t* conn, thread_args_t* args, FILE* f) {
+	packet_t packet0;
 
-	args = (thread_args_t*) ptr;
-	args->stat = T_RUNNING;
+	packet0.type = TYPE_COMMAND;
+	packet0.data = CMD_END;
+	gbs_send_packet(conn, &packet0);
+	if (f != NULL)
+		fclose(f);
+	gbs_close(conn);
 
-	if ((r00m = fopen(args->file, "wb")) == NULL) {
-		args->ret=STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
-	}
+	return gbs_finish(args, STAT_CANCELLED);
+}
 
-	if (gbs_open_ftdi(&ftdic)==STAT_ERROR) {
-		args->ret=STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
-	}
+/* makes the next read session start offset bytes into the ROM, or the RAM,
+ * instead of at 0. The host splits it into the mapper bank and the offset
+ * in the bank window. Returns the bytes the caller still has to skip: 0,
+ * or all of them if the flasher can't seek. */
+static uint32_t gbs_seek(conn_t* conn, uint32_t offset, uint32_t bank_size) {
+	packet_t packet0, packet1;
+	uint32_t bank = offset / bank_size;
 
-	/* numero de buffers a leer */
-	chunks = args->size/BUFFER_SIZE;
+	if (offset == 0)
+		return 0;
+	if (!gbs_fw_at_least(conn, FW_SEEK_MAYOR, FW_SEEK_MINOR) || bank > 0xFF)
+		return offset;
 
-	/* comenzamos a recibir */
-	packet0.type  = TYPE_COMMAND;
-	packet0.data = CMD_READ_FLASH;
-	gbs_send_packet(&ftdic, &packet0);
+	packet0.type = TYPE_COMMAND;
+	packet0.data = CMD_SEEK;
+	gbs_send_packet(conn, &packet0);
+	packet0.type = TYPE_DATA;
+	packet0.data = bank;
+	gbs_send_packet(conn, &packet0);
+	packet0.data = (offset % bank_size) >> 8;
+	gbs_send_packet(conn, &packet0);
+	packet0.data = offset % bank_size;
+	gbs_send_packet(conn, &packet0);
+
+	if (gbs_receive_packet(conn, &packet1, RTO_CMD) != STAT_OK
+			|| packet1.data != STAT_OK)
+		return offset;
+
+	return 0;
+}
 
-	for (n=0; n<chunks; n++) {
-		args->progress = n*BUFFER_SIZE*100/args->size;
-		check = 0;
-		/* leemos buffer */
-		for (i=0; i<BUFFER_SIZE; i++) {
-			gbs_receive_byte(&ftdic, &buffer[i], SLEEPTIME);
-		}
-		/* los escribimos en el archivo */
-		fwrite(&buffer, sizeof(uint8_t), BUFFER_SIZE, r00m);
-
-		/* calculamos la suma */
-		for (i=0; i<BUFFER_SIZE; i++)
-			check+=buffer[i];
-
-		/* enviamos la suma */
-		packet2.type  = TYPE_DATA;
-		packet2.data  = check;
-		gbs_send_packet(&ftdic, &packet2);
-		/* respuesta */
-		gbs_receive_packet(&ftdic, &packet1, SLEEPTIME);
-
-		/* fallo en la comprobación? */
-		if (packet1.data == CMD_END) {
-			fclose(r00m);
-			gbs_close_ftdi(&ftdic);
-			args->ret=STAT_ERROR;
-			args->stat = T_END;
-			return NULL;
-		}
+/* writes the part of a block read at stream position pos that falls in
+ * [skip, skip + size), returns the bytes written */
+static uint32_t gbs_write_range(thread_args_t* args, FILE* f,
+		uint8_t* buffer, uint16_t len, uint32_t pos, uint32_t skip,
+		uint32_t size) {
+	uint32_t from = pos < skip ? skip - pos : 0;
+	uint32_t to = len;
+
+	if (pos + to > skip + size)
+		to = skip + size > pos ? skip + size - pos : 0;
+	if (from >= to)
+		return 0;
+
+	if (args->hash != NULL)
+		gbs_hash_feed(args->hash, &buffer[from], to - from);
+	return fwrite(&buffer[from], sizeof(uint8_t), to - from, f);
+}
 
-		/* continuamos */
-		if (n<chunks-1) {
-			packet2.type = TYPE_COMMAND;
-			packet2.data = CMD_READ_FLASH;
-			gbs_send_packet(&ftdic, &packet2);
-		}
+/* first position from pos on that isn't in a skipped bank, size if none */
+static uint32_t gbs_next_bank(thread_args_t* args, uint32_t pos,
+		uint32_t size) {
+	uint32_t bank;
 
-	}
+	for (bank = pos / ROM_BANK_SIZE; bank < args->skip_banks
+			&& args->skip[bank]; bank++)
+		pos = (bank + 1) * ROM_BANK_SIZE;
+
+	return pos < size ? pos : size;
+}
+
+/* ends a program session and starts another at pos, past banks left
+ * erased. CMD_END drops the program algorithm, so the flasher is told it
+ * again. */
+static uint16_t gbs_resume_prg(conn_t* conn, thread_args_t* args,
+		uint8_t prg_cmd, uint32_t pos) {
+	packet_t packet0, packet1;
 
 	packet0.type = TYPE_COMMAND;
 	packet0.data = CMD_END;
-	gbs_send_packet(&ftdic, &packet0);
+	gbs_send_packet(conn, &packet0);
+	/* the algorithm chosen at the start, the chip is still the same */
+	gbs_send_prg_mode(conn, args->prg_mode);
+	if (gbs_seek(conn, pos, ROM_BANK_SIZE) != 0)
+		return STAT_ERROR;
 
+	packet0.type = TYPE_COMMAND;
+	packet0.data = prg_cmd;
+	gbs_send_packet(conn, &packet0);
+	if (gbs_receive_packet(conn, &packet1, RTO_CMD) != STAT_OK
+			|| packet1.data != STAT_OK)
+		return STAT_ERROR;
 
-	fclose(r00m);
-	gbs_close_ftdi(&ftdic);
-	
-	args->ret = STAT_OK;
-	args->stat = T_END;
-	return NULL;
+	return STAT_OK;
 }
 
-void* gbs_write_ram(void* ptr) {	
-	struct ftdi_context ftdic;
-	uint8_t buffer[BUFFER_SIZE];		/* buffer de envio/recepción */
-	packet_t packet0, packet1;			/* packets */
-	uint16_t stat, i;
-	uint8_t check;
-	FILE* r00m;
-	uint64_t fsize;
-	uint32_t chunk_counter;
-	thread_args_t* args;
+/* largest block worth asking for: the caller's limit, but never more than
+ * the data being moved */
+static uint32_t gbs_block_limit(thread_args_t* args, uint64_t size) {
+	uint32_t max = args->block_size ? args->block_size : BLOCK_MAX;
 
-	args = (thread_args_t*) ptr;
-	args->stat = T_RUNNING;
+	return (size < max) ? size : max;
+}
 
+/* opens the operation's file, or streams args->fd (stdin or stdout unless
+ * set) when it is "-". Closing it leaves the descriptor open. */
+static FILE* gbs_fopen(thread_args_t* args, const char* mode) {
+	int fd;
 
-	if ((r00m = fopen(args->file, "rb")) == NULL) {
-		args->ret=STAT_ERROR;
-		args->stat = T_END;
+	if (strcmp(args->file, "-") != 0)
+		return fopen(args->file, mode);
+	fd = args->fd >= 0 ? args->fd
+		: (mode[0] == 'r' ? STDIN_FILENO : STDOUT_FILENO);
+	if ((fd = dup(fd)) < 0)
 		return NULL;
+
+	return fdopen(fd, mode);
+}
+
+/* reads a pipe as the data comes, without blocking: gives up when the
+ * operation is cancelled or the reader is stopped. Returns what came. */
+static uint32_t gbs_src_pipe(gbs_src_t* src, uint8_t* buffer, uint32_t len) {
+	struct pollfd p;
+	uint32_t n = 0;
+	ssize_t got;
+	int ready;
+
+	p.fd = fileno(src->f);
+	p.events = POLLIN;
+	while (n < len && !gbs_cancelled(src->args)
+			&& !atomic_load(&src->closed)) {
+		if ((ready = poll(&p, 1, SRC_POLL_MS)) == 0
+				|| (ready < 0 && errno == EINTR))
+			continue;
+		if (ready < 0)
+			break;
+		if ((got = read(p.fd, &buffer[n], len - n)) < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			break;
+		n += got;
 	}
 
-	/* get file size in bytes */
-	fseek(r00m, 0L, SEEK_END);
-	fsize = ftell(r00m);
-	/* back to start again */
-	fseek(r00m, 0L, SEEK_SET);
-	//printf("RAM size: %ld bytes\n", fsize);
+	return n;
+}
 
+/* Opens what goes to the cart and finds out how big it is: a file's size,
+ * or for a pipe args->size, else what the ROM header in its first bytes
+ * says (rom only). Those are kept in src->head for gbs_src_read(). */
+static uint16_t gbs_src_open(thread_args_t* args, gbs_src_t* src,
+		uint8_t rom) {
+	struct stat st;
+
+	memset(src, 0, sizeof(*src));
+	src->args = args;
+	atomic_init(&src->closed, 0);
+	if ((src->f = gbs_fopen(args, "rb")) == NULL)
+		return STAT_ERROR;
 
-	if (gbs_open_ftdi(&ftdic)==STAT_ERROR) {
-		args->stat = T_END;
-		args->ret=STAT_ERROR;
-		return NULL;
+	if (fstat(fileno(src->f), &st) == 0 && S_ISREG(st.st_mode))
+		src->size = st.st_size;
+	else if (args->size > 0)
+		src->size = args->size;
+	else if (rom) {
+		src->head_len = gbs_src_pipe(src, src->head, sizeof src->head);
+		if (src->head_len == sizeof src->head)
+			src->size = gbs_rom_bytes(src->head[0x148]);
+	}
+	if (src->size == 0) {
+		fclose(src->f);
+		return STAT_ERROR;
 	}
+	src->seekable = S_ISREG(st.st_mode);
 
+	return STAT_OK;
+}
 
-	/* comenzamos a grabar */
-	chunk_counter = 0;
-	packet0.type = TYPE_COMMAND;
-	packet0.data = CMD_PRG_RAM;
-	gbs_send_packet(&ftdic, &packet0);
+/* the next len bytes, never past the size. Returns how many came, fewer
+ * at the end of the data. */
+static uint32_t gbs_src_read(gbs_src_t* src, uint8_t* buffer, uint32_t len) {
+	uint32_t n = 0;
+
+	if (src->pos + len > src->size)
+		len = src->size - src->pos;
+	while (src->pos < src->head_len && n < len)
+		buffer[n++] = src->head[src->pos++];
+	if (n < len) {
+		len = src->seekable ? fread(&buffer[n], 1, len - n, src->f)
+			: gbs_src_pipe(src, &buffer[n], len - n);
+		src->pos += len;
+		n += len;
+	}
 
-	stat = gbs_receive_packet(&ftdic, &packet1, SLEEPTIME);
+	return n;
+}
+
+/* the next block, the last one padded with 0xFF. 0 if the data ended
+ * before src->size. */
+static uint8_t gbs_src_block(gbs_src_t* src, uint8_t* block, uint32_t len) {
+	uint32_t want = src->size - src->pos < len ? src->size - src->pos : len;
+
+	memset(block, 0xFF, len);
+	return gbs_src_read(src, block, len) == want;
+}
+
+/* moves forward to pos: seeks in a file, reads a pipe and drops the data */
+static void gbs_src_skip(gbs_src_t* src, uint32_t pos) {
+	uint8_t scrap[256];
+
+	if (src->seekable && fseek(src->f, pos, SEEK_SET) == 0) {
+		src->pos = pos;
+		return;
+	}
+	while (src->pos < pos && gbs_src_read(src, scrap,
+				pos - src->pos < sizeof scrap ? pos - src->pos
+				: sizeof scrap) > 0)
+		;
+}
+
+/* what the next erase of chip should take, in ms: the mean of the last
+ * ERASE_LOG_LAST ones logged, what this context has seen, or what the
+ * datasheet says. 0 if nothing is known. */
+static uint32_t gbs_erase_expect(conn_t* conn, const chip_desc_t* desc) {
+	uint32_t last[ERASE_LOG_LAST], n = 0, i;
+	uint64_t total = 0;
+	unsigned int chip;
+	unsigned long ms;
+	char line[64];
+	FILE* f;
+
+	if (conn->ctx->erase_log != NULL
+			&& (f = fopen(conn->ctx->erase_log, "r")) != NULL) {
+		while (fgets(line, sizeof line, f) != NULL)
+			if (sscanf(line, "%x %lu", &chip, &ms) == 2
+					&& chip == conn->timing.chip)
+				last[n++ % ERASE_LOG_LAST] = ms;
+		fclose(f);
+	}
+	if (n > 0) {
+		for (i = 0; i < n && i < ERASE_LOG_LAST; i++)
+			total += last[i];
+		return total / i;
+	}
+	if (conn->timing.kind[RTO_ERASE].srtt_ns != 0)
+		return conn->timing.kind[RTO_ERASE].srtt_ns / 1000000;
+	if (desc != NULL)
+		return desc->t_erase_typ_s * 1000;
+
+	return 0;
+}
+
+/* keeps an erase time for gbs_erase_expect() and for tuning */
+static void gbs_erase_log(conn_t* conn, uint32_t ms) {
+	FILE* f;
+
+	if (conn->ctx->erase_log == NULL
+			|| (f = fopen(conn->ctx->erase_log, "a")) == NULL)
+		return;
+	fprintf(f, "%04x %u %ld\n", conn->timing.chip, ms, (long) time(NULL));
+	fclose(f);
+}
+
+/* chip erase on firmware that erases in the background: the chip's
+ * status is polled, more often as the expected time draws near, so the
+ * erase ends as soon as the chip is done. Progress is the elapsed time
+ * against the expected one. */
+static uint16_t gbs_erase_poll(conn_t* conn, thread_args_t* args,
+		uint32_t expect_ms) {
+	packet_t packet0, packet1;
+	uint64_t start, elapsed, wait, expect = expect_ms * 1000000ULL;
+	uint64_t limit = gbs_rto_ns(conn, RTO_ERASE);
+
+	packet0.type = TYPE_COMMAND;
+	packet0.data = CMD_ERASE_START;
+	gbs_send_packet(conn, &packet0);
+	if (gbs_receive_packet(conn, &packet1, RTO_CMD) != STAT_OK
+			|| packet1.data != STAT_OK)
+		return STAT_ERROR;
+	start = gbs_clock_ns(conn);
+
+	do {
+		elapsed = gbs_clock_ns(conn) - start;
+		if (expect_ms != 0)
+			gbs_progress(args, elapsed < expect ? elapsed / 1000000
+					: expect_ms - 1);
+		if (gbs_cancelled(args))
+			return STAT_CANCELLED;
+		if (elapsed > limit) {
+			if (conn->stats != NULL)
+				conn->stats->timeouts++;
+			return STAT_TIMEOUT;
+		}
+
+		wait = expect > elapsed ? (expect - elapsed) / 4 : 0;
+		if (wait < ERASE_POLL_MIN_NS)
+			wait = ERASE_POLL_MIN_NS;
+		if (wait > ERASE_POLL_MAX_NS)
+			wait = ERASE_POLL_MAX_NS;
+		gbs_pause(conn, wait);
+
+		packet0.type = TYPE_COMMAND;
+		packet0.data = CMD_ERASE_STATUS;
+		gbs_send_packet(conn, &packet0);
+		if (gbs_receive_packet(conn, &packet1, RTO_CMD) != STAT_OK)
+			return STAT_ERROR;
+	} while (packet1.data == STAT_BUSY);
+
+	if (packet1.data != STAT_OK)
+		return STAT_ERROR;
+	gbs_rto_observe(conn, RTO_ERASE, gbs_clock_ns(conn) - start);
+
+	return STAT_OK;
+}
+
+/* chip erase on older firmware, which answers once it is done */
+static uint16_t gbs_erase_wait(conn_t* conn, thread_args_t* args) {
+	packet_t packet0, packet1;	/* packets */
+	uint16_t stat;
+
+	/* enviamos el comando */
+	/* preparamos el paquete */
+	packet0.type = TYPE_COMMAND;
+	packet0.data = CMD_ERASE_FLASH;
+	/* lo enviamos */
+	gbs_send_packet(conn, &packet0);
+	/* leemos la respuesta */
+	stat = gbs_wait_packet(conn, &packet1, RTO_ERASE, &args->cancel);
+	if (stat != STAT_OK)
+		return stat;
+
+	return packet1.data == STAT_OK ? STAT_OK : STAT_ERROR;
+}
+
+void* gbs_erase_flash (void* ptr) {
+
+	conn_t conn;
+	packet_t packet1, packet2;	/* packets */
+	const chip_desc_t* chip;
+	status_t status;
+	uint32_t expect_ms;
+	uint64_t start;
+	uint16_t stat;
+	thread_args_t* args;
+
+	args = (thread_args_t*) ptr;
+	gbs_start(args, 0);
+	if (gbs_cancelled(args))
+		return gbs_finish(args, STAT_CANCELLED);
+
+	if (gbs_open(args->ctx, &conn)==STAT_ERROR) {
+		return gbs_finish(args, STAT_ERROR);
+	}
+	gbs_measure(&conn, &args->stats, "erase_flash");
+
+	/* how long the chip may take, and should */
+	gbs_info(&conn, &status, BLOCK_256);
+	chip = gbs_identify(&conn, &packet1, &packet2);
+	start = gbs_clock_ns(&conn);
+	if (gbs_fw_at_least(&conn, FW_POLL_MAYOR, FW_POLL_MINOR)) {
+		if ((expect_ms = gbs_erase_expect(&conn, chip)) != 0) {
+			args->timed = 1;
+			atomic_store(&args->total_bytes, expect_ms);
+		}
+		stat = gbs_erase_poll(&conn, args, expect_ms);
+	}
+	else
+		stat = gbs_erase_wait(&conn, args);
+
+	/* the chip erase itself can't be stopped, a cancel only stops waiting
+	 * for it. The flasher takes the CMD_END once the chip is done, the
+	 * flash is left partly erased. */
+	if (stat == STAT_CANCELLED)
+		return gbs_stop(&conn, args, NULL);
+	if (stat == STAT_OK) {
+		args->erase_ms = (gbs_clock_ns(&conn) - start) / 1000000;
+		gbs_erase_log(&conn, args->erase_ms);
+	}
+	gbs_close(&conn);
+
+	return gbs_finish(args, stat == STAT_OK ? STAT_OK : STAT_ERROR);
+}
+
+/* frames the next block to program into frame. Blocks left all 0xFF are
+ * dropped when the flash is known to be erased. Returns 0 at the end. */
+static uint8_t gbs_prep_fill(gbs_prep_t* prep, gbs_frame_t* frame) {
+	uint8_t block[BLOCK_MAX];
+	uint32_t i, size = prep->src->size;
+	uint16_t zlen;
+	uint8_t blank;
+
+	do {
+		if (prep->skip)
+			prep->pos = gbs_next_bank(prep->args, prep->pos, size);
+		if (prep->pos >= size)
+			return 0;
+
+		/* leemos un bloque de bytes, el último se rellena */
+		gbs_src_skip(prep->src, prep->pos);
+		if (!gbs_src_block(prep->src, block, prep->block_size)) {
+			prep->short_read = 1;
+			return 0;
+		}
+		frame->pos = prep->pos;
+		prep->pos += prep->block_size;
+
+		/* calculamos la comprobación */
+		frame->check = 0;
+		blank = 1;
+		for (i=0; i<prep->block_size; i++) {
+			frame->check+=block[i];
+			blank &= block[i] == 0xFF;
+		}
+	} while (prep->skip && blank);
+
+	if (prep->prg_cmd != CMD_PRG_FLASH_RLE) {
+		memcpy(frame->wire, block, prep->block_size);
+		frame->len = prep->block_size;
+		return 1;
+	}
+
+	/* a format byte and the block, run-length encoded when that saves
+	 * enough to be worth it */
+	zlen = gbs_rle_encode(block, prep->block_size, &frame->wire[1],
+			prep->block_size - RLE_MIN_SAVING);
+	if (zlen != 0) {
+		frame->wire[0] = BLOCK_RLE;
+	}
+	else {
+		frame->wire[0] = BLOCK_RAW;
+		memcpy(&frame->wire[1], block, prep->block_size);
+		zlen = prep->block_size;
+	}
+	frame->len = zlen + 1;
+
+	return 1;
+}
+
+static void* gbs_prep_thread(void* ptr) {
+	gbs_prep_t* prep = (gbs_prep_t*) ptr;
+	uint8_t* slot;
+
+	while ((slot = gbs_ring_claim(&prep->ring)) != NULL
+			&& gbs_prep_fill(prep, (gbs_frame_t*) slot))
+		gbs_ring_publish(&prep->ring, sizeof(gbs_frame_t));
+	gbs_ring_close(&prep->ring);
+
+	return NULL;
+}
+
+static uint16_t gbs_prep_start(gbs_prep_t* prep) {
+	if (prep->args->sequential)
+		return STAT_OK;
+	if (gbs_ring_init(&prep->ring, PREP_SLOTS, sizeof(gbs_frame_t))
+			!= STAT_OK)
+		return STAT_ERROR;
+	prep->ring.abort = &prep->args->cancel;
+	if (pthread_create(&prep->thread, NULL, gbs_prep_thread, prep) != 0) {
+		gbs_ring_free(&prep->ring);
+		return STAT_ERROR;
+	}
+
+	return STAT_OK;
+}
+
+/* the next frame to send, NULL when there are no more or the source
+ * ended short, see gbs_prep_end() */
+static gbs_frame_t* gbs_prep_get(gbs_prep_t* prep) {
+	uint32_t len;
+
+	if (prep->args->sequential)
+		return gbs_prep_fill(prep, &prep->one) ? &prep->one : NULL;
+	return (gbs_frame_t*) gbs_ring_peek(&prep->ring, &len);
+}
+
+/* done with the frame gbs_prep_get() gave */
+static void gbs_prep_put(gbs_prep_t* prep) {
+	if (!prep->args->sequential)
+		gbs_ring_release(&prep->ring);
+}
+
+/* why gbs_prep_get() gave NULL: STAT_OK at the end of the data */
+static uint16_t gbs_prep_end(gbs_prep_t* prep) {
+	if (gbs_cancelled(prep->args))
+		return STAT_CANCELLED;
+	return prep->short_read ? STAT_ERROR : STAT_OK;
+}
+
+static void gbs_prep_stop(gbs_prep_t* prep) {
+	if (prep->args->sequential)
+		return;
+	/* the thread may be waiting on a pipe, it looks at this between polls */
+	atomic_store(&prep->src->closed, 1);
+	gbs_ring_close(&prep->ring);
+	pthread_join(prep->thread, NULL);
+	gbs_ring_free(&prep->ring);
+}
+
+/* programs the prepared frames. The link only sends what is ready and
+ * waits for the flasher, starting a new program session at the next
+ * frame's position whenever the preparation jumped over a part. */
+static uint16_t gbs_write_frames(conn_t* conn, thread_args_t* args,
+		gbs_prep_t* prep) {
+	packet_t packet0, packet1;	/* packets */
+	gbs_frame_t* frame;
+	uint32_t next;
+	uint8_t check;
+
+	if ((frame = gbs_prep_get(prep)) == NULL)
+		return gbs_prep_end(prep);
+	/* sin seek el flasher grabaría el bloque en 0 */
+	if (gbs_seek(conn, frame->pos, ROM_BANK_SIZE) != 0)
+		return STAT_ERROR;
+
+	/* comenzamos a grabar */
+	packet0.type = TYPE_COMMAND;
+	packet0.data = prep->prg_cmd;
+	gbs_send_packet(conn, &packet0);
+	if (gbs_receive_packet(conn, &packet1, RTO_CMD) != STAT_OK
+			|| packet1.data != STAT_OK)
+		return STAT_ERROR;
+
+	while (frame != NULL) {
+		gbs_progress(args, frame->pos);
+
+		/* lo enviamos */
+		args->raw_bytes += conn->block_size;
+		args->sent_bytes += frame->len;
+		gbs_send_data(conn, frame->wire, frame->len);
+		next = frame->pos + conn->block_size;
+		check = frame->check;
+		gbs_prep_put(prep);
+
+		/* recibimos la comprobación */
+		if (gbs_receive_packet(conn, &packet1, RTO_PRG) != STAT_OK)
+			return STAT_ERROR;
+		if (packet1.data != check) {	/* bad check */
+			args->stats.check_errors++;
+			return STAT_ERROR;
+		}
+
+		/* more bytes to transfer? */
+		if ((frame = gbs_prep_get(prep)) == NULL)
+			return gbs_prep_end(prep);
+		if (gbs_cancelled(args))
+			return STAT_CANCELLED;
+		/* seguimos grabando */
+		if (frame->pos != next) {
+			/* saltando bancos en blanco */
+			if (gbs_resume_prg(conn, args, prep->prg_cmd, frame->pos)
+					!= STAT_OK)
+				return STAT_ERROR;
+		}
+		else {
+			packet0.type = TYPE_COMMAND;
+			packet0.data = prep->prg_cmd;
+			gbs_send_packet(conn, &packet0);
+		}
+	}
+
+	return STAT_OK;
+}
+
+void* gbs_write_flash(void* ptr) {	
+	conn_t conn;
+	packet_t packet0;			/* packets */
+	gbs_src_t r00m;
+	gbs_prep_t prep;
+	uint16_t ret;
+	thread_args_t* args;
+
+	args = (thread_args_t*) ptr;
+	gbs_start(args, 0);
+	if (gbs_cancelled(args))
+		return gbs_finish(args, STAT_CANCELLED);
+
+	if (gbs_src_open(args, &r00m, 1) != STAT_OK) {
+		return gbs_finish(args, gbs_cancelled(args) ? STAT_CANCELLED
+				: STAT_ERROR);
+	}
+	args->total_bytes = r00m.size;
+
+	if (gbs_open(args->ctx, &conn)==STAT_ERROR) {
+		fclose(r00m.f);
+		return gbs_finish(args, STAT_ERROR);
+	}
+	gbs_measure(&conn, &args->stats, "write_flash");
+
+	/* the firmware version first, the program algorithm depends on it */
+	gbs_negotiate_block(&conn, gbs_block_limit(args, r00m.size));
+	args->prg_mode = gbs_select_prg_mode(&conn, args->prg_mode);
+
+	memset(&prep, 0, sizeof(prep));
+	prep.args = args;
+	prep.src = &r00m;
+	prep.block_size = conn.block_size;
+
+	/* compressed blocks, if the firmware can take them */
+	prep.prg_cmd = CMD_PRG_FLASH;
+	if (args->compress && gbs_fw_at_least(&conn, FW_RLE_MAYOR, FW_RLE_MINOR))
+		prep.prg_cmd = CMD_PRG_FLASH_RLE;
+	args->raw_bytes = args->sent_bytes = 0;
+
+	/* banks to leave erased, if the firmware can jump over them */
+	prep.skip = args->skip != NULL
+		&& gbs_fw_at_least(&conn, FW_SEEK_MAYOR, FW_SEEK_MINOR);
+
+	ret = gbs_prep_start(&prep);
+	if (ret == STAT_OK) {
+		ret = gbs_write_frames(&conn, args, &prep);
+		gbs_prep_stop(&prep);
+	}
+
+	packet0.type = TYPE_COMMAND;
+	packet0.data = CMD_END;
+	gbs_send_packet(&conn, &packet0);
+
+	fclose(r00m.f);
+	gbs_close(&conn);
+	return gbs_finish(args, ret);
+}
+
+/* receives one block of a read session into buffer and has the flasher
+ * check it: our sum goes back, CMD_END means it didn't match. STAT_ERROR
+ * then, the flasher ended the session; STAT_TIMEOUT if it stopped
+ * answering, still in it. */
+static uint16_t gbs_receive_block(conn_t* conn, thread_args_t* args,
+		uint8_t* buffer) {
+	packet_t packet1, packet2;
+	uint8_t check = 0;
+	uint32_t i;
+
+	/* leemos buffer */
+	for (i=0; i<conn->block_size; i++) {
+		if (gbs_receive_byte(conn, &buffer[i], RTO_READ) != STAT_OK)
+			return STAT_TIMEOUT;
+	}
+
+	/* calculamos la suma */
+	for (i=0; i<conn->block_size; i++)
+		check+=buffer[i];
+
+	/* enviamos la suma */
+	packet2.type  = TYPE_DATA;
+	packet2.data  = check;
+	gbs_send_packet(conn, &packet2);
+	/* respuesta */
+	if (gbs_receive_packet(conn, &packet1, RTO_CMD) != STAT_OK)
+		return STAT_TIMEOUT;
+
+	/* fallo en la comprobación? */
+	if (packet1.data == CMD_END) {
+		args->stats.check_errors++;
+		return STAT_ERROR;
+	}
+
+	return STAT_OK;
+}
+
+/* asks for the next block of a read session, unless cancelled */
+static uint16_t gbs_next_block(conn_t* conn, thread_args_t* args,
+		uint8_t cmd) {
+	packet_t packet2;
+
+	if (gbs_cancelled(args))
+		return STAT_CANCELLED;
+	packet2.type = TYPE_COMMAND;
+	packet2.data = cmd;
+	gbs_send_packet(conn, &packet2);
+
+	return STAT_OK;
+}
+
+/* the blocks of a read session one after the other on this thread, the
+ * link waiting while the file is written */
+static uint16_t gbs_read_blocks_seq(conn_t* conn, thread_args_t* args,
+		FILE* f, uint8_t cmd, uint32_t skip, uint32_t chunks) {
+	uint8_t buffer[BLOCK_MAX];
+	uint32_t n, done = 0;
+
+	uint16_t ret;
+
+	for (n=0; n<chunks; n++) {
+		gbs_progress(args, done);
+		if ((ret = gbs_receive_block(conn, args, buffer)) != STAT_OK)
+			return ret;
+		/* los escribimos en el archivo */
+		done += gbs_write_range(args, f, buffer, conn->block_size,
+				n * conn->block_size, skip, args->size);
+
+		/* continuamos */
+		if (n<chunks-1 && gbs_next_block(conn, args, cmd) != STAT_OK)
+			return STAT_CANCELLED;
+	}
+
+	return STAT_OK;
+}
+
+/* writes the verified blocks out and reports progress, so the link never
+ * waits on the disk or on hashing */
+static void* gbs_sink_thread(void* ptr) {
+	gbs_sink_t* sink = (gbs_sink_t*) ptr;
+	uint8_t* block;
+	uint32_t len, n = 0, done = 0;
+
+	while ((block = gbs_ring_peek(&sink->ring, &len)) != NULL) {
+		done += gbs_write_range(sink->args, sink->f, block, len,
+				n++ * sink->block_size, sink->skip, sink->args->size);
+		gbs_ring_release(&sink->ring);
+		gbs_progress(sink->args, done);
+	}
+
+	return NULL;
+}
+
+/* the blocks of a read session, pipelined: this thread only talks to the
+ * flasher, receiving each block straight into a slot of the sink's ring
+ * and passing it on once the flasher said it is good. The sink thread
+ * writes it (and feeds the digests, a stage further) meanwhile. */
+static uint16_t gbs_read_blocks(conn_t* conn, thread_args_t* args,
+		FILE* f, uint8_t cmd, uint32_t skip, uint32_t chunks) {
+	gbs_sink_t sink;
+	uint8_t* block;
+	uint16_t ret = STAT_OK;
+	uint32_t n;
+
+	sink.args = args;
+	sink.f = f;
+	sink.block_size = conn->block_size;
+	sink.skip = skip;
+	if (gbs_ring_init(&sink.ring, SINK_SLOTS, conn->block_size) != STAT_OK)
+		return gbs_read_blocks_seq(conn, args, f, cmd, skip, chunks);
+	if (pthread_create(&sink.thread, NULL, gbs_sink_thread, &sink) != 0) {
+		gbs_ring_free(&sink.ring);
+		return gbs_read_blocks_seq(conn, args, f, cmd, skip, chunks);
+	}
+
+	for (n=0; n<chunks && ret == STAT_OK; n++) {
+		block = gbs_ring_claim(&sink.ring);
+		if ((ret = gbs_receive_block(conn, args, block)) != STAT_OK)
+			break;
+		gbs_ring_publish(&sink.ring, conn->block_size);
+
+		/* continuamos */
+		if (n<chunks-1 && gbs_next_block(conn, args, cmd) != STAT_OK)
+			ret = STAT_CANCELLED;
+	}
+
+	gbs_ring_close(&sink.ring);
+	pthread_join(sink.thread, NULL);
+	gbs_ring_free(&sink.ring);
+
+	return ret;
+}
+
+/* leaves a read session the flasher stopped answering in. It may still be
+ * sending the block, or waiting for its check: a CMD_END taken for the
+ * check gets an answer and then ends it, a second one ends it otherwise.
+ * What was on its way is dropped, the link is ready for a new command. */
+static void gbs_abort_read(conn_t* conn) {
+	packet_t packet0, packet1;
+
+	packet0.type = TYPE_COMMAND;
+	packet0.data = CMD_END;
+	gbs_send_packet(conn, &packet0);
+	if (gbs_receive_packet(conn, &packet1, RTO_CMD) == STAT_OK)
+		gbs_send_packet(conn, &packet0);
+	gbs_purge_rx(conn);
+}
+
+/* a read session of the range asked for, the flasher seeking to it or
+ * starting at 0 and the blocks before it skipped */
+static uint16_t gbs_read_session(conn_t* conn, thread_args_t* args, FILE* f,
+		uint8_t cmd, uint32_t bank_size) {
+	packet_t packet0;
+	uint32_t chunks, skip;
+	uint16_t ret;
+
+	/* rango pedido, el firmware antiguo lee desde 0 y saltamos el resto */
+	skip = gbs_seek(conn, args->offset, bank_size);
+
+	/* numero de buffers a leer */
+	chunks = (skip + args->size + conn->block_size - 1) / conn->block_size;
+
+	/* comenzamos a recibir */
+	packet0.type  = TYPE_COMMAND;
+	packet0.data = cmd;
+	gbs_send_packet(conn, &packet0);
+
+	if (args->sequential)
+		ret = gbs_read_blocks_seq(conn, args, f, cmd, skip, chunks);
+	else
+		ret = gbs_read_blocks(conn, args, f, cmd, skip, chunks);
+
+	/* el flasher ya terminó si falló la comprobación */
+	if (ret == STAT_TIMEOUT)
+		gbs_abort_read(conn);
+	else if (ret != STAT_ERROR) {
+		packet0.type = TYPE_COMMAND;
+		packet0.data = CMD_END;
+		gbs_send_packet(conn, &packet0);
+	}
+
+	return ret;
+}
+
+/* (re)starts a session of cmd at block n of a robust read. CMD_END first,
+ * so that a seek to 0, which sends nothing, starts one too. */
+static uint16_t gbs_robust_session(conn_t* conn, gbs_robust_t* r,
+		uint8_t cmd, uint32_t n) {
+	packet_t packet0;
+
+	if (gbs_cancelled(r->args))
+		return STAT_CANCELLED;
+	packet0.type = TYPE_COMMAND;
+	packet0.data = CMD_END;
+	gbs_send_packet(conn, &packet0);
+	if (gbs_seek(conn, r->base + n * conn->block_size, r->bank_size) != 0)
+		return STAT_ERROR;
+	packet0.data = cmd;
+	gbs_send_packet(conn, &packet0);
+
+	return STAT_OK;
+}
+
+/* receives a block of a robust read: STAT_OK, CMD_END if it failed the
+ * link check (the flasher ended the session), STAT_ERROR if the flasher
+ * stopped answering */
+static uint16_t gbs_robust_block(conn_t* conn, gbs_robust_t* r,
+		uint8_t* buffer) {
+	switch (gbs_receive_block(conn, r->args, buffer)) {
+		case STAT_OK:
+			return STAT_OK;
+		case STAT_ERROR:
+			return CMD_END;
+		default:
+			return STAT_ERROR;
+	}
+}
+
+/* first pass, every block into the image. One that fails the link check
+ * is marked and the session starts again past it. */
+static uint16_t gbs_robust_fill(conn_t* conn, gbs_robust_t* r) {
+	uint32_t n, bs = conn->block_size;
+	uint16_t ret;
+	uint8_t restart = 1;
+
+	for (n=0; n<r->chunks; n++) {
+		gbs_progress(r->args, n * bs < (uint32_t) r->args->size ? n * bs
+				: (uint32_t) r->args->size);
+		if (restart)
+			ret = gbs_robust_session(conn, r, r->read_cmd, n);
+		else
+			ret = gbs_next_block(conn, r->args, r->read_cmd);
+		if (ret != STAT_OK)
+			return ret;
+
+		if ((ret = gbs_robust_block(conn, r, &r->image[n * bs])) == STAT_ERROR)
+			return ret;
+		restart = (ret == CMD_END);
+		if (restart)
+			r->state[n] |= ROBUST_LINK;
+		r->crc[n] = gbs_crc32(0, &r->image[n * bs], bs);
+	}
+
+	return STAT_OK;
+}
+
+/* second pass, the flasher reads every block from the cart again and
+ * sends back only its CRC-32. Firmware before 0.6 sends the whole block,
+ * which costs as much as the first pass. */
+static uint16_t gbs_robust_verify(conn_t* conn, gbs_robust_t* r) {
+	uint8_t cmd = r->crc_cmd ? r->crc_cmd : r->read_cmd;
+	uint8_t restart = 1, c, i;
+	uint32_t n;
+	uint16_t ret;
+
+	for (n=0; n<r->chunks; n++) {
+		if (restart)
+			ret = gbs_robust_session(conn, r, cmd, n);
+		else
+			ret = gbs_next_block(conn, r->args, cmd);
+		if (ret != STAT_OK)
+			return ret;
+		restart = 0;
+
+		if (cmd == r->crc_cmd) {
+			for (i=0; i<4; i++) {
+				if (gbs_receive_byte(conn, &c, RTO_READ) != STAT_OK)
+					return STAT_ERROR;
+				r->dev[n] = (r->dev[n] << 8) | c;
+			}
+			continue;
+		}
+
+		/* the first copy slot is free until the votes */
+		if ((ret = gbs_robust_block(conn, r, r->copies)) == STAT_ERROR)
+			return ret;
+		if (ret == CMD_END) {
+			r->state[n] |= ROBUST_NO_CRC;
+			restart = 1;
+		}
+		else
+			r->dev[n] = gbs_crc32(0, r->copies, conn->block_size);
+	}
+
+	return STAT_OK;
+}
+
+static void gbs_ballot_add(gbs_ballot_t* ballot, uint32_t crc, int8_t copy) {
+	uint8_t i;
+
+	for (i=0; i<ballot->count && ballot->crc[i] != crc; i++)
+		;
+	if (i == ballot->count) {
+		ballot->crc[i] = crc;
+		ballot->votes[i] = 0;
+		ballot->copy[i] = -1;
+		ballot->count++;
+	}
+	ballot->votes[i]++;
+	ballot->total++;
+	if (ballot->copy[i] < 0)
+		ballot->copy[i] = copy;
+}
+
+/* the version most reads gave, if they are more than half and two at
+ * least and we have its bytes. -1 if there is none yet. */
+static int8_t gbs_ballot_winner(const gbs_ballot_t* ballot) {
+	uint8_t i;
+
+	for (i=0; i<ballot->count; i++)
+		if (ballot->votes[i] >= 2 && ballot->votes[i] * 2 > ballot->total
+				&& ballot->copy[i] >= 0)
+			return i;
+
+	return -1;
+}
+
+/* each byte of block the value most of the k copies have. Returns the
+ * percent of them behind the least agreed on byte, never over 50 for a
+ * single copy. */
+static uint8_t gbs_vote_bytes(const uint8_t* copies, uint8_t k, uint16_t bs,
+		uint8_t* block) {
+	uint8_t a, b, votes, best, worst = k;
+	uint16_t i;
+
+	if (k == 0)
+		return 0;		/* the first read stays, link check or not */
+
+	for (i=0; i<bs; i++) {
+		best = 0;
+		for (a=0; a<k && best * 2 <= k; a++) {
+			votes = 0;
+			for (b=0; b<k; b++)
+				if (copies[b * bs + i] == copies[a * bs + i])
+					votes++;
+			if (votes > best) {
+				best = votes;
+				block[i] = copies[a * bs + i];
+			}
+		}
+		if (best < worst)
+			worst = best;
+	}
+
+	return 100 * worst / (k < 2 ? 2 : k);
+}
+
+/* reads suspect block n again until one version of it has a majority of
+ * the votes: the first read, the flasher's CRC of its second one and the
+ * new reads. If none has after r->reads more, bytewise majority. */
+static uint16_t gbs_robust_vote(conn_t* conn, gbs_robust_t* r, uint32_t n,
+		gbs_bank_report_t* bank) {
+	uint16_t bs = conn->block_size, ret;
+	uint8_t* block = &r->image[n * bs];
+	uint8_t k = 0, tries, confidence;
+	gbs_ballot_t ballot;
+	int8_t w;
+
+	memset(&ballot, 0, sizeof(ballot));
+	if (!(r->state[n] & ROBUST_LINK)) {
+		memcpy(r->copies, block, bs);
+		gbs_ballot_add(&ballot, r->crc[n], k++);
+	}
+	if (!(r->state[n] & ROBUST_NO_CRC))
+		gbs_ballot_add(&ballot, r->dev[n], -1);
+
+	for (tries=0; (w = gbs_ballot_winner(&ballot)) < 0 && tries < r->reads;
+			tries++) {
+		if ((ret = gbs_robust_session(conn, r, r->read_cmd, n)) != STAT_OK)
+			return ret;
+		bank->reads++;
+		ret = gbs_robust_block(conn, r, &r->copies[k * bs]);
+		if (ret == STAT_ERROR)
+			return ret;
+		if (ret == STAT_OK) {
+			gbs_ballot_add(&ballot, gbs_crc32(0, &r->copies[k * bs], bs), k);
+			k++;
+		}
+	}
+
+	if (w >= 0) {
+		memcpy(block, &r->copies[ballot.copy[w] * bs], bs);
+		confidence = 100 * ballot.votes[w] / ballot.total;
+	}
+	else {
+		bank->uncertain++;
+		confidence = gbs_vote_bytes(r->copies, k, bs, block);
+	}
+	if (confidence < bank->confidence)
+		bank->confidence = confidence;
+
+	return STAT_OK;
+}
+
+/* Robust reads, for carts with dirty contacts. The range is read into
+ * memory, the flasher reads it again sending only CRCs, and the blocks
+ * that disagree, or failed the link check, are read again and voted on,
+ * see gbs_robust_vote(). The file is written at the end, and
+ * args->report says how sure each bank is. Needs a flasher that seeks. */
+static uint16_t gbs_read_robust(conn_t* conn, thread_args_t* args, FILE* f,
+		uint8_t read_cmd, uint8_t crc_cmd, uint32_t bank_size) {
+	gbs_robust_t r;
+	gbs_bank_report_t* report, * bank;
+	packet_t packet0;
+	uint32_t n, first, banks, bs = conn->block_size;
+	uint16_t ret = STAT_ERROR;
+
+	memset(&r, 0, sizeof(r));
+	r.args = args;
+	r.read_cmd = read_cmd;
+	if (gbs_fw_at_least(conn, FW_CRC_MAYOR, FW_CRC_MINOR))
+		r.crc_cmd = crc_cmd;
+	r.reads = args->robust < ROBUST_READS_MAX ? args->robust
+		: ROBUST_READS_MAX;
+	r.base = args->offset;
+	r.bank_size = bank_size;
+	r.chunks = (args->size + bs - 1) / bs;
+
+	first = r.base / bank_size;
+	banks = (r.base + (r.chunks - 1) * bs) / bank_size - first + 1;
+	report = calloc(banks, sizeof(*report));
+	r.image = malloc(r.chunks * bs);
+	r.crc = malloc(r.chunks * sizeof(*r.crc));
+	r.dev = calloc(r.chunks, sizeof(*r.dev));
+	r.state = calloc(r.chunks, 1);
+	r.copies = malloc((r.reads + 1) * bs);
+
+	if (report != NULL && r.image != NULL && r.crc != NULL && r.dev != NULL
+			&& r.state != NULL && r.copies != NULL) {
+		for (n=0; n<banks; n++) {
+			report[n].bank = first + n;
+			report[n].confidence = 100;
+		}
+		if ((ret = gbs_robust_fill(conn, &r)) == STAT_OK)
+			ret = gbs_robust_verify(conn, &r);
+		for (n=0; n<r.chunks && ret == STAT_OK; n++) {
+			bank = &report[(r.base + n * bs) / bank_size - first];
+			bank->blocks++;
+			if (r.state[n] == 0 && r.dev[n] == r.crc[n])
+				continue;
+			bank->suspect++;
+			ret = gbs_robust_vote(conn, &r, n, bank);
+		}
+		for (n=0; n<r.chunks && ret == STAT_OK; n++)
+			gbs_write_range(args, f, &r.image[n * bs], bs, n * bs, 0,
+					args->size);
+	}
+
+	packet0.type = TYPE_COMMAND;
+	packet0.data = CMD_END;
+	gbs_send_packet(conn, &packet0);
+
+	if (ret == STAT_OK) {
+		args->report = report;
+		args->report_banks = banks;
+	}
+	else
+		free(report);
+	free(r.image);
+	free(r.crc);
+	free(r.dev);
+	free(r.state);
+	free(r.copies);
+
+	return ret;
+}
+
+void* gbs_read_flash(void* ptr) {	
+	conn_t conn;
+	uint16_t ret;
+	FILE* r00m;
+	thread_args_t* args;
+
+	args = (thread_args_t*) ptr;
+	gbs_start(args, args->size);
+	if (gbs_cancelled(args))
+		return gbs_finish(args, STAT_CANCELLED);
+
+	if ((r00m = gbs_fopen(args, "wb")) == NULL) {
+		return gbs_finish(args, STAT_ERROR);
+	}
+	if (args->hash != NULL && gbs_hash_start(args->hash) != STAT_OK) {
+		fclose(r00m);
+		return gbs_finish(args, STAT_ERROR);
+	}
+
+	if (gbs_open(args->ctx, &conn)==STAT_ERROR) {
+		fclose(r00m);
+		return gbs_finish(args, STAT_ERROR);
+	}
+	gbs_measure(&conn, &args->stats, "read_flash");
+
+	gbs_negotiate_block(&conn, gbs_block_limit(args, args->size));
+
+	if (args->robust && gbs_fw_at_least(&conn, FW_SEEK_MAYOR, FW_SEEK_MINOR))
+		ret = gbs_read_robust(&conn, args, r00m, CMD_READ_FLASH,
+				CMD_CRC_FLASH, ROM_BANK_SIZE);
+	else
+		ret = gbs_read_session(&conn, args, r00m, CMD_READ_FLASH,
+				ROM_BANK_SIZE);
+
+	fclose(r00m);
+	gbs_close(&conn);
+	return gbs_finish(args, ret);
+}
+
+void* gbs_write_ram(void* ptr) {	
+	conn_t conn;
+	uint8_t buffer[BLOCK_MAX];		/* buffer de envio/recepción */
+	packet_t packet0, packet1;			/* packets */
+	uint16_t stat, i;
+	uint8_t check, full;
+	gbs_src_t r00m;
+	uint32_t fsize, chunk_counter;
+	thread_args_t* args;
+
+	args = (thread_args_t*) ptr;
+	gbs_start(args, 0);
+	if (gbs_cancelled(args))
+		return gbs_finish(args, STAT_CANCELLED);
+
+
+	if (gbs_src_open(args, &r00m, 0) != STAT_OK) {
+		return gbs_finish(args, STAT_ERROR);
+	}
+	fsize = r00m.size;
+	args->total_bytes = fsize;
+	//printf("RAM size: %ld bytes\n", fsize);
+
+
+	if (gbs_open(args->ctx, &conn)==STAT_ERROR) {
+		fclose(r00m.f);
+		return gbs_finish(args, STAT_ERROR);
+	}
+	gbs_measure(&conn, &args->stats, "write_ram");
+
+	gbs_negotiate_block(&conn, gbs_block_limit(args, fsize));
+
+	/* leemos un bloque de bytes, el último se rellena. Antes del comando:
+	 * un bloque a medias no se puede parar */
+	if (!gbs_src_block(&r00m, buffer, conn.block_size)) {
+		fclose(r00m.f);
+		gbs_close(&conn);
+		return gbs_finish(args, gbs_cancelled(args) ? STAT_CANCELLED
+				: STAT_ERROR);
+	}
+
+	/* comenzamos a grabar */
+	chunk_counter = 0;
+	packet0.type = TYPE_COMMAND;
+	packet0.data = CMD_PRG_RAM;
+	gbs_send_packet(&conn, &packet0);
+
+	stat = gbs_receive_packet(&conn, &packet1, RTO_CMD);
 	if (stat == STAT_TIMEOUT) {
 		packet0.type = TYPE_COMMAND;
 		packet0.data = CMD_END;
-		gbs_send_packet(&ftdic, &packet0);
+		gbs_send_packet(&conn, &packet0);
 		printf(MSG_TIMEOUT);
-		fclose(r00m);
-		gbs_close_ftdi(&ftdic);
-		args->ret = STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
+		fclose(r00m.f);
+		gbs_close(&conn);
+		return gbs_finish(args, STAT_ERROR);
 	}
 	if (packet1.data == STAT_OK) {
 
-		while (!feof(r00m)) {
-			/* calculate percentage */
-			args->progress = (100*chunk_counter*BUFFER_SIZE)/fsize;
+		while (1) {
+			gbs_progress(args, chunk_counter*conn.block_size);
 
-			/* leemos un bloque de bytes */
-			stat = fread(&buffer, sizeof(uint8_t), BUFFER_SIZE, r00m);
 			check = 0;
 			/* calculamos la comprobación */
-			for (i=0; i<BUFFER_SIZE; i++) {
+			for (i=0; i<conn.block_size; i++) {
 				check+=buffer[i];
 			}
 			/* lo enviamos */
-			gbs_send_buffer(&ftdic, (uint8_t*)&buffer);
+			gbs_send_buffer(&conn, (uint8_t*)&buffer);
 
 			/* recibimos la comprobación */
-			gbs_receive_packet(&ftdic, &packet1, SLEEPTIME);
-			if (packet1.data != check) {	/* bad check */
+			stat = gbs_receive_packet(&conn, &packet1, RTO_RAM);
+			if (stat != STAT_OK || packet1.data != check) {	/* bad check */
+				if (stat == STAT_OK)
+					args->stats.check_errors++;
 				/* paramos */
 				packet0.type = TYPE_COMMAND;
 				packet0.data = CMD_END;
-				gbs_send_packet(&ftdic, &packet0);
-				fclose(r00m);
-				gbs_close_ftdi(&ftdic);
-				args->ret=STAT_ERROR;
-				args->stat = T_END;
-				return NULL;
+				gbs_send_packet(&conn, &packet0);
+				fclose(r00m.f);
+				gbs_close(&conn);
+				return gbs_finish(args, STAT_ERROR);
 			}
 
 			/* more bytes to transfer? */
-			stat = getc(r00m);
-			if (!feof(r00m)) {
-				fseek(r00m, -1, SEEK_CUR);
+			if ((chunk_counter + 1) * conn.block_size < fsize) {
+				full = gbs_src_block(&r00m, buffer, conn.block_size);
+				if (gbs_cancelled(args))
+					return gbs_stop(&conn, args, r00m.f);
+				if (!full) {
+					/* el fichero se acabó antes de tiempo */
+					packet0.type = TYPE_COMMAND;
+					packet0.data = CMD_END;
+					gbs_send_packet(&conn, &packet0);
+					fclose(r00m.f);
+					gbs_close(&conn);
+					return gbs_finish(args, STAT_ERROR);
+				}
 				/* seguimos grabando (si no hemos terminado ya) */
 				packet0.type = TYPE_COMMAND;
 				packet0.data = CMD_PRG_RAM;
-				gbs_send_packet(&ftdic, &packet0);
+				gbs_send_packet(&conn, &packet0);
 				chunk_counter++;
 			}
 			else 
@@ -618,166 +1989,123 @@ void* gbs_write_ram(void* ptr) {
 	else {
 		packet0.type = TYPE_COMMAND;
 		packet0.data = CMD_END;
-		gbs_send_packet(&ftdic, &packet0);
-		fclose(r00m);
-		gbs_close_ftdi(&ftdic);
-		args->ret=STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
+		gbs_send_packet(&conn, &packet0);
+		fclose(r00m.f);
+		gbs_close(&conn);
+		return gbs_finish(args, STAT_ERROR);
 	}
 
 	packet0.type = TYPE_COMMAND;
 	packet0.data = CMD_END;
-	gbs_send_packet(&ftdic, &packet0);
+	gbs_send_packet(&conn, &packet0);
 
 
-	fclose(r00m);
-	gbs_close_ftdi(&ftdic);
-	args->ret=STAT_OK;
-	args->stat = T_END;
-	return NULL;
+	fclose(r00m.f);
+	gbs_close(&conn);
+	return gbs_finish(args, STAT_OK);
 
 }
 
 void* gbs_read_ram(void* ptr) {	
-	struct ftdi_context ftdic;
-	uint8_t buffer[BUFFER_SIZE];		/* buffer de envio/recepción */
-	packet_t packet0, packet1, packet2;	/* packets */
-	uint32_t i, n, chunks;
-	uint8_t check;
+	conn_t conn;
+	uint16_t ret;
 	FILE* r00m;
 	thread_args_t* args;
 
 	args = (thread_args_t*) ptr;
-	args->stat = T_RUNNING;
+	gbs_start(args, args->size);
+	if (gbs_cancelled(args))
+		return gbs_finish(args, STAT_CANCELLED);
 
 
-	if ((r00m = fopen(args->file, "wb")) == NULL) {
-		args->ret=STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
+	if ((r00m = gbs_fopen(args, "wb")) == NULL) {
+		return gbs_finish(args, STAT_ERROR);
 	}
-
-	if (gbs_open_ftdi(&ftdic)==STAT_ERROR) {
-		args->ret=STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
+	if (args->hash != NULL && gbs_hash_start(args->hash) != STAT_OK) {
+		fclose(r00m);
+		return gbs_finish(args, STAT_ERROR);
 	}
 
-	/* numero de buffers a leer */
-	chunks = args->size/BUFFER_SIZE;
-
-	/* comenzamos a recibir */
-	packet0.type  = TYPE_COMMAND;
-	packet0.data = CMD_READ_RAM;
-
-	gbs_send_packet(&ftdic, &packet0);
-
-	for (n=0; n<chunks; n++) {
-		args->progress = n*BUFFER_SIZE*100/args->size;
-		check = 0;
-		/* leemos buffer */
-		for (i=0; i<BUFFER_SIZE; i++) {
-			gbs_receive_byte(&ftdic, &buffer[i], SLEEPTIME);
-		}
-		/* los escribimos en el archivo */
-		fwrite(&buffer, sizeof(uint8_t), BUFFER_SIZE, r00m);
-
-		/* calculamos la suma */
-		for (i=0; i<BUFFER_SIZE; i++)
-			check+=buffer[i];
-
-		/* enviamos la suma */
-		packet2.type  = TYPE_DATA;
-		packet2.data  = check;
-		gbs_send_packet(&ftdic, &packet2);
-		/* respuesta */
-		gbs_receive_packet(&ftdic, &packet1, SLEEPTIME);
-
-		/* fallo en la comprobación? */
-		if (packet1.data == CMD_END) {
-			fclose(r00m);
-			gbs_close_ftdi(&ftdic);
-			args->ret=STAT_ERROR;
-			args->stat = T_END;
-			return NULL;
-		}
-
-		/* continuamos */
-		if (n<chunks-1) {
-			packet2.type = TYPE_COMMAND;
-			packet2.data = CMD_READ_RAM;
-			gbs_send_packet(&ftdic, &packet2);
-		}
+	if (gbs_open(args->ctx, &conn)==STAT_ERROR) {
+		fclose(r00m);
+		return gbs_finish(args, STAT_ERROR);
 	}
+	gbs_measure(&conn, &args->stats, "read_ram");
 
-	packet0.type = TYPE_COMMAND;
-	packet0.data = CMD_END;
-	gbs_send_packet(&ftdic, &packet0);
+	gbs_negotiate_block(&conn, gbs_block_limit(args, args->size));
+
+	if (args->robust && gbs_fw_at_least(&conn, FW_SEEK_MAYOR, FW_SEEK_MINOR))
+		ret = gbs_read_robust(&conn, args, r00m, CMD_READ_RAM, CMD_CRC_RAM,
+				RAM_BANK_SIZE);
+	else
+		ret = gbs_read_session(&conn, args, r00m, CMD_READ_RAM,
+				RAM_BANK_SIZE);
 
 	fclose(r00m);
-	gbs_close_ftdi(&ftdic);
-	args->ret=STAT_OK;
-	args->stat = T_END;
-	return NULL;
+	gbs_close(&conn);
+	return gbs_finish(args, ret);
 }
 
 
 void* gbs_erase_ram (void* ptr) {
-	struct ftdi_context ftdic;
+	conn_t conn;
 	packet_t packet0, packet1;			/* packets */
 	uint16_t stat, i;
 	uint32_t chunk_counter;
 	thread_args_t* args;
 
 	args = (thread_args_t*) ptr;
-	args->stat = T_RUNNING;
+	gbs_start(args, args->size);
+	if (gbs_cancelled(args))
+		return gbs_finish(args, STAT_CANCELLED);
 
 
-	if (gbs_open_ftdi(&ftdic)==STAT_ERROR) {
-		args->ret=STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
+	if (gbs_open(args->ctx, &conn)==STAT_ERROR) {
+		return gbs_finish(args, STAT_ERROR);
 	}
+	gbs_measure(&conn, &args->stats, "erase_ram");
+
+	gbs_negotiate_block(&conn, gbs_block_limit(args, args->size));
 
 	/* comenzamos a grabar */
 	chunk_counter = 0;
 	packet0.type = TYPE_COMMAND;
 	packet0.data = CMD_ERASE_RAM;
-	gbs_send_packet(&ftdic, &packet0);
+	gbs_send_packet(&conn, &packet0);
 
-	stat = gbs_receive_packet(&ftdic, &packet1, SLEEPTIME);
+	stat = gbs_receive_packet(&conn, &packet1, RTO_CMD);
 	if (stat == STAT_TIMEOUT) {
 		packet0.type = TYPE_COMMAND;
 		packet0.data = CMD_END;
-		gbs_send_packet(&ftdic, &packet0);
+		gbs_send_packet(&conn, &packet0);
 		printf(MSG_TIMEOUT);
-		gbs_close_ftdi(&ftdic);
-		args->ret=STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
+		gbs_close(&conn);
+		return gbs_finish(args, STAT_ERROR);
 	}
 	if (packet1.data == STAT_OK) {
-		for (i=0; i<=args->size/BUFFER_SIZE; i++) {
-			/* calculate percentage */
-			args->progress = (100*chunk_counter*BUFFER_SIZE)/args->size;
+		for (i=0; i<(args->size+conn.block_size-1)/conn.block_size; i++) {
+			gbs_progress(args, chunk_counter*conn.block_size);
 
-			gbs_receive_packet(&ftdic, &packet1, SLEEPTIME);
-			if (packet1.data != STAT_OK) {	/* bad */
+			stat = gbs_receive_packet(&conn, &packet1, RTO_RAM);
+			if (stat != STAT_OK || packet1.data != STAT_OK) {	/* bad */
 				/* paramos */
 				packet0.type = TYPE_COMMAND;
 				packet0.data = CMD_END;
-				gbs_send_packet(&ftdic, &packet0);
-				gbs_close_ftdi(&ftdic);
-				args->ret=STAT_ERROR;
-				return NULL;
+				gbs_send_packet(&conn, &packet0);
+				gbs_close(&conn);
+				return gbs_finish(args, STAT_ERROR);
 			}
 
-			/* continue */
+			/* continue, unless that was the last block: an extra command
+			 * would erase past the RAM and answer into the next session */
+			chunk_counter++;
+			if (chunk_counter*conn.block_size >= args->size)
+				break;
+			if (gbs_cancelled(args))
+				return gbs_stop(&conn, args, NULL);
 			packet0.type = TYPE_COMMAND;
 			packet0.data = CMD_ERASE_RAM;
-			gbs_send_packet(&ftdic, &packet0);
-			chunk_counter++;
+			gbs_send_packet(&conn, &packet0);
 
 		}
 
@@ -785,21 +2113,17 @@ void* gbs_erase_ram (void* ptr) {
 	else {
 		packet0.type = TYPE_COMMAND;
 		packet0.data = CMD_END;
-		gbs_send_packet(&ftdic, &packet0);
-		gbs_close_ftdi(&ftdic);
-		args->ret=STAT_ERROR;
-		args->stat = T_END;
-		return NULL;
+		gbs_send_packet(&conn, &packet0);
+		gbs_close(&conn);
+		return gbs_finish(args, STAT_ERROR);
 	}
 
 	packet0.type = TYPE_COMMAND;
 	packet0.data = CMD_END;
-	gbs_send_packet(&ftdic, &packet0);
+	gbs_send_packet(&conn, &packet0);
 
-	gbs_close_ftdi(&ftdic);
-	args->ret=STAT_OK;
-	args->stat = T_END;
-	return NULL;
+	gbs_close(&conn);
+	return gbs_finish(args, STAT_OK);
 
 }
 
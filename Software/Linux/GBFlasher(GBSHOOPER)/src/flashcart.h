@@ -15,10 +15,13 @@ Description : Ladecadence.net GameBoy FlashCart interface
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 
 #include "communications.h"
 #include "gbshooper.h"
+#include "hash.h"
 
 /* Types */
 /*********/
@@ -36,12 +39,26 @@ typedef struct
 	uint8_t version_minor;
 } status_t;
 
+typedef struct
+{
+	uint8_t manufacturer_id;
+	uint8_t chip_id;
+	char name[30];
+	uint8_t prg_mode;		/* fastest program algorithm, PRG_* */
+	uint8_t wbuf_size;		/* write buffer size in bytes, 0 if none */
+	uint16_t t_byte_max_us;	/* worst case byte program, from the datasheet */
+	uint16_t t_erase_typ_s;	/* typical chip erase */
+	uint16_t t_erase_max_s;	/* worst case chip erase */
+} chip_desc_t;
+
 typedef struct
 {
 	uint8_t manufacturer_id;
 	uint8_t chip_id;
 	char* manufacturer;
 	char* chip;
+	uint8_t prg_mode;
+	uint8_t wbuf_size;
 } flash_id_t;
 
 typedef struct
@@ -55,23 +72,81 @@ typedef struct
 	
 } rom_header_t;
 
+/* what gbs_probe_cart() saw in the slot. Two probes of the same cart
+ * compare equal with memcmp(). */
+typedef struct
+{
+	uint8_t present;		/* a sane header, or a flash chip we know */
+	uint8_t header[19];		/* CMD_READ_HEADER: type, ROM, RAM, title */
+	uint8_t manufacturer_id;	/* flash ID, only asked for if the header */
+	uint8_t chip_id;			/* is blank */
+} gbs_probe_t;
+
+/* what a robust read found in one bank */
+typedef struct
+{
+	uint16_t bank;
+	uint16_t blocks;		/* blocks starting in it */
+	uint16_t suspect;		/* of them, read again */
+	uint16_t reads;			/* the extra reads they took */
+	uint16_t uncertain;		/* no version got a majority, bytewise vote */
+	uint8_t confidence;		/* percent, its weakest block's */
+} gbs_bank_report_t;
+
+/* parameters and results of one slow operation */
 typedef struct
 {
+	gbs_ctx_t* ctx;			/* flasher to run it on */
 	int size;
-	char* file;
-	uint8_t progress;
+	uint32_t offset;		/* reads start here, bytes into the ROM or RAM */
+	char* file;				/* "-" streams fd */
+	int fd;					/* -1 for stdin, or stdout for reads */
+	_Atomic uint32_t done_bytes;	/* progress, in bytes */
+	_Atomic uint32_t total_bytes;	/* 0 while unknown */
+	uint8_t timed;			/* progress counts milliseconds, not bytes */
 	uint16_t ret;
-	uint8_t stat;
+	uint8_t stat;					/* T_*, guarded by lock */
+	_Atomic uint8_t cancel;			/* set by gbs_cancel() */
+	pthread_mutex_t lock;
+	pthread_cond_t done;			/* signalled when stat is T_END */
+	uint8_t prg_mode;		/* PRG_AUTO, or force an algorithm */
+	uint16_t block_size;	/* largest block to negotiate, 0 = BLOCK_MAX */
+	uint8_t compress;		/* run-length encode flash blocks */
+	const uint8_t* skip;	/* per ROM bank, non-zero to leave it erased */
+	uint16_t skip_banks;	/* banks in skip, NULL and 0 for none */
+	gbs_hash_t* hash;		/* reads: digests of the data, NULL for none */
+	uint8_t sequential;		/* no read or write pipeline, to compare with */
+	uint8_t robust;			/* reads: verify the blocks and read the bad ones
+							   up to this many times more, 0 for a plain read */
+	gbs_bank_report_t* report;	/* robust reads: per bank, freed with them */
+	uint16_t report_banks;
+	uint32_t raw_bytes;		/* block bytes programmed */
+	uint32_t sent_bytes;	/* bytes that went on the wire for them */
+	uint32_t erase_ms;		/* erase_flash: how long the chip took */
+	gbs_stats_t stats;		/* traffic of the last run */
 } thread_args_t;
 
 
 /* function prototypes */
 /***********************/
 
-uint16_t gbs_status(status_t* status);
-uint16_t gbs_flash_id(flash_id_t* id);
-uint16_t gbs_read_header(rom_header_t* header);
-/* slow routines run in their own threads */
+uint16_t gbs_status(gbs_ctx_t* ctx, status_t* status);
+uint16_t gbs_flash_id(gbs_ctx_t* ctx, flash_id_t* id);
+uint16_t gbs_read_header(gbs_ctx_t* ctx, rom_header_t* header);
+uint16_t gbs_probe_cart(gbs_ctx_t* ctx, gbs_probe_t* probe);
+const char* gbs_prg_mode_name(uint8_t mode);
+uint32_t gbs_rom_bytes(uint8_t code);
+void gbs_args_init(thread_args_t* args, gbs_ctx_t* ctx);
+void gbs_args_destroy(thread_args_t* args);
+uint8_t gbs_wait(thread_args_t* args, uint32_t timeout_ms);
+double gbs_fraction(thread_args_t* args);
+void gbs_cancel(thread_args_t* args);
+uint8_t gbs_cancelled(thread_args_t* args);
+/* the bookkeeping of an operation, for ones run elsewhere (remote.c) */
+void gbs_start(thread_args_t* args, uint32_t total);
+void gbs_progress(thread_args_t* args, uint32_t bytes);
+void* gbs_finish(thread_args_t* args, uint16_t ret);
+/* slow routines, run them with gbs_start_op() or call them directly */
 void* gbs_erase_flash(void* ptr);
 void* gbs_write_flash(void* ptr);
 void* gbs_read_flash(void* ptr);
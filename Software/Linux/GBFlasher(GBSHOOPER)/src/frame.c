@@ -0,0 +1,156 @@
+/*
+============================================================================
+Name        : frame.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Protocol v2 framing, see gbshooper.h
+============================================================================
+*/
+
+#include <string.h>
+
+#include "frame.h"
+
+/* CRC-16 CCITT, polynomial 0x1021 from 0xFFFF, bit by bit like the
+ * firmware does it */
+static uint16_t gbs_crc16(uint16_t crc, const uint8_t* data, uint16_t len) {
+	uint8_t i;
+
+	while (len--) {
+		crc ^= (uint16_t) *data++ << 8;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+}
+
+static uint16_t gbs_frame_put(uint8_t* out, uint8_t seq, uint8_t cmd,
+		const uint8_t* data, uint16_t len) {
+	uint16_t crc;
+
+	out[0] = FRAME_SOF;
+	out[1] = seq;
+	out[2] = cmd;
+	out[3] = len;
+	out[4] = len >> 8;
+	memcpy(&out[FRAME_HEAD], data, len);
+	crc = gbs_crc16(0xFFFF, &out[1], FRAME_HEAD - 1 + len);
+	out[FRAME_HEAD + len] = crc;
+	out[FRAME_HEAD + len + 1] = crc >> 8;
+
+	return FRAME_HEAD + len + FRAME_CRC;
+}
+
+/* both ends start numbering at 0 when the link switches to v2 */
+void gbs_frame_init(gbs_framer_t* fr) {
+	memset(fr, 0, sizeof(*fr));
+	fr->rx_sync = 1;
+}
+
+/* drops the frame coming in, after the receive buffer was purged. What
+ * was lost can't be asked for, so the next frame's number is taken. */
+void gbs_frame_resync(gbs_framer_t* fr) {
+	fr->rx_have = 0;
+	fr->rx_len = 0;
+	fr->rx_sync = 0;
+}
+
+/* frames len bytes, FRAME_MAX at most, with the next number and keeps
+ * the frame for resends. *frame points at it, its length is returned. */
+uint16_t gbs_frame_build(gbs_framer_t* fr, uint8_t cmd, const uint8_t* data,
+		uint16_t len, const uint8_t** frame) {
+	uint8_t slot = fr->tx_seq % FRAME_WINDOW;
+
+	fr->win_len[slot] = gbs_frame_put(fr->win[slot], fr->tx_seq++, cmd,
+			data, len);
+	*frame = fr->win[slot];
+
+	return fr->win_len[slot];
+}
+
+/* a NAK for everything from rx_seq on, into out, which takes
+ * FRAME_HEAD + 1 + FRAME_CRC bytes */
+uint16_t gbs_frame_nak(gbs_framer_t* fr, uint8_t* out) {
+	return gbs_frame_put(out, 0, FRAME_NAK, &fr->rx_seq, 1);
+}
+
+/* sent frame seq, if it is still in the window. 0 if it isn't. */
+uint16_t gbs_frame_kept(gbs_framer_t* fr, uint8_t seq,
+		const uint8_t** frame) {
+	uint8_t age = fr->tx_seq - seq;
+
+	if (age == 0 || age > FRAME_WINDOW)
+		return 0;
+	*frame = fr->win[seq % FRAME_WINDOW];
+	fr->resent++;
+
+	return fr->win_len[seq % FRAME_WINDOW];
+}
+
+/* bytes still missing from the frame coming in, never past its end */
+uint16_t gbs_frame_need(const gbs_framer_t* fr) {
+	uint16_t len;
+
+	if (fr->rx_have < FRAME_HEAD)
+		return FRAME_HEAD - fr->rx_have;
+	len = fr->rx[3] | fr->rx[4] << 8;
+
+	return FRAME_HEAD + len + FRAME_CRC - fr->rx_have;
+}
+
+/* takes one received byte, see FRAME_*. Bytes before a FRAME_SOF are
+ * skipped. A frame numbered below the expected one is a resend of one
+ * already taken and is dropped quietly. */
+uint8_t gbs_frame_byte(gbs_framer_t* fr, uint8_t c) {
+	uint16_t len, crc;
+	uint8_t diff;
+
+	if (fr->rx_have == 0 && c != FRAME_SOF)
+		return FRAME_MORE;
+	fr->rx[fr->rx_have++] = c;
+	if (fr->rx_have < FRAME_HEAD)
+		return FRAME_MORE;
+
+	len = fr->rx[3] | fr->rx[4] << 8;
+	if (len > FRAME_MAX) {
+		fr->rx_have = 0;
+		fr->errors++;
+		return fr->rx_sync ? FRAME_BAD : FRAME_MORE;
+	}
+	if (fr->rx_have < FRAME_HEAD + len + FRAME_CRC)
+		return FRAME_MORE;
+
+	fr->rx_have = 0;
+	crc = fr->rx[FRAME_HEAD + len] | fr->rx[FRAME_HEAD + len + 1] << 8;
+	if (crc != gbs_crc16(0xFFFF, &fr->rx[1], FRAME_HEAD - 1 + len)) {
+		fr->errors++;
+		return fr->rx_sync ? FRAME_BAD : FRAME_MORE;
+	}
+
+	if (fr->rx[2] == FRAME_NAK) {
+		if (len != 1)
+			return FRAME_MORE;
+		fr->nak = fr->rx[FRAME_HEAD];
+		return FRAME_RESEND;
+	}
+
+	if (!fr->rx_sync) {
+		fr->rx_seq = fr->rx[1];
+		fr->rx_sync = 1;
+	}
+	diff = fr->rx[1] - fr->rx_seq;
+	if (diff >= 0x80)
+		return FRAME_MORE;
+	if (diff != 0) {
+		fr->errors++;
+		return FRAME_BAD;
+	}
+	fr->rx_seq++;
+	fr->rx_len = len;
+	fr->rx_cmd = fr->rx[2];
+
+	return FRAME_GOOD;
+}
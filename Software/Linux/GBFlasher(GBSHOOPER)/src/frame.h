@@ -0,0 +1,60 @@
+/*
+============================================================================
+Name        : frame.h
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Protocol v2 framing, see gbshooper.h
+============================================================================
+*/
+
+#ifndef __FRAME_H
+#define __FRAME_H
+
+#include <inttypes.h>
+
+#include "gbshooper.h"
+
+#define FRAME_SIZE		(FRAME_HEAD + FRAME_MAX + FRAME_CRC)
+
+/* what gbs_frame_byte() made of the byte */
+#define FRAME_MORE		0	/* nothing yet */
+#define FRAME_GOOD		1	/* a frame is in, its payload in rx */
+#define FRAME_BAD		2	/* damaged or out of order, NAK rx_seq */
+#define FRAME_RESEND	3	/* the other end NAKed, resend from nak */
+
+/* Types */
+/*********/
+
+/* one end of a framed link. Both ends number their frames from 0 when
+ * the link switches to v2, and keep the last FRAME_WINDOW sent so a NAK
+ * can get them again, go-back-N. NAKs are not numbered. */
+typedef struct
+{
+	uint8_t tx_seq;			/* next frame out */
+	uint8_t rx_seq;			/* next frame expected */
+	uint8_t rx_sync;		/* 0: take the next frame's number as it is */
+	uint8_t nak;			/* FRAME_RESEND: first frame wanted */
+	uint8_t win[FRAME_WINDOW][FRAME_SIZE];
+	uint16_t win_len[FRAME_WINDOW];
+	uint8_t rx[FRAME_SIZE];	/* frame coming in */
+	uint16_t rx_have;
+	uint16_t rx_len;		/* FRAME_GOOD: payload bytes, at rx + FRAME_HEAD */
+	uint8_t rx_cmd;			/* and the command it was tagged with */
+	uint32_t errors;		/* frames NAKed */
+	uint32_t resent;		/* frames sent again */
+} gbs_framer_t;
+
+/* function prototypes */
+/***********************/
+void gbs_frame_init(gbs_framer_t* fr);
+void gbs_frame_resync(gbs_framer_t* fr);
+uint16_t gbs_frame_build(gbs_framer_t* fr, uint8_t cmd, const uint8_t* data,
+		uint16_t len, const uint8_t** frame);
+uint16_t gbs_frame_nak(gbs_framer_t* fr, uint8_t* out);
+uint16_t gbs_frame_kept(gbs_framer_t* fr, uint8_t seq, const uint8_t** frame);
+uint16_t gbs_frame_need(const gbs_framer_t* fr);
+uint8_t gbs_frame_byte(gbs_framer_t* fr, uint8_t c);
+
+#endif
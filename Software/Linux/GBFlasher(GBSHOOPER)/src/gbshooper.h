@@ -28,7 +28,59 @@ Description : Ladecadence.net GameBoy FlashCart interface
 /****************************** DEFINES ***************************************/
 /******************************************************************************/
 
-#define BUFFER_SIZE		256
+#define BUFFER_SIZE		256		/* bloque por defecto, firmware antiguo */
+#define BLOCK_MAX		4096
+
+/* Tamaños de bloque negociables: BUFFER_SIZE << código */
+#define BLOCK_256		0x00
+#define BLOCK_512		0x01
+#define BLOCK_1K		0x02
+#define BLOCK_4K		0x04
+/* primer firmware que negocia el tamaño de bloque */
+#define FW_BLOCK_MAYOR	'0'
+#define FW_BLOCK_MINOR	'2'
+/* primer firmware que acepta CMD_PRG_MODE */
+#define FW_PRG_MODE_MAYOR	'0'
+#define FW_PRG_MODE_MINOR	'2'
+
+/* Formato de bloque en CMD_PRG_FLASH_RLE */
+#define BLOCK_RAW		0x00
+#define BLOCK_RLE		0x01
+#define RLE_MIN_SAVING	16		/* bytes que debe ahorrar un bloque */
+/* primer firmware que descomprime */
+#define FW_RLE_MAYOR	'0'
+#define FW_RLE_MINOR	'3'
+/* primer firmware que empieza las lecturas donde se le diga */
+#define FW_SEEK_MAYOR	'0'
+#define FW_SEEK_MINOR	'4'
+/* primer firmware que borra en segundo plano */
+#define FW_POLL_MAYOR	'0'
+#define FW_POLL_MINOR	'5'
+/* primer firmware que manda el CRC-32 de un bloque en vez del bloque */
+#define FW_CRC_MAYOR	'0'
+#define FW_CRC_MINOR	'6'
+/* primer firmware que habla el protocolo con tramas */
+#define FW_PROTO_MAYOR	'0'
+#define FW_PROTO_MINOR	'7'
+
+/* Protocolos: el de paquetes de 2 bytes y el de tramas (v2). En v2 cada
+ * escritura va en una trama:
+ *   FRAME_SOF, secuencia, comando, longitud (2, little endian), datos,
+ *   CRC-16 CCITT de secuencia a datos (2, little endian)
+ * Dentro van los mismos paquetes y bloques que en el protocolo antiguo.
+ * Una trama dañada o fuera de orden se pide otra vez con FRAME_NAK. */
+#define PROTO_LEGACY	1
+#define PROTO_V2		2
+#define FRAME_SOF		0xA5
+#define FRAME_NAK		0xF0	/* comando: reenviar desde la secuencia en datos */
+#define FRAME_HEAD		5
+#define FRAME_CRC		2
+#define FRAME_MAX		(BLOCK_MAX + 16)	/* datos de una trama */
+#define FRAME_WINDOW	4		/* tramas enviadas que se guardan para reenviar */
+
+/* Ventanas de banco del mapper */
+#define ROM_BANK_SIZE	0x4000
+#define RAM_BANK_SIZE	0x2000
 
 #define GBS_ID			0x17	/* 23 decimal */
 #define VER_MAYOR		0
@@ -60,6 +112,8 @@ Description : Ladecadence.net GameBoy FlashCart interface
 #define STAT_OK			0x14	/* 10.4 ;-) */
 #define STAT_ERROR		0xEE
 #define STAT_TIMEOUT	0xAA
+#define STAT_CANCELLED	0xCC	/* solo en el PC, cancelada por el usuario */
+#define STAT_BUSY		0xBB	/* el chip sigue borrando (DQ6 conmuta) */
 
 /* Tipos de paquetes */
 #define TYPE_COMMAND	0x11
@@ -70,14 +124,28 @@ Description : Ladecadence.net GameBoy FlashCart interface
 /* Comandos */
 #define CMD_ID			0x11
 #define	CMD_READ_FLASH	0x22
+#define CMD_CRC_FLASH	0x23	/* como CMD_READ_FLASH, 4 bytes de CRC-32 */
 #define CMD_READ_RAM	0x33
+#define CMD_CRC_RAM		0x34	/* como CMD_READ_RAM, 4 bytes de CRC-32 */
 #define CMD_PRG_FLASH	0x44
+#define CMD_PRG_FLASH_RLE	0x45	/* bloques con byte de formato */
 #define CMD_PRG_RAM		0x55
 #define CMD_ERASE_FLASH	0x66
+#define CMD_ERASE_START	0x67	/* borra en segundo plano, contesta ya */
+#define CMD_ERASE_STATUS	0x68	/* STAT_BUSY mientras borra, luego STAT_OK */
 #define CMD_ERASE_RAM	0x77
 #define CMD_READ_HEADER	0x88
+#define CMD_PRG_MODE	0x99	/* + DATA mode, DATA write-buffer size */
+#define CMD_SEEK		0x9A	/* + DATA banco, DATA offset alto y bajo */
+#define CMD_PROTO		0x9B	/* + DATA PROTO_*, contesta y luego cambia */
 #define CMD_END			0xFF
 
+/* Algoritmos de programación de la flash */
+#define PRG_AUTO			0x00	/* elegido a partir del ID del chip */
+#define PRG_GENERIC			0x01	/* AA/55/A0 + dato, por byte */
+#define PRG_UNLOCK_BYPASS	0x02	/* A0 + dato, tras un solo desbloqueo */
+#define PRG_WRITE_BUFFER	0x03	/* páginas del buffer de escritura */
+
 /* Mensajes */
 #define MSG_VERSION				"GB Shooper v%d.%d\n"
 #define MSG_READY				"GB Shooper hardware READY\n"
@@ -87,6 +155,8 @@ Description : Ladecadence.net GameBoy FlashCart interface
 #define MSG_FLASH_ERASING		"ERASING FLASH...\n"
 #define MSG_FLASH_ERASED 		"FLASH ERASED\n"
 #define MSG_FLASH_PROGRAMMING	"PROGRAMMING FLASH...\n"
+#define MSG_PRG_MODE			"Program algorithm: %s\n"
+#define MSG_COMPRESSION			"Sent %u of %u bytes, ratio %.2f:1\n"
 #define MSG_FLASH_PROGRAMMED	"FLASH PROGRAMMED\n"
 #define MSG_FLASH_READING	   	"READING FLASH...\n"
 #define MSG_FLASH_READ    		"FLASH READ\n"
@@ -99,6 +169,7 @@ Description : Ladecadence.net GameBoy FlashCart interface
 
 
 #define MSG_TIMEOUT				"TIMEOUT!\n"
+#define MSG_CANCELLED			"CANCELLED\n"
 #define NEWLINE					'\n'
 
 /* Codigos de salida */
@@ -0,0 +1,559 @@
+/*
+============================================================================
+Name        : gbshooperd.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Keeps the flasher open and runs jobs sent over a UNIX socket
+============================================================================
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "gbshooper.h"
+#include "flashcart.h"
+#include "context.h"
+#include "remote.h"
+
+#define GBSD_CLIENTS	64		/* connections served at once */
+#define ERASE_LOG		".gbshooper-erase.log"	/* in $HOME, gbshooper's */
+
+/* Types */
+/*********/
+
+typedef struct gbsd_job gbsd_job_t;
+
+/* a connection, and its job once the request is in */
+typedef struct gbsd_client
+{
+	gbs_remote_t r;
+	gbsd_job_t* job;
+	int slot;				/* in the poll set, -1 if not there yet */
+	uint8_t ended;			/* replied, drop it */
+	struct gbsd_client* next;
+} gbsd_client_t;
+
+/* a request queued on the context. args first: the op's pointer to its
+ * thread_args_t is one to the job too. */
+struct gbsd_job
+{
+	thread_args_t args;
+	gbsd_client_t* client;	/* NULL once it hung up */
+	char name[16];
+	char file[REMOTE_LINE];
+	int fd;					/* the client's file, -1 if none */
+	uint8_t skip[REMOTE_BANKS];
+	gbs_hash_t hash;
+	uint8_t want;			/* HASH_* to sum, 0 for none */
+	status_t status;
+	flash_id_t id;
+	rom_header_t header;
+	gbs_probe_t probe;
+	uint64_t start_ns;
+	uint64_t sent_ns;		/* last progress line */
+};
+
+static volatile sig_atomic_t quit = 0;
+
+static gbs_ctx_t* ctx;
+static uint32_t pending = 0;	/* jobs queued or running */
+static uint8_t reopen = 0;		/* a job failed, the session may be stale */
+
+static void gbsd_signal(int sig) {
+	quit = 1;
+}
+
+static void gbsd_help() {
+	printf("gbshooperd [options]\n");
+	printf("Keeps the flasher open and runs the jobs gbshooper --server ");
+	printf("sends, one at a time,\nin the order they come, streaming their ");
+	printf("progress back.\n\n");
+	printf("\t --socket PATH: listen there, $XDG_RUNTIME_DIR/%s ",
+			REMOTE_SOCKET);
+	printf("by default.\n");
+	printf("\t --device PATH, --proto N, --erase-log FILE: as for ");
+	printf("gbshooper.\n");
+}
+
+static uint64_t gbsd_now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* a reply line to the job's client, if it is still there */
+static void gbsd_reply(gbsd_job_t* job, const char* fmt, ...) {
+	char line[REMOTE_LINE];
+	va_list ap;
+
+	if (job->client == NULL)
+		return;
+	va_start(ap, fmt);
+	vsnprintf(line, sizeof line, fmt, ap);
+	va_end(ap);
+	if (gbs_remote_send(job->client->r.sock, line, -1) != STAT_OK)
+		job->client->ended = 1;
+}
+
+static void gbsd_field_text(gbsd_job_t* job, const char* name,
+		const char* value) {
+	char text[REMOTE_LINE / 2];
+
+	gbs_remote_text(value != NULL ? value : "", text, sizeof text);
+	gbsd_reply(job, "field %s %s", name, text);
+}
+
+/* the quick ones go through the queue too, the worker has the link */
+static void* gbsd_status(void* ptr) {
+	gbsd_job_t* job = (gbsd_job_t*) ptr;
+
+	job->args.ret = gbs_status(job->args.ctx, &job->status);
+	return NULL;
+}
+
+static void* gbsd_id(void* ptr) {
+	gbsd_job_t* job = (gbsd_job_t*) ptr;
+
+	job->args.ret = gbs_flash_id(job->args.ctx, &job->id);
+	return NULL;
+}
+
+static void* gbsd_header(void* ptr) {
+	gbsd_job_t* job = (gbsd_job_t*) ptr;
+
+	job->args.ret = gbs_read_header(job->args.ctx, &job->header);
+	return NULL;
+}
+
+static void* gbsd_probe(void* ptr) {
+	gbsd_job_t* job = (gbsd_job_t*) ptr;
+
+	job->args.ret = gbs_probe_cart(job->args.ctx, &job->probe);
+	return NULL;
+}
+
+static const struct
+{
+	const char* name;
+	void* (*op)(void*);
+} queries[] = {
+	{"status", gbsd_status}, {"id", gbsd_id}, {"header", gbsd_header},
+	{"probe", gbsd_probe}
+};
+
+static void gbsd_progress(thread_args_t* args, void* data) {
+	gbsd_job_t* job = (gbsd_job_t*) data;
+	uint64_t now = gbsd_now();
+
+	if (now - job->sent_ns < REMOTE_PROGRESS_MS * 1000000ULL)
+		return;
+	job->sent_ns = now;
+	gbsd_reply(job, "progress %u %u %u", atomic_load(&args->done_bytes),
+			atomic_load(&args->total_bytes), args->timed);
+}
+
+static void gbsd_free_job(gbsd_job_t* job) {
+	if (job->fd >= 0)
+		close(job->fd);
+	free(job->id.manufacturer);
+	free(job->id.chip);
+	free(job->header.title);
+	free(job->header.cart);
+	free(job->header.rom_size);
+	free(job->header.ram_size);
+	gbs_args_destroy(&job->args);
+	free(job);
+}
+
+/* what the job found, then its end */
+static void gbsd_done(thread_args_t* args, void* data) {
+	gbsd_job_t* job = (gbsd_job_t*) data;
+	char text[REMOTE_LINE];
+	gbs_bank_report_t* bank;
+	uint16_t i;
+
+	if (strcmp(job->name, "status") == 0) {
+		gbsd_reply(job, "field version_mayor %u", job->status.version_mayor);
+		gbsd_reply(job, "field version_minor %u", job->status.version_minor);
+	}
+	else if (strcmp(job->name, "id") == 0) {
+		gbsd_reply(job, "field manufacturer_id %u", job->id.manufacturer_id);
+		gbsd_reply(job, "field chip_id %u", job->id.chip_id);
+		gbsd_reply(job, "field prg_mode %u", job->id.prg_mode);
+		gbsd_reply(job, "field wbuf_size %u", job->id.wbuf_size);
+		gbsd_field_text(job, "manufacturer", job->id.manufacturer);
+		gbsd_field_text(job, "chip", job->id.chip);
+	}
+	else if (strcmp(job->name, "header") == 0) {
+		gbsd_field_text(job, "title", job->header.title);
+		gbsd_field_text(job, "cart", job->header.cart);
+		gbsd_field_text(job, "rom_size", job->header.rom_size);
+		gbsd_field_text(job, "ram_size", job->header.ram_size);
+		gbsd_reply(job, "field rom_bytes %u", job->header.rom_bytes);
+		gbsd_reply(job, "field ram_bytes %u", job->header.ram_bytes);
+	}
+	else if (strcmp(job->name, "probe") == 0) {
+		for (i = 0; i < sizeof job->probe.header; i++)
+			sprintf(&text[i * 2], "%02x", job->probe.header[i]);
+		gbsd_reply(job, "field present %u", job->probe.present);
+		gbsd_reply(job, "field header %s", text);
+		gbsd_reply(job, "field manufacturer_id %u",
+				job->probe.manufacturer_id);
+		gbsd_reply(job, "field chip_id %u", job->probe.chip_id);
+	}
+	else {
+		gbsd_reply(job, "progress %u %u %u", atomic_load(&args->done_bytes),
+				atomic_load(&args->total_bytes), args->timed);
+		gbsd_reply(job, "field erase_ms %u", args->erase_ms);
+		gbsd_reply(job, "field raw_bytes %u", args->raw_bytes);
+		gbsd_reply(job, "field sent_bytes %u", args->sent_bytes);
+		gbs_remote_stats(&args->stats, text, sizeof text);
+		gbsd_reply(job, "field stats %s", text);
+		if (args->report != NULL) {
+			gbsd_reply(job, "field report %u", args->report_banks);
+			for (i = 0; i < args->report_banks; i++) {
+				bank = &args->report[i];
+				gbsd_reply(job, "field bank %u %u %u %u %u %u", bank->bank,
+						bank->blocks, bank->suspect, bank->reads,
+						bank->uncertain, bank->confidence);
+			}
+		}
+		if (job->want) {
+			gbsd_reply(job, "field crc32 %08x", job->hash.crc32);
+			gbs_hash_hex(job->hash.md5, 16, text);
+			gbsd_reply(job, "field md5 %s", text);
+			gbs_hash_hex(job->hash.sha1, 20, text);
+			gbsd_reply(job, "field sha1 %s", text);
+			gbsd_reply(job, "field hash_bytes %" PRIu64, job->hash.bytes);
+		}
+	}
+	gbsd_reply(job, "end %u", args->ret);
+
+	fprintf(stderr, "%s: %s, %.3f s\n", job->name,
+			args->ret == STAT_OK ? "ok" : args->ret == STAT_CANCELLED
+			? "cancelled" : "failed", (gbsd_now() - job->start_ns) / 1e9);
+	if (args->ret == STAT_ERROR || args->ret == STAT_TIMEOUT)
+		reopen = 1;
+	if (job->client != NULL) {
+		job->client->job = NULL;
+		job->client->ended = 1;
+	}
+	pending--;
+	gbsd_free_job(job);
+}
+
+/* ends a request that can't run */
+static void gbsd_refuse(gbsd_client_t* c) {
+	char line[16];
+
+	snprintf(line, sizeof line, "end %u", STAT_ERROR);
+	gbs_remote_send(c->r.sock, line, -1);
+	c->ended = 1;
+}
+
+/* a request line: the job is set up and queued, or refused at once */
+static void gbsd_request(gbsd_client_t* c, char* line) {
+	gbsd_job_t* job;
+	void* (*op)(void*) = NULL;
+	char* words[32], * value;
+	int count = 0, i;
+	uint16_t q, b;
+	unsigned int byte;
+	size_t len;
+
+	while (count < 32 && (words[count] = strtok(count ? NULL : line, " "))
+			!= NULL)
+		count++;
+	if (count == 0 || (job = calloc(1, sizeof(*job))) == NULL) {
+		gbsd_refuse(c);
+		return;
+	}
+
+	memset(&job->args, 0, sizeof(job->args));
+	gbs_args_init(&job->args, ctx);
+	job->client = c;
+	job->fd = -1;
+	job->start_ns = gbsd_now();
+	snprintf(job->name, sizeof job->name, "%s", words[0]);
+	for (q = 0; q < sizeof queries / sizeof queries[0]; q++)
+		if (strcmp(words[0], queries[q].name) == 0)
+			op = queries[q].op;
+	if (op == NULL)
+		op = gbs_remote_op(words[0]);
+
+	for (i = 1; i < count && op != NULL; i++) {
+		if ((value = strchr(words[i], '=')) == NULL)
+			continue;
+		*value++ = '\0';
+		if (strcmp(words[i], "size") == 0)
+			job->args.size = strtol(value, NULL, 10);
+		else if (strcmp(words[i], "offset") == 0)
+			job->args.offset = strtoul(value, NULL, 10);
+		else if (strcmp(words[i], "block") == 0)
+			job->args.block_size = strtoul(value, NULL, 10);
+		else if (strcmp(words[i], "prg_mode") == 0)
+			job->args.prg_mode = strtoul(value, NULL, 10);
+		else if (strcmp(words[i], "compress") == 0)
+			job->args.compress = strtoul(value, NULL, 10);
+		else if (strcmp(words[i], "sequential") == 0)
+			job->args.sequential = strtoul(value, NULL, 10);
+		else if (strcmp(words[i], "robust") == 0)
+			job->args.robust = strtoul(value, NULL, 10);
+		else if (strcmp(words[i], "hash") == 0)
+			job->want = strtoul(value, NULL, 10) & HASH_ALL;
+		else if (strcmp(words[i], "skip") == 0) {
+			/* all of it or nothing, a partial map programs the rest */
+			len = strlen(value);
+			if (len % 2 || len / 2 > REMOTE_BANKS
+					|| strspn(value, "0123456789abcdefABCDEF") != len)
+				op = NULL;
+			for (b = 0; op != NULL && b < len / 2; b++) {
+				sscanf(&value[b * 2], "%2x", &byte);
+				job->skip[b] = byte;
+			}
+			job->args.skip = job->skip;
+			job->args.skip_banks = b;
+		}
+		else if (strcmp(words[i], "file") == 0 && strcmp(value, "-") == 0) {
+			/* the descriptor that came with the request */
+			job->fd = c->r.fd;
+			c->r.fd = -1;
+			job->args.file = "-";
+			job->args.fd = job->fd;
+			if (job->fd < 0)
+				op = NULL;
+		}
+		else if (strcmp(words[i], "file") == 0) {
+			snprintf(job->file, sizeof job->file, "%s", value);
+			job->args.file = job->file;
+		}
+	}
+	/* with no file an operation would take our stdin or stdout */
+	if (op != NULL && strncmp(job->name, "read_", 5) != 0
+			&& strncmp(job->name, "write_", 6) != 0)
+		job->args.file = NULL;
+	else if (op != NULL && job->args.file == NULL)
+		op = NULL;
+
+	if (op == NULL) {
+		gbsd_refuse(c);
+		job->client = NULL;
+		gbsd_free_job(job);
+		return;
+	}
+
+	/* the read starts and stops the summing itself */
+	if (job->want) {
+		gbs_hash_init(&job->hash, job->want);
+		job->args.hash = &job->hash;
+	}
+
+	/* the first job after a quiet spell opens the flasher for the next */
+	if (pending == 0)
+		gbs_session_begin(ctx);
+	c->job = job;
+	gbsd_reply(job, "queued %u", pending);
+	if (gbs_start_op(ctx, op, &job->args, gbsd_progress, gbsd_done, job)
+			!= STAT_OK) {
+		gbsd_reply(job, "end %u", STAT_ERROR);
+		c->job = NULL;
+		c->ended = 1;
+		gbsd_free_job(job);
+		return;
+	}
+	pending++;
+}
+
+/* what came in on a connection: the request, then maybe a cancel */
+static void gbsd_input(gbsd_client_t* c) {
+	char line[REMOTE_LINE];
+
+	if (gbs_remote_fill(&c->r) <= 0) {
+		/* hung up, a job still running is of no use to anybody */
+		if (c->job != NULL) {
+			c->job->client = NULL;
+			gbs_cancel(&c->job->args);
+			c->job = NULL;
+		}
+		c->ended = 1;
+		return;
+	}
+	while (!c->ended && gbs_remote_line(&c->r, line, sizeof line)) {
+		if (c->job == NULL)
+			gbsd_request(c, line);
+		else if (strcmp(line, "cancel") == 0)
+			gbs_cancel(&c->job->args);
+	}
+}
+
+/* drops the connections that are done with */
+static void gbsd_reap(gbsd_client_t** clients, uint32_t* count) {
+	gbsd_client_t* c, ** link = clients;
+
+	while ((c = *link) != NULL) {
+		if (!c->ended) {
+			link = &c->next;
+			continue;
+		}
+		*link = c->next;
+		if (c->job != NULL)
+			c->job->client = NULL;
+		if (c->r.fd >= 0)
+			close(c->r.fd);
+		close(c->r.sock);
+		free(c);
+		(*count)--;
+	}
+}
+
+/* a socket at path, unless a server already answers there */
+static int gbsd_listen(const char* path) {
+	struct sockaddr_un addr;
+	int sock;
+
+	if ((sock = gbs_remote_connect(path)) >= 0) {
+		close(sock);
+		fprintf(stderr, "A gbshooperd already listens at %s\n", path);
+		return -1;
+	}
+	if (strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+	unlink(path);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0
+			|| bind(sock, (struct sockaddr*) &addr, sizeof(addr)) != 0
+			|| chmod(path, 0600) != 0
+			|| listen(sock, GBSD_CLIENTS) != 0) {
+		perror(path);
+		if (sock >= 0)
+			close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+int main(int argc, char* argv[]) {
+	struct pollfd fds[GBSD_CLIENTS + 2];
+	gbsd_client_t* clients = NULL, * c;
+	char path[REMOTE_LINE], erase_log[1024];
+	char* socket_path = NULL, * device = NULL, * log = NULL;
+	uint32_t count = 0;
+	uint8_t proto = 0;
+	int listener, sock, n, i;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 >= argc) {
+			gbsd_help();
+			return EXIT_FAIL;
+		}
+		else if (strcmp(argv[i], "--socket") == 0)
+			socket_path = argv[++i];
+		else if (strcmp(argv[i], "--device") == 0)
+			device = argv[++i];
+		else if (strcmp(argv[i], "--proto") == 0)
+			proto = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--erase-log") == 0)
+			log = argv[++i];
+		else {
+			gbsd_help();
+			return EXIT_FAIL;
+		}
+	}
+	if (socket_path == NULL) {
+		gbs_remote_path(path, sizeof path);
+		socket_path = path;
+	}
+	if (log == NULL && getenv("HOME") != NULL) {
+		snprintf(erase_log, sizeof erase_log, "%s/%s", getenv("HOME"),
+				ERASE_LOG);
+		log = erase_log;
+	}
+
+	if ((ctx = gbs_ctx_new()) == NULL)
+		return EXIT_FAIL;
+	if (device != NULL)
+		gbs_ctx_set_device(ctx, device);
+	gbs_ctx_set_erase_log(ctx, log);
+	gbs_ctx_set_proto(ctx, proto);
+	if ((listener = gbsd_listen(socket_path)) < 0) {
+		gbs_ctx_free(ctx);
+		return EXIT_FAIL;
+	}
+	gbs_session_begin(ctx);
+
+	signal(SIGINT, gbsd_signal);
+	signal(SIGTERM, gbsd_signal);
+	/* a client reading a dump from a pipe may go away */
+	signal(SIGPIPE, SIG_IGN);
+	fprintf(stderr, "Listening at %s\n", socket_path);
+
+	while (!quit) {
+		n = 0;
+		fds[n].fd = gbs_ctx_fd(ctx);
+		fds[n++].events = POLLIN;
+		fds[n].fd = count < GBSD_CLIENTS ? listener : -1;
+		fds[n++].events = POLLIN;
+		for (c = clients; c != NULL; c = c->next) {
+			c->slot = n;
+			fds[n].fd = c->r.sock;
+			fds[n++].events = POLLIN;
+		}
+		for (i = 0; i < n; i++)
+			fds[i].revents = 0;
+		if (poll(fds, n, pending ? REMOTE_PROGRESS_MS : -1) < 0)
+			continue;
+
+		for (c = clients; c != NULL; c = c->next)
+			if (c->slot >= 0 && fds[c->slot].revents != 0 && !c->ended)
+				gbsd_input(c);
+		if (fds[1].revents != 0
+				&& (sock = accept(listener, NULL, NULL)) >= 0) {
+			/* only our own user's jobs, see gbs_remote_peer_ok() */
+			if (!gbs_remote_peer_ok(sock)
+					|| (c = calloc(1, sizeof(*c))) == NULL)
+				close(sock);
+			else {
+				gbs_remote_init(&c->r, sock);
+				c->slot = -1;
+				c->next = clients;
+				clients = c;
+				count++;
+			}
+		}
+
+		gbs_ctx_dispatch(ctx);
+		gbsd_reap(&clients, &count);
+
+		/* a flasher unplugged and back gets a fresh link */
+		if (reopen && pending == 0) {
+			gbs_session_end(ctx);
+			reopen = 0;
+		}
+	}
+
+	for (c = clients; c != NULL; c = c->next)
+		c->ended = 1;
+	gbsd_reap(&clients, &count);
+	gbs_ctx_free(ctx);
+	close(listener);
+	unlink(socket_path);
+
+	return EXIT_WIN;
+}
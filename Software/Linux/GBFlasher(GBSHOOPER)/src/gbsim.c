@@ -0,0 +1,839 @@
+/*
+============================================================================
+Name        : gbsim.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Software model of the flasher and cartridge
+============================================================================
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gbsim.h"
+#include "gbshooper.h"
+#include "hash.h"
+#include "rle.h"
+
+/* receiver states */
+#define SIM_IDLE		0	/* waiting for a packet type */
+#define SIM_PACKET		1	/* waiting for the packet data */
+#define SIM_BLOCK		2	/* receiving a raw block */
+#define SIM_FORMAT		3	/* waiting for a block format byte */
+#define SIM_RLE			4	/* waiting for an RLE control byte */
+#define SIM_RLE_LIT		5	/* receiving RLE literals */
+#define SIM_RLE_RUN		6	/* waiting for the RLE repeated byte */
+
+#define IS_PRG_FLASH(c)	((c) == CMD_PRG_FLASH || (c) == CMD_PRG_FLASH_RLE)
+#define IS_RAM(c)		((c) == CMD_READ_RAM || (c) == CMD_CRC_RAM \
+		|| (c) == CMD_PRG_RAM || (c) == CMD_ERASE_RAM)
+
+#define MODE(m)			(1 << (m))
+
+/* typical datasheet timings */
+const gbsim_chip_t gbsim_chips[] = {
+	{0x01, 0xA4, "29F040B", S_512K, MODE(PRG_GENERIC),
+		0, 7000, 0, 8000},
+	{0x01, 0xAD, "AM29F016", S_2MB,
+		MODE(PRG_GENERIC) | MODE(PRG_UNLOCK_BYPASS),
+		0, 7000, 0, 25000},
+	{0x01, 0xD5, "AM29F080", S_1MB,
+		MODE(PRG_GENERIC) | MODE(PRG_UNLOCK_BYPASS),
+		0, 7000, 0, 16000},
+	{0x04, 0xAD, "MBM29F016", S_2MB, MODE(PRG_GENERIC),
+		0, 8000, 0, 25000},
+	{0x01, 0x7E, "S29GL032", S_4MB,
+		MODE(PRG_GENERIC) | MODE(PRG_UNLOCK_BYPASS) | MODE(PRG_WRITE_BUFFER),
+		32, 60000, 240000, 32000},
+	{0xC2, 0x7E, "MX29GL032", S_4MB,
+		MODE(PRG_GENERIC) | MODE(PRG_UNLOCK_BYPASS) | MODE(PRG_WRITE_BUFFER),
+		32, 11000, 90000, 25000}
+};
+const uint16_t gbsim_chips_count = sizeof gbsim_chips / sizeof gbsim_chips[0];
+
+
+const gbsim_chip_t* gbsim_find_chip(const char* name) {
+	uint16_t i;
+
+	for (i = 0; i < gbsim_chips_count; i++)
+		if (strcmp(name, gbsim_chips[i].name) == 0)
+			return &gbsim_chips[i];
+
+	return NULL;
+}
+
+uint16_t gbsim_init(gbsim_t* sim, const gbsim_chip_t* chip,
+		uint32_t ram_size) {
+
+	memset(sim, 0, sizeof(gbsim_t));
+	sim->chip = chip;
+	sim->ram_size = ram_size ? ram_size : 1;
+	sim->baudrate = BAUDRATE_230_4K;
+	sim->prg_mode = PRG_GENERIC;
+	sim->max_block = BLOCK_4K;
+	sim->fw_mayor = GBSIM_FW_MAYOR;
+	sim->fw_minor = GBSIM_FW_MINOR;
+	sim->latency_ns = GBSIM_LATENCY_NS;
+	sim->block_size = BUFFER_SIZE;
+	sim->mbc = GBSIM_MBC5;
+	sim->t_byte_ns = chip->t_byte_ns;
+	sim->t_wbuf_ns = chip->t_wbuf_ns;
+	sim->t_erase_ms = chip->t_erase_ms;
+	sim->seed = 0x6B5;
+	sim->proto = PROTO_LEGACY;
+	sim->rom_lo = 1;
+	sim->fw_rom_bank = sim->fw_ram_bank = GBSIM_NO_BANK;
+
+	/* blank flash, cleared RAM */
+	if ((sim->flash = malloc(chip->size)) == NULL)
+		return STAT_ERROR;
+	memset(sim->flash, 0xFF, chip->size);
+	if ((sim->ram = calloc(sim->ram_size, 1)) == NULL) {
+		free(sim->flash);
+		return STAT_ERROR;
+	}
+
+	return STAT_OK;
+}
+
+void gbsim_free(gbsim_t* sim) {
+	free(sim->flash);
+	free(sim->ram);
+	sim->flash = NULL;
+	sim->ram = NULL;
+}
+
+void gbsim_purge(gbsim_t* sim) {
+	sim->out_head = sim->out_tail = 0;
+}
+
+/* time one byte takes on the serial link */
+static void gbsim_wire(gbsim_t* sim, uint32_t bytes) {
+	sim->clock_ns += (uint64_t) bytes * 10 * 1000000000ULL / sim->baudrate;
+}
+
+/* a random bit to flip ppm times in a million, 0 the other times */
+static uint8_t gbsim_damage(gbsim_t* sim, uint32_t ppm) {
+	if (ppm == 0)
+		return 0;
+
+	/* xorshift32 */
+	sim->seed ^= sim->seed << 13;
+	sim->seed ^= sim->seed >> 17;
+	sim->seed ^= sim->seed << 5;
+	if (sim->seed % 1000000 >= ppm)
+		return 0;
+
+	return 1 << (sim->seed >> 24) % 8;
+}
+
+/* damages a wire byte now and then, if asked to */
+static uint8_t gbsim_wire_byte(gbsim_t* sim, uint8_t c) {
+	uint8_t bit = gbsim_damage(sim, sim->corrupt_ppm);
+
+	if (bit != 0)
+		sim->corrupted++;
+	return c ^ bit;
+}
+
+/* one byte onto the wire to the host */
+static void gbsim_out(gbsim_t* sim, uint8_t c) {
+	c = gbsim_wire_byte(sim, c);
+	if (sim->out_head - sim->out_tail >= GBSIM_FIFO_SIZE)
+		return;		/* host is not reading, drop like the UART would */
+	sim->out[sim->out_head++ % GBSIM_FIFO_SIZE] = c;
+}
+
+static void gbsim_out_frame(gbsim_t* sim, const uint8_t* frame,
+		uint16_t len) {
+	uint16_t i;
+
+	for (i=0; i<len; i++)
+		gbsim_out(sim, frame[i]);
+}
+
+/* v2: what the request produced goes out as one frame */
+static void gbsim_flush(gbsim_t* sim) {
+	const uint8_t* frame;
+	uint16_t len;
+
+	if (sim->pend_len == 0)
+		return;
+	len = gbs_frame_build(&sim->framer, sim->frame_cmd, sim->pend,
+			sim->pend_len, &frame);
+	gbsim_out_frame(sim, frame, len);
+	sim->pend_len = 0;
+}
+
+static void gbsim_put(gbsim_t* sim, uint8_t c) {
+	if (sim->proto != PROTO_V2) {
+		gbsim_out(sim, c);
+		return;
+	}
+	sim->pend[sim->pend_len++] = c;
+	if (sim->pend_len == FRAME_MAX)
+		gbsim_flush(sim);
+}
+
+static void gbsim_reply(gbsim_t* sim, uint8_t type, uint8_t data) {
+	gbsim_put(sim, type);
+	gbsim_put(sim, data);
+}
+
+static void gbsim_bus(gbsim_t* sim, uint64_t writes, uint64_t wait_ns) {
+	uint64_t ns = writes * GBSIM_BUS_CYCLE_NS + wait_ns;
+
+	sim->bus_writes += writes;
+	sim->prg_ns += ns;
+	sim->clock_ns += ns;
+}
+
+/* the cartridge: mapper registers below 8000, RAM at A000-BFFF */
+static void gbsim_cart_write(gbsim_t* sim, uint16_t addr, uint8_t data) {
+	sim->bus_writes++;
+	sim->clock_ns += GBSIM_BUS_CYCLE_NS;
+
+	if (sim->mbc == GBSIM_MBC_NONE)
+		return;
+
+	switch (addr >> 13) {
+		case 0:		/* 0000-1FFF */
+			sim->ram_enabled = (data & 0x0F) == 0x0A;
+			break;
+		case 1:		/* 2000-3FFF */
+			if (sim->mbc == GBSIM_MBC1)
+				sim->rom_lo = (data & 0x1F) ? (data & 0x1F) : 1;
+			else if (sim->mbc == GBSIM_MBC3)
+				sim->rom_lo = (data & 0x7F) ? (data & 0x7F) : 1;
+			else if (addr < 0x3000)
+				sim->rom_lo = data;
+			else
+				sim->rom_hi = data & 0x01;
+			break;
+		case 2:		/* 4000-5FFF */
+			sim->ram_bank = data & (sim->mbc == GBSIM_MBC5 ? 0x0F : 0x03);
+			break;
+		case 3:		/* 6000-7FFF */
+			if (sim->mbc == GBSIM_MBC1)
+				sim->mbc1_mode = data & 0x01;
+			break;
+	}
+}
+
+/* flash offset a cart ROM address decodes to */
+static uint32_t gbsim_rom_phys(gbsim_t* sim, uint16_t addr) {
+	uint32_t bank = 0;
+
+	if (sim->mbc == GBSIM_MBC_NONE)
+		return addr & 0x7FFF;
+
+	if (addr < GBSIM_ROM_BANK) {
+		/* MBC1 mode 1 also banks the low window */
+		if (sim->mbc == GBSIM_MBC1 && sim->mbc1_mode)
+			bank = sim->ram_bank << 5;
+	}
+	else if (sim->mbc == GBSIM_MBC1)
+		bank = (sim->ram_bank << 5) | sim->rom_lo;
+	else if (sim->mbc == GBSIM_MBC5)
+		bank = (sim->rom_hi << 8) | sim->rom_lo;
+	else
+		bank = sim->rom_lo;
+
+	return (bank * GBSIM_ROM_BANK + (addr & 0x3FFF)) % sim->chip->size;
+}
+
+/* RAM offset a cart A000-BFFF address decodes to */
+static uint32_t gbsim_ram_phys(gbsim_t* sim, uint16_t addr) {
+	uint32_t bank = sim->ram_bank;
+
+	if (sim->mbc == GBSIM_MBC_NONE || (sim->mbc == GBSIM_MBC1
+				&& !sim->mbc1_mode))
+		bank = 0;
+
+	return (bank * GBSIM_RAM_BANK + (addr & 0x1FFF)) % sim->ram_size;
+}
+
+/* what the firmware does to reach a linear ROM address: select its bank
+ * through the mapper when it changes, then use the cart address */
+static uint16_t gbsim_rom_addr(gbsim_t* sim, uint32_t linear) {
+	uint32_t bank = linear / GBSIM_ROM_BANK;
+	uint16_t offset = linear & 0x3FFF;
+
+	if (bank == 0 && !(sim->mbc == GBSIM_MBC1 && sim->mbc1_mode))
+		return offset;
+	if (sim->mbc == GBSIM_MBC_NONE)
+		return offset | GBSIM_ROM_BANK;
+	if (bank == sim->fw_rom_bank)
+		return (sim->mbc == GBSIM_MBC1 && (bank & 0x1F) == 0) ? offset
+			: offset | GBSIM_ROM_BANK;
+
+	sim->fw_rom_bank = bank;
+	switch (sim->mbc) {
+		case GBSIM_MBC1:
+			gbsim_cart_write(sim, 0x4000, bank >> 5);
+			/* banks 00/20/40/60 only show up in the low window, mode 1 */
+			if ((bank & 0x1F) == 0) {
+				gbsim_cart_write(sim, 0x6000, 1);
+				return offset;
+			}
+			gbsim_cart_write(sim, 0x6000, 0);
+			gbsim_cart_write(sim, 0x2000, bank & 0x1F);
+			break;
+		case GBSIM_MBC3:
+			gbsim_cart_write(sim, 0x2000, bank & 0x7F);
+			break;
+		default:
+			gbsim_cart_write(sim, 0x2000, bank & 0xFF);
+			gbsim_cart_write(sim, 0x3000, bank >> 8);
+			break;
+	}
+
+	return offset | GBSIM_ROM_BANK;
+}
+
+/* the same for save RAM, enabling it first */
+static uint16_t gbsim_ram_addr(gbsim_t* sim, uint32_t linear) {
+	uint32_t bank = linear / GBSIM_RAM_BANK;
+
+	if (sim->mbc != GBSIM_MBC_NONE && !sim->ram_enabled)
+		gbsim_cart_write(sim, 0x0000, 0x0A);
+	if (sim->mbc != GBSIM_MBC_NONE && bank != sim->fw_ram_bank) {
+		sim->fw_ram_bank = bank;
+		if (sim->mbc == GBSIM_MBC1) {
+			gbsim_cart_write(sim, 0x6000, 1);
+			/* shares the register with the upper ROM bits */
+			sim->fw_rom_bank = GBSIM_NO_BANK;
+		}
+		gbsim_cart_write(sim, 0x4000, bank);
+	}
+
+	return 0xA000 | (linear & 0x1FFF);
+}
+
+static uint8_t gbsim_cart_read(gbsim_t* sim, uint16_t addr) {
+	uint8_t bit = gbsim_damage(sim, sim->flaky_ppm);
+
+	if (sim->cart_out)
+		return 0xFF;
+	if (bit != 0)
+		sim->flaky_reads++;
+	if (addr < 0x8000)
+		return sim->flash[gbsim_rom_phys(sim, addr)] ^ bit;
+	if (sim->mbc != GBSIM_MBC_NONE && !sim->ram_enabled)
+		return 0xFF;
+	return sim->ram[gbsim_ram_phys(sim, addr)] ^ bit;
+}
+
+/* a bank 0 byte, as CMD_READ_HEADER reads it */
+static uint8_t gbsim_header(gbsim_t* sim, uint16_t addr) {
+	return sim->cart_out ? 0xFF : sim->flash[addr];
+}
+
+static void gbsim_cart_write_ram(gbsim_t* sim, uint16_t addr, uint8_t data) {
+	if (sim->mbc != GBSIM_MBC_NONE && !sim->ram_enabled)
+		return;
+	sim->ram[gbsim_ram_phys(sim, addr)] = data;
+}
+
+/* sends the next block of ROM or RAM and remembers its checksum */
+static void gbsim_send_block(gbsim_t* sim, uint8_t ram) {
+	uint16_t i;
+	uint8_t c;
+
+	sim->check = 0;
+	for (i=0; i<sim->block_size; i++) {
+		if (ram)
+			c = gbsim_cart_read(sim, gbsim_ram_addr(sim, sim->addr + i));
+		else
+			c = gbsim_cart_read(sim, gbsim_rom_addr(sim, sim->addr + i));
+		sim->check += c;
+		gbsim_put(sim, c);
+	}
+	sim->addr += sim->block_size;
+	sim->clock_ns += sim->block_size * GBSIM_BUS_CYCLE_NS;
+}
+
+/* reads the next block of ROM or RAM, but sends only its CRC-32, most
+ * significant byte first. There is no check, a bad CRC only costs the
+ * host a read it didn't need. */
+static void gbsim_send_crc(gbsim_t* sim, uint8_t ram) {
+	uint8_t block[BLOCK_MAX];
+	uint32_t crc;
+	uint16_t i;
+
+	for (i=0; i<sim->block_size; i++)
+		block[i] = gbsim_cart_read(sim, ram
+				? gbsim_ram_addr(sim, sim->addr + i)
+				: gbsim_rom_addr(sim, sim->addr + i));
+	crc = gbs_crc32(0, block, sim->block_size);
+	for (i=0; i<4; i++)
+		gbsim_put(sim, crc >> (24 - 8 * i));
+	sim->addr += sim->block_size;
+	sim->clock_ns += sim->block_size * GBSIM_BUS_CYCLE_NS;
+}
+
+static void gbsim_program(gbsim_t* sim) {
+	uint16_t i, page;
+	uint8_t check = 0;
+
+	/* programming can only clear bits */
+	for (i=0; i<sim->block_len; i++) {
+		sim->flash[gbsim_rom_phys(sim, gbsim_rom_addr(sim, sim->addr + i))]
+			&= sim->block[i];
+		check += sim->block[i];
+	}
+
+	switch (sim->prg_mode) {
+		case PRG_WRITE_BUFFER:
+			/* AA, 55, 25, count, data..., 29 per page */
+			for (i=0; i<sim->block_len; i+=page) {
+				page = sim->wbuf_size;
+				if (page > sim->block_len - i)
+					page = sim->block_len - i;
+				gbsim_bus(sim, page + 5, sim->t_wbuf_ns);
+			}
+			break;
+		case PRG_UNLOCK_BYPASS:
+			/* A0, data */
+			gbsim_bus(sim, 2 * sim->block_len,
+					(uint64_t) sim->block_len * sim->t_byte_ns);
+			break;
+		default:
+			/* AA, 55, A0, data */
+			gbsim_bus(sim, 4 * sim->block_len,
+					(uint64_t) sim->block_len * sim->t_byte_ns);
+			break;
+	}
+
+	sim->addr += sim->block_len;
+	gbsim_reply(sim, TYPE_DATA, check);
+}
+
+static void gbsim_write_ram(gbsim_t* sim) {
+	uint16_t i;
+	uint8_t check = 0;
+
+	for (i=0; i<sim->block_len; i++) {
+		gbsim_cart_write_ram(sim, gbsim_ram_addr(sim, sim->addr + i),
+				sim->block[i]);
+		check += sim->block[i];
+	}
+	sim->addr += sim->block_len;
+	sim->clock_ns += sim->block_len * GBSIM_BUS_CYCLE_NS;
+	gbsim_reply(sim, TYPE_DATA, check);
+}
+
+static void gbsim_set_mode(gbsim_t* sim) {
+	uint8_t mode = sim->args[0], wbuf = sim->args[1];
+	uint8_t ok;
+
+	ok = mode < 8 && (sim->chip->modes & MODE(mode));
+	if (mode == PRG_WRITE_BUFFER)
+		ok = ok && wbuf != 0 && wbuf <= sim->chip->wbuf_size;
+
+	if (ok) {
+		sim->prg_mode = mode;
+		sim->wbuf_size = wbuf;
+	}
+	gbsim_reply(sim, TYPE_STAT, ok ? STAT_OK : STAT_ERROR);
+}
+
+/* grants the largest supported block size not above the requested one. A
+ * plain info request is an old host: back to BUFFER_SIZE, no answer. */
+static void gbsim_set_block(gbsim_t* sim, uint8_t request) {
+	uint8_t block = request;
+
+	if (block > sim->max_block)
+		block = sim->max_block;
+	/* no 2K blocks */
+	if (block != BLOCK_4K && block > BLOCK_1K)
+		block = BLOCK_1K;
+
+	sim->block_size = BUFFER_SIZE << block;
+	if (request != BLOCK_256)
+		gbsim_reply(sim, TYPE_INFO, block);
+}
+
+/* CMD_SEEK: the next session starts at a bank and an offset in its window */
+static void gbsim_seek(gbsim_t* sim) {
+	sim->seek = 1;
+	sim->seek_bank = sim->args[0];
+	sim->seek_offset = (sim->args[1] << 8) | sim->args[2];
+	gbsim_reply(sim, TYPE_STAT, STAT_OK);
+}
+
+/* CMD_PROTO: agrees to a protocol it knows, answering in the current one.
+ * The switch waits for the reply to be out. */
+static void gbsim_proto(gbsim_t* sim, uint8_t proto) {
+	if (proto != PROTO_LEGACY && proto != PROTO_V2) {
+		gbsim_reply(sim, TYPE_STAT, STAT_ERROR);
+		return;
+	}
+	gbsim_reply(sim, TYPE_STAT, STAT_OK);
+	sim->proto_next = proto;
+}
+
+static uint8_t gbsim_fw(gbsim_t* sim, uint8_t mayor, uint8_t minor) {
+	return sim->fw_mayor > mayor
+		|| (sim->fw_mayor == mayor && sim->fw_minor >= minor);
+}
+
+/* whether the modelled firmware has the command; the real one drops
+ * commands it doesn't know, so the host must not rely on them */
+static uint8_t gbsim_knows(gbsim_t* sim, uint8_t cmd) {
+	switch (cmd) {
+		case CMD_PRG_MODE:
+			return gbsim_fw(sim, FW_PRG_MODE_MAYOR, FW_PRG_MODE_MINOR);
+		case CMD_PRG_FLASH_RLE:
+			return gbsim_fw(sim, FW_RLE_MAYOR, FW_RLE_MINOR);
+		case CMD_SEEK:
+			return gbsim_fw(sim, FW_SEEK_MAYOR, FW_SEEK_MINOR);
+		case CMD_ERASE_START:
+		case CMD_ERASE_STATUS:
+			return gbsim_fw(sim, FW_POLL_MAYOR, FW_POLL_MINOR);
+		case CMD_CRC_FLASH:
+		case CMD_CRC_RAM:
+			return gbsim_fw(sim, FW_CRC_MAYOR, FW_CRC_MINOR);
+		case CMD_PROTO:
+			return gbsim_fw(sim, FW_PROTO_MAYOR, FW_PROTO_MINOR);
+		default:
+			return 1;
+	}
+}
+
+/* starts or continues a command session, acknowledging the first command */
+static uint8_t gbsim_session(gbsim_t* sim, uint8_t cmd) {
+	if (sim->cmd == cmd)
+		return 0;
+
+	sim->cmd = cmd;
+	sim->addr = 0;
+	if (sim->seek)
+		sim->addr = sim->seek_bank * (IS_RAM(cmd) ? GBSIM_RAM_BANK
+				: GBSIM_ROM_BANK) + sim->seek_offset;
+	sim->seek = 0;
+	sim->fw_rom_bank = sim->fw_ram_bank = GBSIM_NO_BANK;
+	return 1;
+}
+
+static void gbsim_command(gbsim_t* sim, uint8_t cmd) {
+	const gbsim_chip_t* chip = sim->chip;
+	uint32_t i;
+
+	if (!gbsim_knows(sim, cmd))
+		return;
+
+	switch (cmd) {
+		case CMD_ID:
+			gbsim_reply(sim, TYPE_DATA,
+					sim->cart_out ? 0xFF : chip->manufacturer_id);
+			gbsim_reply(sim, TYPE_DATA, sim->cart_out ? 0xFF : chip->chip_id);
+			break;
+		case CMD_READ_HEADER:
+			gbsim_reply(sim, TYPE_DATA, gbsim_header(sim, 0x147));
+			gbsim_reply(sim, TYPE_DATA, gbsim_header(sim, 0x148));
+			gbsim_reply(sim, TYPE_DATA, gbsim_header(sim, 0x149));
+			for (i=0; i<16; i++)
+				gbsim_reply(sim, TYPE_DATA, gbsim_header(sim, 0x134 + i));
+			break;
+		case CMD_READ_FLASH:
+			gbsim_session(sim, cmd);
+			gbsim_send_block(sim, 0);
+			break;
+		case CMD_READ_RAM:
+			gbsim_session(sim, cmd);
+			gbsim_send_block(sim, 1);
+			break;
+		case CMD_CRC_FLASH:
+		case CMD_CRC_RAM:
+			gbsim_session(sim, cmd);
+			gbsim_send_crc(sim, cmd == CMD_CRC_RAM);
+			break;
+		case CMD_PRG_FLASH:
+		case CMD_PRG_FLASH_RLE:
+		case CMD_PRG_RAM:
+			if (gbsim_session(sim, cmd)) {
+				/* unlock bypass is entered once per session: AA, 55, 20 */
+				if (IS_PRG_FLASH(cmd) && sim->prg_mode == PRG_UNLOCK_BYPASS)
+					gbsim_bus(sim, 3, 0);
+				gbsim_reply(sim, TYPE_STAT, STAT_OK);
+			}
+			sim->block_len = 0;
+			sim->state = (cmd == CMD_PRG_FLASH_RLE) ? SIM_FORMAT : SIM_BLOCK;
+			break;
+		case CMD_ERASE_FLASH:
+			/* AA, 55, 80, AA, 55, 10 */
+			memset(sim->flash, 0xFF, chip->size);
+			sim->bus_writes += 6;
+			sim->clock_ns += (uint64_t) sim->t_erase_ms * 1000000;
+			gbsim_reply(sim, TYPE_STAT, STAT_OK);
+			break;
+		case CMD_ERASE_START:
+			/* the same, but the chip works on its own */
+			memset(sim->flash, 0xFF, chip->size);
+			sim->bus_writes += 6;
+			sim->erase_end_ns = sim->clock_ns
+				+ (uint64_t) sim->t_erase_ms * 1000000;
+			gbsim_reply(sim, TYPE_STAT, STAT_OK);
+			break;
+		case CMD_ERASE_STATUS:
+			/* toggle bit: DQ6 changes on every read while it erases */
+			gbsim_reply(sim, TYPE_STAT, sim->clock_ns < sim->erase_end_ns
+					? STAT_BUSY : STAT_OK);
+			break;
+		case CMD_ERASE_RAM:
+			if (gbsim_session(sim, cmd))
+				gbsim_reply(sim, TYPE_STAT, STAT_OK);
+			for (i=0; i<sim->block_size; i++)
+				gbsim_cart_write_ram(sim, gbsim_ram_addr(sim, sim->addr + i), 0);
+			sim->addr += sim->block_size;
+			sim->clock_ns += sim->block_size * GBSIM_BUS_CYCLE_NS;
+			gbsim_reply(sim, TYPE_STAT, STAT_OK);
+			break;
+		case CMD_PRG_MODE:
+		case CMD_SEEK:
+		case CMD_PROTO:
+			sim->cmd = cmd;
+			sim->nargs = 0;
+			break;
+		case CMD_END:
+			/* leave unlock bypass: 90, 00 */
+			if (IS_PRG_FLASH(sim->cmd) && sim->prg_mode == PRG_UNLOCK_BYPASS)
+				gbsim_bus(sim, 2, 0);
+			sim->cmd = 0;
+			sim->prg_mode = PRG_GENERIC;
+			break;
+		default:
+			break;
+	}
+}
+
+static void gbsim_packet(gbsim_t* sim, uint8_t type, uint8_t data) {
+	switch (type) {
+		case TYPE_INFO:
+			gbsim_reply(sim, TYPE_INFO, GBS_ID);
+			gbsim_reply(sim, TYPE_INFO, sim->fw_mayor);
+			gbsim_reply(sim, TYPE_INFO, sim->fw_minor);
+			/* older firmware ignores the block size byte */
+			if (gbsim_fw(sim, FW_BLOCK_MAYOR, FW_BLOCK_MINOR))
+				gbsim_set_block(sim, data);
+			break;
+		case TYPE_COMMAND:
+			gbsim_command(sim, data);
+			break;
+		case TYPE_DATA:
+			if (sim->cmd == CMD_PRG_MODE) {
+				sim->args[sim->nargs++] = data;
+				if (sim->nargs == 2) {
+					sim->cmd = 0;
+					gbsim_set_mode(sim);
+				}
+			}
+			else if (sim->cmd == CMD_PROTO) {
+				sim->cmd = 0;
+				gbsim_proto(sim, data);
+			}
+			else if (sim->cmd == CMD_SEEK) {
+				sim->args[sim->nargs++] = data;
+				if (sim->nargs == 3) {
+					sim->cmd = 0;
+					gbsim_seek(sim);
+				}
+			}
+			else if (sim->cmd == CMD_READ_FLASH || sim->cmd == CMD_READ_RAM) {
+				/* host checksum of the last block, a bad one ends it */
+				gbsim_reply(sim, TYPE_STAT,
+						data == sim->check ? STAT_OK : CMD_END);
+				if (data != sim->check)
+					sim->cmd = 0;
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+/* stores a received block byte, programming the block once it's whole */
+static void gbsim_block_byte(gbsim_t* sim, uint8_t c) {
+	sim->block[sim->block_len++] = c;
+	if (sim->block_len < sim->block_size)
+		return;
+
+	sim->state = SIM_IDLE;
+	if (IS_PRG_FLASH(sim->cmd))
+		gbsim_program(sim);
+	else
+		gbsim_write_ram(sim);
+}
+
+/* run-length decoder, see rle.h */
+static void gbsim_rle_byte(gbsim_t* sim, uint8_t c) {
+	switch (sim->state) {
+		case SIM_RLE:
+			if (c < RLE_NOP) {
+				sim->rle_count = c + 1;
+				sim->state = SIM_RLE_LIT;
+			}
+			else if (c > RLE_NOP) {
+				sim->rle_count = 257 - c;
+				sim->state = SIM_RLE_RUN;
+			}
+			break;
+		case SIM_RLE_LIT:
+			if (--sim->rle_count == 0)
+				sim->state = SIM_RLE;
+			gbsim_block_byte(sim, c);
+			break;
+		case SIM_RLE_RUN:
+			sim->state = SIM_RLE;
+			while (sim->rle_count-- && sim->state == SIM_RLE)
+				gbsim_block_byte(sim, c);
+			break;
+	}
+}
+
+static uint64_t gbsim_now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* time passes with the link quiet, a chip erase goes on meanwhile */
+void gbsim_idle(gbsim_t* sim, uint64_t ns) {
+	sim->clock_ns += ns;
+	sim->idle_ns += ns;
+}
+
+/* Runs the model in real time, for measuring what the host does between
+ * transfers: a host that comes back late finds the clock moved on to now,
+ * and replies are held back until the clock says they are due. The
+ * clock then is wall time since the model started. */
+void gbsim_realtime(gbsim_t* sim) {
+	sim->realtime = 1;
+	sim->wall0_ns = gbsim_now() - sim->clock_ns;
+}
+
+/* a byte of the old protocol, packets and blocks */
+static void gbsim_byte(gbsim_t* sim, uint8_t c) {
+	switch (sim->state) {
+		case SIM_IDLE:
+			sim->type = c;
+			sim->state = SIM_PACKET;
+			break;
+		case SIM_PACKET:
+			sim->state = SIM_IDLE;
+			gbsim_packet(sim, sim->type, c);
+			break;
+		case SIM_BLOCK:
+			gbsim_block_byte(sim, c);
+			break;
+		case SIM_FORMAT:
+			sim->state = (c == BLOCK_RLE) ? SIM_RLE : SIM_BLOCK;
+			break;
+		default:
+			gbsim_rle_byte(sim, c);
+			break;
+	}
+}
+
+/* takes a CMD_PROTO switch once its reply is out */
+static void gbsim_switch(gbsim_t* sim) {
+	if (sim->proto_next == 0)
+		return;
+	sim->proto = sim->proto_next;
+	sim->proto_next = 0;
+	gbs_frame_init(&sim->framer);
+	sim->pend_len = 0;
+}
+
+/* a byte of a v2 frame. The payload of a good one goes through the old
+ * protocol and the reply is framed. A TYPE_INFO where a frame should
+ * start is a host that doesn't know we switched: back to the old one. */
+static void gbsim_frame_byte(gbsim_t* sim, uint8_t c) {
+	uint8_t nak[FRAME_HEAD + 1 + FRAME_CRC];
+	const uint8_t* frame;
+	uint16_t i, len;
+	uint8_t seq;
+
+	if (sim->framer.rx_have == 0 && c == TYPE_INFO) {
+		sim->proto = PROTO_LEGACY;
+		gbsim_byte(sim, c);
+		return;
+	}
+
+	switch (gbs_frame_byte(&sim->framer, c)) {
+		case FRAME_GOOD:
+			sim->frame_cmd = sim->framer.rx_cmd;
+			for (i=0; i<sim->framer.rx_len; i++)
+				gbsim_byte(sim, sim->framer.rx[FRAME_HEAD + i]);
+			gbsim_flush(sim);
+			gbsim_switch(sim);
+			break;
+		case FRAME_BAD:
+			gbsim_out_frame(sim, nak, gbs_frame_nak(&sim->framer, nak));
+			break;
+		case FRAME_RESEND:
+			for (seq = sim->framer.nak; seq != sim->framer.tx_seq; seq++)
+				if ((len = gbs_frame_kept(&sim->framer, seq, &frame)) != 0)
+					gbsim_out_frame(sim, frame, len);
+			break;
+		default:
+			break;
+	}
+}
+
+int gbsim_write(gbsim_t* sim, const uint8_t* buf, int len) {
+	uint64_t now;
+	int i;
+	uint8_t c;
+
+	if (sim->realtime) {
+		now = gbsim_now() - sim->wall0_ns;
+		if (sim->clock_ns < now)
+			sim->clock_ns = now;
+	}
+	gbsim_wire(sim, len);
+	sim->rx_bytes += len;
+	sim->turnaround = 1;
+	for (i=0; i<len; i++) {
+		c = gbsim_wire_byte(sim, buf[i]);
+		if (sim->proto == PROTO_V2)
+			gbsim_frame_byte(sim, c);
+		else {
+			gbsim_byte(sim, c);
+			gbsim_switch(sim);
+		}
+	}
+
+	return len;
+}
+
+int gbsim_read(gbsim_t* sim, uint8_t* buf, int len) {
+	struct timespec ts;
+	uint64_t due;
+	int n = 0;
+
+	if (sim->realtime) {
+		due = sim->wall0_ns + sim->clock_ns;
+		ts.tv_sec = due / 1000000000ULL;
+		ts.tv_nsec = due % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+
+	while (n < len && sim->out_tail != sim->out_head)
+		buf[n++] = sim->out[sim->out_tail++ % GBSIM_FIFO_SIZE];
+	gbsim_wire(sim, n);
+
+	/* the first answer after a request waits for the link to turn around */
+	if (n > 0 && sim->turnaround) {
+		sim->clock_ns += sim->latency_ns;
+		sim->turnaround = 0;
+	}
+
+	return n;
+}
@@ -0,0 +1,141 @@
+/*
+============================================================================
+Name        : gbsim.h
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Software model of the flasher and cartridge
+============================================================================
+*/
+
+#ifndef __GBSIM_H
+#define __GBSIM_H
+
+#include <inttypes.h>
+
+#include "frame.h"
+#include "gbshooper.h"
+
+#define GBSIM_FIFO_SIZE		8192
+#define GBSIM_BUS_CYCLE_NS	1000	/* one cart bus write from the MCU */
+#define GBSIM_LATENCY_NS	1000000	/* USB turnaround, host write to reply */
+
+/* firmware version reported by the model unless told otherwise */
+#define GBSIM_FW_MAYOR		'0'
+#define GBSIM_FW_MINOR		'7'
+
+/* cartridge mappers */
+#define GBSIM_MBC_NONE		0
+#define GBSIM_MBC1			1
+#define GBSIM_MBC3			3
+#define GBSIM_MBC5			5
+
+#define GBSIM_ROM_BANK		0x4000
+#define GBSIM_RAM_BANK		0x2000
+#define GBSIM_NO_BANK		0xFFFFFFFF
+
+/* Types */
+/*********/
+
+/* a flash chip as seen from the cart bus */
+typedef struct
+{
+	uint8_t manufacturer_id;
+	uint8_t chip_id;
+	char* name;
+	uint32_t size;
+	uint8_t modes;			/* supported PRG_* algorithms, (1 << mode) */
+	uint8_t wbuf_size;		/* write buffer size in bytes, 0 if none */
+	uint32_t t_byte_ns;		/* typical byte program time */
+	uint32_t t_wbuf_ns;		/* typical write buffer program time */
+	uint32_t t_erase_ms;	/* typical chip erase time */
+} gbsim_chip_t;
+
+typedef struct
+{
+	const gbsim_chip_t* chip;
+	uint8_t* flash;
+	uint8_t* ram;
+	uint32_t ram_size;
+	uint32_t baudrate;
+	uint8_t max_block;		/* largest BLOCK_* code the firmware grants */
+	uint8_t fw_mayor;		/* firmware version, as the flasher sends it; */
+	uint8_t fw_minor;		/* commands newer than it are ignored */
+	uint32_t latency_ns;	/* link turnaround time */
+	uint8_t realtime;		/* keep the clock in step with the host's */
+	uint64_t wall0_ns;		/* monotonic time the clock started at */
+	uint8_t mbc;			/* GBSIM_MBC_*, mapper on the cart */
+	uint32_t t_byte_ns;		/* program and erase timings, from the chip */
+	uint32_t t_wbuf_ns;
+	uint32_t t_erase_ms;
+	uint32_t corrupt_ppm;	/* wire bytes damaged, per million */
+	uint32_t flaky_ppm;		/* cart bus reads damaged, per million */
+	uint32_t seed;			/* corruption random state */
+	uint8_t cart_out;		/* the slot is empty, the bus floats high */
+
+	/* mapper registers */
+	uint8_t rom_lo;			/* 2000-3FFF */
+	uint8_t rom_hi;			/* MBC5 3000-3FFF */
+	uint8_t ram_bank;		/* 4000-5FFF, MBC1 upper ROM bits too */
+	uint8_t mbc1_mode;		/* MBC1 6000-7FFF */
+	uint8_t ram_enabled;	/* 0000-1FFF */
+	uint32_t fw_rom_bank;	/* banks the firmware last selected */
+	uint32_t fw_ram_bank;
+
+	/* protocol state */
+	uint8_t state;
+	uint8_t type;			/* type of the packet being received */
+	uint8_t cmd;			/* command session in progress */
+	uint8_t args[3];		/* CMD_PRG_MODE and CMD_SEEK arguments */
+	uint8_t nargs;
+	uint8_t seek;			/* CMD_SEEK: where the next session starts */
+	uint8_t seek_bank;
+	uint16_t seek_offset;
+	uint8_t check;			/* checksum of the last block sent */
+	uint8_t prg_mode;
+	uint8_t wbuf_size;
+	uint32_t addr;
+	uint16_t block_size;	/* negotiated transfer block size */
+	uint8_t block[BLOCK_MAX];
+	uint16_t block_len;
+	uint8_t rle_count;		/* literals or repeats left in the RLE code */
+	uint8_t proto;			/* PROTO_* the host talks */
+	uint8_t proto_next;		/* CMD_PROTO: switch once the reply is out */
+	gbs_framer_t framer;	/* v2 */
+	uint8_t frame_cmd;		/* command of the frame being answered */
+	uint8_t pend[FRAME_MAX];	/* v2 reply, framed at the end of the request */
+	uint16_t pend_len;
+
+	/* device to host fifo */
+	uint8_t out[GBSIM_FIFO_SIZE];
+	uint32_t out_head, out_tail;
+	uint8_t turnaround;		/* host wrote since it last read */
+
+	/* virtual time and bus activity */
+	uint64_t clock_ns;		/* link + device time */
+	uint64_t prg_ns;		/* time spent programming the flash */
+	uint64_t idle_ns;		/* time the link was quiet, see gbsim_idle() */
+	uint64_t erase_end_ns;	/* CMD_ERASE_START: when the chip is done */
+	uint64_t bus_writes;	/* cart bus write cycles */
+	uint64_t rx_bytes;		/* bytes received from the host */
+	uint64_t corrupted;		/* wire bytes damaged */
+	uint64_t flaky_reads;	/* cart bus reads damaged */
+} gbsim_t;
+
+extern const gbsim_chip_t gbsim_chips[];
+extern const uint16_t gbsim_chips_count;
+
+/* function prototypes */
+/***********************/
+const gbsim_chip_t* gbsim_find_chip(const char* name);
+uint16_t gbsim_init(gbsim_t* sim, const gbsim_chip_t* chip,
+		uint32_t ram_size);
+void gbsim_free(gbsim_t* sim);
+void gbsim_purge(gbsim_t* sim);
+int gbsim_write(gbsim_t* sim, const uint8_t* buf, int len);
+int gbsim_read(gbsim_t* sim, uint8_t* buf, int len);
+void gbsim_idle(gbsim_t* sim, uint64_t ns);
+void gbsim_realtime(gbsim_t* sim);
+
+#endif
@@ -0,0 +1,304 @@
+/*
+============================================================================
+Name        : gbsimd.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Serves the software device model on a pseudo terminal
+============================================================================
+*/
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gbshooper.h"
+#include "gbsim.h"
+
+#define POLL_MS		200
+
+static volatile sig_atomic_t quit = 0;
+static volatile sig_atomic_t swap = 0;
+
+static void gbsimd_signal(int sig) {
+	quit = 1;
+}
+
+/* SIGUSR1 pulls the cart out, or puts it back */
+static void gbsimd_swap(int sig) {
+	swap = 1;
+}
+
+static void gbsimd_help() {
+	uint16_t i;
+
+	printf("gbsimd [options]\n");
+	printf("Opens a pseudo terminal, prints its path and answers on it like ");
+	printf("the flasher would.\nPoint gbshooper at it with --device PATH.\n\n");
+	printf("\t --chip NAME: flash chip on the cart (default S29GL032).\n");
+	printf("\t --mbc N: mapper, 0 (none), 1, 3 or 5 (default 5).\n");
+	printf("\t --ram BYTES: save RAM size (default 131072).\n");
+	printf("\t --rom FILE: preload the flash with FILE.\n");
+	printf("\t --sav FILE: preload the save RAM with FILE.\n");
+	printf("\t --fw M.N: firmware version to report, commands newer than it ");
+	printf("are ignored\n\t\t (default %c.%c).\n", GBSIM_FW_MAYOR,
+			GBSIM_FW_MINOR);
+	printf("\t --baud N: link speed the wire time is based on.\n");
+	printf("\t --latency-us N: link turnaround time.\n");
+	printf("\t --byte-ns N, --wbuf-ns N, --erase-ms N: program and erase ");
+	printf("times,\n\t\t the chip's typical ones by default.\n");
+	printf("\t --corrupt-ppm N: bytes damaged on the wire, per million.\n");
+	printf("\t --flaky-ppm N: cart reads damaged, per million, like dirty ");
+	printf("contacts.\n");
+	printf("\t --seed N: corruption random seed.\n");
+	printf("\t --no-cart: start with the slot empty. SIGUSR1 puts the cart ");
+	printf("in, or takes it out.\n");
+	printf("\t --realtime: hold replies back until the model's clock says ");
+	printf("they are due.\n");
+	printf("\t --link PATH: also make PATH a symlink to the terminal.\n");
+	printf("\nChips:");
+	for (i = 0; i < gbsim_chips_count; i++)
+		printf(" %s", gbsim_chips[i].name);
+	printf("\n");
+}
+
+static uint64_t gbsimd_now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* sleeps until a monotonic time */
+static void gbsimd_sleep_until(uint64_t ns) {
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0
+			&& !quit)
+		;
+}
+
+static uint16_t gbsimd_load(const char* file, uint8_t* mem, uint32_t size) {
+	FILE* f;
+
+	if ((f = fopen(file, "rb")) == NULL) {
+		fprintf(stderr, "Can't open %s\n", file);
+		return STAT_ERROR;
+	}
+	if (fread(mem, 1, size, f) == 0)
+		fprintf(stderr, "%s is empty\n", file);
+	fclose(f);
+
+	return STAT_OK;
+}
+
+static int gbsimd_write_all(int fd, const uint8_t* buf, int len) {
+	int n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) < 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* the master side of a raw pty, the slave is kept open so the master
+ * doesn't see a hangup between host sessions */
+static int gbsimd_pty(int* slave) {
+	struct termios tio;
+	int master;
+
+	if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0
+			|| grantpt(master) != 0 || unlockpt(master) != 0)
+		return -1;
+	if ((*slave = open(ptsname(master), O_RDWR | O_NOCTTY)) < 0)
+		return -1;
+	if (tcgetattr(*slave, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(*slave, TCSANOW, &tio);
+	}
+
+	return master;
+}
+
+int main(int argc, char* argv[]) {
+	gbsim_t sim;
+	const gbsim_chip_t* chip = gbsim_find_chip("S29GL032");
+	char* rom = NULL, * sav = NULL, * link = NULL;
+	uint32_t ram_size = S_128K, mbc = GBSIM_MBC5;
+	int32_t baud = -1, latency_us = -1, byte_ns = -1, wbuf_ns = -1;
+	int32_t erase_ms = -1;
+	uint32_t corrupt_ppm = 0, flaky_ppm = 0, seed = 0;
+	uint8_t realtime = 0, cart_out = 0;
+	const char* fw = NULL;
+	uint8_t in[BLOCK_MAX], out[BLOCK_MAX];
+	uint64_t wall0, virt0, busy = 0;
+	struct pollfd p;
+	int master, slave, n, i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--realtime") == 0)
+			realtime = 1;
+		else if (strcmp(argv[i], "--no-cart") == 0)
+			cart_out = 1;
+		else if (i + 1 >= argc) {
+			gbsimd_help();
+			return EXIT_FAIL;
+		}
+		else if (strcmp(argv[i], "--chip") == 0) {
+			if ((chip = gbsim_find_chip(argv[++i])) == NULL) {
+				fprintf(stderr, "Unknown chip %s\n", argv[i]);
+				return EXIT_FAIL;
+			}
+		}
+		else if (strcmp(argv[i], "--mbc") == 0)
+			mbc = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--ram") == 0)
+			ram_size = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--rom") == 0)
+			rom = argv[++i];
+		else if (strcmp(argv[i], "--sav") == 0)
+			sav = argv[++i];
+		else if (strcmp(argv[i], "--fw") == 0) {
+			fw = argv[++i];
+			if (!isdigit(fw[0]) || fw[1] != '.' || !isdigit(fw[2])
+					|| fw[3]) {
+				fprintf(stderr, "Bad firmware version %s\n", fw);
+				return EXIT_FAIL;
+			}
+		}
+		else if (strcmp(argv[i], "--baud") == 0)
+			baud = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--latency-us") == 0)
+			latency_us = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--byte-ns") == 0)
+			byte_ns = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--wbuf-ns") == 0)
+			wbuf_ns = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--erase-ms") == 0)
+			erase_ms = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--corrupt-ppm") == 0)
+			corrupt_ppm = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--flaky-ppm") == 0)
+			flaky_ppm = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--seed") == 0)
+			seed = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--link") == 0)
+			link = argv[++i];
+		else {
+			gbsimd_help();
+			return EXIT_FAIL;
+		}
+	}
+	if (mbc != GBSIM_MBC_NONE && mbc != GBSIM_MBC1 && mbc != GBSIM_MBC3
+			&& mbc != GBSIM_MBC5) {
+		fprintf(stderr, "Unknown mapper %u\n", mbc);
+		return EXIT_FAIL;
+	}
+
+	if (gbsim_init(&sim, chip, ram_size) != STAT_OK)
+		return EXIT_FAIL;
+	sim.mbc = mbc;
+	sim.corrupt_ppm = corrupt_ppm;
+	sim.flaky_ppm = flaky_ppm;
+	sim.cart_out = cart_out;
+	if (fw) {
+		sim.fw_mayor = fw[0];
+		sim.fw_minor = fw[2];
+	}
+	if (seed)
+		sim.seed = seed;
+	if (baud > 0)
+		sim.baudrate = baud;
+	if (latency_us >= 0)
+		sim.latency_ns = latency_us * 1000;
+	if (byte_ns >= 0)
+		sim.t_byte_ns = byte_ns;
+	if (wbuf_ns >= 0)
+		sim.t_wbuf_ns = wbuf_ns;
+	if (erase_ms >= 0)
+		sim.t_erase_ms = erase_ms;
+	if ((rom != NULL && gbsimd_load(rom, sim.flash, chip->size) != STAT_OK)
+			|| (sav != NULL
+				&& gbsimd_load(sav, sim.ram, sim.ram_size) != STAT_OK))
+		return EXIT_FAIL;
+
+	if ((master = gbsimd_pty(&slave)) < 0) {
+		perror("pty");
+		return EXIT_FAIL;
+	}
+	if (link != NULL) {
+		unlink(link);
+		if (symlink(ptsname(master), link) != 0) {
+			perror(link);
+			return EXIT_FAIL;
+		}
+	}
+	printf("%s\n", ptsname(master));
+	fflush(stdout);
+
+	signal(SIGINT, gbsimd_signal);
+	signal(SIGTERM, gbsimd_signal);
+	signal(SIGUSR1, gbsimd_swap);
+
+	while (!quit) {
+		if (swap) {
+			swap = 0;
+			sim.cart_out = !sim.cart_out;
+			fprintf(stderr, "cart %s\n", sim.cart_out ? "out" : "in");
+		}
+		p.fd = master;
+		p.events = POLLIN;
+		if (poll(&p, 1, POLL_MS) <= 0)
+			continue;
+		if ((n = read(master, in, sizeof in)) <= 0) {
+			usleep(POLL_MS * 1000);
+			continue;
+		}
+
+		/* the host was idle until now, so the model's clock restarts here.
+		 * A background erase goes on meanwhile: in real time by as long
+		 * as the host was quiet, otherwise it is just over. */
+		wall0 = gbsimd_now();
+		if (realtime && busy != 0 && wall0 > busy)
+			gbsim_idle(&sim, wall0 - busy);
+		else if (!realtime && sim.clock_ns < sim.erase_end_ns)
+			gbsim_idle(&sim, sim.erase_end_ns - sim.clock_ns);
+		virt0 = sim.clock_ns;
+		gbsim_write(&sim, in, n);
+		while ((n = gbsim_read(&sim, out, sizeof out)) > 0) {
+			if (realtime)
+				gbsimd_sleep_until(wall0 + (sim.clock_ns - virt0));
+			if (gbsimd_write_all(master, out, n) < 0)
+				break;
+		}
+		busy = wall0 + (sim.clock_ns - virt0);
+	}
+
+	fprintf(stderr, "%" PRIu64 " bytes in, %" PRIu64 " bus writes, %"
+			PRIu64 " bytes corrupted, %" PRIu64 " flaky cart reads, %.3f s "
+			"of device time\n", sim.rx_bytes, sim.bus_writes, sim.corrupted,
+			sim.flaky_reads,
+			(sim.clock_ns - sim.idle_ns) / 1e9);
+	if (link != NULL)
+		unlink(link);
+	close(slave);
+	close(master);
+	gbsim_free(&sim);
+
+	return EXIT_WIN;
+}
@@ -0,0 +1,209 @@
+/*
+============================================================================
+Name        : gbstrace.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Offline analyzer for packet traces
+============================================================================
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gbshooper.h"
+#include "trace.h"
+
+#define GAP_MS		10		/* idle link time worth reporting */
+#define STALL_MS	100		/* device reply time worth reporting */
+#define MAX_REPORTS	20		/* gaps and stalls listed */
+
+typedef struct
+{
+	uint8_t code;
+	char* name;
+} cmd_name_t;
+
+static const cmd_name_t cmd_names[] = {
+	{CMD_ID, "id"}, {CMD_READ_FLASH, "read flash"},
+	{CMD_CRC_FLASH, "crc flash"}, {CMD_READ_RAM, "read ram"},
+	{CMD_CRC_RAM, "crc ram"}, {CMD_PRG_FLASH, "prg flash"},
+	{CMD_PRG_FLASH_RLE, "prg flash rle"}, {CMD_PRG_RAM, "prg ram"},
+	{CMD_ERASE_FLASH, "erase flash"}, {CMD_ERASE_START, "erase start"},
+	{CMD_ERASE_STATUS, "erase status"}, {CMD_ERASE_RAM, "erase ram"},
+	{CMD_READ_HEADER, "read header"}, {CMD_PRG_MODE, "prg mode"},
+	{CMD_SEEK, "seek"}, {CMD_PROTO, "proto"}, {CMD_END, "end"}
+};
+
+/* per command timing: from the command packet to the next one */
+typedef struct
+{
+	uint32_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint32_t replies;
+	uint64_t reply_ns;		/* command to first byte back */
+	uint32_t timeouts;
+} cmd_stats_t;
+
+/* index 256 holds TYPE_INFO exchanges */
+static cmd_stats_t cmds[257];
+
+static const char* cmd_name(uint16_t code) {
+	static char unknown[8];
+	uint16_t i;
+
+	if (code == 256)
+		return "info";
+	for (i = 0; i < sizeof cmd_names / sizeof cmd_names[0]; i++)
+		if (cmd_names[i].code == code)
+			return cmd_names[i].name;
+	snprintf(unknown, sizeof unknown, "0x%.2X", code);
+	return unknown;
+}
+
+static void gbstrace_help() {
+	printf("gbstrace [--gap ms] [--stall ms] <trace file>\n");
+	printf("\t --gap: report idle link intervals longer than this ");
+	printf("(default %d ms).\n", GAP_MS);
+	printf("\t --stall: report device replies slower than this ");
+	printf("(default %d ms).\n", STALL_MS);
+}
+
+int main(int argc, char* argv[]) {
+	trace_header_t header;
+	trace_event_t* ev;
+	FILE* f;
+	char* file = NULL;
+	uint64_t gap_ns = GAP_MS * 1000000ULL, stall_ns = STALL_MS * 1000000ULL;
+	uint64_t dt, wait_from = 0, cmd_start = 0;
+	uint32_t i, gaps = 0, stalls = 0, timeouts = 0;
+	int32_t cmd = -1;
+	uint8_t replied = 1, waiting = 0;
+
+	for (i = 1; i < (uint32_t) argc; i++) {
+		if (strcmp(argv[i], "--gap") == 0 && i + 1 < (uint32_t) argc)
+			gap_ns = atoi(argv[++i]) * 1000000ULL;
+		else if (strcmp(argv[i], "--stall") == 0 && i + 1 < (uint32_t) argc)
+			stall_ns = atoi(argv[++i]) * 1000000ULL;
+		else
+			file = argv[i];
+	}
+	if (file == NULL) {
+		gbstrace_help();
+		return EXIT_FAIL;
+	}
+
+	if ((f = fopen(file, "rb")) == NULL
+			|| fread(&header, sizeof(header), 1, f) != 1
+			|| memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0
+			|| header.version != TRACE_VERSION) {
+		fprintf(stderr, "%s: not a trace file\n", file);
+		return EXIT_FAIL;
+	}
+	if ((ev = malloc((header.count + 1) * sizeof(trace_event_t))) == NULL
+			|| fread(ev, sizeof(trace_event_t), header.count, f)
+				!= header.count) {
+		fprintf(stderr, "%s: truncated trace\n", file);
+		return EXIT_FAIL;
+	}
+	fclose(f);
+
+	printf("%u events", header.count);
+	if (header.dropped)
+		printf(" (%" PRIu64 " older ones overwritten)", header.dropped);
+	if (header.count)
+		printf(", %.3f ms", (ev[header.count-1].t_ns - ev[0].t_ns) / 1e6);
+	printf("\n\n");
+
+	for (i = 0; i < header.count; i++) {
+		/* idle link */
+		dt = i ? ev[i].t_ns - ev[i-1].t_ns : 0;
+		if (dt > gap_ns && gaps++ < MAX_REPORTS)
+			printf("gap    %10.3f ms at %12.3f ms, %s -> %s\n", dt / 1e6,
+					ev[i-1].t_ns / 1e6, gbs_trace_kind_name(ev[i-1].kind),
+					gbs_trace_kind_name(ev[i].kind));
+
+		switch (ev[i].kind) {
+			case TRACE_TX_PACKET:
+			case TRACE_TX_DATA:
+				wait_from = ev[i].t_ns;
+				waiting = 1;
+				if (ev[i].kind == TRACE_TX_DATA || (ev[i].a != TYPE_COMMAND
+							&& ev[i].a != TYPE_INFO))
+					break;
+				/* a new command closes the previous one */
+				if (cmd >= 0) {
+					dt = ev[i].t_ns - cmd_start;
+					cmds[cmd].total_ns += dt;
+					if (dt > cmds[cmd].max_ns)
+						cmds[cmd].max_ns = dt;
+				}
+				cmd = ev[i].a == TYPE_INFO ? 256 : ev[i].b;
+				cmds[cmd].count++;
+				cmd_start = ev[i].t_ns;
+				replied = 0;
+				break;
+
+			case TRACE_RX_PACKET:
+			case TRACE_RX_BYTE:
+				if (waiting) {
+					dt = ev[i].t_ns - wait_from;
+					if (dt > stall_ns && stalls++ < MAX_REPORTS)
+						printf("stall  %10.3f ms at %12.3f ms, %s\n", dt / 1e6,
+								wait_from / 1e6, cmd >= 0 ? cmd_name(cmd) : "-");
+					waiting = 0;
+				}
+				if (cmd >= 0 && !replied) {
+					cmds[cmd].replies++;
+					cmds[cmd].reply_ns += ev[i].t_ns - cmd_start;
+					replied = 1;
+				}
+				break;
+
+			case TRACE_TIMEOUT:
+				timeouts++;
+				if (cmd >= 0)
+					cmds[cmd].timeouts++;
+				printf("timeout           at %12.3f ms, %s\n",
+						ev[i].t_ns / 1e6, cmd >= 0 ? cmd_name(cmd) : "-");
+				waiting = 0;
+				break;
+
+			case TRACE_CLOSE:
+				if (cmd >= 0) {
+					dt = ev[i].t_ns - cmd_start;
+					cmds[cmd].total_ns += dt;
+					if (dt > cmds[cmd].max_ns)
+						cmds[cmd].max_ns = dt;
+				}
+				cmd = -1;
+				waiting = 0;
+				break;
+
+			default:
+				break;
+		}
+	}
+	if (gaps > MAX_REPORTS || stalls > MAX_REPORTS)
+		printf("(only the first %d gaps and stalls listed)\n", MAX_REPORTS);
+	printf("%u gaps over %.1f ms, %u stalls over %.1f ms, %u timeouts\n\n",
+			gaps, gap_ns / 1e6, stalls, stall_ns / 1e6, timeouts);
+
+	printf("%-14s %8s %12s %10s %10s %10s %8s\n", "command", "count",
+			"total ms", "avg ms", "max ms", "reply ms", "timeouts");
+	for (i = 0; i < 257; i++) {
+		if (cmds[i].count == 0)
+			continue;
+		printf("%-14s %8u %12.3f %10.3f %10.3f %10.3f %8u\n", cmd_name(i),
+				cmds[i].count, cmds[i].total_ns / 1e6,
+				cmds[i].total_ns / 1e6 / cmds[i].count, cmds[i].max_ns / 1e6,
+				cmds[i].replies ? cmds[i].reply_ns / 1e6 / cmds[i].replies : 0,
+				cmds[i].timeouts);
+	}
+
+	free(ev);
+	return EXIT_WIN;
+}
@@ -14,6 +14,7 @@ Description : Ladecadence.net GameBoy FlashCart interface
 #include <time.h>
 #include <pthread.h>
 #include <gtk/gtk.h>
+#include <glib-unix.h>
 
 
 #ifndef __BUILD_WINDOWS__
@@ -25,6 +26,10 @@ Description : Ladecadence.net GameBoy FlashCart interface
 #include "gbshooper.h"
 #include "communications.h"
 #include "flashcart.h"
+#include "context.h"
+
+/* the flasher, its callbacks are dispatched from the main loop */
+static gbs_ctx_t *ctx;
 
 /* Callback function in which reacts to the "response" signal from the user in
  * the message dialog window.
@@ -56,7 +61,7 @@ about_cb (GSimpleAction *simple,
    gchar* status_text;
    
    // check hardware
-   erc = gbs_status(&status);
+   erc = gbs_status(ctx, &status);
    if (erc != STAT_OK)
    {	
 	 status_text = g_strdup_printf("Hardware not detected\n");
@@ -120,7 +125,7 @@ status_cb (GSimpleAction *simple,
    												GTK_MESSAGE_INFO,
    												GTK_BUTTONS_CLOSE,
    												"Status");
-  erc = gbs_status(&status);
+  erc = gbs_status(ctx, &status);
   if (erc != STAT_OK)
   {
 	gtk_message_dialog_format_secondary_text((GtkMessageDialog*)status_dialog,
@@ -153,7 +158,7 @@ header_cb (GSimpleAction *simple,
    												GTK_BUTTONS_CLOSE,
    												"Cart Info");
 
-  erc = gbs_read_header(&header);
+  erc = gbs_read_header(ctx, &header);
   if (erc != STAT_OK)
   {
 	gtk_message_dialog_format_secondary_text((GtkMessageDialog*)header_dialog,
@@ -177,58 +182,184 @@ RAM Size: %s\n",
 
 }
 
+/* a flashcart operation running in the background, with its own window.
+ * The operation runs on the context's worker, its progress and result come
+ * back through gbs_ctx_dispatch() in the main loop.
+ */
+typedef struct
+{
+  GtkWidget *window;
+  GtkWidget *info_label;
+  GtkWidget *progress_bar;
+  GtkWidget *button;
+  const gchar *done_text;
+  const gchar *fail_text;
+  guint timer;
+  gboolean running;
+  thread_args_t targs;
+} gui_job_t;
+
+#define GUI_PULSE_MS	100	/* progress bar pulse period, length unknown */
+
 static void
-erase_rom_cb (GSimpleAction *simple,
-          GVariant      *parameter,
-          gpointer       user_data)
+job_close (GtkButton *button,
+           gpointer   user_data)
 {
-   GtkWidget *erase_rom_window, *vbox, *progress_bar,
-   			 *info_label, *button;
-   GThread *exec_thread;
-   thread_args_t targs;
-	
-   erase_rom_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-   gtk_window_set_deletable (GTK_WINDOW(erase_rom_window), FALSE);
-   gtk_window_set_modal(GTK_WINDOW(erase_rom_window), TRUE);
-   vbox = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
-  
-  info_label = gtk_label_new("Erasing ROM...");
-  progress_bar = gtk_progress_bar_new();
-  gtk_progress_bar_set_pulse_step (GTK_PROGRESS_BAR(progress_bar), 0.1);
-  button = gtk_button_new_with_label("Close");
-  gtk_widget_set_sensitive(button, FALSE);
-  g_signal_connect (button, "clicked", G_CALLBACK (gtk_main_quit),
-                    NULL);
-  gtk_box_pack_start(GTK_BOX(vbox), info_label, TRUE, TRUE, 0 );												
-  gtk_box_pack_start(GTK_BOX(vbox), progress_bar, TRUE, TRUE, 0 );
-  gtk_box_pack_start(GTK_BOX(vbox), button, TRUE, TRUE, 0 );
-  
-  gtk_container_add (GTK_CONTAINER (erase_rom_window), vbox);
-  
-  gtk_widget_show_all(erase_rom_window);
-												
-  targs.stat = T_RUNNING;
-  exec_thread = g_thread_new("erase_flash", &gbs_erase_flash, (void*) &targs);
-  while (targs.stat != T_END)
+  gui_job_t *job = user_data;
+
+  gtk_widget_destroy (job->window);
+  g_free (job->targs.file);
+  g_free (job);
+}
+
+/* cancels the operation while it runs, closes the window after */
+static void
+job_button (GtkButton *button,
+            gpointer   user_data)
+{
+  gui_job_t *job = user_data;
+
+  if (!job->running)
+  {
+	job_close (button, job);
+	return;
+  }
+
+  gbs_cancel (&job->targs);
+  gtk_button_set_label (button, "Cancelling...");
+  gtk_widget_set_sensitive (job->button, FALSE);
+}
+
+/* creates the job window, with the progress bar and a cancel button */
+static gui_job_t*
+job_new (const gchar *text)
+{
+  gui_job_t *job;
+  GtkWidget *vbox;
+
+  job = g_new0 (gui_job_t, 1);
+
+  job->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+  gtk_window_set_deletable (GTK_WINDOW(job->window), FALSE);
+  gtk_window_set_modal(GTK_WINDOW(job->window), TRUE);
+  vbox = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
+
+  job->info_label = gtk_label_new(text);
+  job->progress_bar = gtk_progress_bar_new();
+  gtk_progress_bar_set_pulse_step (GTK_PROGRESS_BAR(job->progress_bar), 0.1);
+  job->button = gtk_button_new_with_label("Cancel");
+  job->running = TRUE;
+  g_signal_connect (job->button, "clicked", G_CALLBACK (job_button), job);
+  gtk_box_pack_start(GTK_BOX(vbox), job->info_label, TRUE, TRUE, 0 );
+  gtk_box_pack_start(GTK_BOX(vbox), job->progress_bar, TRUE, TRUE, 0 );
+  gtk_box_pack_start(GTK_BOX(vbox), job->button, TRUE, TRUE, 0 );
+
+  gtk_container_add (GTK_CONTAINER (job->window), vbox);
+
+  gtk_widget_show_all(job->window);
+
+  return job;
+}
+
+/* shows the result and lets the user close the window */
+static void
+job_finish (gui_job_t *job, gboolean ok)
+{
+  if (!ok && job->targs.ret == STAT_CANCELLED)
   {
-	gtk_progress_bar_pulse (GTK_PROGRESS_BAR(progress_bar));
-	gtk_main_iteration ();
+	gtk_label_set_text (GTK_LABEL(job->info_label), "Cancelled");
+	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(job->progress_bar), 0);
   }
-  if (targs.ret != STAT_OK)
+  else if (!ok)
   {
-	gtk_label_set_text (GTK_LABEL(info_label), "Erase ROM Failed!");
-	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(progress_bar), 0);
+	gtk_label_set_text (GTK_LABEL(job->info_label), job->fail_text);
+	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(job->progress_bar), 0);
   }
   else {
-  	gtk_label_set_text (GTK_LABEL(info_label), "ROM Erased");
-  	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(progress_bar), 1);
+  	gtk_label_set_text (GTK_LABEL(job->info_label), job->done_text);
+  	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(job->progress_bar), 1);
   }
-  
-  gtk_widget_set_sensitive(button, TRUE);
-  gtk_main();
-  gtk_widget_destroy (erase_rom_window);
-  g_thread_unref (exec_thread);
 
+  job->running = FALSE;
+  gtk_button_set_label (GTK_BUTTON(job->button), "Close");
+  gtk_widget_set_sensitive(job->button, TRUE);
+}
+
+/* main loop timer, keeps the bar moving while the length is unknown */
+static gboolean
+job_pulse (gpointer user_data)
+{
+  gui_job_t *job = user_data;
+
+  if (atomic_load(&job->targs.total_bytes) == 0)
+	gtk_progress_bar_pulse (GTK_PROGRESS_BAR(job->progress_bar));
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+job_progress (thread_args_t *args,
+              void          *data)
+{
+  gui_job_t *job = data;
+
+  gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(job->progress_bar),
+								 gbs_fraction(args));
+}
+
+static void
+job_done (thread_args_t *args,
+          void          *data)
+{
+  gui_job_t *job = data;
+
+  g_source_remove (job->timer);
+  gbs_args_destroy (&job->targs);
+  job_finish (job, job->targs.ret == STAT_OK);
+}
+
+/* the context has callbacks for us */
+static gboolean
+ctx_ready (gint         fd,
+           GIOCondition condition,
+           gpointer     user_data)
+{
+  gbs_ctx_dispatch (ctx);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* runs op in the background, the callback returns to the main loop at once */
+static void
+job_start (gui_job_t   *job,
+           void*      (*op)(void*),
+           const gchar *done_text,
+           const gchar *fail_text)
+{
+  job->done_text = done_text;
+  job->fail_text = fail_text;
+
+  job->timer = g_timeout_add (GUI_PULSE_MS, job_pulse, job);
+  if (gbs_start_op (ctx, op, &job->targs, job_progress, job_done, job)
+	  != STAT_OK)
+  {
+	g_source_remove (job->timer);
+	gbs_args_destroy (&job->targs);
+	job_finish (job, FALSE);
+  }
+}
+
+static void
+erase_rom_cb (GSimpleAction *simple,
+          GVariant      *parameter,
+          gpointer       user_data)
+{
+  gui_job_t *job;
+
+  job = job_new("Erasing ROM...");
+
+  gbs_args_init(&job->targs, ctx);
+  job_start (job, &gbs_erase_flash, "ROM Erased", "Erase ROM Failed!");
 }
 
 static void
@@ -236,53 +367,12 @@ erase_ram_cb (GSimpleAction *simple,
           GVariant      *parameter,
           gpointer       user_data)
 {
-   GtkWidget *erase_ram_window, *vbox, *progress_bar,
-   			 *info_label, *button;
-   GThread *exec_thread;
-   thread_args_t targs;
-	
-   erase_ram_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-   gtk_window_set_deletable (GTK_WINDOW(erase_ram_window), FALSE);
-   gtk_window_set_modal(GTK_WINDOW(erase_ram_window), TRUE);
-   vbox = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
-  
-  info_label = gtk_label_new("Erasing RAM...");
-  progress_bar = gtk_progress_bar_new();
-  gtk_progress_bar_set_pulse_step (GTK_PROGRESS_BAR(progress_bar), 0.1);
-  button = gtk_button_new_with_label("Close");
-  gtk_widget_set_sensitive(button, FALSE);
-  g_signal_connect (button, "clicked", G_CALLBACK (gtk_main_quit),
-                    NULL);
-  gtk_box_pack_start(GTK_BOX(vbox), info_label, TRUE, TRUE, 0 );												
-  gtk_box_pack_start(GTK_BOX(vbox), progress_bar, TRUE, TRUE, 0 );
-  gtk_box_pack_start(GTK_BOX(vbox), button, TRUE, TRUE, 0 );
-  
-  gtk_container_add (GTK_CONTAINER (erase_ram_window), vbox);
-  
-  gtk_widget_show_all(erase_ram_window);
-												
-  targs.stat = T_RUNNING;
-  exec_thread = g_thread_new("erase_ram", &gbs_erase_ram, (void*) &targs);
-  while (targs.stat != T_END)
-  {
-	gtk_progress_bar_pulse (GTK_PROGRESS_BAR(progress_bar));
-	gtk_main_iteration ();
-  }
-  if (targs.ret != STAT_OK)
-  {
-	gtk_label_set_text (GTK_LABEL(info_label), "Erase RAM Failed!");
-	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(progress_bar), 0);
-  }
-  else {
-  	gtk_label_set_text (GTK_LABEL(info_label), "RAM Erased");
-  	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(progress_bar), 1);
-  }
-  
-  gtk_widget_set_sensitive(button, TRUE);
-  gtk_main();
-  gtk_widget_destroy (erase_ram_window);
-  g_thread_unref (exec_thread);
+  gui_job_t *job;
+
+  job = job_new("Erasing RAM...");
 
+  gbs_args_init(&job->targs, ctx);
+  job_start (job, &gbs_erase_ram, "RAM Erased", "Erase RAM Failed!");
 }
 
 
@@ -291,45 +381,29 @@ read_rom_cb (GSimpleAction *simple,
           GVariant      *parameter,
           gpointer       user_data)
 {
-   GtkWidget *read_rom_window, *vbox, *progress_bar,
-   			 *info_label, *button, *file_dialog;
+   GtkWidget *file_dialog;
    GtkFileFilter *filter;
    gchar* info_text;
-   GThread *exec_thread;
-   thread_args_t targs;
+   gui_job_t *job;
    uint8_t erc;
    rom_header_t header;
    
-	
-   read_rom_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-   gtk_window_set_deletable (GTK_WINDOW(read_rom_window), FALSE);
-   gtk_window_set_modal(GTK_WINDOW(read_rom_window), TRUE);
-   vbox = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
-  
-  info_label = gtk_label_new("Reading ROM...");
-  progress_bar = gtk_progress_bar_new();
-  gtk_progress_bar_set_pulse_step (GTK_PROGRESS_BAR(progress_bar), 0.1);
-  button = gtk_button_new_with_label("Close");
-  gtk_widget_set_sensitive(button, FALSE);
-  g_signal_connect (button, "clicked", G_CALLBACK (gtk_main_quit),
-                    NULL);
-  gtk_box_pack_start(GTK_BOX(vbox), info_label, TRUE, TRUE, 0 );												
-  gtk_box_pack_start(GTK_BOX(vbox), progress_bar, TRUE, TRUE, 0 );
-  gtk_box_pack_start(GTK_BOX(vbox), button, TRUE, TRUE, 0 );
-  
-  gtk_container_add (GTK_CONTAINER (read_rom_window), vbox);
-  
-  gtk_widget_show_all(read_rom_window);
+  job = job_new("Reading ROM...");
+  job->fail_text = "Read ROM Failed!";
   
   // get header to get ROM size
-  erc = gbs_read_header(&header);
-  if (erc == STAT_OK && header.rom_bytes != 0)
+  erc = gbs_read_header(ctx, &header);
+  if (erc != STAT_OK || header.rom_bytes == 0)
   {
+	job_finish (job, FALSE);
+	return;
+  }
   
   // select ROM size
-  targs.size = header.rom_bytes;
+  job->targs.size = header.rom_bytes;
   info_text = g_strdup_printf("Reading %s ROM", header.rom_size);
-  gtk_label_set_text (GTK_LABEL(info_label), info_text);
+  gtk_label_set_text (GTK_LABEL(job->info_label), info_text);
+  g_free(info_text);
   
   filter = gtk_file_filter_new ();
   gtk_file_filter_set_name (filter, "GameBoy ROMS");
@@ -351,46 +425,19 @@ read_rom_cb (GSimpleAction *simple,
   
   if (gtk_dialog_run (GTK_DIALOG (file_dialog)) == GTK_RESPONSE_ACCEPT)
   {
-    targs.file = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (file_dialog)); 
+    job->targs.file = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (file_dialog)); 
   }
   else
   {
   	gtk_widget_destroy (file_dialog);
-  	gtk_widget_destroy (read_rom_window);
+  	job_close (NULL, job);
   	return;
   }
 
   gtk_widget_destroy (file_dialog);
   											
-  targs.stat = T_RUNNING;
-  exec_thread = g_thread_new("read_flash", &gbs_read_flash, (void*) &targs);
-  while (targs.stat != T_END)
-  {
-	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(progress_bar), targs.progress/100.0);
-	gtk_main_iteration ();
-  }
-  if (targs.ret != STAT_OK)
-  {
-	gtk_label_set_text (GTK_LABEL(info_label), "Read ROM Failed!");
-	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(progress_bar), 0);
-  }
-  else {
-  	gtk_label_set_text (GTK_LABEL(info_label), "ROM Read");
-  	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(progress_bar), 1);
-  }
-  
-  }
-  else
-  {
-  	gtk_label_set_text (GTK_LABEL(info_label), "Read ROM Failed!");
-	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(progress_bar), 0);
-  }
-  
-  gtk_widget_set_sensitive(button, TRUE);
-  gtk_main();
-  gtk_widget_destroy (read_rom_window);
-  g_thread_unref (exec_thread);
-
+  gbs_args_init(&job->targs, ctx);
+  job_start (job, &gbs_read_flash, "ROM Read", "Read ROM Failed!");
 }
 
 
@@ -399,31 +446,11 @@ write_rom_cb (GSimpleAction *simple,
           GVariant      *parameter,
           gpointer       user_data)
 {
-   GtkWidget *write_rom_window, *vbox, *progress_bar,
-   			 *info_label, *button, *file_dialog;
+   GtkWidget *file_dialog;
    GtkFileFilter *filter;
-   GThread *exec_thread;
-   thread_args_t targs;
+   gui_job_t *job;
 	
-   write_rom_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-   gtk_window_set_deletable (GTK_WINDOW(write_rom_window), FALSE);
-   gtk_window_set_modal(GTK_WINDOW(write_rom_window), TRUE);
-   vbox = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
-  
-  info_label = gtk_label_new("Writing ROM...");
-  progress_bar = gtk_progress_bar_new();
-  gtk_progress_bar_set_pulse_step (GTK_PROGRESS_BAR(progress_bar), 0.1);
-  button = gtk_button_new_with_label("Close");
-  gtk_widget_set_sensitive(button, FALSE);
-  g_signal_connect (button, "clicked", G_CALLBACK (gtk_main_quit),
-                    NULL);
-  gtk_box_pack_start(GTK_BOX(vbox), info_label, TRUE, TRUE, 0 );												
-  gtk_box_pack_start(GTK_BOX(vbox), progress_bar, TRUE, TRUE, 0 );
-  gtk_box_pack_start(GTK_BOX(vbox), button, TRUE, TRUE, 0 );
-  
-  gtk_container_add (GTK_CONTAINER (write_rom_window), vbox);
-  
-  gtk_widget_show_all(write_rom_window);
+  job = job_new("Writing ROM...");
   
   filter = gtk_file_filter_new ();
   gtk_file_filter_set_name (filter, "GameBoy ROMS");
@@ -445,39 +472,20 @@ write_rom_cb (GSimpleAction *simple,
   
   if (gtk_dialog_run (GTK_DIALOG (file_dialog)) == GTK_RESPONSE_ACCEPT)
   {
-    targs.file = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (file_dialog)); 
+    job->targs.file = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (file_dialog)); 
   }
   else
   {
   	gtk_widget_destroy (file_dialog);
-  	gtk_widget_destroy (write_rom_window);
+  	job_close (NULL, job);
   	return;
   }
 
   gtk_widget_destroy (file_dialog);
   											
-  targs.stat = T_RUNNING;
-  exec_thread = g_thread_new("write_flash", &gbs_write_flash, (void*) &targs);
-  while (targs.stat != T_END)
-  {
-	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(progress_bar), targs.progress/100.0);
-	gtk_main_iteration ();
-  }
-  if (targs.ret != STAT_OK)
-  {
-	gtk_label_set_text (GTK_LABEL(info_label), "Write ROM Failed!");
-	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(progress_bar), 0);
-  }
-  else {
-  	gtk_label_set_text (GTK_LABEL(info_label), "ROM Written");
-  	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(progress_bar), 1);
-  }
-  
-  gtk_widget_set_sensitive(button, TRUE);
-  gtk_main();
-  gtk_widget_destroy (write_rom_window);
-  g_thread_unref (exec_thread);
-
+  gbs_args_init(&job->targs, ctx);
+  job->targs.prg_mode = PRG_AUTO;
+  job_start (job, &gbs_write_flash, "ROM Written", "Write ROM Failed!");
 }
 
 static void
@@ -485,31 +493,11 @@ write_ram_cb (GSimpleAction *simple,
           GVariant      *parameter,
           gpointer       user_data)
 {
-   GtkWidget *write_ram_window, *vbox, *progress_bar,
-   			 *info_label, *button, *file_dialog;
+   GtkWidget *file_dialog;
    GtkFileFilter *filter;
-   GThread *exec_thread;
-   thread_args_t targs;
+   gui_job_t *job;
 	
-   write_ram_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-   gtk_window_set_deletable (GTK_WINDOW(write_ram_window), FALSE);
-   gtk_window_set_modal(GTK_WINDOW(write_ram_window), TRUE);
-   vbox = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
-  
-  info_label = gtk_label_new("Writing RAM...");
-  progress_bar = gtk_progress_bar_new();
-  gtk_progress_bar_set_pulse_step (GTK_PROGRESS_BAR(progress_bar), 0.1);
-  button = gtk_button_new_with_label("Close");
-  gtk_widget_set_sensitive(button, FALSE);
-  g_signal_connect (button, "clicked", G_CALLBACK (gtk_main_quit),
-                    NULL);
-  gtk_box_pack_start(GTK_BOX(vbox), info_label, TRUE, TRUE, 0 );												
-  gtk_box_pack_start(GTK_BOX(vbox), progress_bar, TRUE, TRUE, 0 );
-  gtk_box_pack_start(GTK_BOX(vbox), button, TRUE, TRUE, 0 );
-  
-  gtk_container_add (GTK_CONTAINER (write_ram_window), vbox);
-  
-  gtk_widget_show_all(write_ram_window);
+  job = job_new("Writing RAM...");
   
   filter = gtk_file_filter_new ();
   gtk_file_filter_set_name (filter, "GameBoy SRAM dump");
@@ -527,39 +515,19 @@ write_ram_cb (GSimpleAction *simple,
   
   if (gtk_dialog_run (GTK_DIALOG (file_dialog)) == GTK_RESPONSE_ACCEPT)
   {
-    targs.file = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (file_dialog)); 
+    job->targs.file = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (file_dialog)); 
   }
   else
   {
   	gtk_widget_destroy (file_dialog);
-  	gtk_widget_destroy (write_ram_window);
+  	job_close (NULL, job);
   	return;
   }
 
   gtk_widget_destroy (file_dialog);
   											
-  targs.stat = T_RUNNING;
-  exec_thread = g_thread_new("write_ram", &gbs_write_ram, (void*) &targs);
-  while (targs.stat != T_END)
-  {
-	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(progress_bar), targs.progress/100.0);
-	gtk_main_iteration ();
-  }
-  if (targs.ret != STAT_OK)
-  {
-	gtk_label_set_text (GTK_LABEL(info_label), "Write RAM Failed!");
-	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(progress_bar), 0);
-  }
-  else {
-  	gtk_label_set_text (GTK_LABEL(info_label), "RAM Written");
-  	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(progress_bar), 1);
-  }
-  
-  gtk_widget_set_sensitive(button, TRUE);
-  gtk_main();
-  gtk_widget_destroy (write_ram_window);
-  g_thread_unref (exec_thread);
-
+  gbs_args_init(&job->targs, ctx);
+  job_start (job, &gbs_write_ram, "RAM Written", "Write RAM Failed!");
 }
 
 static void
@@ -814,12 +782,17 @@ main (int argc, char **argv)
   GtkApplication *app;
   int status;
 
+  if ((ctx = gbs_ctx_new ()) == NULL)
+	return EXIT_FAIL;
+  g_unix_fd_add (gbs_ctx_fd (ctx), G_IO_IN, ctx_ready, NULL);
+
   app = gtk_application_new ("net.ladecadence.gbshooper",
   				G_APPLICATION_FLAGS_NONE);
   g_signal_connect (app, "activate", G_CALLBACK (activate), NULL);
   g_signal_connect (app, "startup", G_CALLBACK (startup), NULL);
   status = g_application_run (G_APPLICATION (app), argc, argv);
   g_object_unref (app);
+  gbs_ctx_free (ctx);
 
   return status;
 }
@@ -0,0 +1,316 @@
+/*
+============================================================================
+Name        : hash.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Dump digests, computed while the data comes in
+============================================================================
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gbshooper.h"
+#include "hash.h"
+
+#define ROL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static const uint32_t md5_k[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+	0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+	0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+	0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+	0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+	0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+	0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+	0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+	0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const uint8_t md5_r[16] = {
+	7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21
+};
+
+static void gbs_crc_table() {
+	uint32_t i, j, c;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		crc_table[i] = c;
+	}
+}
+
+static void gbs_md5_block(gbs_digest_t* d) {
+	uint32_t w[16], a, b, c, e, f, t;
+	uint8_t i, g;
+
+	for (i = 0; i < 16; i++)
+		w[i] = d->block[i*4] | d->block[i*4+1] << 8
+			| d->block[i*4+2] << 16 | (uint32_t) d->block[i*4+3] << 24;
+
+	a = d->h[0];
+	b = d->h[1];
+	c = d->h[2];
+	e = d->h[3];
+	for (i = 0; i < 64; i++) {
+		if (i < 16) {
+			f = (b & c) | (~b & e);
+			g = i;
+		} else if (i < 32) {
+			f = (e & b) | (~e & c);
+			g = (5*i + 1) % 16;
+		} else if (i < 48) {
+			f = b ^ c ^ e;
+			g = (3*i + 5) % 16;
+		} else {
+			f = c ^ (b | ~e);
+			g = (7*i) % 16;
+		}
+		t = e;
+		e = c;
+		c = b;
+		b += ROL(a + f + md5_k[i] + w[g], md5_r[(i / 16) * 4 + i % 4]);
+		a = t;
+	}
+	d->h[0] += a;
+	d->h[1] += b;
+	d->h[2] += c;
+	d->h[3] += e;
+}
+
+static void gbs_sha1_block(gbs_digest_t* d) {
+	uint32_t w[80], a, b, c, e, g, f, k, t;
+	uint8_t i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32_t) d->block[i*4] << 24 | d->block[i*4+1] << 16
+			| d->block[i*4+2] << 8 | d->block[i*4+3];
+	for (i = 16; i < 80; i++)
+		w[i] = ROL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+	a = d->h[0];
+	b = d->h[1];
+	c = d->h[2];
+	e = d->h[3];
+	g = d->h[4];
+	for (i = 0; i < 80; i++) {
+		if (i < 20) {
+			f = (b & c) | (~b & e);
+			k = 0x5A827999;
+		} else if (i < 40) {
+			f = b ^ c ^ e;
+			k = 0x6ED9EBA1;
+		} else if (i < 60) {
+			f = (b & c) | (b & e) | (c & e);
+			k = 0x8F1BBCDC;
+		} else {
+			f = b ^ c ^ e;
+			k = 0xCA62C1D6;
+		}
+		t = ROL(a, 5) + f + g + k + w[i];
+		g = e;
+		e = c;
+		c = ROL(b, 30);
+		b = a;
+		a = t;
+	}
+	d->h[0] += a;
+	d->h[1] += b;
+	d->h[2] += c;
+	d->h[3] += e;
+	d->h[4] += g;
+}
+
+static void gbs_digest_update(gbs_digest_t* d, const uint8_t* data,
+		uint32_t len, void (*block)(gbs_digest_t*)) {
+	uint32_t used, n;
+
+	while (len > 0) {
+		used = d->bytes % 64;
+		n = 64 - used < len ? 64 - used : len;
+		memcpy(&d->block[used], data, n);
+		d->bytes += n;
+		data += n;
+		len -= n;
+		if (used + n == 64)
+			block(d);
+	}
+}
+
+/* pads the last block with the length in bits, big or little endian */
+static void gbs_digest_final(gbs_digest_t* d, void (*block)(gbs_digest_t*),
+		uint8_t big_endian) {
+	uint64_t bits = d->bytes * 8;
+	uint32_t used = d->bytes % 64;
+	uint8_t i;
+
+	d->block[used++] = 0x80;
+	if (used > 56) {
+		memset(&d->block[used], 0, 64 - used);
+		block(d);
+		used = 0;
+	}
+	memset(&d->block[used], 0, 56 - used);
+	for (i = 0; i < 8; i++)
+		d->block[big_endian ? 63 - i : 56 + i] = bits >> (8 * i);
+	block(d);
+}
+
+void gbs_hash_init(gbs_hash_t* hash, uint8_t want) {
+	static const uint32_t md5_h[4] = {
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+	};
+	static const uint32_t sha1_h[5] = {
+		0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+	};
+
+	pthread_once(&crc_once, gbs_crc_table);
+	memset(hash, 0, sizeof(*hash));
+	hash->want = want;
+	hash->crc32 = 0xFFFFFFFF;
+	memcpy(hash->md5_state.h, md5_h, sizeof md5_h);
+	memcpy(hash->sha1_state.h, sha1_h, sizeof sha1_h);
+}
+
+void gbs_hash_update(gbs_hash_t* hash, const uint8_t* data, uint32_t len) {
+	uint32_t i, crc = hash->crc32;
+
+	hash->bytes += len;
+	if (hash->want & HASH_CRC32) {
+		for (i = 0; i < len; i++)
+			crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		hash->crc32 = crc;
+	}
+	if (hash->want & HASH_MD5)
+		gbs_digest_update(&hash->md5_state, data, len, gbs_md5_block);
+	if (hash->want & HASH_SHA1)
+		gbs_digest_update(&hash->sha1_state, data, len, gbs_sha1_block);
+}
+
+/* fills in the digests asked for, the others stay zero */
+void gbs_hash_final(gbs_hash_t* hash) {
+	uint8_t i;
+
+	hash->crc32 = (hash->want & HASH_CRC32) ? hash->crc32 ^ 0xFFFFFFFF : 0;
+	if (hash->want & HASH_MD5) {
+		gbs_digest_final(&hash->md5_state, gbs_md5_block, 0);
+		for (i = 0; i < 16; i++)
+			hash->md5[i] = hash->md5_state.h[i / 4] >> (8 * (i % 4));
+	}
+	if (hash->want & HASH_SHA1) {
+		gbs_digest_final(&hash->sha1_state, gbs_sha1_block, 1);
+		for (i = 0; i < 20; i++)
+			hash->sha1[i] = hash->sha1_state.h[i / 4] >> (24 - 8 * (i % 4));
+	}
+}
+
+/* takes the queued blocks, oldest first, until gbs_hash_stop() */
+static void* gbs_hash_thread(void* ptr) {
+	gbs_hash_t* hash = (gbs_hash_t*) ptr;
+	uint8_t* block;
+	uint32_t len;
+
+	while ((block = gbs_ring_peek(&hash->ring, &len)) != NULL) {
+		gbs_hash_update(hash, block, len);
+		gbs_ring_release(&hash->ring);
+	}
+
+	return NULL;
+}
+
+/* starts the helper thread for gbs_hash_feed() */
+uint16_t gbs_hash_start(gbs_hash_t* hash) {
+	if (gbs_ring_init(&hash->ring, HASH_SLOTS, HASH_SLOT_SIZE) != STAT_OK)
+		return STAT_ERROR;
+	if (pthread_create(&hash->thread, NULL, gbs_hash_thread, hash) != 0) {
+		gbs_ring_free(&hash->ring);
+		return STAT_ERROR;
+	}
+	hash->running = 1;
+
+	return STAT_OK;
+}
+
+/* queues a copy of the data for the helper thread, waiting only if it is
+ * HASH_SLOTS blocks behind */
+void gbs_hash_feed(gbs_hash_t* hash, const uint8_t* data, uint32_t len) {
+	uint8_t* slot;
+	uint32_t n;
+
+	while (len > 0) {
+		n = len < HASH_SLOT_SIZE ? len : HASH_SLOT_SIZE;
+		slot = gbs_ring_claim(&hash->ring);
+		memcpy(slot, data, n);
+		gbs_ring_publish(&hash->ring, n);
+		data += n;
+		len -= n;
+	}
+}
+
+/* lets the helper thread finish what is queued, then the digests are in */
+void gbs_hash_stop(gbs_hash_t* hash) {
+	if (!hash->running)
+		return;
+
+	gbs_ring_close(&hash->ring);
+	pthread_join(hash->thread, NULL);
+	gbs_ring_free(&hash->ring);
+	hash->running = 0;
+	gbs_hash_final(hash);
+}
+
+/* the CRC-32 of a buffer, crc the one of what came before it (0 first) */
+uint32_t gbs_crc32(uint32_t crc, const uint8_t* data, uint32_t len) {
+	uint32_t i;
+
+	pthread_once(&crc_once, gbs_crc_table);
+	crc ^= 0xFFFFFFFF;
+	for (i = 0; i < len; i++)
+		crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+	return crc ^ 0xFFFFFFFF;
+}
+
+/* "crc32,md5,sha1", any of them, or "all". 0 if a name is unknown. */
+uint8_t gbs_hash_parse(const char* list) {
+	static const struct { const char* name; uint8_t bit; } names[] = {
+		{"crc32", HASH_CRC32}, {"crc", HASH_CRC32}, {"md5", HASH_MD5},
+		{"sha1", HASH_SHA1}, {"all", HASH_ALL}
+	};
+	uint8_t want = 0, i;
+	size_t len;
+
+	while (*list != '\0') {
+		len = strcspn(list, ",");
+		for (i = 0; i < sizeof names / sizeof names[0]; i++)
+			if (strlen(names[i].name) == len
+					&& strncmp(list, names[i].name, len) == 0)
+				break;
+		if (i == sizeof names / sizeof names[0])
+			return 0;
+		want |= names[i].bit;
+		list += len;
+		if (*list == ',')
+			list++;
+	}
+
+	return want;
+}
+
+void gbs_hash_hex(const uint8_t* digest, uint32_t len, char* dst) {
+	uint32_t i;
+
+	for (i = 0; i < len; i++)
+		sprintf(&dst[i * 2], "%02x", digest[i]);
+	dst[len * 2] = '\0';
+}
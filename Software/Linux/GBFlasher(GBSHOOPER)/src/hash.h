@@ -0,0 +1,70 @@
+/*
+============================================================================
+Name        : hash.h
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Dump digests, computed while the data comes in
+============================================================================
+*/
+
+#ifndef __HASH_H
+#define __HASH_H
+
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "ring.h"
+
+#define HASH_CRC32		0x01
+#define HASH_MD5		0x02
+#define HASH_SHA1		0x04
+#define HASH_ALL		(HASH_CRC32 | HASH_MD5 | HASH_SHA1)
+
+#define HASH_SLOTS		8		/* blocks queued for the helper thread */
+#define HASH_SLOT_SIZE	4096	/* BLOCK_MAX */
+
+/* Types */
+/*********/
+
+/* block digest state, little endian words for MD5, big endian for SHA-1 */
+typedef struct
+{
+	uint32_t h[5];
+	uint64_t bytes;
+	uint8_t block[64];
+} gbs_digest_t;
+
+/* The digests of one dump. A read operation given one feeds it every byte
+ * it writes to the file through a small ring, and a helper thread does the
+ * sums, so the link never waits for them. Valid once the operation ends. */
+typedef struct
+{
+	uint8_t want;			/* HASH_* to compute */
+	uint64_t bytes;
+	uint32_t crc32;
+	uint8_t md5[16];
+	uint8_t sha1[20];
+
+	/* private */
+	gbs_digest_t md5_state;
+	gbs_digest_t sha1_state;
+	pthread_t thread;
+	gbs_ring_t ring;
+	uint8_t running;
+} gbs_hash_t;
+
+/* function prototypes */
+/***********************/
+void gbs_hash_init(gbs_hash_t* hash, uint8_t want);
+void gbs_hash_update(gbs_hash_t* hash, const uint8_t* data, uint32_t len);
+void gbs_hash_final(gbs_hash_t* hash);
+uint16_t gbs_hash_start(gbs_hash_t* hash);
+void gbs_hash_feed(gbs_hash_t* hash, const uint8_t* data, uint32_t len);
+void gbs_hash_stop(gbs_hash_t* hash);
+uint8_t gbs_hash_parse(const char* list);
+uint32_t gbs_crc32(uint32_t crc, const uint8_t* data, uint32_t len);
+void gbs_hash_hex(const uint8_t* digest, uint32_t len, char* dst);
+
+#endif
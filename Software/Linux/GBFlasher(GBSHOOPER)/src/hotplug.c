@@ -0,0 +1,121 @@
+/*
+============================================================================
+Name        : hotplug.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Waits for the kernel to see a flasher plugged in
+============================================================================
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+#include <linux/netlink.h>
+#endif
+
+#include "gbshooper.h"
+#include "hotplug.h"
+
+/* subscribes to the kernel's uevents. STAT_ERROR if there are none, the
+ * waits still work, as plain sleeps. */
+uint16_t gbs_hotplug_open(gbs_hotplug_t* hp) {
+#ifdef __linux__
+	struct sockaddr_nl addr;
+#endif
+
+	hp->fd = -1;
+	hp->added = 0;
+#ifdef __linux__
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = 0;
+	addr.nl_groups = 1;		/* the kernel's, not udev's */
+	hp->fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			NETLINK_KOBJECT_UEVENT);
+	if (hp->fd >= 0
+			&& bind(hp->fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+		close(hp->fd);
+		hp->fd = -1;
+	}
+#endif
+
+	return hp->fd >= 0 ? STAT_OK : STAT_ERROR;
+}
+
+void gbs_hotplug_close(gbs_hotplug_t* hp) {
+	if (hp->fd >= 0)
+		close(hp->fd);
+	hp->fd = -1;
+}
+
+/* "add@path\0KEY=value\0..." of a USB device with the flasher's IDs, or
+ * of a new serial port for --device */
+static uint8_t gbs_hotplug_match(const char* event, int len) {
+	const char* p, * end = event + len;
+	uint8_t add = 0, usb = 0, tty = 0, ours = 0;
+
+	for (p = event; p < end; p += strlen(p) + 1) {
+		if (strcmp(p, "ACTION=add") == 0)
+			add = 1;
+		else if (strcmp(p, "SUBSYSTEM=tty") == 0)
+			tty = 1;
+		else if (strcmp(p, "DEVTYPE=usb_device") == 0)
+			usb = 1;
+		else if (strncmp(p, "PRODUCT=", 8) == 0
+				&& strncmp(p + 8, HOTPLUG_PRODUCT,
+					strlen(HOTPLUG_PRODUCT)) == 0)
+			ours = 1;
+	}
+
+	return add && ((usb && ours) || tty);
+}
+
+/* waits up to timeout_ms for a flasher to come. Returns 1 if one did, 0
+ * on timeout or a signal. */
+uint8_t gbs_hotplug_wait(gbs_hotplug_t* hp, uint32_t timeout_ms) {
+	char event[HOTPLUG_EVENT];
+	struct timespec now, end;
+	struct pollfd p;
+	int left, len;
+
+	if (hp->fd < 0) {
+		poll(NULL, 0, timeout_ms);
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += timeout_ms / 1000;
+	end.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (end.tv_nsec >= 1000000000L) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000L;
+	}
+
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left = (end.tv_sec - now.tv_sec) * 1000
+			+ (end.tv_nsec - now.tv_nsec) / 1000000;
+		if (left <= 0)
+			return 0;
+		p.fd = hp->fd;
+		p.events = POLLIN;
+		p.revents = 0;
+		if (poll(&p, 1, left) <= 0)
+			return 0;
+		while ((len = recv(hp->fd, event, sizeof event - 1, 0)) > 0) {
+			event[len] = '\0';
+			if (gbs_hotplug_match(event, len)) {
+				hp->added++;
+				return 1;
+			}
+		}
+	}
+}
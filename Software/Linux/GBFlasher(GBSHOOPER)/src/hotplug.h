@@ -0,0 +1,38 @@
+/*
+============================================================================
+Name        : hotplug.h
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Waits for the kernel to see a flasher plugged in
+============================================================================
+*/
+
+#ifndef __HOTPLUG_H
+#define __HOTPLUG_H
+
+#include <inttypes.h>
+
+/* the flasher's FTDI chip in a usb uevent PRODUCT, vendor/product/bcd */
+#define HOTPLUG_PRODUCT		"403/6001/"
+#define HOTPLUG_EVENT		2048	/* longest uevent kept */
+
+/* Types */
+/*********/
+
+/* kernel uevents, the ones udev gets. Where there are none (not Linux, or
+ * no netlink in a container) waits just sleep, callers poll instead. */
+typedef struct
+{
+	int fd;					/* -1 without uevents */
+	uint32_t added;			/* flashers or serial ports seen coming */
+} gbs_hotplug_t;
+
+/* function prototypes */
+/***********************/
+uint16_t gbs_hotplug_open(gbs_hotplug_t* hp);
+uint8_t gbs_hotplug_wait(gbs_hotplug_t* hp, uint32_t timeout_ms);
+void gbs_hotplug_close(gbs_hotplug_t* hp);
+
+#endif
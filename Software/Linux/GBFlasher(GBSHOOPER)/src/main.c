@@ -12,7 +12,11 @@ Description : Ladecadence.net GameBoy FlashCart interface
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <signal.h>
 #include <pthread.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
 
 #ifndef __BUILD_WINDOWS__
 #include <ftdi.h>
@@ -23,16 +27,94 @@ Description : Ladecadence.net GameBoy FlashCart interface
 #include "gbshooper.h"
 #include "communications.h"
 #include "flashcart.h"
+#include "context.h"
+#include "snapshot.h"
+#include "multicart.h"
+#include "hash.h"
+#include "dat.h"
+#include "hotplug.h"
+#include "remote.h"
+
+#define PROGRESS_INTERVAL_MS	250	/* progress redraw period */
+#define BATCH_LINE				1024	/* longest manifest line */
+#define BATCH_ARGS				16		/* words in a manifest line */
+#define STATION_PROBE_MS		500		/* cart probes, --probe-ms */
+#define STATION_RETRY_MS		2000	/* flasher opens, without uevents */
+#define STATION_RESCAN_MS		30000	/* and with them, in case one is missed */
+#define STATION_SETTLE_MS		300		/* a new device's driver binding */
+
+#define MSG_NO_SIZE		"Unknown size, try reading the header first.\n"
+#define MSG_NO_RAM		"The cart has no save RAM.\n"
+#define MSG_NO_SNAPSHOT	"No such snapshot.\n"
+#define MSG_NO_DAT		"Can't open the DAT index %s\n"
+#define MSG_ERASE_TIME	"Erased in %u.%03u s\n"
+#define MSG_NOT_ROBUST	"The flasher can't seek, that was a plain read.\n"
+#define MSG_STATION_DONE	"\a*** CART %u DONE: %s, take it out ***\n"
+#define MSG_STATION_FAIL	"\a\a\a*** CART %u FAILED: %s, take it out ***\n"
+#define ERASE_LOG		".gbshooper-erase.log"	/* in $HOME by default */
 
 /******************************************************************************/
 /***************************** VARIABLES **************************************/
 /******************************************************************************/
 
+/* the flasher */
+gbs_ctx_t* ctx = NULL;
+
+/* --stats output */
+enum { STATS_NONE, STATS_SUMMARY, STATS_JSON } stats_mode = STATS_NONE;
+
+/* --device */
+char* device = NULL;
+
+/* --erase-log */
+char* erase_log = NULL;
+char erase_log_home[1024];
+
+/* --server */
+char* server = NULL;
+char server_path[1024];
+
+/* --trace */
+gbs_trace_t* trace = NULL;
+char* trace_file = NULL;
+
+/* running a --batch manifest, stats go in its summary */
+uint8_t batch_mode = 0;
+gbs_stats_t last_stats;
+
+/* Ctrl-C seen, the running operation gets cancelled */
+volatile sig_atomic_t interrupted = 0;
+
+/* where dumps to "-" go once stdout is taken over, see gbs_stdout_data() */
+int stdout_data = -1;
+
+/* --hash and --dat of a dump */
+gbs_hash_t dump_hash;
+uint8_t hash_want = 0;
+char* dat_index = NULL;
+
+/* --station: number of the cart being done, {seq} */
+uint32_t station_cart = 1;
+
+/* cart header, see gbs_get_header() */
+rom_header_t header;
+uint8_t header_valid = 0;
+
 
 /******************************************************************************/
 /******************************* DATOS ****************************************/
 /******************************************************************************/
 
+/* a finished manifest line */
+typedef struct
+{
+	char action[16];
+	uint32_t line;
+	int ret;
+	uint64_t ns;
+	gbs_stats_t stats;
+} batch_job_t;
+
 
 
 /******************************************************************************/
@@ -46,6 +128,9 @@ void gbs_help() {
 	printf("\n");
 	printf("gbshooper <action> <options> [file]\n");
 	printf("\n");
+	printf("A [file] of - reads stdin or writes stdout, messages then go ");
+	printf("to stderr.\n");
+	printf("\n");
 	printf("Actions:\n");
 	printf("\t --version: prints the software version.\n");
 	printf("\t --status: checks the hardware.\n");
@@ -57,22 +142,105 @@ void gbs_help() {
 	printf("\t\toptions: \n");
 	printf("\t\t  --size N: Specify ROM size:\n");
 	printf("\t\t\t 1=32KB, 2=64KB, 3=128KB, 4=256KB, 5=512KB, 6=1MB, ");
-	printf("7=2MB, 8=4MB\n");
+	printf("7=2MB, 8=4MB,\n\t\t\t auto=from the cart header\n");
 	printf("\t\t If no size is specified, 32KB are read\n");
+	printf("\t\t  --bank N: start at ROM bank N, 16KB each.\n");
+	printf("\t\t  --offset N: start N bytes into the bank, or into the ");
+	printf("ROM without --bank.\n");
+	printf("\t\t  --length N: read N bytes, one bank by default with ");
+	printf("--bank.\n");
+	printf("\t\t  --hash LIST: print the crc32, md5 and/or sha1 (or all) ");
+	printf("of the dump,\n\t\t\t summed while it is read.\n");
+	printf("\t\t  --dat INDEX: identify the dump in a DAT index, see ");
+	printf("--compile-dat.\n");
+	printf("\t\t  --robust N: for dirty carts, the flasher reads every ");
+	printf("block twice\n\t\t\t and the ones that disagree are read ");
+	printf("up to N times more and\n\t\t\t voted on, with a confidence ");
+	printf("report per bank (firmware 0.4+).\n");
 	printf("\t --write-flash: writes the flash with contents from [file].\n");
+	printf("\t\toptions: \n");
+	printf("\t\t  --compress: run-length encode blocks on the wire ");
+	printf("(firmware 0.3+)\n");
+	printf("\t\t  --size N: as for --read-flash, only for - without a ");
+	printf("ROM header.\n");
 	printf("\t --read-ram: reads the contents of the save RAM ");
 	printf("and writes it on [file].\n");
 	printf("\t\toptions: \n");
 	printf("\t\t  --size N: Specify RAM size:\n");
-	printf("\t\t\t 1=8KB, 2=32KB, 3=1MB\n");
+	printf("\t\t\t 1=8KB, 2=32KB, 3=1MB, auto=from the cart header\n");
 	printf("\t\t If no size is specified, 8KB are read\n");
+	printf("\t\t  --bank, --offset, --length, --hash, --dat, --robust: as for ");
+	printf("--read-flash,\n\t\t\t 8KB RAM banks.\n");
 	printf("\t --write-ram: writes the save RAM with contents from [file].\n");
+	printf("\t\toptions: \n");
+	printf("\t\t  --size N: as for --read-ram, needed for -.\n");
 	printf("\t --erase-ram: clears the contents of the save RAM with 0's.\n");
 	printf("\t\toptions: \n");
 	printf("\t\t  --size N: Specify RAM size:\n");
-	printf("\t\t\t 1=8KB, 2=32KB, 3=1MB\n");
+	printf("\t\t\t 1=8KB, 2=32KB, 3=1MB, auto=from the cart header\n");
 	printf("\t\t If no size is specified, 8KB are erased\n");
+	printf("\t --snapshot-ram STORE: reads the save RAM into the snapshot ");
+	printf("store directory\n\t\t STORE, keeping only the blocks that ");
+	printf("changed since the cart's last\n\t\t snapshot.\n");
+	printf("\t\toptions: \n");
+	printf("\t\t  --size N: as for --read-ram, from the cart header by ");
+	printf("default\n");
+	printf("\t\t  --cart NAME: the operator's label for this cart. Carts are ");
+	printf("told apart by\n\t\t\t their header, so copies of the same game ");
+	printf("share one history\n\t\t\t unless labelled.\n");
+	printf("\t --snapshots STORE [CART]: lists the carts in STORE, or the ");
+	printf("snapshots of CART.\n");
+	printf("\t --extract-snapshot STORE CART N FILE: writes snapshot N of ");
+	printf("CART to FILE,\n\t\t -1 is the latest.\n");
+	printf("\t --compile-dat DAT INDEX: indexes a No-Intro style XML DAT ");
+	printf("for --dat.\n");
+	printf("\t --build-multicart OUT ROM...: packs the ROMs into the ");
+	printf("image OUT, the first one\n\t\t (the menu) in bank 0, ");
+	printf("and writes its sector map to OUT.map.\n");
+	printf("\t --write-multicart ROM...: packs the ROMs the same way, ");
+	printf("erases the flash\n\t\t and programs only the banks that ");
+	printf("aren't left blank.\n");
+	printf("\t\toptions: \n");
+	printf("\t\t  --size N: flash size, as for --read-flash, 4MB by ");
+	printf("default\n");
+	printf("\t --batch FILE: runs the actions listed in FILE (- for ");
+	printf("stdin), one per line,\n");
+	printf("\t\t opening the flasher only once. Stops at the first ");
+	printf("failure unless\n\t\t --keep-going is given. File names may ");
+	printf("use {title}, {cart}, {rom},\n\t\t {ram} from the cart header ");
+	printf("and {n}, {date}, {time} of the batch.\n");
+	printf("\t --station FILE: unattended, runs the batch FILE on every ");
+	printf("cart put in the\n\t\t flasher until Ctrl-C, and rings when ");
+	printf("it can come out: once when\n\t\t done, three times when it ");
+	printf("failed. Plugging the flasher in is enough\n\t\t to start. ");
+	printf("{seq} numbers the carts in FILE.\n");
+	printf("\t\toptions: \n");
+	printf("\t\t  --probe-ms N: look for a new cart every N ms, %u by ",
+			STATION_PROBE_MS);
+	printf("default.\n");
+	printf("\t\t  --on-done CMD, --on-fail CMD: run CMD after each cart, ");
+	printf("with\n\t\t\t GBS_SEQ and GBS_TITLE set.\n");
 	printf("\t --help: show this help.\n");
+	printf("\n");
+	printf("Options, for any action:\n");
+	printf("\t --stats[=json]: print transfer statistics on stderr ");
+	printf("when done.\n");
+	printf("\t --trace FILE: record the packets exchanged to FILE, ");
+	printf("see gbstrace.\n");
+	printf("\t --device PATH: talk to a serial device, like a gbsimd ");
+	printf("pty, instead of the USB flasher.\n");
+	printf("\t --erase-log FILE: log flash erase times there, and ");
+	printf("expect the next ones\n\t\t from them. ~/%s by default.\n",
+			ERASE_LOG);
+	printf("\t --proto N: 1 keeps to the old 2-byte packets, 2 (the ");
+	printf("default) frames them\n\t\t with sequence numbers and CRCs ");
+	printf("when the firmware can (0.7+).\n");
+	printf("\t --server PATH: hand the action to the gbshooperd listening ");
+	printf("at PATH, which\n\t\t keeps the flasher open and runs ");
+	printf("actions in turn. auto is its\n\t\t default socket, ");
+	printf("$XDG_RUNTIME_DIR/%s.\n", REMOTE_SOCKET);
+	printf("\nCtrl-C cancels the running action and leaves the flasher ");
+	printf("idle, a second one quits\nright away.\n");
 printf("\n");
 }
 
@@ -80,25 +248,539 @@ void gbs_version() {
 	printf(MSG_VERSION, VER_MAYOR, VER_MINOR);
 }
 
+/* writes the packet trace out, whatever way we leave */
+void gbs_trace_exit() {
+	gbs_ctx_free(ctx);
+	if (gbs_trace_dump(trace, trace_file) != STAT_OK)
+		fprintf(stderr, "Can't write trace to %s\n", trace_file);
+	gbs_trace_free(trace);
+}
 
-/******************************************************************************/
-/************************* PROGRAMA PRINCIPAL *********************************/
-/******************************************************************************/
+/* prints a progress line: percentage, throughput and time left */
+void gbs_show_progress(thread_args_t* args, double elapsed) {
+	uint32_t done = atomic_load_explicit(&args->done_bytes,
+			memory_order_relaxed);
+	uint32_t total = atomic_load(&args->total_bytes);
+	double rate = elapsed > 0 ? done / elapsed : 0;
+	uint32_t secs;
 
-int main(int argc, char* argv[]) {
+	if (total == 0) {
+		/* length unknown (chip erase), just show it is alive */
+		secs = elapsed;
+		printf("%u:%02u elapsed\r", secs / 60, secs % 60);
+	} else if (args->timed) {
+		/* milliseconds out of those expected */
+		secs = done < total ? (total - done + 999) / 1000 : 0;
+		printf("%3u%% %.1f of ~%.1f s, ETA %u:%02u   \r",
+				(uint32_t) ((uint64_t) done * 100 / total), done / 1e3,
+				total / 1e3, secs / 60, secs % 60);
+	} else {
+		secs = (rate > 0 && done < total) ? (total - done) / rate : 0;
+		printf("%3u%% %u/%u bytes, %.1f KB/s, ETA %u:%02u   \r",
+				(uint32_t) ((uint64_t) done * 100 / total), done, total,
+				rate / 1024, secs / 60, secs % 60);
+	}
+	fflush(stdout);
+}
 
-	uint8_t erc;
-	uint8_t s;
-	uint64_t size;
-	int t;
+/* the first Ctrl-C asks gbs_run() to cancel, the next one kills us */
+static void gbs_interrupt(int sig) {
+	interrupted = 1;
+	signal(sig, SIG_DFL);
+}
 
-	pthread_t exec_thread;				/* process thread */
+/* what --robust found: a line for each bank that needed votes, then the
+ * totals */
+void gbs_print_report(thread_args_t* args) {
+	gbs_bank_report_t* bank;
+	uint32_t blocks = 0, suspect = 0, reads = 0, uncertain = 0;
+	uint8_t confidence = 100, header = 0;
+	uint16_t i;
 
-	/* sin parámetros, imprime ayuda y sale */
-	if (argc == 1) {
+	if (args->report == NULL) {
+		printf(MSG_NOT_ROBUST);
+		return;
+	}
+
+	for (i = 0; i < args->report_banks; i++) {
+		bank = &args->report[i];
+		blocks += bank->blocks;
+		suspect += bank->suspect;
+		reads += bank->reads;
+		uncertain += bank->uncertain;
+		if (bank->confidence < confidence)
+			confidence = bank->confidence;
+		if (bank->suspect == 0)
+			continue;
+		if (!header++)
+			printf("Bank  Blocks  Re-read  Reads  Uncertain  Confidence\n");
+		printf("%4u  %6u  %7u  %5u  %9u  %9u%%\n", bank->bank, bank->blocks,
+				bank->suspect, bank->reads, bank->uncertain,
+				bank->confidence);
+	}
+	printf("Robust read: %u blocks in %u banks, %u read again in %u reads, "
+			"%u uncertain, %u%% confidence\n", blocks, args->report_banks,
+			suspect, reads, uncertain, confidence);
+}
+
+static void gbs_run_done(thread_args_t* args, void* data) {
+	*(uint8_t*) data = 1;
+}
+
+/* runs op on the context's worker, redrawing progress every
+ * PROGRESS_INTERVAL_MS until its completion is dispatched. Cancels it
+ * on Ctrl-C. */
+uint16_t gbs_run(void* (*op)(void*), thread_args_t* args) {
+	struct timespec start, now;
+	double elapsed, drawn = 0;
+	uint8_t finished = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (gbs_start_op(ctx, op, args, NULL, gbs_run_done, &finished)
+			!= STAT_OK)
+		return STAT_ERROR;
+
+	gbs_show_progress(args, 0);
+	do {
+		if (interrupted && !atomic_load(&args->cancel))
+			gbs_ctx_cancel(ctx);
+		gbs_ctx_wait(ctx, PROGRESS_INTERVAL_MS);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec)
+			+ (now.tv_nsec - start.tv_nsec) / 1e9;
+		if (finished || elapsed - drawn >= PROGRESS_INTERVAL_MS / 1e3) {
+			gbs_show_progress(args, elapsed);
+			drawn = elapsed;
+		}
+	} while (!finished);
+	printf("\n");
+
+	if (args->ret == STAT_OK && args->robust)
+		gbs_print_report(args);
+	gbs_args_destroy(args);
+
+	last_stats = args->stats;
+	if (batch_mode)
+		return args->ret;
+	if (stats_mode == STATS_SUMMARY)
+		gbs_stats_print(&args->stats, stderr);
+	else if (stats_mode == STATS_JSON)
+		gbs_stats_json(&args->stats, stderr);
+
+	return args->ret;
+}
+
+
+/* cart header, read once for --size auto and the batch file name
+ * templates. Anything that writes the flash drops it. */
+rom_header_t* gbs_get_header() {
+	if (!header_valid) {
+		if (gbs_read_header(ctx, &header) != STAT_OK)
+			return NULL;
+		header_valid = 1;
+	}
+	return &header;
+}
+
+void gbs_forget_header() {
+	if (!header_valid)
+		return;
+	free(header.title);
+	free(header.cart);
+	free(header.rom_size);
+	free(header.ram_size);
+	header_valid = 0;
+}
+
+/* --size argument for the flash: a size code, or auto for the header's */
+uint32_t gbs_rom_size(const char* arg) {
+	static const uint32_t sizes[] = {S_32K, S_64K, S_128K, S_256K, S_512K,
+		S_1MB, S_2MB, S_4MB};
+	rom_header_t* h;
+	int s;
+
+	if (strcmp(arg, "auto") == 0)
+		return (h = gbs_get_header()) != NULL ? h->rom_bytes : 0;
+	s = atoi(arg);
+	return (s >= 1 && s <= 8) ? sizes[s-1] : S_32K;
+}
+
+/* --size argument for the save RAM, same as above */
+uint32_t gbs_ram_size(const char* arg) {
+	static const uint32_t sizes[] = {S_8K, S_32K, S_1MB};
+	rom_header_t* h;
+	int s;
+
+	if (strcmp(arg, "auto") == 0)
+		return (h = gbs_get_header()) != NULL ? h->ram_bytes : 0;
+	s = atoi(arg);
+	return (s >= 1 && s <= 3) ? sizes[s-1] : S_8K;
+}
+
+/* a dump to "-" takes stdout for the data alone: from here on messages
+ * and progress, which go to stdout, end up on stderr. Returns the
+ * descriptor of the real stdout. */
+int gbs_stdout_data() {
+	if (stdout_data < 0) {
+		fflush(stdout);
+		stdout_data = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	}
+	return stdout_data;
+}
+
+/* options of --write-flash and --write-ram, the file comes last. --size is
+ * only needed for a pipe ("-") without a ROM header to read it from. */
+uint16_t gbs_write_options(int argc, char* argv[], thread_args_t* args,
+		uint32_t (*size_of)(const char*)) {
+	int i;
+
+	args->size = 0;
+	for (i = 2; i < argc - 1; i++) {
+		if (strcmp(argv[i], "--compress") == 0)
+			args->compress = 1;
+		else if (strcmp(argv[i], "--size") == 0 && i < argc - 2)
+			args->size = size_of(argv[++i]);
+		else
+			return STAT_ERROR;
+	}
+	if (i != argc - 1)
+		return STAT_ERROR;
+	args->file = argv[argc-1];
+
+	return STAT_OK;
+}
+
+/* options of --read-flash and --read-ram, the file comes last. --bank and
+ * --offset pick where to start, --length how much to read: one bank from
+ * --bank, up to the end of --size from a plain --offset. */
+uint16_t gbs_read_options(int argc, char* argv[], thread_args_t* args,
+		uint32_t (*size_of)(const char*), uint32_t bank_size) {
+	uint32_t length = 0, bank = 0;
+	uint8_t banked = 0;
+	int i;
+
+	args->size = (bank_size == ROM_BANK_SIZE) ? S_32K : S_8K;
+	args->offset = 0;
+	hash_want = 0;
+	dat_index = NULL;
+	for (i = 2; i < argc - 2; i += 2) {
+		if (strcmp(argv[i], "--size") == 0)
+			args->size = size_of(argv[i+1]);
+		else if (strcmp(argv[i], "--bank") == 0) {
+			bank = strtoul(argv[i+1], NULL, 0);
+			banked = 1;
+		}
+		else if (strcmp(argv[i], "--offset") == 0)
+			args->offset = strtoul(argv[i+1], NULL, 0);
+		else if (strcmp(argv[i], "--length") == 0)
+			length = strtoul(argv[i+1], NULL, 0);
+		else if (strcmp(argv[i], "--hash") == 0) {
+			if ((hash_want |= gbs_hash_parse(argv[i+1])) == 0)
+				return STAT_ERROR;
+		}
+		else if (strcmp(argv[i], "--dat") == 0) {
+			dat_index = argv[i+1];
+			hash_want |= HASH_ALL;
+		}
+		else if (strcmp(argv[i], "--robust") == 0) {
+			if ((args->robust = strtoul(argv[i+1], NULL, 0)) == 0)
+				return STAT_ERROR;
+		}
+		else
+			return STAT_ERROR;
+	}
+	if (i != argc - 1)
+		return STAT_ERROR;
+	args->file = argv[argc-1];
+	if (strcmp(args->file, "-") == 0)
+		args->fd = gbs_stdout_data();
+	if (hash_want != 0) {
+		gbs_hash_init(&dump_hash, hash_want);
+		args->hash = &dump_hash;
+	}
+
+	if (banked) {
+		if (args->offset >= bank_size)
+			return STAT_ERROR;
+		args->offset += bank * bank_size;
+		if (length == 0)
+			length = bank_size - args->offset % bank_size;
+	}
+	if (length != 0)
+		args->size = length;
+	else if (args->size != 0 && args->offset >= (uint32_t) args->size)
+		return STAT_ERROR;
+	else if (args->size != 0)
+		args->size -= args->offset;
+
+	return STAT_OK;
+}
+
+/* runs a dump, with the digests --hash asked for summed as the blocks
+ * come in and looked up in the --dat index, mapped before the first one,
+ * as soon as the last one is written */
+uint16_t gbs_run_dump(void* (*op)(void*), thread_args_t* args) {
+	const dat_entry_t* entry;
+	gbs_dat_t db;
+	char hex[41];
+	uint16_t erc;
+
+	if (dat_index != NULL && gbs_dat_open(&db, dat_index) != STAT_OK) {
+		fprintf(stderr, MSG_NO_DAT, dat_index);
+		return STAT_ERROR;
+	}
+
+	if ((erc = gbs_run(op, args)) == STAT_OK && args->hash != NULL) {
+		if (dump_hash.want & HASH_CRC32)
+			printf("CRC32: %08x\n", dump_hash.crc32);
+		if (dump_hash.want & HASH_MD5) {
+			gbs_hash_hex(dump_hash.md5, 16, hex);
+			printf("MD5: %s\n", hex);
+		}
+		if (dump_hash.want & HASH_SHA1) {
+			gbs_hash_hex(dump_hash.sha1, 20, hex);
+			printf("SHA-1: %s\n", hex);
+		}
+		if (dat_index != NULL) {
+			if ((entry = gbs_dat_lookup(&db, &dump_hash)) != NULL)
+				printf("Identified: %s (%s)\n", gbs_dat_name(&db, entry),
+						gbs_dat_file(&db, entry));
+			else
+				printf("Not in the DAT.\n");
+		}
+	}
+
+	if (dat_index != NULL)
+		gbs_dat_close(&db);
+	return erc;
+}
+
+/* --snapshot-ram: the save RAM goes through a file next to the store and
+ * into it as a snapshot */
+int gbs_snapshot_ram(const char* store, const char* size,
+		const char* label) {
+	thread_args_t args = {0};
+	rom_header_t* h;
+	snap_info_t info;
+	char cart[SNAP_NAME], file[SNAP_NAME + 1024];
+	uint8_t* image;
+	uint16_t erc;
+	FILE* f;
+	int fd;
+
+	if ((h = gbs_get_header()) == NULL) {
+		printf("Hardware error\n");
+		return EXIT_FAIL;
+	}
+	gbs_snap_fingerprint(h, label, cart, sizeof cart);
+
+	gbs_args_init(&args, ctx);
+	args.size = gbs_ram_size(size != NULL ? size : "auto");
+	if (args.size == 0) {
+		printf(MSG_NO_RAM);
+		return EXIT_WIN;
+	}
+
+	mkdir(store, 0777);
+	snprintf(file, sizeof file, "%s/.%sXXXXXX", store, cart);
+	if ((fd = mkstemp(file)) < 0) {
+		fprintf(stderr, "Can't write in %s\n", store);
+		return EXIT_FAIL;
+	}
+	close(fd);
+	args.file = file;
+
+	printf(MSG_RAM_READING);
+	if ((erc = gbs_run(&gbs_read_ram, &args)) != STAT_OK) {
+		printf(erc == STAT_CANCELLED ? MSG_CANCELLED : MSG_ERROR);
+		unlink(file);
+		return EXIT_FAIL;
+	}
+
+	erc = STAT_ERROR;
+	if ((image = malloc(args.size)) != NULL
+			&& (f = fopen(file, "rb")) != NULL) {
+		if (fread(image, 1, args.size, f) == (size_t) args.size)
+			erc = gbs_snap_save(store, cart, image, args.size, time(NULL),
+					&info);
+		fclose(f);
+	}
+	unlink(file);
+	free(image);
+	if (erc != STAT_OK) {
+		fprintf(stderr, "Can't store the snapshot in %s\n", store);
+		return EXIT_FAIL;
+	}
+
+	printf("Snapshot of %s: %s, %u bytes stored for %u\n", cart,
+			info.full ? "full image" : "delta", info.stored, info.size);
+	return EXIT_WIN;
+}
+
+/* --snapshots: the carts in a store, or the snapshots of one */
+int gbs_list_snapshots(const char* store, const char* cart) {
+	snap_info_t* list;
+	struct dirent* ent;
+	struct tm tm;
+	time_t t;
+	char name[SNAP_NAME + 8], date[32];
+	uint64_t total = 0;
+	size_t len;
+	int32_t count, i;
+	DIR* dir;
+
+	if (cart != NULL) {
+		if ((count = gbs_snap_list(store, cart, &list)) < 0) {
+			printf(MSG_NO_SNAPSHOT);
+			return EXIT_FAIL;
+		}
+		printf("%5s  %-19s %-5s %10s %10s\n", "n", "date", "kind", "size",
+				"stored");
+		for (i = 0; i < count; i++) {
+			t = list[i].time;
+			localtime_r(&t, &tm);
+			strftime(date, sizeof date, "%Y-%m-%d %H:%M:%S", &tm);
+			printf("%5d  %-19s %-5s %10u %10u\n", i, date,
+					list[i].full ? "full" : "delta", list[i].size,
+					list[i].stored);
+			total += list[i].stored;
+		}
+		printf("%d snapshots, %" PRIu64 " bytes stored\n", count, total);
+		free(list);
+		return EXIT_WIN;
+	}
+
+	if ((dir = opendir(store)) == NULL) {
+		fprintf(stderr, "Can't open %s\n", store);
+		return EXIT_FAIL;
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		len = strlen(ent->d_name);
+		if (len <= strlen(SNAP_EXT) || len >= sizeof name
+				|| strcmp(ent->d_name + len - strlen(SNAP_EXT), SNAP_EXT) != 0)
+			continue;
+		snprintf(name, sizeof name, "%.*s", (int) (len - strlen(SNAP_EXT)),
+				ent->d_name);
+		if ((count = gbs_snap_list(store, name, &list)) < 0)
+			continue;
+		for (total = 0, i = 0; i < count; i++)
+			total += list[i].stored;
+		printf("%-40s %5d snapshots %10" PRIu64 " bytes\n", name, count,
+				total);
+		free(list);
+	}
+	closedir(dir);
+
+	return EXIT_WIN;
+}
+
+/* --extract-snapshot */
+int gbs_extract_snapshot(const char* store, const char* cart,
+		const char* n, const char* file) {
+	uint8_t* image;
+	uint32_t size;
+	FILE* f;
+	size_t written;
+
+	if (gbs_snap_load(store, cart, atoi(n), &image, &size) != STAT_OK) {
+		printf(MSG_NO_SNAPSHOT);
+		return EXIT_FAIL;
+	}
+	if ((f = fopen(file, "wb")) == NULL) {
+		fprintf(stderr, "Can't open %s\n", file);
+		free(image);
+		return EXIT_FAIL;
+	}
+	written = fwrite(image, 1, size, f);
+	free(image);
+	if (fclose(f) != 0 || written != size) {
+		fprintf(stderr, "Can't write %s\n", file);
+		return EXIT_FAIL;
+	}
+
+	printf("%u bytes written to %s\n", size, file);
+	return EXIT_WIN;
+}
+
+/* --build-multicart and --write-multicart, from argv[first] on */
+int gbs_multicart(int argc, char* argv[], int first, uint8_t write) {
+	thread_args_t args = {0};
+	gbs_multicart_t mc;
+	uint32_t max_size = S_4MB;
+	char file[1024];
+	const char* out;
+	uint16_t erc;
+	FILE* f;
+	int fd;
+
+	if (argc > first + 1 && strcmp(argv[first], "--size") == 0) {
+		max_size = gbs_rom_size(argv[first+1]);
+		first += 2;
+	}
+	out = write ? NULL : argv[first++];
+	if (first >= argc) {
 		gbs_help();
 		return EXIT_FAIL;
 	}
+	if (gbs_mc_build(&mc, &argv[first], argc - first, max_size) != STAT_OK)
+		return EXIT_FAIL;
+	gbs_mc_print_map(&mc, stdout);
+
+	if (out == NULL) {
+		snprintf(file, sizeof file, "/tmp/gbsmcXXXXXX");
+		if ((fd = mkstemp(file)) < 0) {
+			gbs_mc_free(&mc);
+			return EXIT_FAIL;
+		}
+		close(fd);
+		out = file;
+	}
+	if ((f = fopen(out, "wb")) == NULL
+			|| fwrite(mc.image, 1, mc.size, f) != mc.size || fclose(f) != 0) {
+		fprintf(stderr, "Can't write %s\n", out);
+		gbs_mc_free(&mc);
+		return EXIT_FAIL;
+	}
+
+	if (!write) {
+		if (snprintf(file, sizeof file, "%s.map", out) < (int) sizeof file
+				&& (f = fopen(file, "w")) != NULL) {
+			gbs_mc_print_map(&mc, f);
+			fclose(f);
+		}
+		gbs_mc_free(&mc);
+		return EXIT_WIN;
+	}
+
+	/* one erase, then one pass over the banks in use */
+	gbs_forget_header();
+	gbs_args_init(&args, ctx);
+	printf(MSG_FLASH_ERASING);
+	if ((erc = gbs_run(&gbs_erase_flash, &args)) == STAT_OK) {
+		gbs_args_init(&args, ctx);
+		args.file = file;
+		args.prg_mode = PRG_AUTO;
+		args.skip = mc.blank;
+		args.skip_banks = mc.banks;
+		printf(MSG_FLASH_PROGRAMMING);
+		erc = gbs_run(&gbs_write_flash, &args);
+	}
+	unlink(file);
+	gbs_mc_free(&mc);
+	if (erc != STAT_OK) {
+		printf(erc == STAT_CANCELLED ? MSG_CANCELLED : MSG_ERROR);
+		return EXIT_FAIL;
+	}
+
+	printf(MSG_FLASH_PROGRAMMED);
+	return EXIT_WIN;
+}
+
+/* runs one action, argv as on the command line */
+int gbs_action(int argc, char* argv[]) {
+
+	uint8_t erc;
 
 	/* selecciona comando */
 	if (strcmp(argv[1], "--version")==0) {
@@ -107,7 +789,7 @@ int main(int argc, char* argv[]) {
 	}
 	if (strcmp(argv[1],"--status")==0) {
 		status_t status;
-		erc = gbs_status(&status);
+		erc = gbs_status(ctx, &status);
 		if (erc != STAT_OK)
 		{
 			printf("Hardware error\n");
@@ -120,9 +802,10 @@ int main(int argc, char* argv[]) {
 	}
 	if (strcmp(argv[1],"--id")==0) {
 		flash_id_t id;
-		gbs_flash_id(&id);
+		gbs_flash_id(ctx, &id);
 		printf("Flash manufacturer: %s\n", id.manufacturer);
 		printf("Flash chip type: %s\n", id.chip);
+		printf(MSG_PRG_MODE, gbs_prg_mode_name(id.prg_mode));
 		return EXIT_WIN;
 	}
 	if (strcmp(argv[1],"--help")==0) {
@@ -130,38 +813,34 @@ int main(int argc, char* argv[]) {
 		return EXIT_WIN;
 	}
 	if (strcmp(argv[1],"--read-header")==0) {
-		rom_header_t header;
-		gbs_read_header(&header);
-		printf("Cart name: %s\n", header.title);
-		printf("Cart type: %s\n", header.cart);
-		printf("Cart name: %s\n", header.rom_size);
-		printf("Cart name: %s\n", header.ram_size);
+		rom_header_t* h;
+
+		gbs_forget_header();
+		if ((h = gbs_get_header()) == NULL) {
+			printf("Hardware error\n");
+			return EXIT_FAIL;
+		}
+		printf("Cart name: %s\n", h->title);
+		printf("Cart type: %s\n", h->cart);
+		printf("Cart name: %s\n", h->rom_size);
+		printf("Cart name: %s\n", h->ram_size);
 		return EXIT_WIN;
 	}
 	if (strcmp(argv[1],"--erase-flash")==0) {
-		thread_args_t args;
+		thread_args_t args = {0};
+
+		gbs_args_init(&args, ctx);
+		gbs_forget_header();
 
 		printf(MSG_FLASH_ERASING);
 		
-		args.stat = T_RUNNING;
-		t = pthread_create(&exec_thread, NULL, &gbs_erase_flash, (void*) &args);
-		if (t) {
-			printf("\n");
-			printf(MSG_ERROR);
-			return EXIT_FAIL;
-		}
-		while (args.stat != T_END)
-		{
-			sleep(1);
-		}
-
-		if (args.ret!=STAT_OK)
+		if ((erc = gbs_run(&gbs_erase_flash, &args)) != STAT_OK)
 		{
-			printf("\n");
-			printf(MSG_ERROR);
+			printf(erc == STAT_CANCELLED ? MSG_CANCELLED : MSG_ERROR);
 			return EXIT_FAIL;
 		}
 		printf(MSG_FLASH_ERASED);
+		printf(MSG_ERASE_TIME, args.erase_ms / 1000, args.erase_ms % 1000);
 		return EXIT_WIN;
 	}
 
@@ -170,32 +849,29 @@ int main(int argc, char* argv[]) {
 			gbs_help();
 			return EXIT_FAIL;
 		} else {
-			thread_args_t args;
+			thread_args_t args = {0};
 
-			args.file = argv[2];
-			args.stat = T_RUNNING;
-			printf(MSG_FLASH_PROGRAMMING);
-			t = pthread_create(&exec_thread, NULL, &gbs_write_flash, (void*) &args);
-			if (t) {
-				printf("\n");
-				printf(MSG_ERROR);
+			gbs_args_init(&args, ctx);
+			if (gbs_write_options(argc, argv, &args, gbs_rom_size)
+					!= STAT_OK) {
+				gbs_help();
 				return EXIT_FAIL;
 			}
+			gbs_forget_header();
 
-			//gbs_write_flash(&args);
-			while (args.stat != T_END)
-			{
-				printf("%d%%\r", args.progress);
-				fflush(stdout);
-			}
-			if (args.ret!=STAT_OK)
+			args.prg_mode = PRG_AUTO;
+			printf(MSG_FLASH_PROGRAMMING);
+			if ((erc = gbs_run(&gbs_write_flash, &args)) != STAT_OK)
 			{
-				printf("\n");
-				printf(MSG_ERROR);
+				printf(erc == STAT_CANCELLED ? MSG_CANCELLED : MSG_ERROR);
 				return EXIT_FAIL;
 			}
 
-			printf("100%%\n");
+			printf("ROM size: %u bytes\n", args.total_bytes);
+			printf(MSG_PRG_MODE, gbs_prg_mode_name(args.prg_mode));
+			if (args.compress && args.sent_bytes != 0)
+				printf(MSG_COMPRESSION, args.sent_bytes, args.raw_bytes,
+						(double) args.raw_bytes / args.sent_bytes);
 			printf(MSG_FLASH_PROGRAMMED);
 			return EXIT_WIN;
 		}
@@ -206,70 +882,27 @@ int main(int argc, char* argv[]) {
 			gbs_help();
 			return EXIT_FAIL;
 		} else {
-			thread_args_t args;
+			thread_args_t args = {0};
 
-			if (strcmp(argv[2], "--size") == 0)
-			{
-				s = atoi(argv[3]);
-				switch (s) {
-					case 1:
-						size = S_32K;
-						break;
-					case 2:
-						size = S_64K;
-						break;
-					case 3:
-						size = S_128K;
-						break;
-					case 4:
-						size = S_256K;
-						break;
-					case 5:
-						size = S_512K;
-						break;
-					case 6:
-						size = S_1MB;
-						break;
-					case 7:
-						size = S_2MB;
-						break;
-					case 8:
-						size = S_4MB;
-						break;
-					default:
-						size = S_32K;
-						break;
-				}
-				args.file = argv[4];
-				args.size = size;
-			}
-			else {
-				args.file = argv[2];
-				args.size = S_32K;
-			}
+			gbs_args_init(&args, ctx);
 
-			args.stat = T_RUNNING;
-			printf(MSG_FLASH_READING);
-			t = pthread_create(&exec_thread, NULL, &gbs_read_flash, (void*) &args);
-			if (t) {
-				printf("\n");
-				printf(MSG_ERROR);
+			if (gbs_read_options(argc, argv, &args, gbs_rom_size,
+						ROM_BANK_SIZE) != STAT_OK) {
+				gbs_help();
 				return EXIT_FAIL;
 			}
-
-			while (args.stat != T_END)
-			{
-				printf("%d%%\r", args.progress);
-				fflush(stdout);
+			if (args.size == 0) {
+				printf(MSG_NO_SIZE);
+				return EXIT_FAIL;
 			}
-			if (args.ret!=STAT_OK)
+
+			printf(MSG_FLASH_READING);
+			if ((erc = gbs_run_dump(&gbs_read_flash, &args)) != STAT_OK)
 			{
-				printf("\n");
-				printf(MSG_ERROR);
+				printf(erc == STAT_CANCELLED ? MSG_CANCELLED : MSG_ERROR);
 				return EXIT_FAIL;
 			}
 
-			printf("100%%\n");
 			printf(MSG_FLASH_READ);
 			return EXIT_WIN;
 
@@ -282,31 +915,22 @@ int main(int argc, char* argv[]) {
 			gbs_help();
 			return EXIT_FAIL;
 		} else {
-			thread_args_t args;
+			thread_args_t args = {0};
 
-			args.file = argv[2];
-			args.stat = T_RUNNING;
-			printf(MSG_RAM_PROGRAMMING);
-			t = pthread_create(&exec_thread, NULL, &gbs_write_ram, (void*) &args);
-			if (t) {
-				printf("\n");
-				printf(MSG_ERROR);
+			gbs_args_init(&args, ctx);
+			if (gbs_write_options(argc, argv, &args, gbs_ram_size)
+					!= STAT_OK) {
+				gbs_help();
 				return EXIT_FAIL;
 			}
 
-			while (args.stat != T_END)
-			{
-				printf("%d%%\r", args.progress);
-				fflush(stdout);
-			}
-			if (args.ret!=STAT_OK)
+			printf(MSG_RAM_PROGRAMMING);
+			if ((erc = gbs_run(&gbs_write_ram, &args)) != STAT_OK)
 			{
-				printf("\n");
-				printf(MSG_ERROR);
+				printf(erc == STAT_CANCELLED ? MSG_CANCELLED : MSG_ERROR);
 				return EXIT_FAIL;
 			}
 
-			printf("100%%\n");
 			printf(MSG_RAM_PROGRAMMED);
 			return EXIT_WIN;
 
@@ -318,55 +942,32 @@ int main(int argc, char* argv[]) {
 			gbs_help();
 			return EXIT_FAIL;
 		} else {
-			thread_args_t args;
+			thread_args_t args = {0};
 
-			if (strcmp(argv[2], "--size") == 0)
-			{
-				s = atoi(argv[3]);
-				switch (s) {
-					case 1:
-						size = S_8K;
-						break;
-					case 2:
-						size = S_32K;
-						break;
-					case 3:
-						size = S_1MB;
-						break;
-					default:
-						size = S_8K;
-						break;
-				}
-				args.size = size;
-				args.file = argv[4];
+			gbs_args_init(&args, ctx);
+
+			if (gbs_read_options(argc, argv, &args, gbs_ram_size,
+						RAM_BANK_SIZE) != STAT_OK) {
+				gbs_help();
+				return EXIT_FAIL;
 			}
-			else {
-				args.size = S_8K;
-				args.file = argv[2];
+			if (args.size == 0 && header_valid) {
+				/* the header says there is nothing to save */
+				printf(MSG_NO_RAM);
+				return EXIT_WIN;
 			}
-
-			args.stat = T_RUNNING;
-			printf(MSG_RAM_READING);
-			t = pthread_create(&exec_thread, NULL, &gbs_read_ram, (void*) &args);
-			if (t) {
-				printf("\n");
-				printf(MSG_ERROR);
+			if (args.size == 0) {
+				printf(MSG_NO_SIZE);
 				return EXIT_FAIL;
 			}
 
-			while (args.stat != T_END)
-			{
-				printf("%d%%\r", args.progress);
-				fflush(stdout);
-			}
-			if (args.ret!=STAT_OK)
+			printf(MSG_RAM_READING);
+			if ((erc = gbs_run_dump(&gbs_read_ram, &args)) != STAT_OK)
 			{
-				printf("\n");
-				printf(MSG_ERROR);
+				printf(erc == STAT_CANCELLED ? MSG_CANCELLED : MSG_ERROR);
 				return EXIT_FAIL;
 			}
 
-			printf("100%%\n");
 			printf(MSG_RAM_READ);
 			return EXIT_WIN;
 
@@ -380,58 +981,563 @@ int main(int argc, char* argv[]) {
 			gbs_help();
 			return EXIT_FAIL;
 		} else {
-			thread_args_t args;
+			thread_args_t args = {0};
 
-			if (strcmp(argv[2], "--size") == 0)
-			{
-				s = atoi(argv[3]);
-				switch (s) {
-					case 1:
-						size = S_8K;
-						break;
-					case 2:
-						size = S_32K;
-						break;
-					case 3:
-						size = S_1MB;
-						break;
-					default:
-						size = S_8K;
-						break;
-				}
-				args.size = size;
-			}
+			gbs_args_init(&args, ctx);
+
+			if (argc > 3 && strcmp(argv[2], "--size") == 0)
+				args.size = gbs_ram_size(argv[3]);
 			else
 				args.size = S_8K;
-
-			args.stat = T_RUNNING;
-			printf(MSG_RAM_ERASING);
-			t = pthread_create(&exec_thread, NULL, &gbs_erase_ram, (void*) &args);
-			if (t) {
-				printf("\n");
-				printf(MSG_ERROR);
+			if (args.size == 0 && header_valid) {
+				printf(MSG_NO_RAM);
+				return EXIT_WIN;
+			}
+			if (args.size == 0) {
+				printf(MSG_NO_SIZE);
 				return EXIT_FAIL;
 			}
 
-			while (args.stat != T_END)
-			{
-				printf("%d%%\r", args.progress);
-				fflush(stdout);
-			}
-			if (args.ret!=STAT_OK)
+			printf(MSG_RAM_ERASING);
+			if ((erc = gbs_run(&gbs_erase_ram, &args)) != STAT_OK)
 			{
-				printf("\n");
-				printf(MSG_ERROR);
+				printf(erc == STAT_CANCELLED ? MSG_CANCELLED : MSG_ERROR);
 				return EXIT_FAIL;
 			}
 
-			printf("100%%\n");
 			printf(MSG_RAM_ERASED);
 			return EXIT_WIN;
 		}
 	}	
 	
+	if (strcmp(argv[1], "--snapshot-ram") == 0 && argc > 2) {
+		const char* size = NULL, * label = NULL;
+		int i;
+
+		for (i = 3; i + 1 < argc; i += 2) {
+			if (strcmp(argv[i], "--size") == 0)
+				size = argv[i+1];
+			else if (strcmp(argv[i], "--cart") == 0)
+				label = argv[i+1];
+			else
+				break;
+		}
+		if (i < argc) {
+			gbs_help();
+			return EXIT_FAIL;
+		}
+		return gbs_snapshot_ram(argv[2], size, label);
+	}
+	if (strcmp(argv[1], "--snapshots") == 0 && argc > 2)
+		return gbs_list_snapshots(argv[2], argc > 3 ? argv[3] : NULL);
+	if (strcmp(argv[1], "--extract-snapshot") == 0 && argc > 5)
+		return gbs_extract_snapshot(argv[2], argv[3], argv[4], argv[5]);
+	if (strcmp(argv[1], "--compile-dat") == 0 && argc > 3) {
+		int32_t n;
+
+		if ((n = gbs_dat_compile(argv[2], argv[3])) < 0) {
+			fprintf(stderr, "Can't compile %s into %s\n", argv[2], argv[3]);
+			return EXIT_FAIL;
+		}
+		printf("%d ROMs indexed in %s\n", n, argv[3]);
+		return EXIT_WIN;
+	}
+	if (strcmp(argv[1], "--build-multicart") == 0)
+		return gbs_multicart(argc, argv, 2, 0);
+	if (strcmp(argv[1], "--write-multicart") == 0)
+		return gbs_multicart(argc, argv, 2, 1);
+
 	gbs_help();
 	return EXIT_FAIL;
 
 }
+
+/* copies a header string into a file name, keeping it to letters, digits
+ * and -._+ */
+void gbs_file_name(char* dst, const char* src, size_t n) {
+	size_t i = 0;
+
+	for (; *src != '\0' && i + 1 < n; src++) {
+		if ((*src >= 'a' && *src <= 'z') || (*src >= 'A' && *src <= 'Z')
+				|| (*src >= '0' && *src <= '9') || strchr("-._+", *src))
+			dst[i++] = *src;
+		else if (i > 0 && dst[i-1] != '_')
+			dst[i++] = '_';
+	}
+	while (i > 0 && dst[i-1] == '_')
+		i--;
+	dst[i] = '\0';
+	if (i == 0)
+		snprintf(dst, n, "untitled");
+}
+
+/* expands the {field} templates of a batch argument into out. Header fields
+ * read the cart header if nothing did yet. */
+uint16_t gbs_expand(const char* arg, char* out, size_t n, uint32_t job,
+		const struct tm* start) {
+	char field[16], value[64];
+	const char* end;
+	rom_header_t* h;
+	size_t len = 0, flen;
+
+	while (*arg != '\0') {
+		if (*arg != '{' || (end = strchr(arg, '}')) == NULL
+				|| (flen = end - arg - 1) >= sizeof field) {
+			if (len + 1 < n)
+				out[len++] = *arg;
+			arg++;
+			continue;
+		}
+		memcpy(field, arg + 1, flen);
+		field[flen] = '\0';
+
+		h = NULL;
+		if (strcmp(field, "title") == 0 || strcmp(field, "cart") == 0
+				|| strcmp(field, "rom") == 0 || strcmp(field, "ram") == 0) {
+			if ((h = gbs_get_header()) == NULL) {
+				fprintf(stderr, "Can't read the header for {%s}\n", field);
+				return STAT_ERROR;
+			}
+		}
+		if (strcmp(field, "title") == 0)
+			gbs_file_name(value, h->title, sizeof value);
+		else if (strcmp(field, "cart") == 0)
+			gbs_file_name(value, h->cart, sizeof value);
+		else if (strcmp(field, "rom") == 0)
+			gbs_file_name(value, h->rom_size, sizeof value);
+		else if (strcmp(field, "ram") == 0)
+			gbs_file_name(value, h->ram_size, sizeof value);
+		else if (strcmp(field, "n") == 0)
+			snprintf(value, sizeof value, "%u", job);
+		else if (strcmp(field, "seq") == 0)
+			snprintf(value, sizeof value, "%u", station_cart);
+		else if (strcmp(field, "date") == 0)
+			strftime(value, sizeof value, "%Y%m%d", start);
+		else if (strcmp(field, "time") == 0)
+			strftime(value, sizeof value, "%H%M%S", start);
+		else {
+			fprintf(stderr, "Unknown field {%s}\n", field);
+			return STAT_ERROR;
+		}
+
+		if (len + strlen(value) >= n) {
+			fprintf(stderr, "Argument too long: %s\n", arg);
+			return STAT_ERROR;
+		}
+		strcpy(&out[len], value);
+		len += strlen(value);
+		arg = end + 1;
+	}
+	out[len] = '\0';
+
+	return STAT_OK;
+}
+
+/* splits a manifest line into words. Double quotes group words, # starts
+ * a comment. Returns the word count. */
+int gbs_split(char* line, char* words[], int max) {
+	int count = 0;
+	char* w;
+
+	while (count < max) {
+		while (*line == ' ' || *line == '\t' || *line == '\r'
+				|| *line == '\n')
+			line++;
+		if (*line == '\0' || *line == '#')
+			break;
+		if (*line == '"') {
+			w = ++line;
+			while (*line != '\0' && *line != '"')
+				line++;
+		} else {
+			w = line;
+			while (*line != '\0' && *line != ' ' && *line != '\t'
+					&& *line != '\r' && *line != '\n')
+				line++;
+		}
+		words[count++] = w;
+		if (*line == '\0')
+			break;
+		*line++ = '\0';
+	}
+
+	return count;
+}
+
+/* runs the actions listed in a manifest, one per line, over one open link,
+ * then prints a summary of them all */
+int gbs_batch(const char* file, uint8_t keep_going) {
+	char line[BATCH_LINE];
+	char* words[BATCH_ARGS];
+	char expanded[BATCH_ARGS][BATCH_LINE];
+	char* argv[BATCH_ARGS + 2];
+	batch_job_t* jobs = NULL, * job;
+	gbs_stats_t total;
+	struct timespec start, t0, t1;
+	struct tm start_tm;
+	time_t now;
+	FILE* f;
+	uint32_t count = 0, failed = 0, lineno = 0, i;
+	uint64_t busy_ns = 0, wall_ns;
+	uint8_t own_session = !ctx->session_open;
+	int argc, words_count;
+
+	if (strcmp(file, "-") == 0)
+		f = stdin;
+	else if ((f = fopen(file, "r")) == NULL) {
+		fprintf(stderr, "Can't open %s\n", file);
+		return EXIT_FAIL;
+	}
+
+	now = time(NULL);
+	localtime_r(&now, &start_tm);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	batch_mode = 1;
+
+	if (gbs_session_begin(ctx) != STAT_OK) {
+		printf("Hardware error\n");
+		if (f != stdin)
+			fclose(f);
+		return EXIT_FAIL;
+	}
+
+	while (fgets(line, sizeof line, f) != NULL) {
+		lineno++;
+		if (strchr(line, '\n') == NULL && !feof(f)) {
+			fprintf(stderr, "%s:%u: line too long\n", file, lineno);
+			failed++;
+			break;
+		}
+		if ((words_count = gbs_split(line, words, BATCH_ARGS)) == 0)
+			continue;
+
+		if ((job = realloc(jobs, (count + 1) * sizeof(*jobs))) == NULL)
+			break;
+		jobs = job;
+		job = &jobs[count++];
+		memset(job, 0, sizeof(*job));
+		snprintf(job->action, sizeof job->action, "%s", words[0]);
+		job->line = lineno;
+
+		printf("[%u]", count);
+		for (i = 0; i < (uint32_t) words_count; i++)
+			printf(" %s", words[i]);
+		printf("\n");
+		fflush(stdout);
+
+		/* fill in the templates, the action sees a normal argv */
+		argv[0] = "gbshooper";
+		job->ret = EXIT_WIN;
+		for (argc = 1; argc <= words_count; argc++) {
+			if (gbs_expand(words[argc-1], expanded[argc-1], BATCH_LINE,
+						count, &start_tm) != STAT_OK)
+				job->ret = EXIT_FAIL;
+			else if (strcmp(words[argc-1], expanded[argc-1]) != 0)
+				printf("    %s\n", expanded[argc-1]);
+			argv[argc] = expanded[argc-1];
+		}
+		argv[argc] = NULL;
+		if (strcmp(argv[1], "--batch") == 0) {
+			fprintf(stderr, "%s:%u: batches don't nest\n", file, lineno);
+			job->ret = EXIT_FAIL;
+		}
+
+		memset(&last_stats, 0, sizeof(last_stats));
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (job->ret == EXIT_WIN)
+			job->ret = gbs_action(argc, argv);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		job->ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL
+			+ t1.tv_nsec - t0.tv_nsec;
+		job->stats = last_stats;
+		busy_ns += job->ns;
+
+		if (job->ret != EXIT_WIN) {
+			failed++;
+			if (!keep_going)
+				break;
+		}
+		/* Ctrl-C stops the batch, --keep-going or not */
+		if (interrupted)
+			break;
+	}
+
+	if (own_session)
+		gbs_session_end(ctx);
+	if (f != stdin)
+		fclose(f);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	wall_ns = (t1.tv_sec - start.tv_sec) * 1000000000ULL
+		+ t1.tv_nsec - start.tv_nsec;
+
+	/* one line per job and the totals */
+	memset(&total, 0, sizeof(total));
+	printf("\n%5s %5s %-14s %10s %10s %10s %s\n", "job", "line", "action",
+			"bytes", "s", "KB/s", "result");
+	for (i = 0; i < count; i++) {
+		job = &jobs[i];
+		printf("%5u %5u %-14s %10" PRIu64 " %10.3f ", i + 1, job->line,
+				job->action, job->stats.bytes, job->ns / 1e9);
+		if (job->stats.bytes && job->ns)
+			printf("%10.1f", job->stats.bytes * 1e9 / job->ns / 1024);
+		else
+			printf("%10s", "-");
+		printf(" %s\n", job->ret == EXIT_WIN ? "ok" : "FAILED");
+		gbs_stats_merge(&total, &job->stats);
+	}
+	printf("%u jobs, %u failed, %" PRIu64 " bytes in %.3f s, "
+			"%.3f s in jobs\n", count, failed, total.bytes, wall_ns / 1e9,
+			busy_ns / 1e9);
+
+	total.op = "batch";
+	total.wall_ns = wall_ns;
+	fflush(stdout);
+	if (stats_mode == STATS_SUMMARY)
+		gbs_stats_print(&total, stderr);
+	else if (stats_mode == STATS_JSON)
+		gbs_stats_json(&total, stderr);
+
+	free(jobs);
+	return failed ? EXIT_FAIL : EXIT_WIN;
+}
+
+/* waits for a flasher to show up: a uevent, the --device path appearing,
+ * or a while where neither can be watched. Returns 1 when it is worth
+ * trying to open it. */
+static uint8_t gbs_station_wait(gbs_hotplug_t* hp, uint32_t probe_ms) {
+	if (device != NULL) {
+		gbs_hotplug_wait(hp, probe_ms);
+		return access(device, F_OK) == 0;
+	}
+	if (gbs_hotplug_wait(hp, hp->fd < 0 ? STATION_RETRY_MS
+				: STATION_RESCAN_MS))
+		poll(NULL, 0, STATION_SETTLE_MS);
+
+	return 1;
+}
+
+/* the title of a probed cart, to tell the operator which one it was */
+static void gbs_station_title(const gbs_probe_t* probe, char* dst,
+		size_t n) {
+	size_t i, len = 0;
+
+	for (i = 3; i < sizeof probe->header && probe->header[i] != '\0'
+			&& len + 1 < n; i++)
+		dst[len++] = probe->header[i] >= ' ' && probe->header[i] < 0x7F
+			? probe->header[i] : '?';
+	dst[len] = '\0';
+	if (len == 0)
+		snprintf(dst, n, "blank flash cart");
+}
+
+/* runs the batch on the cart just put in, then tells the operator and
+ * the --on-done or --on-fail command how it went */
+static int gbs_station_cart(const char* file, uint8_t keep_going,
+		const gbs_probe_t* probe, const char* on_done, const char* on_fail) {
+	char title[32], seq[16];
+	const char* hook;
+	int ret;
+
+	gbs_station_title(probe, title, sizeof title);
+	printf("\nCart %u: %s\n", station_cart, title);
+	fflush(stdout);
+	gbs_forget_header();
+	ret = gbs_batch(file, keep_going);
+
+	if (ret == EXIT_WIN)
+		printf(MSG_STATION_DONE, station_cart, title);
+	else
+		printf(MSG_STATION_FAIL, station_cart, title);
+	fflush(stdout);
+
+	hook = ret == EXIT_WIN ? on_done : on_fail;
+	if (hook != NULL) {
+		snprintf(seq, sizeof seq, "%u", station_cart);
+		setenv("GBS_SEQ", seq, 1);
+		setenv("GBS_TITLE", title, 1);
+		if (system(hook) != 0)
+			fprintf(stderr, "%s failed\n", hook);
+	}
+	station_cart++;
+
+	return ret;
+}
+
+/* --station: runs the batch FILE on every cart put in the flasher, until
+ * Ctrl-C. The flasher is opened when it is plugged in and kept open, and
+ * probed every probe_ms for a new cart: one that reads the same twice in
+ * a row, and not as the last one done read when it was. */
+int gbs_station(const char* file, uint8_t keep_going, uint32_t probe_ms,
+		const char* on_done, const char* on_fail) {
+	gbs_hotplug_t hp;
+	gbs_probe_t probe, seen, last;
+	uint32_t done = 0, failed = 0;
+	uint8_t ready = 0, look = device == NULL || access(device, F_OK) == 0;
+
+	if (strcmp(file, "-") == 0 || access(file, R_OK) != 0) {
+		fprintf(stderr, "Can't open %s, the station reads it again for "
+				"every cart\n", file);
+		return EXIT_FAIL;
+	}
+
+	gbs_hotplug_open(&hp);
+	memset(&seen, 0, sizeof(seen));
+	memset(&last, 0, sizeof(last));
+	printf("Station: %s on every cart, Ctrl-C to stop.\n", file);
+	printf("Waiting for the flasher...\n");
+	fflush(stdout);
+
+	while (!interrupted) {
+		if (!ctx->session_open) {
+			if (look && gbs_session_begin(ctx) == STAT_OK)
+				continue;
+			look = gbs_station_wait(&hp, probe_ms);
+			continue;
+		}
+
+		if (gbs_probe_cart(ctx, &probe) != STAT_OK) {
+			/* unplugged, or not a flasher */
+			gbs_session_end(ctx);
+			if (ready)
+				printf("Flasher gone, waiting for it...\n");
+			fflush(stdout);
+			ready = 0;
+			look = gbs_station_wait(&hp, probe_ms);
+			continue;
+		}
+		if (!ready) {
+			/* a new flasher, whatever is in it is a new cart */
+			printf("Flasher ready, put a cart in.\n");
+			fflush(stdout);
+			memset(&last, 0, sizeof(last));
+			ready = 1;
+		}
+
+		if (!probe.present || memcmp(&probe, &seen, sizeof(probe)) != 0
+				|| memcmp(&probe, &last, sizeof(probe)) == 0) {
+			if (!probe.present && last.present) {
+				printf("Cart out, ready for the next one.\n");
+				fflush(stdout);
+				memset(&last, 0, sizeof(last));
+			}
+			seen = probe;
+			poll(NULL, 0, probe_ms);
+			continue;
+		}
+
+		last = probe;
+		if (gbs_station_cart(file, keep_going, &probe, on_done, on_fail)
+				== EXIT_WIN)
+			done++;
+		else
+			failed++;
+		/* a write leaves another header behind, it's still the same cart */
+		if (gbs_probe_cart(ctx, &probe) == STAT_OK && probe.present)
+			last = probe;
+		seen = last;
+	}
+
+	gbs_session_end(ctx);
+	gbs_hotplug_close(&hp);
+	printf("\nStation: %u carts done, %u failed\n", done, failed);
+
+	return failed ? EXIT_FAIL : EXIT_WIN;
+}
+
+
+/******************************************************************************/
+/************************* PROGRAMA PRINCIPAL *********************************/
+/******************************************************************************/
+
+int main(int argc, char* argv[]) {
+
+	int i, j;
+	uint8_t keep_going = 0, proto = 0;
+
+	/* opciones globales, se quitan de la línea de comandos */
+	for (i = j = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--stats") == 0)
+			stats_mode = STATS_SUMMARY;
+		else if (strcmp(argv[i], "--stats=json") == 0)
+			stats_mode = STATS_JSON;
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			trace_file = argv[++i];
+		else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc)
+			device = argv[++i];
+		else if (strcmp(argv[i], "--erase-log") == 0 && i + 1 < argc)
+			erase_log = argv[++i];
+		else if (strcmp(argv[i], "--proto") == 0 && i + 1 < argc)
+			proto = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc)
+			server = argv[++i];
+		else if (strcmp(argv[i], "--keep-going") == 0)
+			keep_going = 1;
+		else
+			argv[j++] = argv[i];
+	}
+	argc = j;
+	argv[argc] = NULL;
+
+	if ((ctx = gbs_ctx_new()) == NULL)
+		return EXIT_FAIL;
+	if (device != NULL)
+		gbs_ctx_set_device(ctx, device);
+	if (erase_log == NULL && getenv("HOME") != NULL) {
+		snprintf(erase_log_home, sizeof erase_log_home, "%s/%s",
+				getenv("HOME"), ERASE_LOG);
+		erase_log = erase_log_home;
+	}
+	gbs_ctx_set_erase_log(ctx, erase_log);
+	gbs_ctx_set_proto(ctx, proto);
+	if (server != NULL && strcmp(server, "auto") == 0) {
+		gbs_remote_path(server_path, sizeof server_path);
+		server = server_path;
+	}
+	if (server != NULL)
+		gbs_ctx_set_server(ctx, server);
+	if (trace_file != NULL) {
+		if ((trace = gbs_trace_new(TRACE_EVENTS)) == NULL)
+			return EXIT_FAIL;
+		gbs_ctx_set_trace(ctx, trace);
+		atexit(gbs_trace_exit);
+	}
+
+	signal(SIGINT, gbs_interrupt);
+
+	/* sin parámetros, imprime ayuda y sale */
+	if (argc == 1) {
+		gbs_help();
+		return EXIT_FAIL;
+	}
+
+	if (strcmp(argv[1], "--batch") == 0) {
+		if (argc < 3) {
+			gbs_help();
+			return EXIT_FAIL;
+		}
+		return gbs_batch(argv[2], keep_going);
+	}
+
+	if (strcmp(argv[1], "--station") == 0 && argc > 2) {
+		uint32_t probe_ms = STATION_PROBE_MS;
+		char* on_done = NULL, * on_fail = NULL;
+
+		for (i = 3; i + 1 < argc; i += 2) {
+			if (strcmp(argv[i], "--probe-ms") == 0)
+				probe_ms = strtoul(argv[i+1], NULL, 0);
+			else if (strcmp(argv[i], "--on-done") == 0)
+				on_done = argv[i+1];
+			else if (strcmp(argv[i], "--on-fail") == 0)
+				on_fail = argv[i+1];
+			else
+				break;
+		}
+		if (i != argc || probe_ms == 0) {
+			gbs_help();
+			return EXIT_FAIL;
+		}
+		return gbs_station(argv[2], keep_going, probe_ms, on_done, on_fail);
+	}
+
+	return gbs_action(argc, argv);
+}
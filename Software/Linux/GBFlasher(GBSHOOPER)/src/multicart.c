@@ -0,0 +1,227 @@
+/*
+============================================================================
+Name        : multicart.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Multicart image builder
+============================================================================
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gbshooper.h"
+#include "flashcart.h"
+#include "multicart.h"
+
+/* smallest slot that holds n bytes */
+static uint32_t gbs_mc_slot_size(uint32_t n) {
+	uint32_t size = MC_MIN_SLOT;
+
+	while (size < n)
+		size <<= 1;
+	return size;
+}
+
+static uint8_t* gbs_mc_load(const char* file, uint32_t max, uint32_t* len) {
+	uint8_t* data;
+	FILE* f;
+	long n;
+
+	if ((f = fopen(file, "rb")) == NULL) {
+		fprintf(stderr, "Can't open %s\n", file);
+		return NULL;
+	}
+	fseek(f, 0L, SEEK_END);
+	n = ftell(f);
+	fseek(f, 0L, SEEK_SET);
+	if (n <= 0 || (uint32_t) n > max || (data = malloc(n)) == NULL) {
+		fprintf(stderr, "%s: empty or too big\n", file);
+		fclose(f);
+		return NULL;
+	}
+	if (fread(data, 1, n, f) != (size_t) n) {
+		fprintf(stderr, "Can't read %s\n", file);
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+
+	*len = n;
+	return data;
+}
+
+/* first offset, aligned to its size, where a slot overlaps none of the
+ * slots placed before it */
+static uint32_t gbs_mc_place(gbs_multicart_t* mc, mc_slot_t* slot,
+		const uint16_t* placed, uint16_t count, uint32_t max) {
+	mc_slot_t* other;
+	uint32_t offset;
+	uint16_t i;
+
+	for (offset = 0; offset + slot->size <= max; offset += slot->size) {
+		for (i = 0; i < count; i++) {
+			other = &mc->slots[placed[i]];
+			if (other->same_as < 0 && offset < other->offset + other->size
+					&& other->offset < offset + slot->size)
+				break;
+		}
+		if (i == count)
+			return offset;
+	}
+
+	return max;
+}
+
+/* places the loaded ROMs and lays out the image */
+static uint16_t gbs_mc_pack(gbs_multicart_t* mc, uint8_t* data[],
+		uint32_t max_size) {
+	uint16_t order[MC_SLOTS];
+	mc_slot_t* slot;
+	uint32_t end = 0, i, j;
+
+	/* menu first, then biggest first */
+	for (i = 0; i < mc->count; i++) {
+		for (j = i; j > 1 && mc->slots[order[j-1]].size
+				< mc->slots[i].size; j--)
+			order[j] = order[j-1];
+		order[j] = i;
+	}
+	for (i = 0; i < mc->count; i++) {
+		slot = &mc->slots[order[i]];
+		if (slot->same_as >= 0)
+			continue;
+		slot->offset = gbs_mc_place(mc, slot, order, i, max_size);
+		if (slot->offset >= max_size) {
+			fprintf(stderr, "%s doesn't fit in %u KB\n", slot->file,
+					max_size / 1024);
+			return STAT_ERROR;
+		}
+		if (slot->offset + slot->size > end)
+			end = slot->offset + slot->size;
+	}
+	for (i = 0; i < mc->count; i++)
+		if (mc->slots[i].same_as >= 0) {
+			mc->slots[i].offset = mc->slots[mc->slots[i].same_as].offset;
+			mc->slots[i].size = mc->slots[mc->slots[i].same_as].size;
+		}
+
+	/* the image, erased flash where there is no ROM */
+	mc->size = gbs_mc_slot_size(end);
+	mc->banks = mc->size / ROM_BANK_SIZE;
+	if ((mc->image = malloc(mc->size)) == NULL
+			|| (mc->blank = malloc(mc->banks)) == NULL)
+		return STAT_ERROR;
+	memset(mc->image, 0xFF, mc->size);
+	for (i = 0; i < mc->count; i++)
+		if (mc->slots[i].same_as < 0)
+			memcpy(&mc->image[mc->slots[i].offset], data[i],
+					mc->slots[i].used);
+
+	/* sector map: banks left erased don't need programming */
+	for (i = 0; i < mc->banks; i++) {
+		mc->blank[i] = 1;
+		for (j = i * ROM_BANK_SIZE; j < (i + 1) * ROM_BANK_SIZE; j++)
+			if (mc->image[j] != 0xFF) {
+				mc->blank[i] = 0;
+				break;
+			}
+	}
+
+	return STAT_OK;
+}
+
+/* Packs ROMs in one image of at most max_size bytes. Each gets a slot of
+ * a power of two size, big enough for the file and for the ROM size its
+ * header says, aligned to that size so a multicart mapper can show it
+ * from its first bank. The first ROM, the menu, keeps bank 0, the rest go
+ * biggest first into the first free aligned slot, which leaves no holes
+ * between slots. ROMs that are byte for byte the same share a slot. */
+uint16_t gbs_mc_build(gbs_multicart_t* mc, char* files[], uint16_t count,
+		uint32_t max_size) {
+	uint8_t* data[MC_SLOTS];
+	mc_slot_t* slot;
+	uint32_t i, j, k;
+	uint16_t ret = STAT_ERROR;
+
+	memset(mc, 0, sizeof(*mc));
+	if (count == 0 || count > MC_SLOTS)
+		return STAT_ERROR;
+
+	for (i = 0; i < count; i++) {
+		slot = &mc->slots[i];
+		slot->file = files[i];
+		slot->same_as = -1;
+		if ((data[i] = gbs_mc_load(files[i], max_size, &slot->used)) == NULL)
+			break;
+		mc->count++;
+
+		if (slot->used > 0x148) {
+			for (k = 0; k < 16 && data[i][0x134 + k] >= ' '
+					&& data[i][0x134 + k] < 0x7F; k++)
+				slot->title[k] = data[i][0x134 + k];
+			slot->size = gbs_rom_bytes(data[i][0x148]);
+		}
+		slot->size = gbs_mc_slot_size(slot->size > slot->used ? slot->size
+				: slot->used);
+
+		for (j = 0; j < i; j++)
+			if (mc->slots[j].same_as < 0 && mc->slots[j].used == slot->used
+					&& memcmp(data[j], data[i], slot->used) == 0) {
+				slot->same_as = j;
+				break;
+			}
+	}
+
+	if (mc->count == count)
+		ret = gbs_mc_pack(mc, data, max_size);
+	for (i = 0; i < mc->count; i++)
+		free(data[i]);
+	if (ret != STAT_OK)
+		gbs_mc_free(mc);
+
+	return ret;
+}
+
+void gbs_mc_free(gbs_multicart_t* mc) {
+	free(mc->image);
+	free(mc->blank);
+	mc->image = mc->blank = NULL;
+}
+
+uint32_t gbs_mc_blank_bytes(gbs_multicart_t* mc) {
+	uint32_t i, n = 0;
+
+	for (i = 0; i < mc->banks; i++)
+		n += mc->blank[i];
+	return n * ROM_BANK_SIZE;
+}
+
+/* the slots, then one character per bank: # to program, . left erased */
+void gbs_mc_print_map(gbs_multicart_t* mc, FILE* f) {
+	mc_slot_t* slot;
+	uint32_t i;
+
+	fprintf(f, "%4s %8s %7s %5s  %-16s %s\n", "slot", "offset", "size",
+			"bank", "title", "file");
+	for (i = 0; i < mc->count; i++) {
+		slot = &mc->slots[i];
+		fprintf(f, "%4u 0x%06x %6uK %5u  %-16s %s", i, slot->offset,
+				slot->size / 1024, slot->offset / ROM_BANK_SIZE, slot->title,
+				slot->file);
+		if (slot->same_as >= 0)
+			fprintf(f, " (same as %d)", slot->same_as);
+		fprintf(f, "\n");
+	}
+
+	for (i = 0; i < mc->banks; i++) {
+		if (i % 64 == 0)
+			fprintf(f, "%s0x%06x ", i ? "\n" : "", i * ROM_BANK_SIZE);
+		fputc(mc->blank[i] ? '.' : '#', f);
+	}
+	fprintf(f, "\n%u KB image, %u banks, %u KB left erased\n",
+			mc->size / 1024, mc->banks, gbs_mc_blank_bytes(mc) / 1024);
+}
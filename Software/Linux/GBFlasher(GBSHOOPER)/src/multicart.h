@@ -0,0 +1,54 @@
+/*
+============================================================================
+Name        : multicart.h
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Multicart image builder
+============================================================================
+*/
+
+#ifndef __MULTICART_H
+#define __MULTICART_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#define MC_SLOTS		64		/* ROMs on one cart */
+#define MC_MIN_SLOT		S_32K
+
+/* Types */
+/*********/
+
+/* where one ROM went */
+typedef struct
+{
+	const char* file;
+	char title[17];
+	uint32_t offset;		/* in the image, a multiple of size */
+	uint32_t size;			/* slot, a power of two */
+	uint32_t used;			/* bytes of the file */
+	int16_t same_as;		/* slot with identical contents, or -1 */
+} mc_slot_t;
+
+/* a packed image and its sector map */
+typedef struct
+{
+	uint8_t* image;
+	uint32_t size;
+	uint8_t* blank;			/* per ROM bank, 1 if all 0xFF */
+	uint16_t banks;
+	mc_slot_t slots[MC_SLOTS];
+	uint16_t count;
+} gbs_multicart_t;
+
+/* function prototypes */
+/***********************/
+uint16_t gbs_mc_build(gbs_multicart_t* mc, char* files[], uint16_t count,
+		uint32_t max_size);
+void gbs_mc_free(gbs_multicart_t* mc);
+void gbs_mc_print_map(gbs_multicart_t* mc, FILE* f);
+uint32_t gbs_mc_blank_bytes(gbs_multicart_t* mc);
+
+#endif
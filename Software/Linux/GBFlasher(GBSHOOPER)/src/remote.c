@@ -0,0 +1,558 @@
+/*
+============================================================================
+Name        : remote.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Jobs sent to gbshooperd over a UNIX socket
+============================================================================
+*/
+
+#define _GNU_SOURCE		/* struct ucred */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "gbshooper.h"
+#include "context.h"
+#include "remote.h"
+
+/* the operations a server runs, by name. out: the op writes its file. */
+static const struct
+{
+	const char* name;
+	void* (*op)(void*);
+	uint8_t file;
+	uint8_t out;
+} remote_ops[] = {
+	{"read_flash", gbs_read_flash, 1, 1},
+	{"write_flash", gbs_write_flash, 1, 0},
+	{"erase_flash", gbs_erase_flash, 0, 0},
+	{"read_ram", gbs_read_ram, 1, 1},
+	{"write_ram", gbs_write_ram, 1, 0},
+	{"erase_ram", gbs_erase_ram, 0, 0}
+};
+
+#define REMOTE_OPS	(sizeof remote_ops / sizeof remote_ops[0])
+
+/* what a job's replies carry back, beyond progress */
+typedef struct
+{
+	thread_args_t* args;
+	uint16_t bank;			/* next report line */
+	gbs_hash_t hash;		/* the server's digests, if asked for */
+} remote_job_t;
+
+typedef void (*remote_field_fn)(const char* name, const char* value,
+		void* data);
+
+/* $XDG_RUNTIME_DIR/gbshooperd.sock, or one per user in /tmp */
+void gbs_remote_path(char* dst, size_t n) {
+	const char* dir = getenv("XDG_RUNTIME_DIR");
+
+	if (dir != NULL && dir[0] != '\0')
+		snprintf(dst, n, "%s/%s", dir, REMOTE_SOCKET);
+	else
+		snprintf(dst, n, "/tmp/gbshooperd-%u.sock", (unsigned) getuid());
+}
+
+/* 1 if the other end of a connection runs as us. Clients send servers
+ * descriptors of their files, writable for reads, so both ends check:
+ * whoever got to a socket path in /tmp first mustn't get them. */
+uint8_t gbs_remote_peer_ok(int sock) {
+	struct ucred cred;
+	socklen_t len = sizeof cred;
+
+	if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+		return 0;
+
+	return cred.uid == getuid();
+}
+
+int gbs_remote_connect(const char* path) {
+	struct sockaddr_un addr;
+	int sock;
+
+	if (strlen(path) >= sizeof addr.sun_path)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+	if (connect(sock, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+		close(sock);
+		return -1;
+	}
+	if (!gbs_remote_peer_ok(sock)) {
+		fprintf(stderr, "%s is another user's\n", path);
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+void gbs_remote_init(gbs_remote_t* r, int sock) {
+	r->sock = sock;
+	r->len = 0;
+	r->fd = -1;
+}
+
+/* one read from the connection, keeping a descriptor that came with it.
+ * Returns the bytes read, 0 when the other end hung up, -1 on errors. */
+int gbs_remote_fill(gbs_remote_t* r) {
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	struct cmsghdr* cmsg;
+	struct iovec iov;
+	ssize_t n;
+
+	if (r->len >= sizeof r->buf)
+		return -1;
+	iov.iov_base = r->buf + r->len;
+	iov.iov_len = sizeof r->buf - r->len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof control;
+	if ((n = recvmsg(r->sock, &msg, MSG_CMSG_CLOEXEC)) <= 0)
+		return n;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+			cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			if (r->fd >= 0)
+				close(r->fd);
+			memcpy(&r->fd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	r->len += n;
+
+	return n;
+}
+
+/* takes the next whole line out of what was read, without its newline.
+ * Returns 0 if there is none yet. */
+int gbs_remote_line(gbs_remote_t* r, char* line, size_t n) {
+	char* nl;
+	size_t len;
+
+	if ((nl = memchr(r->buf, '\n', r->len)) == NULL)
+		return 0;
+	len = nl - r->buf;
+	snprintf(line, n, "%.*s", (int) len, r->buf);
+	r->len -= len + 1;
+	memmove(r->buf, nl + 1, r->len);
+
+	return 1;
+}
+
+/* sends a line, a newline is added. fd goes along with it unless -1. */
+uint16_t gbs_remote_send(int sock, const char* line, int fd) {
+	char control[CMSG_SPACE(sizeof(int))], buf[REMOTE_LINE + 1];
+	struct msghdr msg;
+	struct cmsghdr* cmsg;
+	struct iovec iov;
+	size_t len = snprintf(buf, sizeof buf, "%s\n", line), sent = 0;
+	ssize_t n;
+
+	if (len >= sizeof buf)
+		return STAT_ERROR;
+	memset(&msg, 0, sizeof(msg));
+	if (fd >= 0) {
+		memset(control, 0, sizeof control);
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof control;
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	while (sent < len) {
+		iov.iov_base = buf + sent;
+		iov.iov_len = len - sent;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		if ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return STAT_ERROR;
+		}
+		sent += n;
+		/* the descriptor only once */
+		msg.msg_control = NULL;
+		msg.msg_controllen = 0;
+	}
+
+	return STAT_OK;
+}
+
+const char* gbs_remote_op_name(void* (*op)(void*)) {
+	uint16_t i;
+
+	for (i = 0; i < REMOTE_OPS; i++)
+		if (remote_ops[i].op == op)
+			return remote_ops[i].name;
+
+	return NULL;
+}
+
+void* (*gbs_remote_op(const char* name))(void*) {
+	uint16_t i;
+
+	for (i = 0; i < REMOTE_OPS; i++)
+		if (strcmp(remote_ops[i].name, name) == 0)
+			return remote_ops[i].op;
+
+	return NULL;
+}
+
+/* the numbers of a gbs_stats_t, the op name aside, for a stats field */
+void gbs_remote_stats(const gbs_stats_t* stats, char* dst, size_t n) {
+	size_t len;
+	uint16_t i;
+
+	len = snprintf(dst, n, "%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+			" %" PRIu64 " %u %" PRIu64 " %" PRIu64 " %" PRIu64 " %u %u %u %u",
+			stats->bytes, stats->start_ns, stats->wall_ns, stats->tx_bytes,
+			stats->rx_bytes, stats->rtt_count, stats->rtt_total_ns,
+			stats->rtt_min_ns, stats->rtt_max_ns, stats->timeouts,
+			stats->check_errors, stats->frame_errors, stats->resent);
+	for (i = 0; i < STATS_BUCKETS && len < n; i++)
+		len += snprintf(dst + len, n - len, " %u", stats->rtt_hist[i]);
+}
+
+static void gbs_remote_parse_stats(const char* src, gbs_stats_t* stats) {
+	uint64_t v[13 + STATS_BUCKETS];
+	char* end;
+	uint16_t i;
+
+	for (i = 0; i < sizeof v / sizeof v[0]; i++) {
+		v[i] = strtoull(src, &end, 10);
+		if (end == src)
+			return;
+		src = end;
+	}
+	stats->bytes = v[0];
+	stats->start_ns = v[1];
+	stats->wall_ns = v[2];
+	stats->tx_bytes = v[3];
+	stats->rx_bytes = v[4];
+	stats->rtt_count = v[5];
+	stats->rtt_total_ns = v[6];
+	stats->rtt_min_ns = v[7];
+	stats->rtt_max_ns = v[8];
+	stats->timeouts = v[9];
+	stats->check_errors = v[10];
+	stats->frame_errors = v[11];
+	stats->resent = v[12];
+	for (i = 0; i < STATS_BUCKETS; i++)
+		stats->rtt_hist[i] = v[13 + i];
+}
+
+/* a string for a field value: one line, printable */
+void gbs_remote_text(const char* src, char* dst, size_t n) {
+	size_t i;
+
+	for (i = 0; src[i] != '\0' && i + 1 < n; i++)
+		dst[i] = (src[i] >= ' ' && src[i] < 0x7F) ? src[i] : '?';
+	dst[i] = '\0';
+}
+
+static void gbs_remote_hex(const char* src, uint8_t* dst, uint32_t len) {
+	unsigned int byte;
+	uint32_t i;
+
+	for (i = 0; i < len && sscanf(&src[i * 2], "%2x", &byte) == 1; i++)
+		dst[i] = byte;
+}
+
+/* sends request (and fd) to the context's server, then takes replies until
+ * its end: progress into args, if there are any, and fields to field().
+ * A cancel of args is passed on. */
+static uint16_t gbs_remote_call(gbs_ctx_t* ctx, const char* request, int fd,
+		thread_args_t* args, remote_field_fn field, void* data) {
+	gbs_remote_t r;
+	char line[REMOTE_LINE], * value;
+	struct pollfd p;
+	unsigned int done, total, timed;
+	uint16_t ret = STAT_ERROR;
+	uint8_t ended = 0, cancel_sent = 0;
+	int sock;
+
+	if ((sock = gbs_remote_connect(ctx->server)) < 0) {
+		fprintf(stderr, "Can't reach gbshooperd at %s\n", ctx->server);
+		return STAT_ERROR;
+	}
+	if (gbs_remote_send(sock, request, fd) != STAT_OK) {
+		close(sock);
+		return STAT_ERROR;
+	}
+
+	gbs_remote_init(&r, sock);
+	while (!ended) {
+		while (!ended && gbs_remote_line(&r, line, sizeof line)) {
+			if (strncmp(line, "end ", 4) == 0) {
+				ret = strtoul(line + 4, NULL, 10);
+				ended = 1;
+			}
+			else if (args != NULL && sscanf(line, "progress %u %u %u", &done,
+						&total, &timed) == 3) {
+				args->timed = timed;
+				atomic_store(&args->total_bytes, total);
+				gbs_progress(args, done);
+			}
+			else if (strncmp(line, "field ", 6) == 0 && field != NULL
+					&& (value = strchr(line + 6, ' ')) != NULL) {
+				*value++ = '\0';
+				field(line + 6, value, data);
+			}
+		}
+		if (ended)
+			break;
+
+		if (args != NULL && gbs_cancelled(args) && !cancel_sent) {
+			gbs_remote_send(sock, "cancel", -1);
+			cancel_sent = 1;
+		}
+		p.fd = sock;
+		p.events = POLLIN;
+		p.revents = 0;
+		if (poll(&p, 1, args != NULL ? REMOTE_POLL_MS : -1) < 0
+				&& errno != EINTR)
+			break;
+		if (p.revents != 0 && gbs_remote_fill(&r) <= 0)
+			break;
+	}
+	close(sock);
+
+	return ret;
+}
+
+static void gbs_remote_job_field(const char* name, const char* value,
+		void* data) {
+	remote_job_t* job = (remote_job_t*) data;
+	thread_args_t* args = job->args;
+	gbs_bank_report_t* bank;
+
+	if (strcmp(name, "erase_ms") == 0)
+		args->erase_ms = strtoul(value, NULL, 10);
+	else if (strcmp(name, "raw_bytes") == 0)
+		args->raw_bytes = strtoul(value, NULL, 10);
+	else if (strcmp(name, "sent_bytes") == 0)
+		args->sent_bytes = strtoul(value, NULL, 10);
+	else if (strcmp(name, "stats") == 0)
+		gbs_remote_parse_stats(value, &args->stats);
+	else if (strcmp(name, "report") == 0 && args->report == NULL) {
+		args->report_banks = strtoul(value, NULL, 10);
+		args->report = calloc(args->report_banks ? args->report_banks : 1,
+				sizeof(*args->report));
+		if (args->report == NULL)
+			args->report_banks = 0;
+	}
+	else if (strcmp(name, "bank") == 0 && job->bank < args->report_banks) {
+		bank = &args->report[job->bank++];
+		sscanf(value, "%hu %hu %hu %hu %hu %hhu", &bank->bank, &bank->blocks,
+				&bank->suspect, &bank->reads, &bank->uncertain,
+				&bank->confidence);
+	}
+	else if (strcmp(name, "crc32") == 0)
+		job->hash.crc32 = strtoul(value, NULL, 16);
+	else if (strcmp(name, "md5") == 0)
+		gbs_remote_hex(value, job->hash.md5, 16);
+	else if (strcmp(name, "sha1") == 0)
+		gbs_remote_hex(value, job->hash.sha1, 20);
+	else if (strcmp(name, "hash_bytes") == 0)
+		job->hash.bytes = strtoull(value, NULL, 10);
+}
+
+/* runs op on the server instead of here, see gbs_ctx_set_server(). The
+ * file is opened here and its descriptor sent along, so paths, "-" and
+ * permissions are this process's. */
+void gbs_remote_job(void* (*op)(void*), thread_args_t* args) {
+	char request[REMOTE_LINE];
+	remote_job_t job;
+	size_t len;
+	uint16_t ret, i;
+	int fd = -1, own = 0;
+
+	gbs_start(args, 0);
+	for (i = 0; i < REMOTE_OPS && remote_ops[i].op != op; i++)
+		;
+	if (i == REMOTE_OPS) {
+		gbs_finish(args, STAT_ERROR);
+		return;
+	}
+	if (gbs_cancelled(args)) {
+		gbs_finish(args, STAT_CANCELLED);
+		return;
+	}
+	gbs_stats_reset(&args->stats, remote_ops[i].name, 0);
+
+	if (remote_ops[i].file && strcmp(args->file, "-") == 0)
+		fd = args->fd >= 0 ? args->fd
+			: (remote_ops[i].out ? STDOUT_FILENO : STDIN_FILENO);
+	else if (remote_ops[i].file) {
+		fd = remote_ops[i].out
+			? open(args->file, O_WRONLY | O_CREAT | O_TRUNC, 0666)
+			: open(args->file, O_RDONLY);
+		if (fd < 0) {
+			gbs_finish(args, STAT_ERROR);
+			return;
+		}
+		own = 1;
+	}
+
+	len = snprintf(request, sizeof request, "%s size=%d offset=%u block=%u "
+			"prg_mode=%u compress=%u sequential=%u robust=%u",
+			remote_ops[i].name, args->size, args->offset, args->block_size,
+			args->prg_mode, args->compress, args->sequential, args->robust);
+	if (args->hash != NULL)
+		len += snprintf(request + len, sizeof request - len, " hash=%u",
+				args->hash->want);
+	if (args->skip != NULL && args->skip_banks > 0) {
+		len += snprintf(request + len, sizeof request - len, " skip=");
+		for (i = 0; i < args->skip_banks && len < sizeof request; i++)
+			len += snprintf(request + len, sizeof request - len, "%02x",
+					args->skip[i]);
+	}
+	if (fd >= 0 && len < sizeof request)
+		len += snprintf(request + len, sizeof request - len, " file=-");
+	/* cut short, the request would program the banks it lost */
+	if (len >= sizeof request || args->skip_banks > REMOTE_BANKS) {
+		fprintf(stderr, "Skip map too long for gbshooperd\n");
+		if (own)
+			close(fd);
+		gbs_finish(args, STAT_ERROR);
+		return;
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.args = args;
+	ret = gbs_remote_call(args->ctx, request, fd, args,
+			gbs_remote_job_field, &job);
+	if (own)
+		close(fd);
+
+	/* the digests were summed over there */
+	if (args->hash != NULL) {
+		gbs_hash_stop(args->hash);
+		args->hash->bytes = job.hash.bytes;
+		args->hash->crc32 = job.hash.crc32;
+		memcpy(args->hash->md5, job.hash.md5, sizeof job.hash.md5);
+		memcpy(args->hash->sha1, job.hash.sha1, sizeof job.hash.sha1);
+	}
+	gbs_finish(args, ret);
+}
+
+static void gbs_remote_status_field(const char* name, const char* value,
+		void* data) {
+	status_t* status = (status_t*) data;
+
+	if (strcmp(name, "version_mayor") == 0)
+		status->version_mayor = strtoul(value, NULL, 10);
+	else if (strcmp(name, "version_minor") == 0)
+		status->version_minor = strtoul(value, NULL, 10);
+}
+
+uint16_t gbs_remote_status(gbs_ctx_t* ctx, status_t* status) {
+	memset(status, 0, sizeof(*status));
+	return gbs_remote_call(ctx, "status", -1, NULL, gbs_remote_status_field,
+			status);
+}
+
+static void gbs_remote_id_field(const char* name, const char* value,
+		void* data) {
+	flash_id_t* id = (flash_id_t*) data;
+
+	if (strcmp(name, "manufacturer_id") == 0)
+		id->manufacturer_id = strtoul(value, NULL, 10);
+	else if (strcmp(name, "chip_id") == 0)
+		id->chip_id = strtoul(value, NULL, 10);
+	else if (strcmp(name, "prg_mode") == 0)
+		id->prg_mode = strtoul(value, NULL, 10);
+	else if (strcmp(name, "wbuf_size") == 0)
+		id->wbuf_size = strtoul(value, NULL, 10);
+	else if (strcmp(name, "manufacturer") == 0 && id->manufacturer == NULL)
+		id->manufacturer = strdup(value);
+	else if (strcmp(name, "chip") == 0 && id->chip == NULL)
+		id->chip = strdup(value);
+}
+
+uint16_t gbs_remote_id(gbs_ctx_t* ctx, flash_id_t* id) {
+	uint16_t ret;
+
+	memset(id, 0, sizeof(*id));
+	ret = gbs_remote_call(ctx, "id", -1, NULL, gbs_remote_id_field, id);
+	if (id->manufacturer == NULL)
+		id->manufacturer = strdup("Unknown manufacturer");
+	if (id->chip == NULL)
+		id->chip = strdup("Unknown flash ID");
+
+	return ret;
+}
+
+static void gbs_remote_header_field(const char* name, const char* value,
+		void* data) {
+	rom_header_t* header = (rom_header_t*) data;
+
+	if (strcmp(name, "title") == 0 && header->title == NULL)
+		header->title = strdup(value);
+	else if (strcmp(name, "cart") == 0 && header->cart == NULL)
+		header->cart = strdup(value);
+	else if (strcmp(name, "rom_size") == 0 && header->rom_size == NULL)
+		header->rom_size = strdup(value);
+	else if (strcmp(name, "ram_size") == 0 && header->ram_size == NULL)
+		header->ram_size = strdup(value);
+	else if (strcmp(name, "rom_bytes") == 0)
+		header->rom_bytes = strtoul(value, NULL, 10);
+	else if (strcmp(name, "ram_bytes") == 0)
+		header->ram_bytes = strtoul(value, NULL, 10);
+}
+
+uint16_t gbs_remote_header(gbs_ctx_t* ctx, rom_header_t* header) {
+	uint16_t ret;
+
+	memset(header, 0, sizeof(*header));
+	ret = gbs_remote_call(ctx, "header", -1, NULL, gbs_remote_header_field,
+			header);
+	if (header->title == NULL)
+		header->title = strdup("");
+	if (header->cart == NULL)
+		header->cart = strdup("Unknown cart type");
+	if (header->rom_size == NULL)
+		header->rom_size = strdup("Unknown ROM size");
+	if (header->ram_size == NULL)
+		header->ram_size = strdup("Unknown RAM size");
+
+	return ret;
+}
+
+static void gbs_remote_probe_field(const char* name, const char* value,
+		void* data) {
+	gbs_probe_t* probe = (gbs_probe_t*) data;
+
+	if (strcmp(name, "present") == 0)
+		probe->present = strtoul(value, NULL, 10);
+	else if (strcmp(name, "header") == 0)
+		gbs_remote_hex(value, probe->header, sizeof probe->header);
+	else if (strcmp(name, "manufacturer_id") == 0)
+		probe->manufacturer_id = strtoul(value, NULL, 10);
+	else if (strcmp(name, "chip_id") == 0)
+		probe->chip_id = strtoul(value, NULL, 10);
+}
+
+uint16_t gbs_remote_probe(gbs_ctx_t* ctx, gbs_probe_t* probe) {
+	memset(probe, 0, sizeof(*probe));
+	return gbs_remote_call(ctx, "probe", -1, NULL, gbs_remote_probe_field,
+			probe);
+}
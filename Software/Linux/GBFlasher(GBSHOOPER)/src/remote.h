@@ -0,0 +1,74 @@
+/*
+============================================================================
+Name        : remote.h
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Jobs sent to gbshooperd over a UNIX socket
+============================================================================
+*/
+
+#ifndef __REMOTE_H
+#define __REMOTE_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "flashcart.h"
+#include "stats.h"
+
+#define REMOTE_LINE			2048	/* longest request or reply line */
+#define REMOTE_BANKS		512		/* longest skip map, an 8MB ROM's */
+#define REMOTE_SOCKET		"gbshooperd.sock"	/* in $XDG_RUNTIME_DIR */
+#define REMOTE_POLL_MS		100		/* client cancel checks */
+#define REMOTE_PROGRESS_MS	100		/* server progress lines, at most */
+
+/* The protocol, a line each way at a time:
+ *
+ *   request:  NAME key=value ...       one per connection
+ *             cancel                   later, to stop it
+ *   replies:  queued N                 jobs ahead of it
+ *             progress DONE TOTAL TIMED
+ *             field NAME VALUE         results, VALUE to the end of line
+ *             end STAT                 STAT_* in decimal, then it hangs up
+ *
+ * NAME is status, id, header, probe, or an operation: read_flash,
+ * write_flash, erase_flash, read_ram, write_ram, erase_ram. Operations take
+ * size, offset, block, prg_mode, compress, sequential, robust, skip (hex,
+ * one byte per bank, REMOTE_BANKS at most) and file. file=- means the descriptor sent with the
+ * request (SCM_RIGHTS), any other file is opened by the server. */
+
+/* Types */
+/*********/
+
+/* reads a connection's lines, and the descriptors sent along */
+typedef struct
+{
+	int sock;
+	char buf[REMOTE_LINE];
+	size_t len;
+	int fd;					/* last descriptor received, -1 if none */
+} gbs_remote_t;
+
+/* function prototypes */
+/***********************/
+void gbs_remote_path(char* dst, size_t n);
+uint8_t gbs_remote_peer_ok(int sock);
+int gbs_remote_connect(const char* path);
+void gbs_remote_init(gbs_remote_t* r, int sock);
+int gbs_remote_fill(gbs_remote_t* r);
+int gbs_remote_line(gbs_remote_t* r, char* line, size_t n);
+uint16_t gbs_remote_send(int sock, const char* line, int fd);
+const char* gbs_remote_op_name(void* (*op)(void*));
+void* (*gbs_remote_op(const char* name))(void*);
+void gbs_remote_stats(const gbs_stats_t* stats, char* dst, size_t n);
+void gbs_remote_text(const char* src, char* dst, size_t n);
+/* the client end, see gbs_ctx_set_server() */
+void gbs_remote_job(void* (*op)(void*), thread_args_t* args);
+uint16_t gbs_remote_status(gbs_ctx_t* ctx, status_t* status);
+uint16_t gbs_remote_id(gbs_ctx_t* ctx, flash_id_t* id);
+uint16_t gbs_remote_header(gbs_ctx_t* ctx, rom_header_t* header);
+uint16_t gbs_remote_probe(gbs_ctx_t* ctx, gbs_probe_t* probe);
+
+#endif
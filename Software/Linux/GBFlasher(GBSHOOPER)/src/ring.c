@@ -0,0 +1,119 @@
+/*
+============================================================================
+Name        : ring.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Single producer, single consumer ring of block buffers
+============================================================================
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+
+#include "gbshooper.h"
+#include "ring.h"
+
+#define RING_SPINS		64
+#define RING_YIELDS		64
+#define RING_NAP_NS		100000
+
+/* backs off a little more every time the other side isn't there yet */
+static void gbs_ring_wait(uint32_t* tries) {
+	struct timespec nap = {0, RING_NAP_NS};
+
+	if (*tries >= RING_SPINS + RING_YIELDS)
+		nanosleep(&nap, NULL);
+	else if (*tries >= RING_SPINS)
+		sched_yield();
+	(*tries)++;
+}
+
+uint16_t gbs_ring_init(gbs_ring_t* ring, uint32_t slots, uint32_t slot_size) {
+	memset(ring, 0, sizeof(*ring));
+	if (slots == 0 || (slots & (slots - 1)) != 0)
+		return STAT_ERROR;
+	if ((ring->data = malloc(slots * slot_size)) == NULL
+			|| (ring->len = calloc(slots, sizeof(*ring->len))) == NULL) {
+		free(ring->data);
+		return STAT_ERROR;
+	}
+	ring->slots = slots;
+	ring->slot_size = slot_size;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->closed, 0);
+
+	return STAT_OK;
+}
+
+void gbs_ring_free(gbs_ring_t* ring) {
+	free(ring->data);
+	free(ring->len);
+	ring->data = NULL;
+	ring->len = NULL;
+}
+
+/* whether a wait should give up */
+static uint8_t gbs_ring_aborted(gbs_ring_t* ring) {
+	return ring->abort != NULL && atomic_load(ring->abort);
+}
+
+/* producer: the next free slot, waiting while the ring is full. NULL if
+ * the consumer closed it, or on abort. */
+uint8_t* gbs_ring_claim(gbs_ring_t* ring) {
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint32_t tries = 0;
+
+	while (head - atomic_load_explicit(&ring->tail, memory_order_acquire)
+			== ring->slots) {
+		if (atomic_load_explicit(&ring->closed, memory_order_acquire)
+				|| gbs_ring_aborted(ring))
+			return NULL;
+		gbs_ring_wait(&tries);
+	}
+
+	return &ring->data[(head & (ring->slots - 1)) * ring->slot_size];
+}
+
+/* producer: hands the claimed slot, len bytes of it, to the consumer */
+void gbs_ring_publish(gbs_ring_t* ring, uint32_t len) {
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	ring->len[head & (ring->slots - 1)] = len;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/* consumer: the oldest published slot, waiting while there is none. NULL
+ * once the producer closed the ring and everything was taken, or on
+ * abort. */
+uint8_t* gbs_ring_peek(gbs_ring_t* ring, uint32_t* len) {
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint32_t tries = 0;
+
+	while (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+		if (atomic_load_explicit(&ring->closed, memory_order_acquire)
+				&& atomic_load_explicit(&ring->head, memory_order_acquire)
+					== tail)
+			return NULL;
+		if (gbs_ring_aborted(ring))
+			return NULL;
+		gbs_ring_wait(&tries);
+	}
+
+	*len = ring->len[tail & (ring->slots - 1)];
+	return &ring->data[(tail & (ring->slots - 1)) * ring->slot_size];
+}
+
+/* consumer: gives the slot peeked at back to the producer */
+void gbs_ring_release(gbs_ring_t* ring) {
+	atomic_fetch_add_explicit(&ring->tail, 1, memory_order_release);
+}
+
+/* either side: nothing more will be published, or taken */
+void gbs_ring_close(gbs_ring_t* ring) {
+	atomic_store_explicit(&ring->closed, 1, memory_order_release);
+}
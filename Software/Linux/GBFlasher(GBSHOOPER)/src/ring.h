@@ -0,0 +1,48 @@
+/*
+============================================================================
+Name        : ring.h
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Single producer, single consumer ring of block buffers
+============================================================================
+*/
+
+#ifndef __RING_H
+#define __RING_H
+
+#include <inttypes.h>
+#include <stdatomic.h>
+
+/* Types */
+/*********/
+
+/* Hands blocks from one thread to another without locks: the producer
+ * fills the slot at head and moves head on, the consumer takes the one at
+ * tail and moves tail on, each only ever writing its own index. The
+ * buffers are allocated once and reused. A side that finds the ring full,
+ * or empty, spins a little, then yields, then naps. */
+typedef struct
+{
+	uint8_t* data;			/* slots times slot_size bytes */
+	uint32_t* len;			/* bytes used in each slot */
+	uint32_t slots;			/* a power of two */
+	uint32_t slot_size;
+	_Atomic uint32_t head;	/* slots published, ever */
+	_Atomic uint32_t tail;	/* slots released, ever */
+	_Atomic uint8_t closed;	/* no more slots coming, or wanted */
+	_Atomic uint8_t* abort;	/* the waits give up once it is set, if not NULL */
+} gbs_ring_t;
+
+/* function prototypes */
+/***********************/
+uint16_t gbs_ring_init(gbs_ring_t* ring, uint32_t slots, uint32_t slot_size);
+void gbs_ring_free(gbs_ring_t* ring);
+uint8_t* gbs_ring_claim(gbs_ring_t* ring);
+void gbs_ring_publish(gbs_ring_t* ring, uint32_t len);
+uint8_t* gbs_ring_peek(gbs_ring_t* ring, uint32_t* len);
+void gbs_ring_release(gbs_ring_t* ring);
+void gbs_ring_close(gbs_ring_t* ring);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+============================================================================
+Name        : rle.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Run-length codec for compressed flash blocks
+============================================================================
+*/
+
+#include <string.h>
+
+#include "rle.h"
+
+/* encodes len bytes into out. Returns the encoded length, or 0 if it
+ * doesn't fit in max bytes */
+uint16_t gbs_rle_encode(const uint8_t* in, uint16_t len, uint8_t* out,
+		uint16_t max) {
+	uint16_t i = 0, o = 0, run, lit;
+
+	while (i < len) {
+		/* length of the run starting here */
+		run = 1;
+		while (i + run < len && run < RLE_MAX_RUN && in[i + run] == in[i])
+			run++;
+
+		if (run >= RLE_MIN_RUN) {
+			if (o + 2 > max)
+				return 0;
+			out[o++] = 257 - run;
+			out[o++] = in[i];
+			i += run;
+			continue;
+		}
+
+		/* literals up to the next run worth encoding */
+		lit = 0;
+		while (i + lit < len && lit < RLE_MAX_LITERAL) {
+			if (i + lit + 2 < len && in[i + lit] == in[i + lit + 1]
+					&& in[i + lit] == in[i + lit + 2])
+				break;
+			lit++;
+		}
+		if (o + 1 + lit > max)
+			return 0;
+		out[o++] = lit - 1;
+		memcpy(&out[o], &in[i], lit);
+		o += lit;
+		i += lit;
+	}
+
+	return o;
+}
@@ -0,0 +1,31 @@
+/*
+============================================================================
+Name        : rle.h
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Run-length codec for compressed flash blocks
+============================================================================
+*/
+
+#ifndef __RLE_H
+#define __RLE_H
+
+#include <inttypes.h>
+
+/* PackBits style stream, decoded until a whole block has been produced:
+ *   0x00-0x7F  n+1 literal bytes follow
+ *   0x81-0xFF  next byte repeated 257-n times
+ *   0x80       ignored */
+#define RLE_MAX_LITERAL	128
+#define RLE_MAX_RUN		128
+#define RLE_MIN_RUN		3
+#define RLE_NOP			0x80
+
+/* function prototypes */
+/***********************/
+uint16_t gbs_rle_encode(const uint8_t* in, uint16_t len, uint8_t* out,
+		uint16_t max);
+
+#endif
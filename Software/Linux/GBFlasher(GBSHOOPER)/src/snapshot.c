@@ -0,0 +1,333 @@
+/*
+============================================================================
+Name        : snapshot.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Save RAM snapshot store
+============================================================================
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gbshooper.h"
+#include "snapshot.h"
+
+#define SNAP_PATH		1024
+
+/* appends the letters and digits of src to dst at i, anything else as one
+ * '_', leaving room for the hash. Returns the new length. */
+static size_t gbs_snap_word(const char* src, char* dst, size_t i, size_t n) {
+	for (; *src != '\0' && i + 10 < n; src++) {
+		if ((*src >= 'a' && *src <= 'z') || (*src >= 'A' && *src <= 'Z')
+				|| (*src >= '0' && *src <= '9'))
+			dst[i++] = *src;
+		else if (i > 0 && dst[i-1] != '_' && dst[i-1] != '-')
+			dst[i++] = '_';
+	}
+	while (i > 0 && dst[i-1] == '_')
+		i--;
+
+	return i;
+}
+
+/* names a cart by its title, plus a hash of everything the header says so
+ * carts sharing a title don't share a file. Copies of the same game have
+ * the same header: the operator's label, if any, tells them apart. */
+void gbs_snap_fingerprint(const rom_header_t* header, const char* label,
+		char* dst, size_t n) {
+	const char* fields[5] = {header->title, header->cart, header->rom_size,
+		header->ram_size, label};
+	const char* c;
+	uint32_t hash = 2166136261u;		/* FNV-1a */
+	size_t i, j;
+
+	if (label != NULL && *label == '\0')
+		label = fields[4] = NULL;
+	for (j = 0; j < 5 && fields[j] != NULL; j++) {
+		if (j == 4)		/* unlabelled carts keep the old names */
+			hash = (hash ^ 0xFF) * 16777619u;
+		for (c = fields[j]; *c != '\0'; c++)
+			hash = (hash ^ (uint8_t) *c) * 16777619u;
+	}
+
+	i = gbs_snap_word(header->title, dst, 0, n);
+	if (label != NULL && i > 0 && i + 10 < n)
+		dst[i++] = '-';
+	if (label != NULL)
+		i = gbs_snap_word(label, dst, i, n);
+	while (i > 0 && dst[i-1] == '-')
+		i--;
+	snprintf(dst + i, n - i, "%s%08x", i ? "-" : "", hash);
+}
+
+static FILE* gbs_snap_open(const char* store, const char* cart,
+		const char* mode) {
+	char path[SNAP_PATH];
+
+	snprintf(path, sizeof path, "%s/%s%s", store, cart, SNAP_EXT);
+	return fopen(path, mode);
+}
+
+/* bytes of data after a record */
+static uint32_t gbs_snap_data(const snap_record_t* rec) {
+	if (rec->full)
+		return rec->size;
+	return rec->blocks * (sizeof(uint16_t) + SNAP_BLOCK);
+}
+
+/* reads the snapshot records of an open store file. A record cut short by
+ * a crash ends the list, *end is where the good part of the file ends. */
+static int32_t gbs_snap_scan(FILE* f, snap_info_t** list, long* end) {
+	snap_header_t header;
+	snap_record_t rec;
+	snap_info_t* info = NULL, * p;
+	struct stat st;
+	int32_t count = 0;
+	long pos;
+
+	*list = NULL;
+	if (fread(&header, sizeof(header), 1, f) != 1
+			|| memcmp(header.magic, SNAP_MAGIC, sizeof(header.magic)) != 0
+			|| header.version != SNAP_VERSION || header.block != SNAP_BLOCK
+			|| fstat(fileno(f), &st) != 0)
+		return -1;
+
+	pos = sizeof(header);
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		if (pos + sizeof(rec) + gbs_snap_data(&rec) > (uint64_t) st.st_size)
+			break;
+		if ((p = realloc(info, (count + 1) * sizeof(*info))) == NULL) {
+			free(info);
+			return -1;
+		}
+		info = p;
+		p = &info[count++];
+		p->time = rec.time;
+		p->size = rec.size;
+		p->full = rec.full;
+		p->stored = sizeof(rec) + gbs_snap_data(&rec);
+		p->data = pos + sizeof(rec);
+		pos += p->stored;
+		if (fseek(f, pos, SEEK_SET) != 0)
+			break;
+	}
+
+	*list = info;
+	*end = pos;
+	return count;
+}
+
+/* lists the snapshots of a cart, oldest first. Returns how many, or -1 if
+ * the store has none of it. Free *list. */
+int32_t gbs_snap_list(const char* store, const char* cart,
+		snap_info_t** list) {
+	FILE* f;
+	int32_t count;
+	long end;
+
+	*list = NULL;
+	if ((f = gbs_snap_open(store, cart, "rb")) == NULL)
+		return -1;
+	count = gbs_snap_scan(f, list, &end);
+	fclose(f);
+
+	return count;
+}
+
+/* applies the changed blocks of a delta record, the file at its data, to
+ * an image of size bytes */
+static uint16_t gbs_snap_delta(FILE* f, const snap_info_t* rec, uint8_t* img,
+		uint32_t size) {
+	uint16_t block;
+	uint32_t b, len;
+
+	for (b = 0; b < (rec->stored - sizeof(snap_record_t))
+			/ (sizeof(uint16_t) + SNAP_BLOCK); b++) {
+		/* the image's last block may be short, padded in the file */
+		if (fread(&block, sizeof(block), 1, f) != 1
+				|| block * SNAP_BLOCK >= size)
+			return STAT_ERROR;
+		len = size - block * SNAP_BLOCK;
+		if (len > SNAP_BLOCK)
+			len = SNAP_BLOCK;
+		if (fread(&img[block * SNAP_BLOCK], 1, len, f) != len
+				|| fseek(f, SNAP_BLOCK - len, SEEK_CUR) != 0)
+			return STAT_ERROR;
+	}
+
+	return STAT_OK;
+}
+
+/* rebuilds snapshot index, from the end if negative (-1 is the latest),
+ * starting at the last full image before it. Any bad record on the way
+ * fails it. Free *image. */
+static uint16_t gbs_snap_rebuild(FILE* f, snap_info_t* list, int32_t count,
+		int32_t index, uint8_t** image, uint32_t* size) {
+	uint8_t* img;
+	int32_t i, base;
+
+	if (index < 0)
+		index += count;
+	if (index < 0 || index >= count)
+		return STAT_ERROR;
+	for (base = index; base > 0 && !list[base].full; base--)
+		;
+	if (!list[base].full || (img = malloc(list[index].size)) == NULL)
+		return STAT_ERROR;
+
+	for (i = base; i <= index; i++) {
+		if (list[i].size != list[index].size
+				|| fseek(f, list[i].data, SEEK_SET) != 0)
+			break;
+		if (list[i].full) {
+			if (fread(img, 1, list[i].size, f) != list[i].size)
+				break;
+		}
+		else if (gbs_snap_delta(f, &list[i], img, list[index].size)
+				!= STAT_OK)
+			break;
+	}
+	if (i <= index) {
+		free(img);
+		return STAT_ERROR;
+	}
+
+	*image = img;
+	*size = list[index].size;
+	return STAT_OK;
+}
+
+uint16_t gbs_snap_load(const char* store, const char* cart, int32_t index,
+		uint8_t** image, uint32_t* size) {
+	snap_info_t* list;
+	FILE* f;
+	uint16_t ret;
+	int32_t count;
+	long end;
+
+	if ((f = gbs_snap_open(store, cart, "rb")) == NULL)
+		return STAT_ERROR;
+	count = gbs_snap_scan(f, &list, &end);
+	ret = gbs_snap_rebuild(f, list, count, index, image, size);
+	free(list);
+	fclose(f);
+
+	return ret;
+}
+
+/* writes a record and its data */
+static uint16_t gbs_snap_append(FILE* f, const snap_record_t* rec,
+		const uint8_t* image, const uint16_t* changed) {
+	uint8_t pad[SNAP_BLOCK];
+	uint32_t b, len;
+
+	if (fwrite(rec, sizeof(*rec), 1, f) != 1)
+		return STAT_ERROR;
+	if (rec->full)
+		return fwrite(image, 1, rec->size, f) == rec->size ? STAT_OK
+			: STAT_ERROR;
+
+	memset(pad, 0, sizeof pad);
+	for (b = 0; b < rec->blocks; b++) {
+		len = rec->size - changed[b] * SNAP_BLOCK;
+		if (len > SNAP_BLOCK)
+			len = SNAP_BLOCK;
+		if (fwrite(&changed[b], sizeof(uint16_t), 1, f) != 1
+				|| fwrite(&image[changed[b] * SNAP_BLOCK], 1, len, f) != len
+				|| fwrite(pad, 1, SNAP_BLOCK - len, f) != SNAP_BLOCK - len)
+			return STAT_ERROR;
+	}
+
+	return STAT_OK;
+}
+
+/* adds an image to the store, as the blocks that changed since the last
+ * snapshot of the cart when that's worth it. Only the new record is
+ * written, info gets what it cost. */
+uint16_t gbs_snap_save(const char* store, const char* cart,
+		const uint8_t* image, uint32_t size, int64_t time, snap_info_t* info) {
+	snap_header_t header;
+	snap_record_t rec;
+	snap_info_t* list = NULL;
+	uint8_t* last = NULL;
+	uint16_t* changed = NULL;
+	uint32_t b, blocks = (size + SNAP_BLOCK - 1) / SNAP_BLOCK, len;
+	int32_t count = -1, i, chain = 0;
+	uint16_t ret = STAT_ERROR;
+	long end = 0;
+	FILE* f;
+
+	if (size == 0 || blocks > 0x10000)
+		return STAT_ERROR;
+	mkdir(store, 0777);
+	if ((f = gbs_snap_open(store, cart, "r+b")) != NULL)
+		count = gbs_snap_scan(f, &list, &end);
+	else if ((f = gbs_snap_open(store, cart, "w+b")) == NULL)
+		return STAT_ERROR;
+
+	/* never write over something that isn't a store file, only start a new
+	 * or empty one */
+	if (count < 0 && (fseek(f, 0, SEEK_END) != 0 || ftell(f) != 0)) {
+		fclose(f);
+		return STAT_ERROR;
+	}
+	if (count < 0) {
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, SNAP_MAGIC, sizeof(header.magic));
+		header.version = SNAP_VERSION;
+		header.block = SNAP_BLOCK;
+		rewind(f);
+		fwrite(&header, sizeof(header), 1, f);
+		end = sizeof(header);
+		count = 0;
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.time = time;
+	rec.size = size;
+	rec.full = 1;
+
+	/* against the latest snapshot, if it has the same size and the chain
+	 * of deltas since a full image isn't too long already */
+	for (i = count - 1; i >= 0 && !list[i].full; i--)
+		chain++;
+	if (count > 0 && list[count-1].size == size && chain < SNAP_CHAIN
+			&& gbs_snap_rebuild(f, list, count, -1, &last, &len) == STAT_OK
+			&& (changed = malloc(blocks * sizeof(*changed))) != NULL) {
+		for (b = 0; b < blocks; b++) {
+			len = (b == blocks - 1) ? size - b * SNAP_BLOCK : SNAP_BLOCK;
+			if (memcmp(&last[b * SNAP_BLOCK], &image[b * SNAP_BLOCK], len))
+				changed[rec.blocks++] = b;
+		}
+		rec.full = rec.blocks * (sizeof(uint16_t) + SNAP_BLOCK) >= size / 2;
+	}
+	if (rec.full)
+		rec.blocks = 0;
+
+	/* drop whatever a crash left after the last good record */
+	if (fflush(f) == 0 && ftruncate(fileno(f), end) == 0
+			&& fseek(f, end, SEEK_SET) == 0
+			&& gbs_snap_append(f, &rec, image, changed) == STAT_OK
+			&& fflush(f) == 0 && fsync(fileno(f)) == 0)
+		ret = STAT_OK;
+
+	if (ret == STAT_OK && info != NULL) {
+		info->time = rec.time;
+		info->size = rec.size;
+		info->full = rec.full;
+		info->stored = sizeof(rec) + gbs_snap_data(&rec);
+		info->data = end + sizeof(rec);
+	}
+
+	fclose(f);
+	free(list);
+	free(last);
+	free(changed);
+	return ret;
+}
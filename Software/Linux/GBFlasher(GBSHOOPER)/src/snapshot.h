@@ -0,0 +1,72 @@
+/*
+============================================================================
+Name        : snapshot.h
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Save RAM snapshot store
+============================================================================
+*/
+
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include <inttypes.h>
+
+#include "flashcart.h"
+
+#define SNAP_MAGIC		"GBSSNAPS"
+#define SNAP_VERSION	1
+#define SNAP_EXT		".gbss"
+#define SNAP_BLOCK		64		/* delta granularity */
+#define SNAP_CHAIN		64		/* deltas before a full image again */
+#define SNAP_NAME		64		/* longest cart fingerprint */
+
+/* Types */
+/*********/
+
+/* One file per cart in the store directory, named after its fingerprint.
+ * A header, then the snapshots oldest first, each a record followed by:
+ *   full   size bytes of image
+ *   delta  blocks times a uint16_t block index and SNAP_BLOCK bytes,
+ *          the image's last block zero padded if it is short
+ * Deltas are against the snapshot before. Host byte order. */
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t block;
+} snap_header_t;
+
+typedef struct
+{
+	int64_t time;			/* seconds since the epoch */
+	uint32_t size;			/* image size */
+	uint32_t blocks;		/* changed blocks in a delta */
+	uint8_t full;
+	uint8_t pad[7];
+} snap_record_t;
+
+/* a snapshot as listed by gbs_snap_list() */
+typedef struct
+{
+	int64_t time;
+	uint32_t size;
+	uint32_t stored;		/* bytes it takes in the store */
+	uint8_t full;
+	long data;				/* file offset of its data */
+} snap_info_t;
+
+/* function prototypes */
+/***********************/
+void gbs_snap_fingerprint(const rom_header_t* header, const char* label,
+		char* dst, size_t n);
+int32_t gbs_snap_list(const char* store, const char* cart,
+		snap_info_t** list);
+uint16_t gbs_snap_load(const char* store, const char* cart, int32_t index,
+		uint8_t** image, uint32_t* size);
+uint16_t gbs_snap_save(const char* store, const char* cart,
+		const uint8_t* image, uint32_t size, int64_t time, snap_info_t* info);
+
+#endif
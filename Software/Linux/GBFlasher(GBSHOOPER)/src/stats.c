@@ -0,0 +1,125 @@
+/*
+============================================================================
+Name        : stats.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Per operation transfer statistics
+============================================================================
+*/
+
+#include <string.h>
+
+#include "stats.h"
+
+void gbs_stats_reset(gbs_stats_t* stats, const char* op, uint64_t now_ns) {
+	memset(stats, 0, sizeof(*stats));
+	stats->op = op;
+	stats->start_ns = now_ns;
+}
+
+void gbs_stats_rtt(gbs_stats_t* stats, uint64_t ns) {
+	uint64_t us = ns / 1000;
+	uint8_t bucket = 0;
+
+	while (bucket < STATS_BUCKETS - 1 && us >= (1ULL << bucket))
+		bucket++;
+	stats->rtt_hist[bucket]++;
+
+	if (stats->rtt_count == 0 || ns < stats->rtt_min_ns)
+		stats->rtt_min_ns = ns;
+	if (ns > stats->rtt_max_ns)
+		stats->rtt_max_ns = ns;
+	stats->rtt_total_ns += ns;
+	stats->rtt_count++;
+}
+
+/* adds the traffic of one operation to a running total. The total keeps its
+ * own name and times, the caller sets them. */
+void gbs_stats_merge(gbs_stats_t* total, const gbs_stats_t* stats) {
+	uint8_t i;
+
+	if (stats->op == NULL)
+		return;
+
+	total->bytes += stats->bytes;
+	total->tx_bytes += stats->tx_bytes;
+	total->rx_bytes += stats->rx_bytes;
+	if (stats->rtt_count && (total->rtt_count == 0
+				|| stats->rtt_min_ns < total->rtt_min_ns))
+		total->rtt_min_ns = stats->rtt_min_ns;
+	if (stats->rtt_max_ns > total->rtt_max_ns)
+		total->rtt_max_ns = stats->rtt_max_ns;
+	total->rtt_count += stats->rtt_count;
+	total->rtt_total_ns += stats->rtt_total_ns;
+	for (i = 0; i < STATS_BUCKETS; i++)
+		total->rtt_hist[i] += stats->rtt_hist[i];
+	total->timeouts += stats->timeouts;
+	total->check_errors += stats->check_errors;
+	total->frame_errors += stats->frame_errors;
+	total->resent += stats->resent;
+}
+
+/* bytes per second, 0 if the clock didn't move */
+static double gbs_stats_rate(const gbs_stats_t* stats) {
+	return stats->wall_ns ? stats->bytes * 1e9 / stats->wall_ns : 0;
+}
+
+static double gbs_stats_rtt_avg(const gbs_stats_t* stats) {
+	return stats->rtt_count ? (double) stats->rtt_total_ns / stats->rtt_count
+		: 0;
+}
+
+void gbs_stats_print(const gbs_stats_t* stats, FILE* f) {
+	uint8_t i;
+
+	if (stats->op == NULL)
+		return;
+
+	fprintf(f, "Operation:    %s\n", stats->op);
+	fprintf(f, "Bytes:        %" PRIu64 "\n", stats->bytes);
+	fprintf(f, "Time:         %.3f s\n", stats->wall_ns / 1e9);
+	fprintf(f, "Throughput:   %.1f KB/s\n", gbs_stats_rate(stats) / 1024);
+	fprintf(f, "Wire:         %" PRIu64 " bytes out, %" PRIu64 " bytes in\n",
+			stats->tx_bytes, stats->rx_bytes);
+	fprintf(f, "Round trips:  %u, min %.3f ms, avg %.3f ms, max %.3f ms\n",
+			stats->rtt_count, stats->rtt_min_ns / 1e6,
+			gbs_stats_rtt_avg(stats) / 1e6, stats->rtt_max_ns / 1e6);
+	fprintf(f, "Timeouts:     %u\n", stats->timeouts);
+	fprintf(f, "Check errors: %u\n", stats->check_errors);
+	fprintf(f, "Frames:       %u bad in, %u resent\n", stats->frame_errors,
+			stats->resent);
+
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		if (stats->rtt_hist[i] == 0)
+			continue;
+		if (i == STATS_BUCKETS - 1)
+			fprintf(f, "  >= %6llu us %10u\n", 1ULL << (i - 1),
+					stats->rtt_hist[i]);
+		else
+			fprintf(f, "  <  %6llu us %10u\n", 1ULL << i, stats->rtt_hist[i]);
+	}
+}
+
+void gbs_stats_json(const gbs_stats_t* stats, FILE* f) {
+	uint8_t i;
+
+	if (stats->op == NULL)
+		return;
+
+	fprintf(f, "{\"op\":\"%s\",\"bytes\":%" PRIu64 ",\"wall_ns\":%" PRIu64
+			",\"bytes_per_s\":%.1f,\"tx_bytes\":%" PRIu64
+			",\"rx_bytes\":%" PRIu64 ",", stats->op, stats->bytes,
+			stats->wall_ns, gbs_stats_rate(stats), stats->tx_bytes,
+			stats->rx_bytes);
+	fprintf(f, "\"rtt\":{\"count\":%u,\"min_ns\":%" PRIu64
+			",\"avg_ns\":%.0f,\"max_ns\":%" PRIu64 ",\"hist_us\":[",
+			stats->rtt_count, stats->rtt_min_ns, gbs_stats_rtt_avg(stats),
+			stats->rtt_max_ns);
+	for (i = 0; i < STATS_BUCKETS; i++)
+		fprintf(f, "%s%u", i ? "," : "", stats->rtt_hist[i]);
+	fprintf(f, "]},\"timeouts\":%u,\"check_errors\":%u,\"frame_errors\":%u,"
+			"\"resent\":%u}\n", stats->timeouts, stats->check_errors,
+			stats->frame_errors, stats->resent);
+}
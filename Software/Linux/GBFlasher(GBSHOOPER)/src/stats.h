@@ -0,0 +1,51 @@
+/*
+============================================================================
+Name        : stats.h
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Per operation transfer statistics
+============================================================================
+*/
+
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+/* round trip histogram, bucket n counts replies under 2^n microseconds,
+ * the last one everything slower */
+#define STATS_BUCKETS	16
+
+/* Types */
+/*********/
+typedef struct
+{
+	const char* op;			/* operation name, NULL if nothing ran */
+	uint64_t bytes;			/* payload moved */
+	uint64_t start_ns;
+	uint64_t wall_ns;		/* open to close of the link */
+	uint64_t tx_bytes;		/* bytes on the wire, both ways */
+	uint64_t rx_bytes;
+	uint32_t rtt_count;		/* command to reply round trips */
+	uint64_t rtt_total_ns;
+	uint64_t rtt_min_ns;
+	uint64_t rtt_max_ns;
+	uint32_t rtt_hist[STATS_BUCKETS];
+	uint32_t timeouts;		/* receives that gave up */
+	uint32_t check_errors;	/* blocks the checksum rejected */
+	uint32_t frame_errors;	/* v2 frames that came in damaged or lost */
+	uint32_t resent;		/* v2 frames the flasher asked for again */
+} gbs_stats_t;
+
+/* function prototypes */
+/***********************/
+void gbs_stats_reset(gbs_stats_t* stats, const char* op, uint64_t now_ns);
+void gbs_stats_rtt(gbs_stats_t* stats, uint64_t ns);
+void gbs_stats_merge(gbs_stats_t* total, const gbs_stats_t* stats);
+void gbs_stats_print(const gbs_stats_t* stats, FILE* f);
+void gbs_stats_json(const gbs_stats_t* stats, FILE* f);
+
+#endif
@@ -0,0 +1,94 @@
+/*
+============================================================================
+Name        : trace.c
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Packet trace recorder
+============================================================================
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gbshooper.h"
+#include "trace.h"
+
+/* trace event names */
+static const char* kind_names[] = {
+	"?", "open", "close", "tx", "rx", "tx-data", "rx-byte", "timeout"
+};
+
+gbs_trace_t* gbs_trace_new(uint32_t events) {
+	gbs_trace_t* trace;
+	uint32_t size = 1;
+
+	while (size < events)
+		size <<= 1;
+
+	if ((trace = malloc(sizeof(*trace))) == NULL)
+		return NULL;
+	if ((trace->events = calloc(size, sizeof(trace_event_t))) == NULL) {
+		free(trace);
+		return NULL;
+	}
+	trace->mask = size - 1;
+	atomic_init(&trace->head, 0);
+
+	return trace;
+}
+
+void gbs_trace_free(gbs_trace_t* trace) {
+	if (trace == NULL)
+		return;
+	free(trace->events);
+	free(trace);
+}
+
+/* claims a slot and fills it, the oldest event is overwritten when full */
+void gbs_trace_record(gbs_trace_t* trace, uint64_t t_ns, uint8_t kind,
+		uint16_t len, uint8_t a, uint8_t b) {
+	uint64_t n = atomic_fetch_add_explicit(&trace->head, 1,
+			memory_order_relaxed);
+	trace_event_t* ev = &trace->events[n & trace->mask];
+
+	ev->t_ns = t_ns;
+	ev->len = len;
+	ev->kind = kind;
+	ev->a = a;
+	ev->b = b;
+}
+
+/* writes the ring, oldest event first. Call it once recording stopped. */
+uint16_t gbs_trace_dump(gbs_trace_t* trace, const char* file) {
+	trace_header_t header;
+	uint64_t head = atomic_load(&trace->head);
+	uint64_t first, n;
+	FILE* f;
+
+	first = head > trace->mask ? head - trace->mask - 1 : 0;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.count = head - first;
+	header.dropped = first;
+
+	if ((f = fopen(file, "wb")) == NULL)
+		return STAT_ERROR;
+	fwrite(&header, sizeof(header), 1, f);
+	for (n = first; n < head; n++)
+		fwrite(&trace->events[n & trace->mask], sizeof(trace_event_t), 1, f);
+	if (fclose(f) != 0)
+		return STAT_ERROR;
+
+	return STAT_OK;
+}
+
+const char* gbs_trace_kind_name(uint8_t kind) {
+	if (kind >= sizeof kind_names / sizeof kind_names[0])
+		return kind_names[0];
+	return kind_names[kind];
+}
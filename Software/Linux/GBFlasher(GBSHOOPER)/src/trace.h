@@ -0,0 +1,71 @@
+/*
+============================================================================
+Name        : trace.h
+Author      : WeisTekEng
+Version     :
+Copyright   : (C) WeisTekEng 2026
+Description : Ladecadence.net GameBoy FlashCart interface
+              Packet trace recorder
+============================================================================
+*/
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#define TRACE_EVENTS	65536		/* default ring size, power of two */
+#define TRACE_MAGIC		"GBSTRACE"
+#define TRACE_VERSION	1
+
+/* event kinds */
+#define TRACE_OPEN		0x01
+#define TRACE_CLOSE		0x02
+#define TRACE_TX_PACKET	0x03		/* a = type, b = data */
+#define TRACE_RX_PACKET	0x04		/* a = type, b = data */
+#define TRACE_TX_DATA	0x05		/* len bytes, a and b the first two */
+#define TRACE_RX_BYTE	0x06		/* a = byte */
+#define TRACE_TIMEOUT	0x07		/* a receive gave up */
+
+/* Types */
+/*********/
+
+/* one event, also the on-disk record (host byte order) */
+typedef struct
+{
+	uint64_t t_ns;			/* link clock */
+	uint16_t len;
+	uint8_t kind;
+	uint8_t a;
+	uint8_t b;
+	uint8_t pad[3];
+} trace_event_t;
+
+/* file header, followed by count events, oldest first */
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	uint64_t dropped;		/* events overwritten before the dump */
+} trace_header_t;
+
+/* ring of the last events, any thread may record without locking */
+typedef struct
+{
+	trace_event_t* events;
+	uint32_t mask;
+	_Atomic uint64_t head;	/* events recorded so far */
+} gbs_trace_t;
+
+/* function prototypes */
+/***********************/
+gbs_trace_t* gbs_trace_new(uint32_t events);
+void gbs_trace_free(gbs_trace_t* trace);
+void gbs_trace_record(gbs_trace_t* trace, uint64_t t_ns, uint8_t kind,
+		uint16_t len, uint8_t a, uint8_t b);
+uint16_t gbs_trace_dump(gbs_trace_t* trace, const char* file);
+const char* gbs_trace_kind_name(uint8_t kind);
+
+#endif